@@ -52,6 +52,10 @@ public class JH3 implements Serializable{
      * ``kreon-rdma://127.0.0.1:2181`` for distributed Kreon with RDMA, where the network location refers to the ZooKeeper host and port
      * ``rocksdb:///tmp/h3/rocksdb`` for `RocksDB <https://rocksdb.org>`_
      * ``redis://127.0.0.1:6379`` for `Redis <https://redis.io>`_
+     * ``lmdb:///tmp/h3/lmdb`` for `LMDB <https://www.symas.com/lmdb>`_
+     * ``mem:///`` for memory, private to the handle unless named in the path (e.g. ``mem:///hot``)
+     * ``split://meta=rocksdb:///nvme/h3?data=file:///hdd/h3`` for metadata and data on different stores, each given by its own URI
+     * ``cache://hot=mem:///?cold=file:///hdd/h3`` for a hot store caching the data of a cold one, each given by its own URI
 
      * @param storageURI  The backend storage URI.
      * @param userId      The user that performs all operations.
@@ -19,6 +19,7 @@
 #include "h3fuse_config.h"
 
 #define H3_FUSE_MAX_FILENAME	255	// This is restricted by KV_FS plugin in h3lib
+#define H3FS_CACHE_SIZE			65536	// Max number of cached attributes
 
 #ifndef RENAME_NOREPLACE
 #define RENAME_NOREPLACE	(1 << 0)	/* Don't overwrite target */
@@ -43,10 +44,41 @@ typedef struct {
      char* bucket;
 } H3FS_Config;
 
+typedef struct {
+    GMutex lock;
+    H3_Name object;     // Follows renames while the file is open, changed with both locks held
+    uint32_t refs;      // The table and requests looking up files by name, protected by the table lock
+    H3_ObjectInfo info; // As of open, updated by operations through the file
+    off_t offset;       // Object offset of the buffered data
+    size_t size;        // Amount of buffered data
+    char* buffer;       // H3_PART_SIZE long, allocated upon the first write
+}H3FS_OpenFile;
+
+typedef struct {
+    int res;            // 0 or -ENOENT for negative entries
+    struct stat st;
+    gint64 expires;     // Monotonic time in usec
+}H3FS_CachedAttr;
+
+typedef struct {
+    struct timespec lastModification;
+    size_t size;
+}H3FS_CachedVersion;
+
 typedef struct {
     H3_Handle handle;
     H3_Auth token;
     H3_Name bucket;
+    GHashTable* openFiles;
+    GMutex lock;        // Protects the table of open files and their references
+
+    struct fuse* fuse;
+    GThreadPool* invalidator;   // Kernel cache invalidations, issued outside request handlers
+    GHashTable* attrCache;      // Object name --> H3FS_CachedAttr
+    GHashTable* versions;       // Object name --> H3FS_CachedVersion, as of the last open
+    GMutex cacheLock;
+    double attrTimeout;
+    double negativeTimeout;
 }H3FS_PrivateData;
 
 extern FILE* stderr;
@@ -74,6 +106,300 @@ static inline H3_Name Cast2DirEntry(H3_Name dirEntry, int* isDir){
 	return dirEntry;
 }
 
+// Tell whether an object is, or is under, the given one
+static inline int IsUnder(H3_Name object, H3_Name prefix, size_t length){
+    return strncmp(object, prefix, length) == 0 && (object[length] == '\0' || object[length] == '/');
+}
+
+/*
+ * Attributes (and their absence) are cached for as long as the kernel is told to cache them,
+ * i.e. attr_timeout and negative_timeout. Entries are dropped when an object, any object
+ * under it, or any object it is under, is modified through h3fuse. The kernel is notified
+ * about such modifications asynchronously, since notifications must not be issued within
+ * the handler of a related request.
+ */
+
+static void InvalidateKernelCache(gpointer path, gpointer userData){
+    fuse_invalidate_path(data.fuse, (const char*)path);
+    free(path);
+}
+
+static gboolean IsRelated(gpointer key, gpointer value, gpointer object){
+    size_t keyLength = strlen((char*)key), length = strlen((char*)object);
+    return IsUnder(key, object, length) || IsUnder(object, key, keyLength);
+}
+
+static void InvalidateObject(H3_Name object){
+    H3_Name path = NULL;
+
+    g_mutex_lock(&data.cacheLock);
+    g_hash_table_foreach_remove(data.attrCache, IsRelated, object);
+    g_hash_table_foreach_remove(data.versions, IsRelated, object);
+    g_mutex_unlock(&data.cacheLock);
+
+    if(data.invalidator && asprintf(&path, "/%s", object) != -1)
+        g_thread_pool_push(data.invalidator, path, NULL);
+}
+
+static void CacheAttributes(H3_Name object, int res, struct stat* stbuf){
+    H3FS_CachedAttr* entry;
+    double timeout = res?data.negativeTimeout:data.attrTimeout;
+
+    if(timeout <= 0 || !(entry = malloc(sizeof(H3FS_CachedAttr))))
+        return;
+
+    entry->res = res;
+    entry->st = *stbuf;
+    entry->expires = g_get_monotonic_time() + (gint64)(timeout * G_USEC_PER_SEC);
+
+    g_mutex_lock(&data.cacheLock);
+    if(g_hash_table_size(data.attrCache) >= H3FS_CACHE_SIZE)
+        g_hash_table_remove_all(data.attrCache);
+
+    g_hash_table_insert(data.attrCache, strdup(object), entry);
+    g_mutex_unlock(&data.cacheLock);
+}
+
+static int LookupAttributes(H3_Name object, struct stat* stbuf, int* res){
+    H3FS_CachedAttr* entry;
+    int found = 0;
+
+    g_mutex_lock(&data.cacheLock);
+    if( (entry = g_hash_table_lookup(data.attrCache, object)) ){
+        if(entry->expires > g_get_monotonic_time()){
+            *stbuf = entry->st;
+            *res = entry->res;
+            found = 1;
+        }
+        else
+            g_hash_table_remove(data.attrCache, object);
+    }
+    g_mutex_unlock(&data.cacheLock);
+
+    return found;
+}
+
+// Tell whether the object is unchanged since it was last opened, so that the kernel may keep its pages
+static int IsUnchanged(H3_Name object, H3_ObjectInfo* info){
+    H3FS_CachedVersion* version;
+    int unchanged = 0;
+
+    g_mutex_lock(&data.cacheLock);
+    if( (version = g_hash_table_lookup(data.versions, object)) ){
+        unchanged = version->size == info->size &&
+                    version->lastModification.tv_sec == info->lastModification.tv_sec &&
+                    version->lastModification.tv_nsec == info->lastModification.tv_nsec;
+    }
+
+    if(!unchanged && (version = malloc(sizeof(H3FS_CachedVersion)))){
+        version->size = info->size;
+        version->lastModification = info->lastModification;
+
+        if(g_hash_table_size(data.versions) >= H3FS_CACHE_SIZE)
+            g_hash_table_remove_all(data.versions);
+
+        g_hash_table_insert(data.versions, strdup(object), version);
+    }
+    g_mutex_unlock(&data.cacheLock);
+
+    return unchanged;
+}
+
+/*
+ * Small sequential writes are coalesced per open file into a buffer that is written
+ * once it reaches a part boundary, or when the file is flushed, synced or released.
+ * Operations that should observe the data of an object flush its buffers first, whereas
+ * attributes are answered from the open files, whose writes drop the cached ones.
+ *
+ * Each open file has its own lock, so that requests on different files proceed in
+ * parallel. The table lock is always acquired before any file lock, and it is only
+ * held for as long as it takes to find files by name. Files found are referenced so
+ * that they outlive a concurrent release, and are then flushed with the table unlocked,
+ * thus a request waiting for a long write holds up that file alone.
+ */
+
+// Write any buffered data, must be called with the file lock held. Data that failed to be written are retained, thus
+// retried and reported by the next flush, fsync or release, rather than dropped along with the error.
+static int FlushOpenFile(H3FS_OpenFile* file){
+    int res = 0;
+
+    if(file->size){
+        if(H3_WriteObject(data.handle, &data.token, data.bucket, file->object, file->buffer, file->size, file->offset) != H3_SUCCESS)
+            return -EIO;
+
+        file->size = 0;
+        g_mutex_lock(&data.cacheLock);
+        g_hash_table_remove(data.attrCache, file->object);
+        g_hash_table_remove(data.versions, file->object);
+        g_mutex_unlock(&data.cacheLock);
+    }
+
+    return res;
+}
+
+static void PutOpenFile(H3FS_OpenFile* file){
+    uint32_t refs;
+
+    g_mutex_lock(&data.lock);
+    refs = --file->refs;
+    g_mutex_unlock(&data.lock);
+
+    if(!refs){
+        g_mutex_clear(&file->lock);
+        free(file->buffer);
+        free(file->object);
+        free(file);
+    }
+}
+
+// Reference the open files of an object, or of all objects in a directory if "under" is set. NULL returns all open files.
+static GSList* GetOpenFiles(H3_Name object, uint8_t under){
+    size_t length = object?strlen(object):0;
+    GSList* files = NULL;
+    GHashTableIter iter;
+    gpointer key;
+
+    // Names only change with the table lock held
+    g_mutex_lock(&data.lock);
+    g_hash_table_iter_init(&iter, data.openFiles);
+    while(g_hash_table_iter_next(&iter, &key, NULL)){
+        H3FS_OpenFile* file = (H3FS_OpenFile*)key;
+
+        if(!object || (under?IsUnder(file->object, object, length):strcmp(file->object, object) == 0)){
+            file->refs++;
+            files = g_slist_prepend(files, file);
+        }
+    }
+    g_mutex_unlock(&data.lock);
+
+    return files;
+}
+
+// Flush the open files of an object, or of all objects in a directory. NULL flushes all open files.
+static int FlushObject(H3_Name object){
+    GSList *files = GetOpenFiles(object, 1), *entry;
+    int res = 0, err;
+
+    for(entry = files; entry; entry = entry->next){
+        H3FS_OpenFile* file = (H3FS_OpenFile*)entry->data;
+
+        g_mutex_lock(&file->lock);
+        if((err = FlushOpenFile(file)))
+            res = err;
+        g_mutex_unlock(&file->lock);
+
+        PutOpenFile(file);
+    }
+    g_slist_free(files);
+
+    return res;
+}
+
+// Buffered data are not in the store yet, thus open files holding any tell the size and modification time
+static void ApplyOpenFiles(H3_Name object, struct stat* stbuf){
+    GSList *files = GetOpenFiles(object, 0), *entry;
+
+    for(entry = files; entry; entry = entry->next){
+        H3FS_OpenFile* file = (H3FS_OpenFile*)entry->data;
+
+        g_mutex_lock(&file->lock);
+        if(file->size){
+            stbuf->st_size = file->info.size;
+            stbuf->st_mtim = file->info.lastModification;
+        }
+        g_mutex_unlock(&file->lock);
+
+        PutOpenFile(file);
+    }
+    g_slist_free(files);
+}
+
+// Follow a rename (or exchange) of an object or directory
+static void RenameOpenFiles(H3_Name srcObject, H3_Name dstObject, uint8_t swap){
+    size_t srcLength = strlen(srcObject), dstLength = strlen(dstObject);
+    GHashTableIter iter;
+    gpointer key;
+
+    g_mutex_lock(&data.lock);
+    g_hash_table_iter_init(&iter, data.openFiles);
+    while(g_hash_table_iter_next(&iter, &key, NULL)){
+        H3FS_OpenFile* file = (H3FS_OpenFile*)key;
+        H3_Name object = NULL;
+
+        // Only the files renamed are locked
+        if(IsUnder(file->object, srcObject, srcLength))
+            asprintf(&object, "%s%s", dstObject, &file->object[srcLength]);
+
+        else if(swap && IsUnder(file->object, dstObject, dstLength))
+            asprintf(&object, "%s%s", srcObject, &file->object[dstLength]);
+
+        if(object){
+            g_mutex_lock(&file->lock);
+            free(file->object);
+            file->object = object;
+            g_mutex_unlock(&file->lock);
+        }
+    }
+    g_mutex_unlock(&data.lock);
+}
+
+// Follow a truncation of an object through its name
+static void ResizeOpenFiles(H3_Name object, off_t size){
+    GSList *files = GetOpenFiles(object, 0), *entry;
+
+    for(entry = files; entry; entry = entry->next){
+        H3FS_OpenFile* file = (H3FS_OpenFile*)entry->data;
+
+        g_mutex_lock(&file->lock);
+        file->info.size = size;
+        clock_gettime(CLOCK_REALTIME, &file->info.lastModification);
+        g_mutex_unlock(&file->lock);
+
+        PutOpenFile(file);
+    }
+    g_slist_free(files);
+}
+
+static int OpenFile(H3_Name object, struct fuse_file_info* fi){
+    H3FS_OpenFile* file;
+    H3_ObjectInfo info;
+
+    switch(H3_InfoObject(data.handle, &data.token, data.bucket, object, &info)){
+        case H3_SUCCESS:        break;
+        case H3_NOT_EXISTS:     return -ENOENT;
+        case H3_NAME_TOO_LONG:  return -ENAMETOOLONG;
+        case H3_INVALID_ARGS:   return -EINVAL;
+        default:                return -EIO;
+    }
+
+    if(!(file = calloc(1, sizeof(H3FS_OpenFile))) || !(file->object = strdup(object))){
+        free(file);
+        return -ENOMEM;
+    }
+    g_mutex_init(&file->lock);
+    file->refs = 1;
+    file->info = info;
+    fi->keep_cache = IsUnchanged(object, &info);
+
+    g_mutex_lock(&data.lock);
+    g_hash_table_add(data.openFiles, file);
+    g_mutex_unlock(&data.lock);
+
+    fi->fh = (uint64_t)file;
+    return 0;
+}
+
+static void FileInfoToStat(H3_ObjectInfo* info, struct stat* stbuf){
+	stbuf->st_mode = S_IFREG | info->mode;
+	stbuf->st_nlink = 1;
+	stbuf->st_size = info->size;
+	stbuf->st_atim = info->lastAccess;
+	stbuf->st_mtim = info->lastModification;
+	stbuf->st_ctim = info->lastChange;
+	stbuf->st_uid = info->uid;
+	stbuf->st_gid = info->gid;
+}
+
 static int GetObjectInfo(const char* path, struct stat* stbuf){
     int res = 0;
     H3_Name object = (H3_Name)&path[1];
@@ -81,14 +407,7 @@ static int GetObjectInfo(const char* path, struct stat* stbuf){
 
     switch(H3_InfoObject(data.handle, &data.token, data.bucket, object, &info)){
 		case H3_SUCCESS:
-			stbuf->st_mode = S_IFREG | info.mode;
-			stbuf->st_nlink = 1;
-			stbuf->st_size = info.size;
-			stbuf->st_atim = info.lastAccess;
-			stbuf->st_mtim = info.lastModification;
-			stbuf->st_ctim = info.lastChange;
-			stbuf->st_uid = info.uid;
-			stbuf->st_gid = info.gid;
+			FileInfoToStat(&info, stbuf);
 			break;
 
 		case H3_INVALID_ARGS: 	res = -EINVAL; break;
@@ -134,6 +453,25 @@ static int GetObjectInfo(const char* path, struct stat* stbuf){
     return res;
 }
 
+// Open files are not flushed, writes through them drop the cached attributes instead
+static int GetCachedObjectInfo(const char* path, struct stat* stbuf){
+    H3_Name object = (H3_Name)&path[1];
+    int res;
+
+    if(!LookupAttributes(object, stbuf, &res)){
+        memset(stbuf, 0, sizeof(struct stat));
+        res = GetObjectInfo(path, stbuf);
+
+        if(res == 0 && S_ISREG(stbuf->st_mode))
+            ApplyOpenFiles(object, stbuf);
+
+        if(res == 0 || res == -ENOENT)
+            CacheAttributes(object, res, stbuf);
+    }
+
+    return res;
+}
+
 static int H3FS_GetAttr(const char* path, struct stat* stbuf, struct fuse_file_info* fi){
 
     if (strcmp(path, "/") == 0 ) {
@@ -142,7 +480,17 @@ static int H3FS_GetAttr(const char* path, struct stat* stbuf, struct fuse_file_i
         return 0;
     }
 
-    return GetObjectInfo(path, stbuf);
+    // Open files are served from their own state, including any buffered data
+    if(fi && fi->fh){
+        H3FS_OpenFile* file = (H3FS_OpenFile*)fi->fh;
+
+        g_mutex_lock(&file->lock);
+        FileInfoToStat(&file->info, stbuf);
+        g_mutex_unlock(&file->lock);
+        return 0;
+    }
+
+    return GetCachedObjectInfo(path, stbuf);
 }
 
 static int H3FS_MkNod(const char* path, mode_t mode, dev_t dev){
@@ -169,6 +517,9 @@ static int H3FS_MkNod(const char* path, mode_t mode, dev_t dev){
 		res = -EINVAL;
 	}
 
+	if(!res)
+		InvalidateObject(object);
+
 	return res;
 }
 
@@ -213,6 +564,9 @@ static int H3FS_MkDir(const char* path, mode_t mode){
     else
     	res = -EINVAL;
 
+    if(!res)
+    	InvalidateObject(object);
+
     return res;
 }
 
@@ -222,6 +576,7 @@ static int H3FS_Unlink(const char* path){
     size_t length = strlen(object);
 
     if(length){
+        FlushObject(object);
     	if(object[length] == '/'){
     		H3_ObjectInfo objectInfo;
     		switch ( H3_InfoObject(data.handle, &data.token, data.bucket, object, &objectInfo)){
@@ -242,6 +597,9 @@ static int H3FS_Unlink(const char* path){
     else
     	res = -EISDIR;
 
+    if(!res)
+    	InvalidateObject(object);
+
     return res;
 }
 
@@ -277,6 +635,9 @@ static int H3FS_RmDir(const char* path){
     else
     	res = -ENOTDIR;
 
+    if(!res)
+    	InvalidateObject(object);
+
     return res;
 }
 
@@ -352,6 +713,9 @@ static int H3FS_Rename(const char* srcPath, const char* dstPath, unsigned int fl
 	if(!srcDir && dstDir)	return -EISDIR;
 	if(!dstEmpty)			return -ENOTEMPTY;
 
+	FlushObject(srcObject);
+	FlushObject(dstObject);
+
 	// Single file or empty 'directory'
 	if(!srcDir || srcEmpty){
 		if(!swap)
@@ -396,6 +760,12 @@ static int H3FS_Rename(const char* srcPath, const char* dstPath, unsigned int fl
 	    	res = -EFAULT;
 	}
 
+	if(!res){
+		RenameOpenFiles(srcObject, dstObject, swap);
+		InvalidateObject(srcObject);
+		InvalidateObject(dstObject);
+	}
+
 	return res;
 }
 
@@ -435,6 +805,9 @@ static int H3FS_ChMod(const char* path, mode_t mode, struct fuse_file_info* fi){
         }
     }
 
+    if(!res)
+    	InvalidateObject(object);
+
     return res;
 }
 
@@ -470,6 +843,9 @@ static int H3FS_ChOwn(const char* path, uid_t uid, gid_t gid, struct fuse_file_i
         }
     }
 
+	if(!res)
+		InvalidateObject(object);
+
 	return res;
 }
 
@@ -479,8 +855,9 @@ static int H3FS_Truncate(const char* path, off_t size, struct fuse_file_info* fi
     size_t length = strlen(object);
 
     if(length){
+        FlushObject(object);
     	switch(H3_TruncateObject(data.handle, &data.token, data.bucket, object, size)){
-			case H3_SUCCESS: 		res = 0; 				break;
+			case H3_SUCCESS: 		ResizeOpenFiles(object, size); break;
 			case H3_NOT_EXISTS: 	res = -ENOENT; 			break;
 			case H3_NAME_TOO_LONG: 	res = -ENAMETOOLONG; 	break;
 			case H3_FAILURE: 		res = -EIO; 			break;
@@ -491,20 +868,18 @@ static int H3FS_Truncate(const char* path, off_t size, struct fuse_file_info* fi
     else
         res = -ENOENT;
 
+    if(!res)
+    	InvalidateObject(object);
+
     return res;
 }
 
 static int H3FS_Open(const char* path , struct fuse_file_info* fi){
-    return 0;
+    return OpenFile((H3_Name)&path[1], fi);
 }
 
-static int H3FS_Read(const char* path, char* buffer, size_t size, off_t offset , struct fuse_file_info* fi){
+static int ReadObjectData(H3_Name object, char* buffer, size_t size, off_t offset){
     int res = 0;
-    H3_Name object = (H3_Name)&path[1];
-    size_t length = strlen(object);
-
-    if (!length)
-        return -ENOENT;
 
     do {
         void *buf = (void *)&(buffer[res]);
@@ -529,72 +904,398 @@ static int H3FS_Read(const char* path, char* buffer, size_t size, off_t offset ,
     return res;
 }
 
-static int H3FS_Write(const char* path, const char* buffer, size_t size, off_t offset, struct fuse_file_info* fi){
-    int res = 0;
+static int H3FS_Read(const char* path, char* buffer, size_t size, off_t offset , struct fuse_file_info* fi){
     H3_Name object = (H3_Name)&path[1];
     size_t length = strlen(object);
 
-    if(length){
-        switch(H3_WriteObject(data.handle, &data.token, data.bucket, object, (void*)buffer, size, offset)){
+    if (!length)
+        return -ENOENT;
+
+    FlushObject(object);
+    return ReadObjectData(object, buffer, size, offset);
+}
+
+/*
+ * Descriptors handed over to the kernel are in use until the reply is sent, which the high-level
+ * library does from the thread serving the request. Thus, they are closed once the same thread
+ * serves its next read or exits.
+ */
+static void CloseSplicedFds(gpointer fds){
+    guint i;
+
+    for(i=0; i<((GArray*)fds)->len; i++)
+        close(g_array_index((GArray*)fds, int, i));
+
+    g_array_free((GArray*)fds, TRUE);
+}
+
+static GPrivate splicedFds = G_PRIVATE_INIT(CloseSplicedFds);
+
+static GArray* ResetSplicedFds(void){
+    GArray* fds = g_private_get(&splicedFds);
+    guint i;
+
+    if(!fds){
+        fds = g_array_new(FALSE, FALSE, sizeof(int));
+        g_private_set(&splicedFds, fds);
+    }
+
+    for(i=0; i<fds->len; i++)
+        close(g_array_index(fds, int, i));
+    g_array_set_size(fds, 0);
+
+    return fds;
+}
+
+// Point the kernel to the files holding the data if the store allows it, otherwise read them in memory
+static int H3FS_ReadBuf(const char* path, struct fuse_bufvec** bufp, size_t size, off_t offset, struct fuse_file_info* fi){
+    H3_Name object = (H3_Name)&path[1];
+    size_t nBufs = size / H3_PART_SIZE + 3, done = 0;
+    struct fuse_bufvec* bufv;
+    GArray* fds;
+    int res = 0;
+
+    if (!strlen(object))
+        return -ENOENT;
+
+    if( !(bufv = calloc(1, sizeof(struct fuse_bufvec) + nBufs * sizeof(struct fuse_buf))) )
+        return -ENOMEM;
+
+    FlushObject(object);
+    fds = ResetSplicedFds();
+    while(!res && done < size){
+        struct fuse_buf* buf = &bufv->buf[bufv->count];
+        H3_Status status = H3_FAILURE;
+        size_t available;
+        int fd;
+
+        // Parts may be smaller than expected (e.g. multipart uploads), the last buffer is kept for the rest of the data
+        if(bufv->count < nBufs - 1)
+            status = H3_OpenObjectData(data.handle, &data.token, data.bucket, object, offset + done, &fd, &buf->pos, &available);
+
+        switch(status){
             case H3_SUCCESS:
-                res = size;
+                if(available){
+                    g_array_append_val(fds, fd);
+                    buf->flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+                    buf->fd = fd;
+                    buf->size = available < size - done?available:size - done;
+                    bufv->count++;
+                    done += buf->size;
+                }
+                else
+                    size = done;
+                break;
+
+            case H3_NOT_EXISTS:
+                res = -ENOENT;
                 break;
 
+            // The rest of the data are read at once
             default:
-                res = -EINVAL;
+                if( !(buf->mem = malloc(size - done)) ){
+                    res = -ENOMEM;
+                }
+                else if( (res = ReadObjectData(object, buf->mem, size - done, offset + done)) >= 0){
+                    buf->size = res;
+                    bufv->count++;
+                    size = done += res;
+                    res = 0;
+                }
+                else
+                    free(buf->mem);
+                break;
         }
     }
-    else
-        res = -ENOENT;
 
-    return res;
+    if(res){
+        while(bufv->count--){
+            if(!(bufv->buf[bufv->count].flags & FUSE_BUF_IS_FD))
+                free(bufv->buf[bufv->count].mem);
+        }
+        free(bufv);
+        return res;
+    }
+
+    // An empty vector still needs a (zero-sized) buffer
+    if(!bufv->count)
+        bufv->count = 1;
+
+    *bufp = bufv;
+    return 0;
+}
+
+// Advance a buffer vector whose data were consumed in place
+static void SkipBuffer(struct fuse_bufvec* bufv, size_t size){
+    while(size && bufv->idx < bufv->count){
+        size_t left = bufv->buf[bufv->idx].size - bufv->off;
+
+        if(size < left){
+            bufv->off += size;
+            return;
+        }
+
+        size -= left;
+        bufv->idx++;
+        bufv->off = 0;
+    }
+}
+
+// Return the data of the vector's current buffer if it holds at least "size" bytes in memory
+static void* GetBufferMemory(struct fuse_bufvec* bufv, size_t size){
+    struct fuse_buf* buf = &bufv->buf[bufv->idx];
+
+    if(bufv->idx < bufv->count && !(buf->flags & FUSE_BUF_IS_FD) && buf->size - bufv->off >= size)
+        return &((char*)buf->mem)[bufv->off];
+
+    return NULL;
+}
+
+/*
+ * Data are moved straight from the request's buffers, be it memory or a pipe, to the write buffer of the
+ * file. Whole parts are passed to H3 without being buffered, and in place if they are already in memory.
+ */
+static int WriteBuffer(H3FS_OpenFile* file, struct fuse_bufvec* src, off_t offset){
+    int res = 0;
+    size_t size = fuse_buf_size(src);
+    size_t written = 0;
+
+    if(!file)
+        return -EBADF;
+
+    g_mutex_lock(&file->lock);
+
+    // Only contiguous writes are coalesced
+    if(file->size && offset != file->offset + file->size)
+        res = FlushOpenFile(file);
+
+    while(!res && written < size){
+        off_t position = offset + written;
+        size_t remaining = size - written;
+
+        // Whole parts bypass the buffer
+        if(!file->size && position % H3_PART_SIZE == 0 && remaining >= H3_PART_SIZE){
+            size_t chunk = remaining - remaining % H3_PART_SIZE;
+            void* buffer = GetBufferMemory(src, chunk);
+            void* copy = NULL;
+
+            if(buffer){
+                SkipBuffer(src, chunk);
+            }
+            else if( (buffer = copy = malloc(chunk)) ){
+                struct fuse_bufvec dst = FUSE_BUFVEC_INIT(chunk);
+                dst.buf[0].mem = copy;
+                if(fuse_buf_copy(&dst, src, 0) != chunk)
+                    buffer = NULL;
+            }
+
+            if(buffer && H3_WriteObject(data.handle, &data.token, data.bucket, file->object, buffer, chunk, position) == H3_SUCCESS)
+                written += chunk;
+            else
+                res = -EIO;
+            free(copy);
+
+            g_mutex_lock(&data.cacheLock);
+            g_hash_table_remove(data.attrCache, file->object);
+            g_hash_table_remove(data.versions, file->object);
+            g_mutex_unlock(&data.cacheLock);
+
+            continue;
+        }
+
+        if(!file->buffer && !(file->buffer = malloc(H3_PART_SIZE))){
+            res = -ENOMEM;
+            break;
+        }
+
+        // Buffer up to the next part boundary
+        if(!file->size)
+            file->offset = position;
+
+        off_t boundary = (file->offset / H3_PART_SIZE + 1) * H3_PART_SIZE;
+        size_t room = boundary - (file->offset + file->size);
+        size_t chunk = remaining < room?remaining:room;
+
+        struct fuse_bufvec dst = FUSE_BUFVEC_INIT(chunk);
+        dst.buf[0].mem = &file->buffer[file->size];
+        if(fuse_buf_copy(&dst, src, 0) != chunk){
+            res = -EIO;
+            break;
+        }
+        file->size += chunk;
+        written += chunk;
+
+        if(chunk == room)
+            res = FlushOpenFile(file);
+    }
+
+    if(written){
+        if(offset + written > file->info.size)
+            file->info.size = offset + written;
+        clock_gettime(CLOCK_REALTIME, &file->info.lastModification);
+
+        g_mutex_lock(&data.cacheLock);
+        g_hash_table_remove(data.attrCache, file->object);
+        g_mutex_unlock(&data.cacheLock);
+    }
+    g_mutex_unlock(&file->lock);
+
+    return res?res:size;
+}
+
+static int H3FS_Write(const char* path, const char* buffer, size_t size, off_t offset, struct fuse_file_info* fi){
+    struct fuse_bufvec src = FUSE_BUFVEC_INIT(size);
+
+    src.buf[0].mem = (void*)buffer;
+    return WriteBuffer((H3FS_OpenFile*)fi->fh, &src, offset);
+}
+
+static int H3FS_WriteBuf(const char* path, struct fuse_bufvec* buf, off_t offset, struct fuse_file_info* fi){
+    return WriteBuffer((H3FS_OpenFile*)fi->fh, buf, offset);
 }
 
 static int H3FS_Flush(const char* path, struct fuse_file_info* fi){
-	return 0;
+    int res = 0;
+    H3FS_OpenFile* file = (H3FS_OpenFile*)fi->fh;
+
+    if(file){
+        g_mutex_lock(&file->lock);
+        res = FlushOpenFile(file);
+        g_mutex_unlock(&file->lock);
+    }
+
+	return res;
 }
 
 static int H3FS_Release(const char* path, struct fuse_file_info* fi){
-	return 0;
+    int res = 0;
+    H3FS_OpenFile* file = (H3FS_OpenFile*)fi->fh;
+
+    if(file){
+        g_mutex_lock(&data.lock);
+        g_hash_table_remove(data.openFiles, file);
+        g_mutex_unlock(&data.lock);
+
+        // Requests that looked the file up by name may still refer to it
+        g_mutex_lock(&file->lock);
+        res = FlushOpenFile(file);
+        g_mutex_unlock(&file->lock);
+
+        PutOpenFile(file);
+        fi->fh = 0;
+    }
+
+	return res;
 }
 
 static int H3FS_Fsync(const char* path, int isDatasync, struct fuse_file_info* fi){
-	return 0;
+	return H3FS_Flush(path, fi);
+}
+
+// Directory entries built while listing; files carry their own attributes if available
+static struct stat* DirEntryToStat(GHashTable* dirEntries, H3_Name dirEntry, int isDir, H3_ObjectInfo* info){
+    struct stat* st = g_hash_table_lookup(dirEntries, dirEntry);
+
+    if(!st){
+        st = calloc(1, sizeof(struct stat));
+        if(isDir){
+            st->st_mode = S_IFDIR | 0755;
+            st->st_nlink = 2;
+        }
+        else {
+            st->st_mode = S_IFREG | 0777;
+            st->st_nlink = 1;
+        }
+        g_hash_table_insert(dirEntries, dirEntry, st);
+    }
+
+    if(info && !info->isBad){
+        FileInfoToStat(info, st);
+        if(isDir){
+            st->st_mode = S_IFDIR | info->mode;
+            st->st_nlink = 2;
+            st->st_size = 0;
+        }
+    }
+
+    return st;
 }
 
 static int H3FS_ReadDir(const char* path, void* buffer, fuse_fill_dir_t filler, off_t fuseOffset, struct fuse_file_info* fi, enum fuse_readdir_flags flags){
     int res = 0;
     H3_Name prefix = (H3_Name)&path[1];
     size_t length = strlen(prefix);
+    int plus = flags & FUSE_READDIR_PLUS;
 
     char *directory = NULL;
     if (length) {
        asprintf(&directory, "%s/", prefix);
+       length++;
     } else directory = "";
 
     int isDir = 0;
-    GHashTable* uniqueDirEntries = g_hash_table_new(g_str_hash, g_str_equal);
+    GHashTable* uniqueDirEntries = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, free);
     GPtrArray* objectArrays = g_ptr_array_new_full(20, free);
 
-    uint32_t nObjects = 0;
+    uint32_t nObjects = 0, i;
     H3_Name objectNameArray;
+    H3_ObjectInfo* objectInfoArray = NULL;
     H3_Status status;
     uint32_t h3Offset = 0;
-    while( (status = H3_ListObjects(data.handle, &data.token, data.bucket, directory, h3Offset, &objectNameArray, &nObjects)) == H3_CONTINUE || (status == H3_SUCCESS && nObjects)){
+
+    // A plain listing only needs names, READDIRPLUS retrieves the attributes in the same pass
+    while( (status = plus?H3_ListObjectsWithInfo(data.handle, &data.token, data.bucket, directory, h3Offset, &objectNameArray, &objectInfoArray, &nObjects):
+                          H3_ListObjects(data.handle, &data.token, data.bucket, directory, h3Offset, &objectNameArray, &nObjects)) == H3_CONTINUE || (status == H3_SUCCESS && nObjects)){
     	h3Offset += nObjects;
     	g_ptr_array_add(objectArrays, objectNameArray);
+    	if(plus)
+    	    g_ptr_array_add(objectArrays, objectInfoArray);
+
+    	H3_Name currentEntry = objectNameArray;
+    	for(i=0; i<nObjects; i++){
+    		size_t entryLength = strlen(currentEntry);
+    		H3_ObjectInfo* info = plus?&objectInfoArray[i]:NULL;
+
+    		// Only an entry for the directory itself, i.e. a pseudo-object "name/", carries its attributes
+    		H3_Name dirEntry = Cast2DirEntry(&currentEntry[length], &isDir);
+    		if(isDir && dirEntry[strlen(dirEntry) + 1] != '\0')
+    		    info = NULL;
 
-    	H3_Name nextEntry = &objectNameArray[strlen(objectNameArray) + 1];
-    	H3_Name currentEntry = &objectNameArray[length];
-    	while(nObjects--){
-    		H3_Name dirEntry = Cast2DirEntry(currentEntry, &isDir);
-    		g_hash_table_insert(uniqueDirEntries, dirEntry , GINT_TO_POINTER(isDir));
-    		currentEntry = &nextEntry[length];
-    		nextEntry = &nextEntry[strlen(nextEntry)+1];
+    		if(strlen(dirEntry)){
+    		    struct stat* st = DirEntryToStat(uniqueDirEntries, dirEntry, isDir, info);
+
+    		    // Spare the kernel's follow-up lookups from reaching the store. The entry is now the full object name.
+    		    if(info && !info->isBad)
+    		        CacheAttributes(currentEntry, 0, st);
+    		}
+
+    		currentEntry = &currentEntry[entryLength + 1];
     	}
     }
 
-    if (length)
+    // Pending writes are visible in the reported sizes without being flushed
+    if(plus && status == H3_SUCCESS){
+        GSList *files = GetOpenFiles(length?prefix:NULL, 1), *entry;
+
+        for(entry = files; entry; entry = entry->next){
+            H3FS_OpenFile* file = (H3FS_OpenFile*)entry->data;
+            struct stat* st;
+
+            g_mutex_lock(&file->lock);
+            if(file->size && strlen(file->object) > length && !strchr(&file->object[length], '/') &&
+               (st = g_hash_table_lookup(uniqueDirEntries, &file->object[length]))){
+                st->st_size = file->info.size;
+                st->st_mtim = file->info.lastModification;
+                CacheAttributes(file->object, 0, st);
+            }
+            g_mutex_unlock(&file->lock);
+
+            PutOpenFile(file);
+        }
+        g_slist_free(files);
+    }
+
+    if (strlen(directory))
         free(directory);
 
     if(status != H3_SUCCESS){
@@ -602,8 +1303,6 @@ static int H3FS_ReadDir(const char* path, void* buffer, fuse_fill_dir_t filler,
     }
     else {
 		// Use filler to populate the buffer
-		struct stat st;
-		memset(&st, 0, sizeof(st));
 		filler(buffer, ".", NULL, 0, 0);
 		filler(buffer, "..", NULL, 0, 0);
 
@@ -617,44 +1316,43 @@ static int H3FS_ReadDir(const char* path, void* buffer, fuse_fill_dir_t filler,
 				continue;
 			}
 
-			if(strlen((char*)key)){
-				if(value){
-					st.st_mode = S_IFDIR | 0755;
-					st.st_nlink = 2;
-					printf("Directory: %s\n", (char*)key);
-				}
-				else {
-					st.st_mode = S_IFREG | 0777;
-					st.st_nlink = 1;
-					printf("File: %s\n", (char*)key);
-				}
-
-				if (filler(buffer, key, &st, 0, 0))
-					break;
-			}
+			if (filler(buffer, key, (struct stat*)value, 0, plus?FUSE_FILL_DIR_PLUS:0))
+				break;
 		}
     }
 
     g_hash_table_destroy(uniqueDirEntries);
     g_ptr_array_free(objectArrays, TRUE);
 
-
-
     return res;
 }
 
 static void* H3FS_Init(struct fuse_conn_info* conn, struct fuse_config* cfg){
-    (void) conn;
-    (void) cfg;
 //    conn->capable |= FUSE_CAP_NO_OPEN_SUPPORT;
 
+    // Let replies pointing to files be spliced rather than copied
+    conn->want |= conn->capable & (FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_MOVE);
+
     struct fuse_context* cxt = fuse_get_context();
+
+    // Cache attributes in the daemon as long as the kernel does
+    data.attrTimeout = cfg->attr_timeout;
+    data.negativeTimeout = cfg->negative_timeout;
+    if(cxt){
+        data.fuse = cxt->fuse;
+        data.invalidator = g_thread_pool_new(InvalidateKernelCache, NULL, 1, FALSE, NULL);
+    }
+
     if(cxt) return cxt->private_data;
 
     return NULL;
 }
 
 static void H3FS_Destroy(void* privateData){
+	if(data.invalidator)
+		g_thread_pool_free(data.invalidator, TRUE, TRUE);
+
+	FlushObject(NULL);
 	H3_Free(data.handle);
 }
 
@@ -668,7 +1366,7 @@ static int H3FS_Access(const char* path, int mode){
     }
 
     struct stat stbuf;
-    return GetObjectInfo(path, &stbuf);
+    return GetCachedObjectInfo(path, &stbuf);
 }
 
 static int H3FS_Create(const char* path , mode_t mode, struct fuse_file_info* fi){
@@ -677,14 +1375,13 @@ static int H3FS_Create(const char* path , mode_t mode, struct fuse_file_info* fi
     H3_Name object = (H3_Name)&path[1];
     size_t length = strlen(object);
 
-    (void) fi;
-
 	// A call to creat() is equivalent to calling open() with flags equal to O_CREAT|O_WRONLY|O_TRUNC
     if(length){
     	switch((status = H3_CreateObject(data.handle, &data.token, data.bucket, object, NULL, 0))){
 			case H3_FAILURE:
 			case H3_INVALID_ARGS: res = -EINVAL; break;
 			case H3_EXISTS:
+				FlushObject(object);
 				if((status = H3_TruncateObject(data.handle, &data.token, data.bucket, object, 0)) != H3_SUCCESS){
 					res = -EINVAL;
 				}
@@ -697,10 +1394,16 @@ static int H3FS_Create(const char* path , mode_t mode, struct fuse_file_info* fi
     	if(status == H3_SUCCESS && H3_SetObjectAttributes(data.handle, &data.token, data.bucket, object, attrib) != H3_SUCCESS){
     		res = -EINVAL;
     	}
+
+    	if(!res)
+    		res = OpenFile(object, fi);
     }
     else
     	res = -EISDIR;
 
+    if(!res)
+    	InvalidateObject(object);
+
     return res;
 }
 
@@ -716,7 +1419,7 @@ static int H3FS_Utimens(const char *path, const struct timespec tv[2], struct fu
         res = -ENAMETOOLONG;
     }
     else{
-
+        FlushObject(object);
         switch(H3_TouchObject(data.handle, &data.token, data.bucket, object, (struct timespec *)(tv != NULL ? &(tv[0]) : NULL), (struct timespec *)(tv != NULL ? &(tv[1]) : NULL))){
             case H3_SUCCESS:    res = 0;        break;
             case H3_NOT_EXISTS: res = -ENOENT;  break;
@@ -739,6 +1442,9 @@ static int H3FS_Utimens(const char *path, const struct timespec tv[2], struct fu
         }
     }
 
+    if(!res)
+    	InvalidateObject(object);
+
     return res;
 }
 
@@ -770,8 +1476,11 @@ static ssize_t H3FS_CopyFileRange(const char* srcPath, struct fuse_file_info* sr
 	(void) srcFi;
 	(void) dtsFi;
 
+	FlushObject(srcObject);
+	FlushObject(dstObject);
+
 	switch(H3_WriteObjectCopy(data.handle, &data.token, data.bucket, srcObject, srcOffset, &size, dstObject, dstOffset)){
-		case H3_SUCCESS: res = size; break;
+		case H3_SUCCESS: res = size; InvalidateObject(dstObject); break;
 		case H3_NOT_EXISTS: res = -EBADF; break;
 		default: res = -EIO; break;
 	}
@@ -795,6 +1504,8 @@ static struct fuse_operations h3fsOperations = {
     .open       		= H3FS_Open,
     .read       		= H3FS_Read,
     .write      		= H3FS_Write,
+    .read_buf			= H3FS_ReadBuf,
+    .write_buf			= H3FS_WriteBuf,
 //    NOT NECESSARY - int (*statfs) (const char *, struct statvfs *);
     .flush				= H3FS_Flush,
     .release			= H3FS_Release,
@@ -816,8 +1527,6 @@ static struct fuse_operations h3fsOperations = {
 //    NOT SUPPORTED - int (*bmap) (const char *, size_t blocksize, uint64_t *idx);
 //    NOT SUPPORTED - int (*ioctl) (const char *, unsigned int cmd, void *arg, struct fuse_file_info *, unsigned int flags, void *data);
 //    NOT SUPPORTED - int (*poll) (const char *, struct fuse_file_info *, struct fuse_pollhandle *ph, unsigned *reventsp);
-//    NOT SUPPORTED - int (*write_buf) (const char *, struct fuse_bufvec *buf, off_t off, struct fuse_file_info *);
-//    NOT SUPPORTED - int (*read_buf) (const char *, struct fuse_bufvec **bufp, size_t size, off_t off, struct fuse_file_info *);
 //    NOT SUPPORTED - int (*flock) (const char *, struct fuse_file_info *, int op);
 //    NOT SUPPORTED - int (*fallocate) (const char *, int, off_t, off_t, struct fuse_file_info *);
     .copy_file_range	= H3FS_CopyFileRange
@@ -884,6 +1593,14 @@ int main(int argc, char *argv[]) {
 
     // H3lib cleanup will be handled by fuse.destroy
     data.bucket = strdup(conf.bucket);
+    data.openFiles = g_hash_table_new(g_direct_hash, g_direct_equal);
+    data.attrCache = g_hash_table_new_full(g_str_hash, g_str_equal, free, free);
+    data.versions = g_hash_table_new_full(g_str_hash, g_str_equal, free, free);
+    g_mutex_init(&data.lock);
+    g_mutex_init(&data.cacheLock);
+
+    // Cache negative lookups by default, options given by the user take precedence
+    fuse_opt_insert_arg(&args, 1, "-onegative_timeout=1");
     data.handle = H3_Init(conf.storageUri);
     if(H3_InfoBucket(data.handle, &data.token, data.bucket, &info, 0) == H3_SUCCESS){
         ret = fuse_main(args.argc, args.argv, &h3fsOperations, (void*)&data);
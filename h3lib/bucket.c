@@ -14,6 +14,7 @@
 
 #include "common.h"
 #include "util.h"
+#include "compression.h"
 
 H3_Status ValidBucketName(KV_Operations* op, char* name){
     H3_Status status = H3_SUCCESS;
@@ -83,10 +84,13 @@ H3_Status H3_CreateBucket(H3_Handle handle, H3_Token token, H3_Name bucketName){
     // Populate bucket metadata
     memcpy(bucketMetadata.userId, userId, sizeof(H3_UserId));
     clock_gettime(CLOCK_REALTIME, &bucketMetadata.creation);
+    bucketMetadata.compression.codec = H3_CODEC_NONE;
+    bucketMetadata.compression.level = 0;
+    bucketMetadata.compression.dictId = 0;
 
     if( (kvStatus = op->metadata_create(_handle, bucketId, (KV_Value)&bucketMetadata, sizeof(H3_BucketMetadata))) == KV_SUCCESS){
 
-        if( (kvStatus = op->metadata_read(_handle, userId, 0, &value, &metaSize)) == KV_SUCCESS){
+        if( (kvStatus = ReadMetadata(ctx, userId, &value, &metaSize)) == KV_SUCCESS){
             // Extend existing user's metadata to fit new bucket-id if needed
             userMetadata = (H3_UserMetadata*)value;
             if(userMetadata->nBuckets == 0){
@@ -132,9 +136,114 @@ H3_Status H3_CreateBucket(H3_Handle handle, H3_Token token, H3_Name bucketName){
 
 
 
+typedef struct{
+    GHashTable* stored;     // Dictionaries in the store
+    GHashTable* used;       // Dictionaries trained by buckets or used by objects
+    GPtrArray* buckets;
+}H3_DictionaryReferences;
+
+// Listing '#' yields both buckets and dictionaries
+static void CollectBuckets(KV_Key key, KV_Value value, size_t size, void* userData){
+    H3_DictionaryReferences* references = (H3_DictionaryReferences*)userData;
+    H3_BucketMetadata* bucketMetadata = (H3_BucketMetadata*)value;
+
+    if(key[1] == '#')
+        g_hash_table_add(references->stored, GUINT_TO_POINTER(strtoul(&key[2], NULL, 16)));
+
+    else{
+        if(bucketMetadata && bucketMetadata->compression.dictId)
+            g_hash_table_add(references->used, GUINT_TO_POINTER(bucketMetadata->compression.dictId));
+        g_ptr_array_add(references->buckets, g_strdup(&key[1]));
+    }
+}
+
+// Objects and multipart uploads keep the dictionary they were created with
+static void CollectObjects(KV_Key key, KV_Value value, size_t size, void* userData){
+    H3_DictionaryReferences* references = (H3_DictionaryReferences*)userData;
+    H3_ObjectMetadata* objMeta = (H3_ObjectMetadata*)value;
+
+    if(objMeta && size >= sizeof(H3_ObjectMetadata) && objMeta->compression.dictId)
+        g_hash_table_add(references->used, GUINT_TO_POINTER(objMeta->compression.dictId));
+}
+
+static gboolean IsUsed(gpointer key, gpointer value, gpointer userData){
+    return g_hash_table_contains((GHashTable*)userData, key);
+}
+
+static KV_Status CollectReferences(H3_Context* ctx, KV_Key prefix, KV_Key keyBuffer, KV_ListCallback function, H3_DictionaryReferences* references){
+    uint32_t nKeys = 0, keyOffset = 0;
+    KV_Status kvStatus;
+
+    while((kvStatus = ListMetadata(ctx, prefix, 0, keyBuffer, keyOffset, &nKeys, function, references)) == KV_CONTINUE || kvStatus == KV_SUCCESS){
+
+        // Stop at the last batch, it's not an error to get an empty one
+        if(!nKeys || kvStatus == KV_SUCCESS)
+            break;
+
+        keyOffset += nKeys;
+        nKeys = 0;
+    }
+
+    return kvStatus;
+}
+
+/*
+ * Delete the dictionaries no bucket is trained with and no object or multipart upload was compressed with, e.g. the
+ * one of a purged or deleted bucket or the one replaced by retraining once the objects using it are gone. It takes a
+ * scan of all objects, thus it is only done when a bucket is purged or drops a dictionary and stops once all of them
+ * are in use, e.g. right after listing the buckets of a store without dictionaries.
+ * The multipart uploads of a bucket given are looked up as well, as it may be deleted already.
+ */
+static void DeleteDictionaries(H3_Context* ctx, H3_Name bucketName){
+    H3_DictionaryReferences references;
+    H3_DictionaryId dictionaryId;
+    H3_ObjectId prefix;
+    GHashTableIter iter;
+    gpointer dictId;
+    KV_Status kvStatus;
+    KV_Key keyBuffer;
+    uint i;
+
+    if(!(keyBuffer = calloc(1, KV_LIST_BUFFER_SIZE)))
+        return;
+
+    references.stored = g_hash_table_new(NULL, NULL);
+    references.used = g_hash_table_new(NULL, NULL);
+    references.buckets = g_ptr_array_new_with_free_func(g_free);
+    if(bucketName)
+        g_ptr_array_add(references.buckets, g_strdup(bucketName));
+
+    kvStatus = CollectReferences(ctx, "#", keyBuffer, CollectBuckets, &references);
+    g_hash_table_foreach_remove(references.stored, IsUsed, references.used);
+
+    for(i=0; i<references.buckets->len && kvStatus == KV_SUCCESS && g_hash_table_size(references.stored); i++){
+        GetObjectId(g_ptr_array_index(references.buckets, i), NULL, prefix);
+        if((kvStatus = CollectReferences(ctx, prefix, keyBuffer, CollectObjects, &references)) == KV_SUCCESS){
+            GetMultipartObjectId(g_ptr_array_index(references.buckets, i), NULL, prefix);
+            kvStatus = CollectReferences(ctx, prefix, keyBuffer, CollectObjects, &references);
+        }
+        g_hash_table_foreach_remove(references.stored, IsUsed, references.used);
+    }
+
+    if(kvStatus == KV_SUCCESS){
+        g_hash_table_iter_init(&iter, references.stored);
+        while(g_hash_table_iter_next(&iter, &dictId, NULL)){
+            GetDictionaryId(GPOINTER_TO_UINT(dictId), dictionaryId);
+            ctx->operation->metadata_delete(ctx->handle, dictionaryId);
+        }
+    }
+
+    g_ptr_array_free(references.buckets, TRUE);
+    g_hash_table_destroy(references.used);
+    g_hash_table_destroy(references.stored);
+    free(keyBuffer);
+}
+
+
 /*! \brief  Delete a bucket
  *
  * For the bucket to be deleted it must be empty and the token must grant access to it.
+ * The dictionary the bucket was last trained with is deleted along with it, unless still in use.
  *
  * @param[in]    handle             An h3lib handle
  * @param[in]    token              Authentication information
@@ -176,7 +285,7 @@ H3_Status H3_DeleteBucket(H3_Handle handle, H3_Token token, H3_Name bucketName){
     }
 
     status = H3_FAILURE;
-    if((kvStatus = op->metadata_read(_handle, bucketId, 0, &value, &size)) == KV_SUCCESS){
+    if((kvStatus = ReadMetadata(ctx, bucketId, &value, &size)) == KV_SUCCESS){
 
         // Make sure the bucket is empty and the user has access to the bucket prior deletion
         H3_ObjectId prefix;
@@ -186,7 +295,7 @@ H3_Status H3_DeleteBucket(H3_Handle handle, H3_Token token, H3_Name bucketName){
         if( GrantBucketAccess(userId, bucketMetadata)                              &&
 
             (kvStatus = op->list(_handle, prefix, 0, NULL, 0, &nKeys)) == KV_SUCCESS && !nKeys  &&
-            (kvStatus = op->metadata_read(_handle, userId, 0, &value, &size)) == KV_SUCCESS     &&
+            (kvStatus = ReadMetadata(ctx, userId, &value, &size)) == KV_SUCCESS     &&
             (kvStatus = op->metadata_delete(_handle, bucketId)) == KV_SUCCESS                     ){
 
             H3_UserMetadata* userMetadata = (H3_UserMetadata*)value;
@@ -204,7 +313,8 @@ H3_Status H3_DeleteBucket(H3_Handle handle, H3_Token token, H3_Name bucketName){
                 }
 
                 // Push the updated metadata to the store
-                op->metadata_write(_handle, userId, (KV_Value)userMetadata, size);
+                if(op->metadata_write(_handle, userId, (KV_Value)userMetadata, size) == KV_SUCCESS && bucketMetadata->compression.dictId)
+                    DeleteDictionaries(ctx, bucketName);
                 status = H3_SUCCESS;
             }
 
@@ -269,7 +379,7 @@ H3_Status H3_ListBuckets(H3_Handle handle, H3_Token token, H3_Name* bucketNameAr
         return H3_INVALID_ARGS;
     }
 
-    if( (status = op->metadata_read(_handle, userId, 0, &value, &metaSize)) == KV_SUCCESS){
+    if( (status = ReadMetadata(ctx, userId, &value, &metaSize)) == KV_SUCCESS){
         H3_UserMetadata* userMetadata = (H3_UserMetadata*)value;
         if(userMetadata->nBuckets){
             int i;
@@ -305,6 +415,17 @@ H3_Status H3_ListBuckets(H3_Handle handle, H3_Token token, H3_Name* bucketNameAr
 }
 
 
+static void AccumulateStats(KV_Key key, KV_Value value, size_t size, void* userData){
+    H3_BucketStats* stats = (H3_BucketStats*)userData;
+    H3_ObjectMetadata* objMeta = (H3_ObjectMetadata*)value;
+
+    if(objMeta && size >= sizeof(H3_ObjectMetadata) && objMeta->nParts){
+        stats->size += objMeta->part[objMeta->nParts-1].offset + objMeta->part[objMeta->nParts-1].size;
+        stats->lastAccess = Posterior(&stats->lastAccess, &objMeta->lastAccess);
+        stats->lastModification = Posterior(&stats->lastModification, &objMeta->lastModification);
+    }
+}
+
 /*! \brief Retrieve information about a bucket
  *
  * @param[in]    handle             An h3lib handle
@@ -334,7 +455,6 @@ H3_Status H3_InfoBucket(H3_Handle handle, H3_Token token, H3_Name bucketName, H3
     }
 
     H3_Context* ctx = (H3_Context*)handle;
-    KV_Handle _handle = ctx->handle;
     KV_Operations* op = ctx->operation;
 
     // Validate bucketName & extract userId from token
@@ -347,7 +467,7 @@ H3_Status H3_InfoBucket(H3_Handle handle, H3_Token token, H3_Name bucketName, H3
     }
 
     status = H3_FAILURE;
-    if( (kvStatus = op->metadata_read(_handle, bucketId, 0, &value, &size)) == KV_SUCCESS){
+    if( (kvStatus = ReadMetadata(ctx, bucketId, &value, &size)) == KV_SUCCESS){
         H3_BucketMetadata* bucketMetadata = (H3_BucketMetadata*)value;
 
         // Make sure the token grants access to the bucket
@@ -356,32 +476,14 @@ H3_Status H3_InfoBucket(H3_Handle handle, H3_Token token, H3_Name bucketName, H3
 
             if(getStats){
                 KV_Key keyBuffer = calloc(1, KV_LIST_BUFFER_SIZE);
-                size_t bucketSize = 0;
-                struct timespec lastAccess = {0,0};
-                struct timespec lastModification = {0,0};
+                H3_BucketStats stats;
                 H3_ObjectId prefix;
                 uint32_t keyOffset = 0, nKeys = 0;
 
-                // Apply no trim so we don't need to recreate the object-ID for the entries
+                // Objects are accounted for as they are listed, the keys themselves are of no interest
+                memset(&stats, 0, sizeof(H3_BucketStats));
                 GetObjectId(bucketName, NULL, prefix);
-                while((kvStatus = op->list(_handle, prefix, 0, keyBuffer, keyOffset, &nKeys)) == KV_CONTINUE || kvStatus == KV_SUCCESS){
-                    uint32_t i = 0;
-                    KV_Key objId = keyBuffer;
-
-                    value = NULL; size = 0;
-                    while(i < nKeys && (kvStatus = op->metadata_read(_handle, objId, 0, &value, &size)) == KV_SUCCESS){
-                        H3_ObjectMetadata* objMeta = (H3_ObjectMetadata*)value;
-                        if(objMeta->nParts){
-                            bucketSize += objMeta->part[objMeta->nParts-1].offset + objMeta->part[objMeta->nParts-1].size;
-                            lastAccess = Posterior(&lastAccess, &objMeta->lastAccess);
-                            lastModification = Posterior(&lastModification, &objMeta->lastModification);
-                        }
-
-                        objId += strlen(objId)+1;
-                        free(objMeta);
-                        value = NULL; size = 0;
-                        i++;
-                    }
+                while((kvStatus = ListMetadata(ctx, prefix, 0, keyBuffer, keyOffset, &nKeys, AccumulateStats, &stats)) == KV_CONTINUE || kvStatus == KV_SUCCESS){
 
                     // It's not an error to get an empty list
                     if(!nKeys)
@@ -393,10 +495,8 @@ H3_Status H3_InfoBucket(H3_Handle handle, H3_Token token, H3_Name bucketName, H3
 
                 free(keyBuffer);
                 if(kvStatus == KV_SUCCESS){
-                    bucketInfo->stats.nObjects = keyOffset;
-                    bucketInfo->stats.lastAccess = lastAccess;
-                    bucketInfo->stats.lastModification = lastModification;
-                    bucketInfo->stats.size = bucketSize;
+                    stats.nObjects = keyOffset;
+                    bucketInfo->stats = stats;
                     status = H3_SUCCESS;
                 }
                 else if(kvStatus == KV_KEY_TOO_LONG)
@@ -446,15 +546,13 @@ H3_Status H3_ForeachBucket(H3_Handle handle, H3_Token token, h3_name_iterator_cb
     }
 
     H3_Context* ctx = (H3_Context*)handle;
-    KV_Handle _handle = ctx->handle;
-    KV_Operations* op = ctx->operation;
 
     // Validate bucketName & extract userId from token
     if(!GetUserId(token, userId) ){
         return H3_INVALID_ARGS;
     }
 
-    if( op->metadata_read(_handle, userId, 0, &value, &size) == KV_SUCCESS){
+    if( ReadMetadata(ctx, userId, &value, &size) == KV_SUCCESS){
         H3_UserMetadata* userMetadata = (H3_UserMetadata*)value;
 
         // Call the user function
@@ -469,7 +567,10 @@ H3_Status H3_ForeachBucket(H3_Handle handle, H3_Token token, h3_name_iterator_cb
 }
 
 
-/*! \brief Set a bucket's permission bits
+/*! \brief Set a bucket's attributes
+ *
+ * Only compression is applicable to buckets. The codec applies to objects created after the change,
+ * existing objects retain the one they were created with.
  *
  * @param[in]    handle             An h3lib handle
  * @param[in]    token              Authentication information
@@ -513,15 +614,31 @@ H3_Status H3_SetBucketAttributes(H3_Handle handle, H3_Token token, H3_Name bucke
         return H3_INVALID_ARGS;
     }
 
+    if(attrib.type == H3_ATTRIBUTE_COMPRESSION && !ValidCompression(attrib.codec, attrib.level)) {
+        return H3_INVALID_ARGS;
+    }
+
     status = H3_FAILURE;
-    if( (kvStatus = op->metadata_read(_handle, bucketId, 0, &value, &size)) == KV_SUCCESS){
+    if( (kvStatus = ReadMetadata(ctx, bucketId, &value, &size)) == KV_SUCCESS){
         H3_BucketMetadata* bucketMetadata = (H3_BucketMetadata*)value;
 
         // Make sure the token grants access to the bucket
         if( GrantBucketAccess(userId, bucketMetadata) ){
-            // No attributes implemented yet
+
+            // Existing objects retain the setting they were created with
+            uint32_t dictId = bucketMetadata->compression.dictId;
+            if(attrib.type == H3_ATTRIBUTE_COMPRESSION){
+                bucketMetadata->compression.codec = attrib.codec;
+                bucketMetadata->compression.level = attrib.level;
+
+                // Trained dictionaries only apply to Zstandard
+                if(attrib.codec != H3_CODEC_ZSTD)
+                    bucketMetadata->compression.dictId = 0;
+            }
 
             if(op->metadata_write(_handle, bucketId, (KV_Value)bucketMetadata, size) == KV_SUCCESS){
+                if(dictId && dictId != bucketMetadata->compression.dictId)
+                    DeleteDictionaries(ctx, NULL);
                 status = H3_SUCCESS;
             }
         }
@@ -538,7 +655,139 @@ H3_Status H3_SetBucketAttributes(H3_Handle handle, H3_Token token, H3_Name bucke
 }
 
 
+/*! \brief Train a compression dictionary for a bucket
+ *
+ * Train a Zstandard dictionary from a sample of the objects in a bucket (up to H3_DICTIONARY_SAMPLE_SIZE
+ * bytes from each of the first H3_DICTIONARY_MAX_SAMPLES objects) and use it to compress objects created
+ * in the bucket from now on. Dictionaries pay off for buckets of small objects with similar content, e.g.
+ * JSON or CSV records, that compress poorly one by one. The bucket's codec is switched to Zstandard if
+ * needed, while existing objects retain the dictionary (if any) they were created with. The dictionary replaced is
+ * deleted unless still in use, otherwise the next time a bucket is purged or drops a dictionary.
+ *
+ * @param[in]    handle             An h3lib handle
+ * @param[in]    token              Authentication information
+ * @param[in]    bucketName         Name of bucket
+ * @param[in]    dictionarySize     Max size of the dictionary, 0 selects H3_DICTIONARY_SIZE
+ *
+ * @result \b H3_SUCCESS            Operation completed successfully
+ * @result \b H3_NOT_EXISTS         The bucket doesn't exist
+ * @result \b H3_INVALID_ARGS       Missing or malformed arguments
+ * @result \b H3_FAILURE            Storage provider error, too few samples or compression is not supported
+ * @result \b H3_NAME_TOO_LONG      Bucket name is longer than H3_BUCKET_NAME_SIZE
+ *
+ */
+H3_Status H3_TrainBucketDictionary(H3_Handle handle, H3_Token token, H3_Name bucketName, size_t dictionarySize){
+    H3_UserId userId;
+    H3_BucketId bucketId;
+    KV_Value value = NULL;
+    size_t size = 0;
+    H3_Status status;
+
+    // Argument check
+    if(!handle || !token  || !bucketName){
+        return H3_INVALID_ARGS;
+    }
+
+    H3_Context* ctx = (H3_Context*)handle;
+    KV_Handle _handle = ctx->handle;
+    KV_Operations* op = ctx->operation;
+    KV_Status kvStatus;
+
+    // Validate bucketName & extract userId from token
+    if( (status = ValidBucketName(op, bucketName)) != H3_SUCCESS){
+        return status;
+    }
+
+    if( !GetUserId(token, userId) || !GetBucketId(bucketName, bucketId)){
+        return H3_INVALID_ARGS;
+    }
+
+    if( !ValidCompression(H3_CODEC_ZSTD, 0) ){
+        return H3_FAILURE;
+    }
+
+    status = H3_FAILURE;
+    if( (kvStatus = ReadMetadata(ctx, bucketId, &value, &size)) == KV_SUCCESS){
+        H3_BucketMetadata* bucketMetadata = (H3_BucketMetadata*)value;
+
+        // Make sure the token grants access to the bucket
+        if( GrantBucketAccess(userId, bucketMetadata) ){
+            KV_Key keyBuffer = calloc(1, KV_LIST_BUFFER_SIZE);
+            KV_Value samples = malloc(H3_DICTIONARY_MAX_SAMPLES * H3_DICTIONARY_SAMPLE_SIZE);
+            size_t* sampleSizes = calloc(H3_DICTIONARY_MAX_SAMPLES, sizeof(size_t));
+            size_t samplesSize = 0;
+            uint32_t i, nSamples = 0, nKeys = H3_DICTIONARY_MAX_SAMPLES;
+
+            // Collect the leading data of the first objects
+            H3_ObjectId prefix;
+            GetObjectId(bucketName, NULL, prefix);
+            if(keyBuffer && samples && sampleSizes && op->list(_handle, prefix, 0, keyBuffer, 0, &nKeys) != KV_FAILURE){
+                char* key = keyBuffer;
+
+                for(i=0; i<nKeys; i++, key += strlen(key) + 1){
+                    KV_Value objValue = NULL;
+                    size_t objSize = 0;
+
+                    if(ReadMetadata(ctx, key, &objValue, &objSize) == KV_SUCCESS){
+                        H3_ObjectMetadata* objMeta = (H3_ObjectMetadata*)objValue;
+                        size_t sampleSize = H3_DICTIONARY_SAMPLE_SIZE;
+
+                        if( !objMeta->isBad && objMeta->nParts &&
+                            ReadData(ctx, objMeta, &samples[samplesSize], &sampleSize, 0, 0) == KV_SUCCESS && sampleSize){
+                            sampleSizes[nSamples++] = sampleSize;
+                            samplesSize += sampleSize;
+                        }
+                        free(objMeta);
+                    }
+                }
+            }
+
+            KV_Value dictionary = NULL;
+            size_t dictSize = dictionarySize?dictionarySize:H3_DICTIONARY_SIZE;
+            uint32_t dictId;
+            if(nSamples && TrainDictionary(samples, sampleSizes, nSamples, &dictionary, &dictSize, &dictId) == KV_SUCCESS){
+                H3_DictionaryId dictionaryId;
+                GetDictionaryId(dictId, dictionaryId);
+
+                // Dictionary ids are derived from their content, thus an existing key holds the very same dictionary
+                if( (kvStatus = op->metadata_create(_handle, dictionaryId, dictionary, dictSize)) == KV_SUCCESS || kvStatus == KV_KEY_EXIST){
+                    if(bucketMetadata->compression.codec != H3_CODEC_ZSTD){
+                        bucketMetadata->compression.codec = H3_CODEC_ZSTD;
+                        bucketMetadata->compression.level = 0;
+                    }
+                    uint32_t previousDictId = bucketMetadata->compression.dictId;
+                    bucketMetadata->compression.dictId = dictId;
+
+                    if(op->metadata_write(_handle, bucketId, (KV_Value)bucketMetadata, size) == KV_SUCCESS){
+                        if(previousDictId && previousDictId != dictId)
+                            DeleteDictionaries(ctx, NULL);
+                        status = H3_SUCCESS;
+                    }
+                }
+                free(dictionary);
+            }
+
+            free(sampleSizes);
+            free(samples);
+            free(keyBuffer);
+        }
+        free(bucketMetadata);
+    }
+    else if(kvStatus == KV_KEY_NOT_EXIST){
+        return H3_NOT_EXISTS;
+    }
+    else if(kvStatus == KV_KEY_TOO_LONG){
+        return H3_NAME_TOO_LONG;
+    }
+
+    return status;
+}
+
+
 /*! \brief Delete all objects of a bucket
+ *
+ * The dictionary the bucket was last trained with is deleted as well, unless still in use, thus objects
+ * created from now on are compressed without one until the bucket is trained again.
  *
  * @param[in]    handle             An h3lib handle
  * @param[in]    token              Authentication information
@@ -578,7 +827,7 @@ H3_Status H3_PurgeBucket(H3_Handle handle, H3_Token token, H3_Name bucketName){
 	}
 
 	status = H3_FAILURE;
-	if( (kvStatus = op->metadata_read(_handle, bucketId, 0, &value, &size)) == KV_SUCCESS){
+	if( (kvStatus = ReadMetadata(ctx, bucketId, &value, &size)) == KV_SUCCESS){
 
 		// Make sure the token grants access to the bucket
 		H3_BucketMetadata* bucketMetadata = (H3_BucketMetadata*)value;
@@ -616,6 +865,15 @@ H3_Status H3_PurgeBucket(H3_Handle handle, H3_Token token, H3_Name bucketName){
 			free(keyBuffer);
 			if(kvStatus == KV_SUCCESS){
 				status = H3_SUCCESS;
+
+				// Dictionaries left to objects by retraining may be unused by now
+				if(!bucketMetadata->compression.dictId)
+					DeleteDictionaries(ctx, NULL);
+				else{
+					bucketMetadata->compression.dictId = 0;
+					if(op->metadata_write(_handle, bucketId, (KV_Value)bucketMetadata, size) == KV_SUCCESS)
+						DeleteDictionaries(ctx, NULL);
+				}
 			}
 			else if(kvStatus == KV_KEY_TOO_LONG)
 				status = H3_NAME_TOO_LONG;
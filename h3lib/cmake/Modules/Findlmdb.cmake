@@ -0,0 +1,35 @@
+#https://gitlab.kitware.com/cmake/community/-/wikis/doc/tutorials/How-To-Find-Libraries
+
+# - Try to find the Lightning Memory-Mapped Database (LMDB)
+# Once done this will define
+#  LMDB_FOUND - System has LMDB
+#  LMDB_INCLUDE_DIR - The LMDB include directory
+#  LMDB_LIBRARIES - The libraries needed to use LMDB
+#  LMDB_DEFINITIONS - Compiler switches required for using LMDB
+
+
+# Use pkg-config to detect include/library paths of lmdb
+find_package(PkgConfig)
+pkg_check_modules(PC_LMDB QUIET lmdb)
+set(LMDB_DEFINITIONS ${PC_LMDB_CFLAGS_OTHER})
+
+
+# Dependencies use plural forms, the package itself uses the singular forms defined by find_path and find_library
+find_path(LMDB_INCLUDE_DIR lmdb.h
+          HINTS ${PC_LMDB_INCLUDEDIR} ${PC_LMDB_INCLUDE_DIRS}
+          PATH_SUFFIXES include )
+
+find_library(LMDB_LIBRARIES lmdb
+             HINTS ${PC_LMDB_LIBDIR} ${PC_LMDB_LIBRARY_DIRS} )
+
+
+# Call the find_package_handle_standard_args() macro to set the _FOUND variable and print a success or failure message
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(lmdb  DEFAULT_MSG LMDB_LIBRARIES LMDB_INCLUDE_DIR)
+
+
+if(LMDB_FOUND)
+	message(STATUS "LMDB found")
+else()
+	message(STATUS "LMDB not found")
+endif()
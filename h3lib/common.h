@@ -44,13 +44,15 @@
 #define REG_NOERROR 0
 #endif
 
-#define H3_PART_SIZE (1048576 * 1) // = 2Mb - Key - 4Kb kreon metadata
 #define H3_CHUNK	 (H3_PART_SIZE * 16)
 #define H3_SYSTEM_ID    0x00
 
 #define H3_BUCKET_BATCH_SIZE   10
 #define H3_PART_BATCH_SIZE   10
 
+#define H3_ACCESS_PERIOD     86400 // Seconds before H3_OpenObjectData() refreshes the access time, as with relatime
+#define H3_METADATA_VERSION  2     // Layout of H3_ObjectMetadata, records written before versioning are converted when read
+
 #define H3_USERID_SIZE      128
 #define H3_MULIPARTID_SIZE  (UUID_STR_LEN + 1)
 
@@ -61,6 +63,7 @@ typedef char H3_ObjectId[H3_BUCKET_NAME_SIZE + H3_OBJECT_NAME_SIZE + 1];
 typedef char H3_UUID[UUID_STR_LEN];
 typedef char H3_PartId[50];                                                 // '_' + UUID[36+1byte] + '#' + <part_number> + ['.' + <subpart_number>]
 typedef char H3_ObjectMetadataId[H3_BUCKET_NAME_SIZE + H3_OBJECT_NAME_SIZE + H3_METADATA_NAME_SIZE + 2]; // bucket_name + '#' + object_name + '#' + metadata_name
+typedef char H3_DictionaryId[12];                                           // '##' + <dictionary_id in hex>
 
 typedef enum {
     H3_STORE_FILESYSTEM = 0,    // Mounted filesystem
@@ -68,6 +71,10 @@ typedef enum {
     H3_STORE_KREON_RDMA,        // Kreon distributed with RDMA
     H3_STORE_ROCKSDB,           // RocksDB server
     H3_STORE_REDIS,             // Redis
+    H3_STORE_LMDB,              // LMDB local
+    H3_STORE_MEMORY,            // Process memory
+    H3_STORE_SPLIT,             // Metadata and data on different stores
+    H3_STORE_CACHE,             // Hot store caching the data of a cold one
     H3_NumOfStores              // Not an option, used for iteration purposes
 } H3_StoreType;
 
@@ -79,10 +86,18 @@ typedef enum {
 
 typedef struct {
     H3_StoreType type;
+    H3_StoreType dataType;      // The store holding the data parts, differs from the above for split and cache stores
 
     // Store specific
     KV_Handle handle;
     KV_Operations* operation;
+
+    // Compression dictionaries loaded so far
+    GHashTable* dictionaries;
+    GMutex dictionaryLock;
+
+    // Sequential read detection and prefetching
+    struct H3_ReadAhead* readAhead;
 }H3_Context;
 
 typedef struct{
@@ -90,19 +105,29 @@ typedef struct{
     H3_BucketId bucket[];
 }H3_UserMetadata;
 
+typedef struct{
+    uint8_t codec;      // H3_Codec
+    int32_t level;
+    uint32_t dictId;    // Trained dictionary, 0x00 if none
+}H3_Compression;
+
 typedef struct{
     H3_UserId userId;
     struct timespec creation;
+    H3_Compression compression;             // Applied to objects created from now on
 }H3_BucketMetadata;
 
 typedef struct{
     uint number;
     int subNumber;
-    size_t size;
+    size_t size;   // Raw size of the part data
     off_t offset;  // For multipart uploads, the offset is set when the upload completes
+    uint8_t codec;          // H3_CODEC_NONE if stored as is, otherwise the part holds a compressed frame
+    uint32_t storedSize;    // Size of the compressed frame
 }H3_PartMetadata;
 
 typedef struct{
+    uint8_t version;                        // H3_METADATA_VERSION, must remain the first field
     char isBad;
     H3_UserId userId;
     uuid_t uuid;
@@ -114,6 +139,7 @@ typedef struct{
     mode_t mode;
     uid_t uid;
     gid_t gid;
+    H3_Compression compression;             // Inherited from the bucket upon creation
     uint nParts;
     H3_PartMetadata part[];
 }H3_ObjectMetadata;
@@ -124,6 +150,10 @@ typedef struct{
 }H3_MultipartMetadata;
 
 
+H3_StoreType H3_String2Type(const char* type);
+KV_Operations* GetOperations(H3_StoreType storageType);
+H3_StoreType GetSplitDataType(const char* storageUri);
+H3_StoreType GetCacheDataType(const char* storageUri);
 H3_Status ValidBucketName(KV_Operations* op,char* name);
 H3_Status ValidObjectName(KV_Operations* op,char* name);
 H3_Status ValidMetadataName(KV_Operations* op,char* name);
@@ -134,6 +164,7 @@ int GetBucketIndex(H3_UserMetadata* userMetadata, H3_Name bucketName);
 void GetObjectId(H3_Name bucketName, H3_Name objectName, H3_ObjectId id);
 void GetMultipartObjectId(H3_Name bucketName, H3_Name objectName, H3_ObjectId id);
 void GetObjectMetadataId(H3_ObjectMetadataId metadataId, H3_Name bucketName, H3_Name objectName, H3_Name metadataName);
+void GetDictionaryId(uint32_t dictId, H3_DictionaryId id);
 char* GetBucketFromId(H3_ObjectId objId, H3_BucketId bucketId);
 void GetBucketAndObjectFromId(H3_Name* bucketName, H3_Name* objectName, H3_ObjectId id);
 void InitMode(H3_ObjectMetadata* objMeta);
@@ -143,11 +174,17 @@ void CreatePartId(H3_PartId partId, uuid_t uuid, int partNumber, int subPartNumb
 char* PartToId(H3_PartId partId, uuid_t uuid, H3_PartMetadata* part);
 int GrantBucketAccess(H3_UserId id, H3_BucketMetadata* meta);
 int GrantObjectAccess(H3_UserId id, H3_ObjectMetadata* meta);
+void FillObjectInfo(H3_ObjectMetadata* objMeta, H3_ObjectInfo* objectInfo);
 int GrantMultipartAccess(H3_UserId id, H3_MultipartMetadata* meta);
 char* ConvertToOdrinary(H3_ObjectId id);
 H3_Status DeleteObject(H3_Context* ctx, H3_UserId userId, H3_ObjectId objId, char truncate);
+KV_Status ReadPart(H3_Context* ctx, H3_PartMetadata* part, H3_PartId partId, KV_Value value, off_t inPartOffset, size_t size);
+KV_Status WritePart(H3_Context* ctx, H3_ObjectMetadata* meta, H3_PartMetadata* part, H3_PartId partId, KV_Value value, off_t inPartOffset, size_t size);
 KV_Status WriteData(H3_Context* ctx, H3_ObjectMetadata* meta, KV_Value value, size_t size, off_t offset);
-KV_Status ReadData(H3_Context* ctx, H3_ObjectMetadata* meta, KV_Value value, size_t* size, off_t offset);
+KV_Status ReadData(H3_Context* ctx, H3_ObjectMetadata* meta, KV_Value value, size_t* size, off_t offset, char readAhead);
+KV_Status UpgradeMetadata(KV_Key key, KV_Value* value, size_t* size);
+KV_Status ReadMetadata(H3_Context* ctx, KV_Key key, KV_Value* value, size_t* size);
+KV_Status ListMetadata(H3_Context* ctx, KV_Key prefix, uint8_t nTrim, KV_Key buffer, uint32_t offset, uint32_t* nKeys, KV_ListCallback function, void* userData);
 KV_Status CopyData(H3_Context* ctx, H3_UserId userId, H3_ObjectId srcObjId, H3_ObjectId dstObjId, off_t srcOffset, size_t* size, uint8_t noOverwrite, off_t dstOffset);
 H3_Status PurgeObjectMetadata(H3_Context* ctx, H3_UserId userId, H3_Name bucketName, H3_Name objectName);
 H3_Status CopyOrMoveObjectMetadata(H3_Context* ctx, H3_UserId userId, H3_Name bucketName, H3_Name srcObjectName, H3_Name dstObjectName, char move);
\ No newline at end of file
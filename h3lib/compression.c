@@ -0,0 +1,344 @@
+// Copyright [2019] [FORTH-ICS]
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "common.h"
+#include "util.h"
+#include "compression.h"
+
+#ifdef H3LIB_USE_COMPRESSION
+#include <lz4.h>
+#include <zstd.h>
+#include <zdict.h>
+#endif
+
+#define H3_MIN_RAW_SIZE     128     // Values smaller than this are never compressed
+#define H3_SAMPLE_SIZE      4096    // Size of each sample used to assess compressibility
+#define H3_SAMPLE_COUNT     4       // Number of samples taken across a value
+#define H3_MIN_GAIN         8       // Compressed data must save at least 1/H3_MIN_GAIN of the raw size
+
+#ifdef H3LIB_USE_COMPRESSION
+
+/*
+ * Dictionaries are digested once when loaded and shared by all threads using
+ * the handle. The compression dictionary is digested for the default level,
+ * other levels fall back to loading the raw dictionary per call.
+ */
+struct H3_Dictionary{
+    uint32_t id;
+    KV_Value buffer;
+    size_t size;
+    ZSTD_CDict* cdict;
+    ZSTD_DDict* ddict;
+};
+
+static void FreeDictionary(H3_Dictionary* dictionary){
+    ZSTD_freeCDict(dictionary->cdict);
+    ZSTD_freeDDict(dictionary->ddict);
+    free(dictionary->buffer);
+    free(dictionary);
+}
+
+#endif
+
+void InitDictionaries(H3_Context* ctx){
+#ifdef H3LIB_USE_COMPRESSION
+    ctx->dictionaries = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify)FreeDictionary);
+#else
+    ctx->dictionaries = g_hash_table_new(g_direct_hash, g_direct_equal);
+#endif
+    g_mutex_init(&ctx->dictionaryLock);
+}
+
+void FreeDictionaries(H3_Context* ctx){
+    g_hash_table_destroy(ctx->dictionaries);
+    g_mutex_clear(&ctx->dictionaryLock);
+}
+
+// Retrieve a dictionary from the handle's cache, loading it from the store on first use
+H3_Dictionary* GetDictionary(H3_Context* ctx, uint32_t dictId){
+    H3_Dictionary* dictionary = NULL;
+
+#ifdef H3LIB_USE_COMPRESSION
+    g_mutex_lock(&ctx->dictionaryLock);
+    if( !(dictionary = g_hash_table_lookup(ctx->dictionaries, GUINT_TO_POINTER(dictId))) ){
+        H3_DictionaryId dictionaryId;
+        KV_Value value = NULL;
+        size_t size = 0;
+
+        GetDictionaryId(dictId, dictionaryId);
+        if(ctx->operation->metadata_read(ctx->handle, dictionaryId, 0, &value, &size) == KV_SUCCESS){
+            if( (dictionary = calloc(1, sizeof(H3_Dictionary))) ){
+                dictionary->id = dictId;
+                dictionary->buffer = value;
+                dictionary->size = size;
+                dictionary->cdict = ZSTD_createCDict(value, size, ZSTD_CLEVEL_DEFAULT);
+                dictionary->ddict = ZSTD_createDDict(value, size);
+
+                if(dictionary->cdict && dictionary->ddict){
+                    g_hash_table_insert(ctx->dictionaries, GUINT_TO_POINTER(dictId), dictionary);
+                }
+                else {
+                    FreeDictionary(dictionary);
+                    dictionary = NULL;
+                }
+            }
+            else
+                free(value);
+        }
+        else
+            LogActivity(H3_ERROR_MSG, "Failed to load dictionary %08x\n", dictId);
+    }
+    g_mutex_unlock(&ctx->dictionaryLock);
+#endif
+
+    return dictionary;
+}
+
+
+int ValidCompression(H3_Codec codec, int level){
+    switch(codec){
+        case H3_CODEC_NONE:
+            return 1;
+
+#ifdef H3LIB_USE_COMPRESSION
+        case H3_CODEC_LZ4:
+            return level == 0;
+
+        case H3_CODEC_ZSTD:
+            return level == 0 || (ZSTD_minCLevel() <= level && level <= ZSTD_maxCLevel());
+#endif
+
+        default:
+            return 0;
+    }
+}
+
+#ifdef H3LIB_USE_COMPRESSION
+
+static size_t CompressBound(uint8_t codec, size_t size){
+    switch(codec){
+        case H3_CODEC_LZ4:  return LZ4_compressBound(size);
+        case H3_CODEC_ZSTD: return ZSTD_compressBound(size);
+        default:            return 0;
+    }
+}
+
+// Returns the size of the compressed data, 0 on failure
+static size_t Compress(uint8_t codec, int level, H3_Dictionary* dictionary, KV_Value dst, size_t dstCapacity, KV_Value src, size_t srcSize){
+    ZSTD_CCtx* cctx;
+    size_t size = 0;
+
+    switch(codec){
+        case H3_CODEC_LZ4:
+            size = LZ4_compress_default((const char*)src, (char*)dst, srcSize, dstCapacity);
+            break;
+
+        case H3_CODEC_ZSTD:
+            if(!dictionary){
+                size = ZSTD_compress(dst, dstCapacity, src, srcSize, level);
+            }
+            else if( (cctx = ZSTD_createCCtx()) ){
+                if(level == 0 || level == ZSTD_CLEVEL_DEFAULT)
+                    size = ZSTD_compress_usingCDict(cctx, dst, dstCapacity, src, srcSize, dictionary->cdict);
+                else
+                    size = ZSTD_compress_usingDict(cctx, dst, dstCapacity, src, srcSize, dictionary->buffer, dictionary->size, level);
+                ZSTD_freeCCtx(cctx);
+            }
+
+            if(ZSTD_isError(size)){
+                LogActivity(H3_ERROR_MSG, "Zstandard - %s\n", ZSTD_getErrorName(size));
+                size = 0;
+            }
+            break;
+    }
+
+    return size;
+}
+
+// Compress a few evenly spread samples with the cheapest codec to decide whether the whole value is worth the effort.
+static int IsCompressible(KV_Value value, size_t size){
+    if(size <= H3_SAMPLE_SIZE * H3_SAMPLE_COUNT)
+        return 1;
+
+    char buffer[LZ4_COMPRESSBOUND(H3_SAMPLE_SIZE)];
+    size_t stride = size / H3_SAMPLE_COUNT, compressed = 0;
+    int i;
+
+    for(i=0; i<H3_SAMPLE_COUNT; i++){
+        int sampleSize = LZ4_compress_default((const char*)&value[i * stride], buffer, H3_SAMPLE_SIZE, sizeof(buffer));
+        compressed += sampleSize?sampleSize:H3_SAMPLE_SIZE;
+    }
+
+    return compressed * H3_MIN_GAIN <= (H3_SAMPLE_SIZE * H3_SAMPLE_COUNT) * (H3_MIN_GAIN - 1);
+}
+
+#endif
+
+/*
+ * Returns the codec actually applied. If H3_CODEC_NONE, the value is deemed not worth
+ * compressing (or compression failed) and should be stored as is; no frame is allocated.
+ * Otherwise the frame is allocated here and the caller is expected to release it.
+ */
+uint8_t CompressPart(H3_Compression* compression, H3_Dictionary* dictionary, KV_Value value, size_t size, KV_Value* frame, size_t* frameSize){
+#ifdef H3LIB_USE_COMPRESSION
+    uint8_t codec = compression->codec;
+
+    // Only Zstandard makes use of trained dictionaries
+    if(codec != H3_CODEC_ZSTD)
+        dictionary = NULL;
+
+    if(codec == H3_CODEC_NONE || size < H3_MIN_RAW_SIZE || size > UINT32_MAX || !IsCompressible(value, size))
+        return H3_CODEC_NONE;
+
+    size_t capacity = CompressBound(codec, size);
+    KV_Value buffer = malloc(sizeof(H3_FrameHeader) + capacity);
+    if(!buffer)
+        return H3_CODEC_NONE;
+
+    size_t payloadSize = Compress(codec, compression->level, dictionary, &buffer[sizeof(H3_FrameHeader)], capacity, value, size);
+    if(!payloadSize || payloadSize * H3_MIN_GAIN > size * (H3_MIN_GAIN - 1)){
+        free(buffer);
+        return H3_CODEC_NONE;
+    }
+
+    H3_FrameHeader* header = (H3_FrameHeader*)buffer;
+    memset(header, 0, sizeof(H3_FrameHeader));
+    header->magic = H3_FRAME_MAGIC;
+    header->codec = codec;
+    header->dictId = dictionary?dictionary->id:0;
+    header->rawSize = size;
+    header->payloadSize = payloadSize;
+
+    *frame = buffer;
+    *frameSize = sizeof(H3_FrameHeader) + payloadSize;
+    return codec;
+#else
+    return H3_CODEC_NONE;
+#endif
+}
+
+/*
+ * Decode a frame into a caller supplied buffer. Argument "size" is in/out, i.e. the
+ * caller sets it with the buffer capacity and it is set to the raw size of the part.
+ */
+KV_Status DecompressPart(KV_Value frame, size_t frameSize, H3_Dictionary* dictionary, KV_Value value, size_t* size){
+    H3_FrameHeader* header = (H3_FrameHeader*)frame;
+
+    if(frameSize < sizeof(H3_FrameHeader) || header->magic != H3_FRAME_MAGIC ||
+       header->payloadSize > frameSize - sizeof(H3_FrameHeader) || header->rawSize > *size){
+        LogActivity(H3_ERROR_MSG, "Malformed frame\n");
+        return KV_FAILURE;
+    }
+
+#ifdef H3LIB_USE_COMPRESSION
+    KV_Value payload = &frame[sizeof(H3_FrameHeader)];
+    ZSTD_DCtx* dctx;
+    size_t rawSize = 0;
+    int lz4Size;
+
+    if(header->dictId && (!dictionary || dictionary->id != header->dictId)){
+        LogActivity(H3_ERROR_MSG, "Dictionary %08x is not available\n", header->dictId);
+        return KV_FAILURE;
+    }
+
+    switch(header->codec){
+        case H3_CODEC_LZ4:
+            lz4Size = LZ4_decompress_safe((const char*)payload, (char*)value, header->payloadSize, header->rawSize);
+            rawSize = lz4Size < 0?0:lz4Size;
+            break;
+
+        case H3_CODEC_ZSTD:
+            if(!header->dictId){
+                rawSize = ZSTD_decompress(value, header->rawSize, payload, header->payloadSize);
+            }
+            else if( (dctx = ZSTD_createDCtx()) ){
+                rawSize = ZSTD_decompress_usingDDict(dctx, value, header->rawSize, payload, header->payloadSize, dictionary->ddict);
+                ZSTD_freeDCtx(dctx);
+            }
+
+            if(ZSTD_isError(rawSize))
+                rawSize = 0;
+            break;
+    }
+
+    if(rawSize != header->rawSize){
+        LogActivity(H3_ERROR_MSG, "Failed to decompress frame of codec %d\n", header->codec);
+        return KV_FAILURE;
+    }
+
+    *size = rawSize;
+    return KV_SUCCESS;
+#else
+    LogActivity(H3_ERROR_MSG, "Frame of codec %d found but compression support is not built in\n", header->codec);
+    return KV_FAILURE;
+#endif
+}
+
+/*
+ * Earlier versions built with compression support had the Redis and Kreon RDMA drivers keep every
+ * value as a bare Zstandard frame. Returns the decoded value if the argument is exactly one such
+ * frame of known size, NULL otherwise. The value is allocated here and should be released by the caller.
+ */
+KV_Value DecodeLegacyFrame(KV_Value frame, size_t frameSize, size_t* size){
+#ifdef H3LIB_USE_COMPRESSION
+    unsigned long long rawSize;
+    KV_Value value;
+
+    if(frameSize < sizeof(uint32_t) || *(uint32_t*)frame != ZSTD_MAGICNUMBER ||
+       ZSTD_findFrameCompressedSize(frame, frameSize) != frameSize ||
+       (rawSize = ZSTD_getFrameContentSize(frame, frameSize)) == ZSTD_CONTENTSIZE_ERROR || rawSize == ZSTD_CONTENTSIZE_UNKNOWN)
+        return NULL;
+
+    // Empty values are still allocated, as drivers do
+    if( (value = malloc(rawSize?rawSize:1)) ){
+        size_t decoded = ZSTD_decompress(value, rawSize, frame, frameSize);
+        if(ZSTD_isError(decoded) || decoded != rawSize){
+            free(value);
+            return NULL;
+        }
+        *size = rawSize;
+    }
+
+    return value;
+#else
+    return NULL;
+#endif
+}
+
+/*
+ * Train a Zstandard dictionary from samples placed back to back in a buffer. Argument
+ * "size" is in/out, i.e. the caller sets it with the max dictionary size and it is set
+ * to the actual size. The dictionary is allocated here and should be released by the caller.
+ */
+KV_Status TrainDictionary(KV_Value samples, size_t* sampleSizes, uint32_t nSamples, KV_Value* dictionary, size_t* size, uint32_t* dictId){
+#ifdef H3LIB_USE_COMPRESSION
+    KV_Value buffer = malloc(*size);
+    if(!buffer)
+        return KV_FAILURE;
+
+    size_t dictSize = ZDICT_trainFromBuffer(buffer, *size, samples, sampleSizes, nSamples);
+    if(ZDICT_isError(dictSize)){
+        LogActivity(H3_ERROR_MSG, "Zstandard - %s\n", ZDICT_getErrorName(dictSize));
+        free(buffer);
+        return KV_FAILURE;
+    }
+
+    *dictionary = buffer;
+    *size = dictSize;
+    *dictId = ZDICT_getDictID(buffer, dictSize);
+    return KV_SUCCESS;
+#else
+    return KV_FAILURE;
+#endif
+}
@@ -0,0 +1,52 @@
+// Copyright [2019] [FORTH-ICS]
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COMPRESSION_H_
+#define COMPRESSION_H_
+
+#include <stdint.h>
+
+#define H3_FRAME_MAGIC      0x46433348  // "H3CF" in little endian
+
+#define H3_DICTIONARY_SIZE          (112 * 1024)    // Default size of trained dictionaries
+#define H3_DICTIONARY_SAMPLE_SIZE   (16 * 1024)     // Max data taken from each object while training
+#define H3_DICTIONARY_MAX_SAMPLES   1024            // Max number of objects sampled while training
+
+/*
+ * Compressed parts are stored as self-describing frames, i.e. a fixed header
+ * followed by the codec's payload. The raw size is kept in the header so that
+ * parts can be decoded without consulting the object metadata. Frames compressed
+ * with a trained dictionary carry its id, otherwise it is 0x00.
+ */
+typedef struct{
+    uint32_t magic;
+    uint8_t codec;
+    uint8_t reserved[3];
+    uint32_t dictId;
+    uint32_t rawSize;
+    uint32_t payloadSize;
+}H3_FrameHeader;
+
+typedef struct H3_Dictionary H3_Dictionary;
+
+int ValidCompression(H3_Codec codec, int level);
+uint8_t CompressPart(H3_Compression* compression, H3_Dictionary* dictionary, KV_Value value, size_t size, KV_Value* frame, size_t* frameSize);
+KV_Status DecompressPart(KV_Value frame, size_t frameSize, H3_Dictionary* dictionary, KV_Value value, size_t* size);
+KV_Value DecodeLegacyFrame(KV_Value frame, size_t frameSize, size_t* size);
+KV_Status TrainDictionary(KV_Value samples, size_t* sampleSizes, uint32_t nSamples, KV_Value* dictionary, size_t* size, uint32_t* dictId);
+H3_Dictionary* GetDictionary(H3_Context* ctx, uint32_t dictId);
+void InitDictionaries(H3_Context* ctx);
+void FreeDictionaries(H3_Context* ctx);
+
+#endif /* COMPRESSION_H_ */
@@ -15,8 +15,13 @@
 #include "common.h"
 #include "util.h"
 #include "url_parser.h"
+#include "compression.h"
+#include "readahead.h"
 
 extern KV_Operations operationsFilesystem;
+extern KV_Operations operationsMemory;
+extern KV_Operations operationsSplit;
+extern KV_Operations operationsCache;
 
 #ifdef H3LIB_USE_REDIS
 extern KV_Operations operationsRedis;
@@ -34,6 +39,10 @@ extern KV_Operations operationsKreonRDMA;
 extern KV_Operations operationsRocksDB;
 #endif
 
+#ifdef H3LIB_USE_LMDB
+extern KV_Operations operationsLMDB;
+#endif
+
 /*
     http://man7.org/linux/man-pages/man2/umask.2.html
     http://man7.org/linux/man-pages/man2/chmod.2.html
@@ -91,6 +100,11 @@ void GetObjectMetadataId(H3_ObjectMetadataId metadataId, H3_Name bucketName, H3_
         snprintf(metadataId, sizeof(H3_ObjectMetadataId), "%s#", bucketName);
 }
 
+// Dictionaries are named after their id, so that parts can locate them regardless of the bucket
+void GetDictionaryId(uint32_t dictId, H3_DictionaryId id){
+    snprintf(id, sizeof(H3_DictionaryId), "##%08x", dictId);
+}
+
 H3_Name GenerateDummyObjectName() {
     uuid_t uuid;
     H3_UUID uuidString;
@@ -146,7 +160,7 @@ void GetBucketAndObjectFromId(H3_Name* bucketName, H3_Name* objectName, H3_Objec
     if (marker) {
         size_t bucketNameSize = (size_t)(marker - id);
 
-        *bucketName = (H3_Name)calloc(1, bucketNameSize);
+        *bucketName = (H3_Name)calloc(1, bucketNameSize + 1);
         memcpy(*bucketName, id, bucketNameSize);
 
         *objectName = (H3_Name)calloc(1, H3_OBJECT_NAME_SIZE);
@@ -176,13 +190,17 @@ H3_StoreType H3_String2Type(const char* type){
         else if(strcmp(type, "kreon-rdma") == 0)     store = H3_STORE_KREON_RDMA;
         else if(strcmp(type, "rocksdb") == 0)        store = H3_STORE_ROCKSDB;
         else if(strcmp(type, "redis") == 0)          store = H3_STORE_REDIS;
+        else if(strcmp(type, "lmdb") == 0)           store = H3_STORE_LMDB;
+        else if(strcmp(type, "mem") == 0)            store = H3_STORE_MEMORY;
+        else if(strcmp(type, "split") == 0)          store = H3_STORE_SPLIT;
+        else if(strcmp(type, "cache") == 0)          store = H3_STORE_CACHE;
     }
 
     return store;
 }
 
 
-const char* const StoreType[] = {"file", "kreon", "kreon-rdma", "rocksdb", "redis", "unknown"};
+const char* const StoreType[] = {"file", "kreon", "kreon-rdma", "rocksdb", "redis", "lmdb", "mem", "split", "cache", "unknown"};
 const char* H3_Type2String(H3_StoreType type){
 	const char* string;
 
@@ -252,82 +270,251 @@ int GrantMultipartAccess(H3_UserId id, H3_MultipartMetadata* meta){
     return !strncmp(id, meta->userId, sizeof(H3_UserId));
 }
 
-/*! Initialize library
- * @param[in] storageUri    The storage provider URI to be used with this instance
- * @result  The handle if connected to provider, NULL otherwise.
+/*
+ * Layout of object metadata records written before compression was introduced, i.e.
+ * without a version, compression settings and per part codec.
  */
-H3_Handle H3_Init(const char* storageUri) {
-    struct parsed_url *url = parse_url(storageUri);
-    if (url == NULL) {
-        LogActivity(H3_ERROR_MSG, "ERROR: Unrecognized storage URI\n");
-        return NULL;
+typedef struct{
+    uint number;
+    int subNumber;
+    size_t size;
+    off_t offset;
+}H3_PartMetadataV1;
+
+typedef struct{
+    char isBad;
+    H3_UserId userId;
+    uuid_t uuid;
+    struct timespec creation;
+    struct timespec lastAccess;
+    struct timespec lastModification;
+    struct timespec lastChange;
+    char readOnly;
+    mode_t mode;
+    uid_t uid;
+    gid_t gid;
+    uint nParts;
+    H3_PartMetadataV1 part[];
+}H3_ObjectMetadataV1;
+
+static KV_Status UpgradeObjectMetadata(KV_Value* value, size_t* size){
+    H3_ObjectMetadataV1* legacy = (H3_ObjectMetadataV1*)*value;
+
+    if(*size && ((H3_ObjectMetadata*)*value)->version == H3_METADATA_VERSION)
+        return KV_SUCCESS;
+
+    // Legacy records start with the "isBad" flag, i.e. 0x00 or 0x01
+    if(*size < sizeof(H3_ObjectMetadataV1) || (legacy->isBad != 0 && legacy->isBad != 1)){
+        LogActivity(H3_ERROR_MSG, "Unknown object metadata layout\n");
+        return KV_FAILURE;
     }
-    H3_StoreType storageType = H3_String2Type(url->scheme);
-    parsed_url_free(url);
 
-    H3_Context* ctx = malloc(sizeof(H3_Context));
+    // Retain the capacity of the record, it is grown in batches of parts
+    uint capacity = (*size - sizeof(H3_ObjectMetadataV1)) / sizeof(H3_PartMetadataV1);
+    if(legacy->nParts > capacity){
+        LogActivity(H3_ERROR_MSG, "Truncated object metadata\n");
+        return KV_FAILURE;
+    }
 
-    if(ctx){
-		switch(storageType){
-			case H3_STORE_FILESYSTEM:
-				LogActivity(H3_INFO_MSG, "Using kv_fs driver...\n");
-				ctx->operation = &operationsFilesystem;
-				break;
+    size_t newSize = sizeof(H3_ObjectMetadata) + capacity * sizeof(H3_PartMetadata);
+    H3_ObjectMetadata* objMeta = calloc(1, newSize);
+    if(!objMeta)
+        return KV_FAILURE;
+
+    objMeta->version = H3_METADATA_VERSION;
+    objMeta->isBad = legacy->isBad;
+    memcpy(objMeta->userId, legacy->userId, sizeof(H3_UserId));
+    uuid_copy(objMeta->uuid, legacy->uuid);
+    objMeta->creation = legacy->creation;
+    objMeta->lastAccess = legacy->lastAccess;
+    objMeta->lastModification = legacy->lastModification;
+    objMeta->lastChange = legacy->lastChange;
+    objMeta->readOnly = legacy->readOnly;
+    objMeta->mode = legacy->mode;
+    objMeta->uid = legacy->uid;
+    objMeta->gid = legacy->gid;
+    objMeta->nParts = legacy->nParts;
+
+    uint i;
+    for(i=0; i<legacy->nParts; i++){
+        objMeta->part[i].number = legacy->part[i].number;
+        objMeta->part[i].subNumber = legacy->part[i].subNumber;
+        objMeta->part[i].size = legacy->part[i].size;
+        objMeta->part[i].offset = legacy->part[i].offset;
+    }
+
+    free(*value);
+    *value = (KV_Value)objMeta;
+    *size = newSize;
+    return KV_SUCCESS;
+}
+
+/*
+ * Bring metadata records written by earlier versions to the current layout, the record type is
+ * derived from the key. Bucket records gained trailing fields thus shorter ones are zero-extended,
+ * i.e. no compression. Object records are versioned. The value may be reallocated, the stored
+ * record is left intact until next written.
+ */
+KV_Status UpgradeMetadata(KV_Key key, KV_Value* value, size_t* size){
+    char* separator;
+
+    // Bucket, as opposed to dictionary
+    if(key[0] == '#' && key[1] != '#'){
+        if(*size < sizeof(H3_BucketMetadata)){
+            KV_Value bucketMeta = ReAllocFreeOnFail(*value, sizeof(H3_BucketMetadata));
+            if(!bucketMeta){
+                *value = NULL;
+                return KV_FAILURE;
+            }
+
+            memset(&bucketMeta[*size], 0, sizeof(H3_BucketMetadata) - *size);
+            *value = bucketMeta;
+            *size = sizeof(H3_BucketMetadata);
+        }
+        return KV_SUCCESS;
+    }
+
+    // Objects and multipart objects, as opposed to users, multipart Ids and user metadata
+    if(key[0] != '@' && (separator = strpbrk(key, "/#$")) && *separator != '#' && separator[1] != '\0')
+        return UpgradeObjectMetadata(value, size);
+
+    return KV_SUCCESS;
+}
+
+/*
+ * Read a metadata record in the current layout, see UpgradeMetadata()
+ */
+KV_Status ReadMetadata(H3_Context* ctx, KV_Key key, KV_Value* value, size_t* size){
+    KV_Status status;
+
+    if( (status = ctx->operation->metadata_read(ctx->handle, key, 0, value, size)) == KV_SUCCESS &&
+        (status = UpgradeMetadata(key, value, size)) != KV_SUCCESS ){
+        free(*value);
+        *value = NULL;
+    }
 
-			case H3_STORE_ROCKSDB:
+    return status;
+}
+
+/*
+ * Returns the driver of a type of store, NULL if unknown or not built
+ */
+KV_Operations* GetOperations(H3_StoreType storageType){
+    KV_Operations* operation = NULL;
+
+	switch(storageType){
+		case H3_STORE_FILESYSTEM:
+			LogActivity(H3_INFO_MSG, "Using kv_fs driver...\n");
+			operation = &operationsFilesystem;
+			break;
+
+		case H3_STORE_ROCKSDB:
 #ifdef H3LIB_USE_ROCKSDB
-				LogActivity(H3_INFO_MSG, "Using kv_rocksdb driver...\n");
-				ctx->operation = &operationsRocksDB;
+			LogActivity(H3_INFO_MSG, "Using kv_rocksdb driver...\n");
+			operation = &operationsRocksDB;
 #else
-				LogActivity(H3_INFO_MSG, "WARNING: Driver not available...\n");
-				ctx->operation = NULL;
+			LogActivity(H3_INFO_MSG, "WARNING: Driver not available...\n");
+			operation = NULL;
 #endif
-				break;
+			break;
 
-			case H3_STORE_KREON:
+		case H3_STORE_KREON:
 #ifdef H3LIB_USE_KREON
-				LogActivity(H3_INFO_MSG, "Using kv_kreon driver...\n");
-				ctx->operation = &operationsKreon;
+			LogActivity(H3_INFO_MSG, "Using kv_kreon driver...\n");
+			operation = &operationsKreon;
 #else
-				LogActivity(H3_INFO_MSG, "WARNING: Driver not available...\n");
-				ctx->operation = NULL;
+			LogActivity(H3_INFO_MSG, "WARNING: Driver not available...\n");
+			operation = NULL;
 #endif
-				break;
+			break;
 
-            case H3_STORE_KREON_RDMA:
+        case H3_STORE_KREON_RDMA:
 #ifdef H3LIB_USE_KREON_RDMA
-                LogActivity(H3_INFO_MSG, "Using kv_kreon_rdma driver...\n");
-                ctx->operation = &operationsKreonRDMA;
+            LogActivity(H3_INFO_MSG, "Using kv_kreon_rdma driver...\n");
+            operation = &operationsKreonRDMA;
 #else
-                LogActivity(H3_INFO_MSG, "WARNING: Driver not available...\n");
-                ctx->operation = NULL;
+            LogActivity(H3_INFO_MSG, "WARNING: Driver not available...\n");
+            operation = NULL;
 #endif
-                break;
+            break;
 
-            case H3_STORE_REDIS:
+        case H3_STORE_REDIS:
 #ifdef H3LIB_USE_REDIS
-                LogActivity(H3_INFO_MSG, "Using kv_redis driver...\n");
-                ctx->operation = &operationsRedis;
-                break;
+            LogActivity(H3_INFO_MSG, "Using kv_redis driver...\n");
+            operation = &operationsRedis;
 #else
-                LogActivity(H3_INFO_MSG, "WARNING: Driver not available...\n");
-                ctx->operation = NULL;
+            LogActivity(H3_INFO_MSG, "WARNING: Driver not available...\n");
+            operation = NULL;
 #endif
+            break;
 
-			default:
-				LogActivity(H3_ERROR_MSG, "ERROR: Driver not recognized\n");
-				ctx->operation = NULL;
-				return NULL;
-		}
+        case H3_STORE_LMDB:
+#ifdef H3LIB_USE_LMDB
+            LogActivity(H3_INFO_MSG, "Using kv_lmdb driver...\n");
+            operation = &operationsLMDB;
+#else
+            LogActivity(H3_INFO_MSG, "WARNING: Driver not available...\n");
+            operation = NULL;
+#endif
+            break;
+
+        case H3_STORE_MEMORY:
+            LogActivity(H3_INFO_MSG, "Using kv_mem driver...\n");
+            operation = &operationsMemory;
+            break;
+
+        case H3_STORE_SPLIT:
+            LogActivity(H3_INFO_MSG, "Using kv_split driver...\n");
+            operation = &operationsSplit;
+            break;
+
+        case H3_STORE_CACHE:
+            LogActivity(H3_INFO_MSG, "Using kv_cache driver...\n");
+            operation = &operationsCache;
+            break;
+
+		default:
+			LogActivity(H3_ERROR_MSG, "ERROR: Driver not recognized\n");
+			operation = NULL;
+	}
+
+    return operation;
+}
 
+/*! Initialize library
+ * @param[in] storageUri    The storage provider URI to be used with this instance
+ * @result  The handle if connected to provider, NULL otherwise.
+ */
+H3_Handle H3_Init(const char* storageUri) {
+    struct parsed_url *url = parse_url(storageUri);
+    if (url == NULL) {
+        LogActivity(H3_ERROR_MSG, "ERROR: Unrecognized storage URI\n");
+        return NULL;
+    }
+    H3_StoreType storageType = H3_String2Type(url->scheme);
+    parsed_url_free(url);
+
+    H3_Context* ctx = malloc(sizeof(H3_Context));
+
+    if(ctx){
+		ctx->operation = GetOperations(storageType);
 
 		if(!ctx->operation || !(ctx->handle = ctx->operation->init(storageUri))){
 			free(ctx);
 			ctx = NULL;
 			LogActivity(H3_ERROR_MSG, "ERROR: Failed to initialize storage\n");
 		}
-		else
+		else {
 			ctx->type = storageType;
+			if(storageType == H3_STORE_SPLIT)
+				ctx->dataType = GetSplitDataType(storageUri);
+			else if(storageType == H3_STORE_CACHE)
+				ctx->dataType = GetCacheDataType(storageUri);
+			else
+				ctx->dataType = storageType;
+			InitDictionaries(ctx);
+			ctx->readAhead = InitReadAhead(ctx);
+		}
     }
 
     return (H3_Handle)ctx;
@@ -341,7 +528,9 @@ H3_Handle H3_Init(const char* storageUri) {
  */
 void H3_Free(H3_Handle handle){
     H3_Context* ctx = (H3_Context*)handle;
+    FreeReadAhead(ctx->readAhead);
     ctx->operation->free(ctx->handle);
+    FreeDictionaries(ctx);
     free(ctx);
 };
 
@@ -30,6 +30,7 @@
 #define H3_BUCKET_NAME_SIZE    64   //!< Maximum number of characters allowed for a bucket
 #define H3_OBJECT_NAME_SIZE    512  //!< Maximum number of characters allowed for an object
 #define H3_METADATA_NAME_SIZE  64   //!< Maximum number of characters allowed for an object's metadata name
+#define H3_PART_SIZE           (1048576 * 1)    //!< Maximum size of a data part, writes of whole parts are the most efficient
 /** @}*/
 
 
@@ -65,9 +66,18 @@ typedef enum {
     H3_ATTRIBUTE_PERMISSIONS = 0,   //!< Permissions attribute
     H3_ATTRIBUTE_OWNER,             //!< Owner attributes
     H3_ATTRIBUTE_READ_ONLY,         //!< Read only attribute
+    H3_ATTRIBUTE_COMPRESSION,       //!< Compression of object data (buckets only)
     H3_NumOfAttributes              //!< Not an option, used for iteration purposes
 }H3_AttributeType;
 
+/*! \brief Compression codecs applicable to object data */
+typedef enum {
+    H3_CODEC_NONE = 0,              //!< Data are stored as is
+    H3_CODEC_LZ4,                   //!< LZ4, favors speed over ratio
+    H3_CODEC_ZSTD,                  //!< Zstandard, with a selectable level
+    H3_NumOfCodecs                  //!< Not an option, used for iteration purposes
+}H3_Codec;
+
 /** @}*/
 
 /*! \brief User authentication info */
@@ -85,6 +95,15 @@ typedef struct {
 	unsigned long usedSpace;
 } H3_StorageInfo;
 
+/*! \brief Read-ahead statistics of a handle */
+typedef struct {
+    uint64_t hits;          //!< Part reads served from the read-ahead buffer
+    uint64_t misses;        //!< Part reads not served from the read-ahead buffer
+    uint64_t prefetched;    //!< Parts fetched in the background
+    uint64_t wasted;        //!< Prefetched parts dropped without being read
+    uint32_t window;        //!< Max number of parts fetched ahead of a reader
+} H3_ReadAheadStats;
+
 /*! \brief Bucket statistics */
 typedef struct {
     size_t size;                         //!< The size of all objects contained in the bucket
@@ -133,6 +152,10 @@ typedef struct {
             gid_t gid;      //!< Group ID, adhering to chown() semantics
         };
         char readOnly;      //!< This is used from the h3controllers, it is different from the mode  
+        struct {
+            H3_Codec codec; //!< Codec applied to the data of objects created in the bucket from now on
+            int level;      //!< Codec specific level, only used by Zstandard (0 selects the default)
+        };
     };
 }H3_Attribute;
 
@@ -151,6 +174,8 @@ char* H3_Version();
  */
 H3_Handle H3_Init(const char* storageUri);
 void H3_Free(H3_Handle handle);
+H3_Status H3_SetReadAhead(H3_Handle handle, uint32_t window);
+H3_Status H3_InfoReadAhead(H3_Handle handle, H3_ReadAheadStats* stats);
 /** @}*/
 
 /** \defgroup storage Storage Info
@@ -166,6 +191,7 @@ H3_Status H3_ListBuckets(H3_Handle handle, H3_Token token, H3_Name* bucketNameAr
 H3_Status H3_ForeachBucket(H3_Handle handle, H3_Token token, h3_name_iterator_cb function, void* userData);
 H3_Status H3_InfoBucket(H3_Handle handle, H3_Token token, H3_Name bucketName, H3_BucketInfo* bucketInfo, uint8_t getStats);
 H3_Status H3_SetBucketAttributes(H3_Handle handle, H3_Token token, H3_Name bucketName, H3_Attribute attrib);
+H3_Status H3_TrainBucketDictionary(H3_Handle handle, H3_Token token, H3_Name bucketName, size_t dictionarySize);
 H3_Status H3_CreateBucket(H3_Handle handle, H3_Token token, H3_Name bucketName);
 H3_Status H3_DeleteBucket(H3_Handle handle, H3_Token token, H3_Name bucketName);
 H3_Status H3_PurgeBucket(H3_Handle handle, H3_Token token, H3_Name bucketName);
@@ -175,6 +201,7 @@ H3_Status H3_PurgeBucket(H3_Handle handle, H3_Token token, H3_Name bucketName);
  *  @{
  */
 H3_Status H3_ListObjects(H3_Handle handle, H3_Token token, H3_Name bucketName, H3_Name prefix, uint32_t offset, H3_Name* objectNameArray, uint32_t* nObjects);
+H3_Status H3_ListObjectsWithInfo(H3_Handle handle, H3_Token token, H3_Name bucketName, H3_Name prefix, uint32_t offset, H3_Name* objectNameArray, H3_ObjectInfo** objectInfoArray, uint32_t* nObjects);
 H3_Status H3_ForeachObject(H3_Handle handle, H3_Token token, H3_Name bucketName, H3_Name prefix, uint32_t nObjects, uint32_t offset, h3_name_iterator_cb function, void* userData);
 H3_Status H3_InfoObject(H3_Handle handle, H3_Token token, H3_Name bucketName, H3_Name objectName, H3_ObjectInfo* objectInfo);
 H3_Status H3_ObjectExists(H3_Handle handle, H3_Token token, H3_Name bucketName, H3_Name objectName);
@@ -191,6 +218,7 @@ H3_Status H3_WriteObjectFromFile(H3_Handle handle, H3_Token token, H3_Name bucke
 H3_Status H3_ReadObject(H3_Handle handle, H3_Token token, H3_Name bucketName, H3_Name objectName, off_t offset, void** data, size_t* size);
 H3_Status H3_ReadDummyObject(H3_Handle handle, H3_Token token, H3_Name bucketName, H3_Name objectName, size_t* size);
 H3_Status H3_ReadObjectToFile(H3_Handle handle, H3_Token token, H3_Name bucketName, H3_Name objectName, off_t offset, int fd, size_t* size);
+H3_Status H3_OpenObjectData(H3_Handle handle, H3_Token token, H3_Name bucketName, H3_Name objectName, off_t offset, int* fd, off_t* position, size_t* size);
 H3_Status H3_CopyObject(H3_Handle handle, H3_Token token, H3_Name bucketName, H3_Name srcObjectName, H3_Name dstObjectName, uint8_t noOverwrite);
 H3_Status H3_MoveObject(H3_Handle handle, H3_Token token, H3_Name bucketName, H3_Name srcObjectName, H3_Name dstObjectName, uint8_t noOverwrite);
 H3_Status H3_ExchangeObject(H3_Handle handle, H3_Token token, H3_Name bucketName, H3_Name srcObjectName, H3_Name dstObjectName);
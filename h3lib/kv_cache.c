@@ -0,0 +1,967 @@
+// Copyright [2019] [FORTH-ICS]
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "kv_interface.h"
+#include "util.h"
+#include "url_parser.h"
+
+/*
+ * A hot store in front of a cold one. The cold store holds everything, while copies of data parts
+ * are kept in the hot store as they are read or written, whole parts at a time. All other keys,
+ * i.e. users, buckets, object headers and metadata, are served by the cold store alone.
+ *
+ * Parts are tracked by an in-memory index, also deciding which ones to evict, either the least
+ * recently used (LRU) or the ones least likely to be used again by balancing recent against
+ * frequent use (ARC). The index knows nothing of what the hot store held before, thus the hot
+ * store has to be dedicated to a single cache, which is shared by the handles of the same URI.
+ *
+ * Written parts go to both stores (write-through), or to the hot store only until evicted or
+ * released (write-back). Parts are evicted in the background once above the high watermark, down
+ * to the low watermark; while at capacity, parts are read from and written to the cold store
+ * directly. Evictions that fail, e.g. while the cold store is down, are retried after a delay
+ * growing up to a limit.
+ *
+ * The URI gives the options of the cache followed by the hot and the cold store, e.g.
+ * cache://policy=lru&mode=back&size=4096&hot=mem:///?cold=file:///hdd/h3
+ */
+
+#define KV_CACHE_DEFAULT_SIZE       1024    // MB
+#define KV_CACHE_HIGH_WATERMARK     90      // % of the size
+#define KV_CACHE_LOW_WATERMARK      80      // % of the size
+#define KV_CACHE_RETRY_WAIT         10000   // us to wait while all candidates for eviction are busy
+#define KV_CACHE_BACKOFF_LIMIT      1000000 // Max us to wait after failing to evict
+
+typedef enum {
+    KV_CACHE_NONE = 0,          // Not held and not remembered, i.e. being filled
+    KV_CACHE_RECENT,            // Held, used once lately
+    KV_CACHE_FREQUENT,          // Held, used more than once lately
+    KV_CACHE_RECENT_GHOST,      // Evicted from the recent list, only the key is remembered (ARC)
+    KV_CACHE_FREQUENT_GHOST,    // Evicted from the frequent list, only the key is remembered (ARC)
+    KV_CACHE_NumOfLists
+} KV_Cache_Queue;
+
+typedef enum {
+    KV_CACHE_CREATE,
+    KV_CACHE_WRITE,
+    KV_CACHE_UPDATE
+} KV_Cache_WriteType;
+
+typedef struct {
+    char* key;
+    size_t size;
+    KV_Cache_Queue list;
+    GList link;                 // In the list, most recently used at the head
+    char busy;                  // Being filled, written or evicted, others wait
+    char dirty;                 // Only in the hot store
+} KV_Cache_Entry;
+
+typedef struct {
+    KV_Operations* hotOp;
+    KV_Handle hotHandle;
+    KV_Operations* coldOp;
+    KV_Handle coldHandle;
+
+    char writeBack;
+    char arc;
+    size_t capacity;
+    size_t highWatermark;
+    size_t lowWatermark;
+
+    GMutex lock;
+    GCond changed;              // An entry is no longer busy
+    GCond evict;                // Above the high watermark, or stopping
+    GHashTable* index;          // Key to entry, ghosts included
+    GQueue lists[KV_CACHE_NumOfLists];
+    size_t bytes[KV_CACHE_NumOfLists];
+    size_t target;              // The bytes aimed at the recent list, adapted by ghost hits (ARC)
+
+    GThread* evictor;
+    char stop;
+
+    char* uri;
+    uint32_t refs;
+} KV_Cache_Handle;
+
+// Handles of the same URI share a cache, so that parts written back are seen by all of them
+static GMutex cachesLock;
+static GHashTable* caches = NULL;
+
+// Options are passed before the stores, e.g. cache://policy=lru&size=4096&hot=...
+static void ParseOptions(KV_Cache_Handle* cache, const char* spec, size_t specLen){
+    gchar* query = g_strndup(spec, specLen);
+    gchar** options = g_strsplit(query, "&", 0);
+    uint32_t high = KV_CACHE_HIGH_WATERMARK, low = KV_CACHE_LOW_WATERMARK;
+    int i;
+
+    cache->capacity = (size_t)KV_CACHE_DEFAULT_SIZE * __1MByte;
+    cache->arc = 1;
+
+    for(i=0; options[i]; i++){
+        char* value = strchr(options[i], '=');
+        if(!value)
+            continue;
+
+        *value++ = '\0';
+        if(strcmp(options[i], "size") == 0)
+            cache->capacity = strtoul(value, NULL, 10) * __1MByte;
+        else if(strcmp(options[i], "policy") == 0)
+            cache->arc = strcmp(value, "lru") != 0;
+        else if(strcmp(options[i], "mode") == 0)
+            cache->writeBack = strcmp(value, "back") == 0;
+        else if(strcmp(options[i], "high") == 0)
+            high = min(strtoul(value, NULL, 10), 100);
+        else if(strcmp(options[i], "low") == 0)
+            low = strtoul(value, NULL, 10);
+        else
+            LogActivity(H3_INFO_MSG, "WARNING: Unknown option in URI: %s\n", options[i]);
+    }
+
+    cache->highWatermark = cache->capacity / 100 * high;
+    cache->lowWatermark = cache->capacity / 100 * min(low, high);
+
+    g_strfreev(options);
+    g_free(query);
+}
+
+// Parts come from the cold store at first, thus it decides whether reading ahead pays off
+H3_StoreType GetCacheDataType(const char* storageUri){
+    H3_StoreType type = H3_STORE_CACHE;
+    const char *spec;
+    char *hotUri, *coldUri;
+    struct parsed_url *url;
+
+    if(SplitUri(storageUri, "hot", "cold", &spec, &hotUri, &coldUri)){
+        if( (url = parse_url(coldUri)) ){
+            type = H3_String2Type(url->scheme);
+            parsed_url_free(url);
+        }
+        free(hotUri);
+        free(coldUri);
+    }
+
+    return type;
+}
+
+
+// The functions below are called with the lock held
+
+static size_t Resident(KV_Cache_Handle* cache){
+    return cache->bytes[KV_CACHE_RECENT] + cache->bytes[KV_CACHE_FREQUENT];
+}
+
+static int IsResident(KV_Cache_Entry* entry){
+    return entry->list == KV_CACHE_RECENT || entry->list == KV_CACHE_FREQUENT;
+}
+
+static void Link(KV_Cache_Handle* cache, KV_Cache_Entry* entry, KV_Cache_Queue list){
+    entry->list = list;
+    entry->link.data = entry;
+    g_queue_push_head_link(&cache->lists[list], &entry->link);
+    cache->bytes[list] += entry->size;
+}
+
+static void Unlink(KV_Cache_Handle* cache, KV_Cache_Entry* entry){
+    if(entry->list != KV_CACHE_NONE){
+        g_queue_unlink(&cache->lists[entry->list], &entry->link);
+        cache->bytes[entry->list] -= entry->size;
+        entry->list = KV_CACHE_NONE;
+    }
+}
+
+static void FreeEntry(gpointer data){
+    KV_Cache_Entry* entry = (KV_Cache_Entry*)data;
+    free(entry->key);
+    free(entry);
+}
+
+// Also wakes those waiting for the entry, who will find it gone
+static void Drop(KV_Cache_Handle* cache, KV_Cache_Entry* entry){
+    Unlink(cache, entry);
+    g_hash_table_remove(cache->index, entry->key);
+    g_cond_broadcast(&cache->changed);
+}
+
+static void Release(KV_Cache_Handle* cache, KV_Cache_Entry* entry){
+    entry->busy = 0;
+    g_cond_broadcast(&cache->changed);
+}
+
+// Waits for the entry of a key to be available, if there is one
+static KV_Cache_Entry* Acquire(KV_Cache_Handle* cache, KV_Key key){
+    KV_Cache_Entry* entry;
+
+    while( (entry = g_hash_table_lookup(cache->index, key)) && entry->busy )
+        g_cond_wait(&cache->changed, &cache->lock);
+
+    return entry;
+}
+
+static KV_Cache_Entry* NewEntry(KV_Cache_Handle* cache, KV_Key key){
+    KV_Cache_Entry* entry;
+
+    if( !(entry = calloc(1, sizeof(KV_Cache_Entry))) || !(entry->key = strdup(key)) ){
+        free(entry);
+        return NULL;
+    }
+    g_hash_table_insert(cache->index, entry->key, entry);
+
+    return entry;
+}
+
+/*
+ * Marks an entry as busy on behalf of the caller and tells the list its part goes to once held.
+ * Parts used again go to the frequent list, as do those remembered by a ghost, whose hit also
+ * shifts the balance between recent and frequent use towards the list the ghost came from.
+ */
+static KV_Cache_Queue Claim(KV_Cache_Handle* cache, KV_Cache_Entry* entry){
+    KV_Cache_Queue list = KV_CACHE_RECENT;
+    size_t delta;
+
+    if(cache->arc && entry->list != KV_CACHE_NONE){
+        list = KV_CACHE_FREQUENT;
+
+        if(entry->list == KV_CACHE_RECENT_GHOST){
+            delta = max(entry->size, entry->size * cache->bytes[KV_CACHE_FREQUENT_GHOST] / max(cache->bytes[KV_CACHE_RECENT_GHOST], 1));
+            cache->target = min(cache->target + delta, cache->capacity);
+        }
+        else if(entry->list == KV_CACHE_FREQUENT_GHOST){
+            delta = max(entry->size, entry->size * cache->bytes[KV_CACHE_RECENT_GHOST] / max(cache->bytes[KV_CACHE_FREQUENT_GHOST], 1));
+            cache->target = cache->target > delta?cache->target - delta:0;
+        }
+    }
+
+    if(!IsResident(entry))
+        Unlink(cache, entry);
+
+    entry->busy = 1;
+    return list;
+}
+
+// Accounts for the part of an entry held by the hot store
+static void Place(KV_Cache_Handle* cache, KV_Cache_Entry* entry, KV_Cache_Queue list, size_t size){
+    Unlink(cache, entry);
+    entry->size = size;
+    Link(cache, entry, list);
+
+    if(Resident(cache) > cache->highWatermark)
+        g_cond_signal(&cache->evict);
+}
+
+static int Fits(KV_Cache_Handle* cache, KV_Cache_Entry* entry, size_t size){
+    return Resident(cache) - (IsResident(entry)?entry->size:0) + size <= cache->capacity;
+}
+
+static KV_Cache_Entry* LeastRecent(KV_Cache_Handle* cache, KV_Cache_Queue list){
+    GList* link;
+
+    for(link = cache->lists[list].tail; link; link = link->prev){
+        if(!((KV_Cache_Entry*)link->data)->busy)
+            return (KV_Cache_Entry*)link->data;
+    }
+
+    return NULL;
+}
+
+// Picks the part to evict, ARC takes it from the recent list while that exceeds its target
+static KV_Cache_Entry* Victim(KV_Cache_Handle* cache){
+    KV_Cache_Entry* entry = NULL;
+
+    if(!cache->arc || cache->bytes[KV_CACHE_RECENT] > cache->target)
+        entry = LeastRecent(cache, KV_CACHE_RECENT);
+
+    if(!entry)
+        entry = LeastRecent(cache, KV_CACHE_FREQUENT);
+
+    if(!entry)
+        entry = LeastRecent(cache, KV_CACHE_RECENT);
+
+    return entry;
+}
+
+// Evicted parts leave a ghost behind with ARC, ghosts are bounded by the capacity as in ARC
+static void Demote(KV_Cache_Handle* cache, KV_Cache_Entry* entry){
+    KV_Cache_Entry* ghost;
+
+    if(!cache->arc){
+        Drop(cache, entry);
+        return;
+    }
+
+    KV_Cache_Queue list = entry->list == KV_CACHE_RECENT?KV_CACHE_RECENT_GHOST:KV_CACHE_FREQUENT_GHOST;
+    Unlink(cache, entry);
+    Link(cache, entry, list);
+
+    while(cache->bytes[KV_CACHE_RECENT] + cache->bytes[KV_CACHE_RECENT_GHOST] > cache->capacity &&
+          (ghost = LeastRecent(cache, KV_CACHE_RECENT_GHOST))){
+        Drop(cache, ghost);
+    }
+
+    while(Resident(cache) + cache->bytes[KV_CACHE_RECENT_GHOST] + cache->bytes[KV_CACHE_FREQUENT_GHOST] > 2 * cache->capacity &&
+          (ghost = LeastRecent(cache, KV_CACHE_FREQUENT_GHOST))){
+        Drop(cache, ghost);
+    }
+}
+
+
+// The functions below are called without the lock, the caller holds the entry busy
+
+// Writes a dirty part back to the cold store
+static KV_Status Flush(KV_Cache_Handle* cache, KV_Cache_Entry* entry){
+    KV_Value value = NULL;
+    size_t size = 0;
+    KV_Status status;
+
+    if( (status = cache->hotOp->read(cache->hotHandle, entry->key, 0, &value, &size)) == KV_SUCCESS)
+        status = cache->coldOp->write(cache->coldHandle, entry->key, value, size);
+
+    free(value);
+    return status;
+}
+
+static KV_Status Evict(KV_Cache_Handle* cache, KV_Cache_Entry* entry){
+    KV_Status status = KV_SUCCESS;
+
+    if(entry->dirty && (status = Flush(cache, entry)) != KV_SUCCESS)
+        return status;
+
+    if( (status = cache->hotOp->delete(cache->hotHandle, entry->key)) == KV_KEY_NOT_EXIST )
+        status = KV_SUCCESS;
+
+    return status;
+}
+
+// Flushes the part of a key if dirty, keeping it held
+static KV_Status Clean(KV_Cache_Handle* cache, KV_Key key){
+    KV_Cache_Entry* entry;
+    KV_Status status = KV_SUCCESS;
+
+    g_mutex_lock(&cache->lock);
+    if( (entry = Acquire(cache, key)) && entry->dirty ){
+        entry->busy = 1;
+        g_mutex_unlock(&cache->lock);
+
+        status = Flush(cache, entry);
+
+        g_mutex_lock(&cache->lock);
+        if(status == KV_SUCCESS)
+            entry->dirty = 0;
+        Release(cache, entry);
+    }
+    g_mutex_unlock(&cache->lock);
+
+    return status;
+}
+
+// Drops the hot copy of a key, whose cold copy the caller is about to replace or delete
+static KV_Cache_Entry* Invalidate(KV_Cache_Handle* cache, KV_Key key){
+    KV_Cache_Entry* entry;
+
+    g_mutex_lock(&cache->lock);
+    if( (entry = Acquire(cache, key)) )
+        entry->busy = 1;
+    g_mutex_unlock(&cache->lock);
+
+    if(entry && IsResident(entry))
+        cache->hotOp->delete(cache->hotHandle, key);
+
+    return entry;
+}
+
+static void Forget(KV_Cache_Handle* cache, KV_Cache_Entry* entry){
+    if(entry){
+        g_mutex_lock(&cache->lock);
+        Drop(cache, entry);
+        g_mutex_unlock(&cache->lock);
+    }
+}
+
+static gpointer Evictor(gpointer data){
+    KV_Cache_Handle* cache = (KV_Cache_Handle*)data;
+    KV_Cache_Entry* entry;
+    KV_Status status;
+    gint64 backoff = 0, until;
+
+    g_mutex_lock(&cache->lock);
+    while(!cache->stop){
+        if(Resident(cache) <= cache->highWatermark){
+            g_cond_wait(&cache->evict, &cache->lock);
+            continue;
+        }
+
+        while(!cache->stop && Resident(cache) > cache->lowWatermark){
+            if( !(entry = Victim(cache)) ){
+                g_cond_wait_until(&cache->changed, &cache->lock, g_get_monotonic_time() + KV_CACHE_RETRY_WAIT);
+                continue;
+            }
+
+            entry->busy = 1;
+            g_mutex_unlock(&cache->lock);
+
+            status = Evict(cache, entry);
+
+            g_mutex_lock(&cache->lock);
+            Release(cache, entry);
+            if(status == KV_SUCCESS){
+                entry->dirty = 0;
+                Demote(cache, entry);
+                backoff = 0;
+            }
+            else {
+                // Retried once the rest have been tried, not before the failing store had some time to recover
+                LogActivity(H3_ERROR_MSG, "ERROR: Failed to evict %s - %d\n", entry->key, status);
+                Place(cache, entry, entry->list, entry->size);
+
+                backoff = min(max(backoff * 2, KV_CACHE_RETRY_WAIT), KV_CACHE_BACKOFF_LIMIT);
+                until = g_get_monotonic_time() + backoff;
+                while(!cache->stop && g_cond_wait_until(&cache->evict, &cache->lock, until));
+            }
+        }
+    }
+    g_mutex_unlock(&cache->lock);
+
+    return NULL;
+}
+
+static KV_Status FlushAll(KV_Cache_Handle* cache){
+    KV_Status status = KV_SUCCESS;
+    GHashTableIter iter;
+    GSList *keys = NULL, *key;
+    KV_Cache_Entry* entry;
+
+    g_mutex_lock(&cache->lock);
+    g_hash_table_iter_init(&iter, cache->index);
+    while(g_hash_table_iter_next(&iter, NULL, (gpointer*)&entry)){
+        if(entry->dirty)
+            keys = g_slist_prepend(keys, g_strdup(entry->key));
+    }
+    g_mutex_unlock(&cache->lock);
+
+    for(key = keys; key; key = key->next){
+        if(Clean(cache, key->data) != KV_SUCCESS)
+            status = KV_FAILURE;
+    }
+    g_slist_free_full(keys, g_free);
+
+    return status;
+}
+
+static KV_Status ReadCached(KV_Cache_Handle* cache, KV_Key key, off_t offset, KV_Value* value, size_t* size){
+    KV_Cache_Entry* entry;
+    KV_Cache_Queue list;
+    KV_Value part = NULL;
+    size_t partSize = 0, segmentSize;
+    KV_Status status;
+    int fits;
+
+    g_mutex_lock(&cache->lock);
+    if( (entry = Acquire(cache, key)) && IsResident(entry) ){
+        Place(cache, entry, Claim(cache, entry), entry->size);
+        entry->busy = 0;
+        g_mutex_unlock(&cache->lock);
+
+        // The part may have been evicted meanwhile, after being flushed
+        if( (status = cache->hotOp->read(cache->hotHandle, key, offset, value, size)) != KV_KEY_NOT_EXIST )
+            return status;
+
+        return cache->coldOp->read(cache->coldHandle, key, offset, value, size);
+    }
+
+    // Others asking for the same part wait for it to be filled
+    if(!entry && !(entry = NewEntry(cache, key))){
+        g_mutex_unlock(&cache->lock);
+        return cache->coldOp->read(cache->coldHandle, key, offset, value, size);
+    }
+    list = Claim(cache, entry);
+    g_mutex_unlock(&cache->lock);
+
+    if( (status = cache->coldOp->read(cache->coldHandle, key, 0, &part, &partSize)) != KV_SUCCESS ){
+        Forget(cache, entry);
+        free(part);
+        return status;
+    }
+
+    g_mutex_lock(&cache->lock);
+    fits = Fits(cache, entry, partSize);
+    g_mutex_unlock(&cache->lock);
+
+    fits = fits && cache->hotOp->write(cache->hotHandle, key, part, partSize) == KV_SUCCESS;
+
+    g_mutex_lock(&cache->lock);
+    if(fits){
+        Place(cache, entry, list, partSize);
+        Release(cache, entry);
+    }
+    else {
+        Drop(cache, entry);
+        g_cond_signal(&cache->evict);
+    }
+    g_mutex_unlock(&cache->lock);
+
+    // Hand over the requested segment
+    segmentSize = offset < partSize?partSize - offset:0;
+    if(*value == NULL){
+        memmove(part, &part[offset < partSize?offset:0], segmentSize);
+        *value = part;
+        part = NULL;
+    }
+    else {
+        segmentSize = min(segmentSize, *size);
+        memcpy(*value, &part[offset], segmentSize);
+    }
+    *size = segmentSize;
+    free(part);
+
+    return KV_SUCCESS;
+}
+
+static KV_Status WriteStore(KV_Operations* op, KV_Handle handle, KV_Key key, KV_Value value, off_t offset, size_t size, KV_Cache_WriteType type){
+    switch(type){
+        case KV_CACHE_CREATE:   return op->create(handle, key, value, size);
+        case KV_CACHE_UPDATE:   return op->update(handle, key, value, offset, size);
+        default:                return op->write(handle, key, value, size);
+    }
+}
+
+// The hot store may still hold stale copies of parts not held, which are written over
+static KV_Status WriteHot(KV_Cache_Handle* cache, KV_Key key, KV_Value value, off_t offset, size_t size, KV_Cache_WriteType type, int resident){
+    if(type == KV_CACHE_UPDATE && !resident && offset)
+        cache->hotOp->delete(cache->hotHandle, key);
+
+    if(type == KV_CACHE_UPDATE && (resident || offset))
+        return cache->hotOp->update(cache->hotHandle, key, value, offset, size);
+
+    return cache->hotOp->write(cache->hotHandle, key, value, size);
+}
+
+static KV_Status WriteCached(KV_Cache_Handle* cache, KV_Key key, KV_Value value, off_t offset, size_t size, KV_Cache_WriteType type){
+    KV_Cache_Entry* entry;
+    KV_Cache_Queue list;
+    KV_Status status = KV_SUCCESS;
+    size_t partSize = size;
+    int resident, fits, held = 0;
+
+    g_mutex_lock(&cache->lock);
+    entry = Acquire(cache, key);
+    resident = entry && IsResident(entry);
+
+    if(!entry && !(entry = NewEntry(cache, key))){
+        g_mutex_unlock(&cache->lock);
+        return WriteStore(cache->coldOp, cache->coldHandle, key, value, offset, size, type);
+    }
+
+    if(type == KV_CACHE_UPDATE)
+        partSize = resident?max(entry->size, offset + size):offset + size;
+
+    fits = Fits(cache, entry, partSize);
+    list = Claim(cache, entry);
+    g_mutex_unlock(&cache->lock);
+
+    // Parts not held are updated in place, unless new
+    if(type == KV_CACHE_UPDATE && !resident && (status = cache->coldOp->exists(cache->coldHandle, key)) != KV_KEY_NOT_EXIST){
+        if(status == KV_KEY_EXIST)
+            status = cache->coldOp->update(cache->coldHandle, key, value, offset, size);
+    }
+    else if(cache->writeBack && fits){
+        status = KV_SUCCESS;
+        if(type == KV_CACHE_CREATE && resident)
+            status = KV_KEY_EXIST;
+        else if(type == KV_CACHE_CREATE && (status = cache->coldOp->exists(cache->coldHandle, key)) == KV_KEY_NOT_EXIST)
+            status = KV_SUCCESS;
+
+        if(status == KV_SUCCESS)
+            status = WriteHot(cache, key, value, offset, size, type, resident);
+
+        held = status == KV_SUCCESS || resident;
+    }
+    else {
+        // The cold copy has to be up to date before written
+        status = KV_SUCCESS;
+        if(resident && entry->dirty)
+            status = Flush(cache, entry);
+
+        if(status == KV_SUCCESS)
+            status = WriteStore(cache->coldOp, cache->coldHandle, key, value, offset, size, type);
+
+        // Without room, the hot copy is dropped rather than left behind
+        held = status == KV_SUCCESS && fits && WriteHot(cache, key, value, offset, size, type, resident) == KV_SUCCESS;
+        if(!held && resident && status == KV_SUCCESS)
+            cache->hotOp->delete(cache->hotHandle, key);
+        held = held || (resident && status != KV_SUCCESS);
+    }
+
+    g_mutex_lock(&cache->lock);
+    if(held){
+        if(status == KV_SUCCESS){
+            entry->dirty = cache->writeBack && fits;
+            Place(cache, entry, list, partSize);
+        }
+        Release(cache, entry);
+    }
+    else {
+        Drop(cache, entry);
+        if(!fits)
+            g_cond_signal(&cache->evict);
+    }
+    g_mutex_unlock(&cache->lock);
+
+    return status;
+}
+
+static KV_Status DeleteCached(KV_Cache_Handle* cache, KV_Key key){
+    KV_Cache_Entry* entry;
+    KV_Status status;
+    int dirty;
+
+    entry = Invalidate(cache, key);
+    dirty = entry && entry->dirty;
+
+    // Parts written back may not be in the cold store yet
+    if( (status = cache->coldOp->delete(cache->coldHandle, key)) == KV_KEY_NOT_EXIST && dirty )
+        status = KV_SUCCESS;
+
+    Forget(cache, entry);
+
+    return status;
+}
+
+// Copies and moves take place in the cold store, once it holds the latest source
+static KV_Status TransferCached(KV_Cache_Handle* cache, KV_Key srcKey, KV_Key dstKey, int move){
+    KV_Cache_Entry* entry;
+    KV_Status status;
+
+    if( (status = Clean(cache, srcKey)) != KV_SUCCESS )
+        return status;
+
+    entry = Invalidate(cache, dstKey);
+    if(move)
+        status = cache->coldOp->move(cache->coldHandle, srcKey, dstKey);
+    else
+        status = cache->coldOp->copy(cache->coldHandle, srcKey, dstKey);
+    Forget(cache, entry);
+
+    if(move && status == KV_SUCCESS)
+        Forget(cache, Invalidate(cache, srcKey));
+
+    return status;
+}
+
+
+// The URI is cache://[<options>&]hot=<uri>?cold=<uri>, the options of each store go with its URI
+static KV_Cache_Handle* NewCache(const char* storageUri){
+    KV_Cache_Handle* cache;
+    const char *spec, *hot;
+    char *hotUri, *coldUri;
+    int i;
+
+    if(!(hot = SplitUri(storageUri, "hot", "cold", &spec, &hotUri, &coldUri))){
+        LogActivity(H3_ERROR_MSG, "ERROR: Expected cache://[<options>&]hot=<uri>?cold=<uri>, got %s\n", storageUri);
+        return NULL;
+    }
+    LogActivity(H3_INFO_MSG, "INFO: Hot store: %s\n", hotUri);
+    LogActivity(H3_INFO_MSG, "INFO: Cold store: %s\n", coldUri);
+
+    if( (cache = calloc(1, sizeof(KV_Cache_Handle))) ){
+        ParseOptions(cache, spec, hot > spec?hot - 1 - spec:0);
+
+        if( !(cache->uri = strdup(storageUri)) ){
+            free(cache);
+            cache = NULL;
+        }
+        else if( !(cache->hotOp = GetUriOperations(hotUri)) || !(cache->hotHandle = cache->hotOp->init(hotUri)) ){
+            LogActivity(H3_ERROR_MSG, "ERROR: Failed to initialize hot store %s\n", hotUri);
+            free(cache->uri);
+            free(cache);
+            cache = NULL;
+        }
+        else if( !(cache->coldOp = GetUriOperations(coldUri)) || !(cache->coldHandle = cache->coldOp->init(coldUri)) ){
+            LogActivity(H3_ERROR_MSG, "ERROR: Failed to initialize cold store %s\n", coldUri);
+            cache->hotOp->free(cache->hotHandle);
+            free(cache->uri);
+            free(cache);
+            cache = NULL;
+        }
+        else {
+            g_mutex_init(&cache->lock);
+            g_cond_init(&cache->changed);
+            g_cond_init(&cache->evict);
+            cache->index = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, FreeEntry);
+            for(i=0; i<KV_CACHE_NumOfLists; i++)
+                g_queue_init(&cache->lists[i]);
+            cache->refs = 1;
+            cache->evictor = g_thread_new("h3cache", Evictor, cache);
+        }
+    }
+
+    free(hotUri);
+    free(coldUri);
+
+    return cache;
+}
+
+KV_Handle KV_Cache_Init(const char* storageUri) {
+    KV_Cache_Handle* cache;
+
+    g_mutex_lock(&cachesLock);
+    if(!caches)
+        caches = g_hash_table_new(g_str_hash, g_str_equal);
+
+    if( (cache = g_hash_table_lookup(caches, storageUri)) ){
+        LogActivity(H3_INFO_MSG, "INFO: Sharing cache %s\n", storageUri);
+        cache->refs++;
+    }
+    else if( (cache = NewCache(storageUri)) )
+        g_hash_table_insert(caches, cache->uri, cache);
+    g_mutex_unlock(&cachesLock);
+
+    return (KV_Handle)cache;
+}
+
+// Parts written back are flushed, while the hot copies are dropped as no other cache may use them
+void KV_Cache_Free(KV_Handle handle) {
+    KV_Cache_Handle* cache = (KV_Cache_Handle*)handle;
+    GHashTableIter iter;
+    KV_Cache_Entry* entry;
+
+    g_mutex_lock(&cachesLock);
+    if(--cache->refs){
+        g_mutex_unlock(&cachesLock);
+        return;
+    }
+    g_hash_table_remove(caches, cache->uri);
+    g_mutex_unlock(&cachesLock);
+
+    g_mutex_lock(&cache->lock);
+    cache->stop = 1;
+    g_cond_signal(&cache->evict);
+    g_mutex_unlock(&cache->lock);
+    g_thread_join(cache->evictor);
+
+    if(cache->writeBack && FlushAll(cache) != KV_SUCCESS)
+        LogActivity(H3_ERROR_MSG, "ERROR: Failed to flush the hot store\n");
+
+    g_hash_table_iter_init(&iter, cache->index);
+    while(g_hash_table_iter_next(&iter, NULL, (gpointer*)&entry)){
+        if(IsResident(entry) && !entry->dirty)
+            cache->hotOp->delete(cache->hotHandle, entry->key);
+    }
+    g_hash_table_destroy(cache->index);
+
+    cache->coldOp->free(cache->coldHandle);
+    cache->hotOp->free(cache->hotHandle);
+    g_cond_clear(&cache->evict);
+    g_cond_clear(&cache->changed);
+    g_mutex_clear(&cache->lock);
+    free(cache->uri);
+    free(cache);
+}
+
+// The cold store holds all keys, the hot store only copies of some
+KV_Status KV_Cache_StorageInfo(KV_Handle handle, KV_StorageInfo* storageInfo) {
+    KV_Cache_Handle* cache = (KV_Cache_Handle*)handle;
+    return cache->coldOp->storage_info?cache->coldOp->storage_info(cache->coldHandle, storageInfo):KV_FAILURE;
+}
+
+KV_Status KV_Cache_MetadataRead(KV_Handle handle, KV_Key key, off_t offset, KV_Value* value, size_t* size) {
+    KV_Cache_Handle* cache = (KV_Cache_Handle*)handle;
+    return cache->coldOp->metadata_read(cache->coldHandle, key, offset, value, size);
+}
+
+KV_Status KV_Cache_MetadataWrite(KV_Handle handle, KV_Key key, KV_Value value, size_t size) {
+    KV_Cache_Handle* cache = (KV_Cache_Handle*)handle;
+    return cache->coldOp->metadata_write(cache->coldHandle, key, value, size);
+}
+
+KV_Status KV_Cache_MetadataCreate(KV_Handle handle, KV_Key key, KV_Value value, size_t size) {
+    KV_Cache_Handle* cache = (KV_Cache_Handle*)handle;
+    return cache->coldOp->metadata_create(cache->coldHandle, key, value, size);
+}
+
+KV_Status KV_Cache_MetadataDelete(KV_Handle handle, KV_Key key) {
+    KV_Cache_Handle* cache = (KV_Cache_Handle*)handle;
+    return cache->coldOp->metadata_delete(cache->coldHandle, key);
+}
+
+KV_Status KV_Cache_MetadataMove(KV_Handle handle, KV_Key srcKey, KV_Key dstKey) {
+    KV_Cache_Handle* cache = (KV_Cache_Handle*)handle;
+    return cache->coldOp->metadata_move(cache->coldHandle, srcKey, dstKey);
+}
+
+KV_Status KV_Cache_MetadataExists(KV_Handle handle, KV_Key key) {
+    KV_Cache_Handle* cache = (KV_Cache_Handle*)handle;
+    return cache->coldOp->metadata_exists(cache->coldHandle, key);
+}
+
+KV_Status KV_Cache_ListMetadata(KV_Handle handle, KV_Key prefix, uint8_t nTrim, KV_Key buffer, uint32_t offset, uint32_t* nKeys, KV_ListCallback function, void* userData) {
+    KV_Cache_Handle* cache = (KV_Cache_Handle*)handle;
+    return ListStoreMetadata(cache->coldOp, cache->coldHandle, prefix, nTrim, buffer, offset, nKeys, function, userData);
+}
+
+KV_Status KV_Cache_List(KV_Handle handle, KV_Key prefix, uint8_t nTrim, KV_Key buffer, uint32_t offset, uint32_t* nKeys) {
+    KV_Cache_Handle* cache = (KV_Cache_Handle*)handle;
+    return cache->coldOp->list(cache->coldHandle, prefix, nTrim, buffer, offset, nKeys);
+}
+
+KV_Status KV_Cache_Exists(KV_Handle handle, KV_Key key) {
+    KV_Cache_Handle* cache = (KV_Cache_Handle*)handle;
+    KV_Cache_Entry* entry;
+    int resident = 0;
+
+    if(IsPartKey(key)){
+        g_mutex_lock(&cache->lock);
+        resident = (entry = Acquire(cache, key)) && IsResident(entry);
+        g_mutex_unlock(&cache->lock);
+    }
+
+    return resident?KV_KEY_EXIST:cache->coldOp->exists(cache->coldHandle, key);
+}
+
+KV_Status KV_Cache_Read(KV_Handle handle, KV_Key key, off_t offset, KV_Value* value, size_t* size) {
+    KV_Cache_Handle* cache = (KV_Cache_Handle*)handle;
+
+    if(IsPartKey(key))
+        return ReadCached(cache, key, offset, value, size);
+
+    return cache->coldOp->read(cache->coldHandle, key, offset, value, size);
+}
+
+KV_Status KV_Cache_ReadBatch(KV_Handle handle, KV_ReadRequest* requests, uint32_t nRequests){
+    KV_Status status = KV_SUCCESS;
+    uint32_t i;
+
+    for(i=0; i<nRequests; i++){
+        if( (requests[i].status = KV_Cache_Read(handle, requests[i].key, requests[i].offset, &requests[i].value, &requests[i].size)) != KV_SUCCESS )
+            status = KV_FAILURE;
+    }
+
+    return status;
+}
+
+KV_Status KV_Cache_Create(KV_Handle handle, KV_Key key, KV_Value value, size_t size) {
+    KV_Cache_Handle* cache = (KV_Cache_Handle*)handle;
+
+    if(IsPartKey(key))
+        return WriteCached(cache, key, value, 0, size, KV_CACHE_CREATE);
+
+    return cache->coldOp->create(cache->coldHandle, key, value, size);
+}
+
+KV_Status KV_Cache_Update(KV_Handle handle, KV_Key key, KV_Value value, off_t offset, size_t size) {
+    KV_Cache_Handle* cache = (KV_Cache_Handle*)handle;
+
+    if(IsPartKey(key))
+        return WriteCached(cache, key, value, offset, size, KV_CACHE_UPDATE);
+
+    return cache->coldOp->update(cache->coldHandle, key, value, offset, size);
+}
+
+KV_Status KV_Cache_Write(KV_Handle handle, KV_Key key, KV_Value value, size_t size) {
+    KV_Cache_Handle* cache = (KV_Cache_Handle*)handle;
+
+    if(IsPartKey(key))
+        return WriteCached(cache, key, value, 0, size, KV_CACHE_WRITE);
+
+    return cache->coldOp->write(cache->coldHandle, key, value, size);
+}
+
+KV_Status KV_Cache_Copy(KV_Handle handle, KV_Key srcKey, KV_Key dstKey) {
+    KV_Cache_Handle* cache = (KV_Cache_Handle*)handle;
+
+    if(IsPartKey(srcKey))
+        return TransferCached(cache, srcKey, dstKey, 0);
+
+    return cache->coldOp->copy(cache->coldHandle, srcKey, dstKey);
+}
+
+KV_Status KV_Cache_Move(KV_Handle handle, KV_Key srcKey, KV_Key dstKey) {
+    KV_Cache_Handle* cache = (KV_Cache_Handle*)handle;
+
+    if(IsPartKey(srcKey))
+        return TransferCached(cache, srcKey, dstKey, 1);
+
+    return cache->coldOp->move(cache->coldHandle, srcKey, dstKey);
+}
+
+KV_Status KV_Cache_Delete(KV_Handle handle, KV_Key key) {
+    KV_Cache_Handle* cache = (KV_Cache_Handle*)handle;
+
+    if(IsPartKey(key))
+        return DeleteCached(cache, key);
+
+    return cache->coldOp->delete(cache->coldHandle, key);
+}
+
+// Held parts are opened in the hot store if it keeps them in files, otherwise in the cold store
+KV_Status KV_Cache_Open(KV_Handle handle, KV_Key key, int* fd) {
+    KV_Cache_Handle* cache = (KV_Cache_Handle*)handle;
+    KV_Cache_Entry* entry;
+    int resident;
+
+    g_mutex_lock(&cache->lock);
+    resident = (entry = Acquire(cache, key)) && IsResident(entry);
+    g_mutex_unlock(&cache->lock);
+
+    if(resident && cache->hotOp->open && cache->hotOp->open(cache->hotHandle, key, fd) == KV_SUCCESS)
+        return KV_SUCCESS;
+
+    if(!cache->coldOp->open || Clean(cache, key) != KV_SUCCESS)
+        return KV_FAILURE;
+
+    return cache->coldOp->open(cache->coldHandle, key, fd);
+}
+
+KV_Status KV_Cache_Sync(KV_Handle handle) {
+    KV_Cache_Handle* cache = (KV_Cache_Handle*)handle;
+    KV_Status status = KV_SUCCESS;
+
+    if(cache->writeBack)
+        status = FlushAll(cache);
+
+    if(cache->coldOp->sync && cache->coldOp->sync(cache->coldHandle) != KV_SUCCESS)
+        status = KV_FAILURE;
+
+    return status;
+}
+
+KV_Operations operationsCache = {
+    .init = KV_Cache_Init,
+    .free = KV_Cache_Free,
+    .storage_info = KV_Cache_StorageInfo,
+    .validate_key = ValidateNestedKey,
+
+    .metadata_read = KV_Cache_MetadataRead,
+    .metadata_write = KV_Cache_MetadataWrite,
+    .metadata_create = KV_Cache_MetadataCreate,
+    .metadata_delete = KV_Cache_MetadataDelete,
+    .metadata_move = KV_Cache_MetadataMove,
+    .metadata_exists = KV_Cache_MetadataExists,
+    .metadata_list = KV_Cache_ListMetadata,
+
+    .list = KV_Cache_List,
+    .exists = KV_Cache_Exists,
+    .read = KV_Cache_Read,
+    .read_batch = KV_Cache_ReadBatch,
+    .create = KV_Cache_Create,
+    .update = KV_Cache_Update,
+    .write = KV_Cache_Write,
+    .copy = KV_Cache_Copy,
+    .move = KV_Cache_Move,
+    .delete = KV_Cache_Delete,
+    .open = KV_Cache_Open,
+    .sync = KV_Cache_Sync
+};
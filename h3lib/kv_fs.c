@@ -25,23 +25,108 @@
 #include <sys/statvfs.h>
 #include <fcntl.h>
 #include <assert.h>
-#include <ftw.h>
-#include <regex.h>
 #include <ctype.h>
+#include <dirent.h>
+#include <limits.h>
+#include <regex.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
 
 #include "common.h"
 #include "kv_interface.h"
 
 #include "util.h"
 #include "url_parser.h"
+#include "kv_fs_uring.h"
 
 #define KV_FS_DIRECTORY_CHAR	0x7F	// In place of last slash to turn directory object into file object
+#define KV_FS_PARTS_DIR         "_"     // Top-level directory of the sharded part files
+#define KV_FS_WHOLE_PART        "-"     // File name of a part key without a part number
+#define KV_FS_UUID_LEN          36      // As printed by uuid_unparse()
+
+#define KV_FS_DESCRIPTORS           64          // Default number of part files kept open
+#define KV_FS_DIRECTORIES           65536       // Max number of directories remembered as existing
+#define KV_FS_DIRECT_ALIGNMENT      4096        // Alignment of offsets, sizes and buffers with O_DIRECT
+#define KV_FS_DIRECT_BUFFERS        16          // Max number of idle aligned buffers kept around
+#define KV_FS_DIRECT_BUFFER_SIZE    (H3_PART_SIZE + 2 * KV_FS_DIRECT_ALIGNMENT)
+
+#define KV_FS_COPY_BUFFER_SIZE      H3_PART_SIZE
+
+#define KV_FS_RING_DEPTH            64          // Max number of reads in flight per batch
+#define KV_FS_RINGS                 8           // Max number of idle rings kept around
+
+#define KV_FS_COMMIT_INTERVAL       2           // Default max milliseconds a commit waits for more operations
+#define KV_FS_COMMIT_BATCH          64          // Default number of operations that start a commit right away
+
+#ifndef O_DIRECT
+#define O_DIRECT    0   // Not available, e.g. on macOS
+#endif
 
+#define AlignDown(x)    ((x) & ~((off_t)KV_FS_DIRECT_ALIGNMENT - 1))
+#define AlignUp(x)      AlignDown((x) + KV_FS_DIRECT_ALIGNMENT - 1)
+
+typedef struct {
+    char* path;
+    int fd;
+    uint8_t writable;
+    uint8_t direct;
+    uint8_t evicted;            // Not cached, closed by its last user
+    uint32_t refs;
+    GList* link;                // Position in the LRU queue
+    GMutex lock;                // Serialises the read-modify-write of unaligned writes with O_DIRECT
+}KV_FS_Descriptor;
+
+typedef enum {
+    KV_FS_DURABILITY_NONE,      // Left to the kernel
+    KV_FS_DURABILITY_GROUP,     // Filesystems synced by a commit thread for many operations at once
+    KV_FS_DURABILITY_STRICT     // Files and directories synced by each operation
+}KV_FS_Durability;
+
+/*
+ * Operations are numbered as they ask to be committed. The commit thread waits for a batch to
+ * build up, syncs the filesystems of the store and marks all operations up to the last one taken
+ * in as committed. Operations on parts do not wait, as the metadata written after them waits for
+ * a later commit; if no such write follows, they are still committed within the interval.
+ */
 typedef struct {
-    char * metadata_root;
+    GMutex lock;
+    GCond pending;              // Wakes the commit thread
+    GCond done;                 // Wakes the operations waiting for a commit
+    GThread* thread;
+    uint64_t requested;
+    uint64_t committed;
+    uint64_t failedFrom;        // Operations in (failedFrom, failedUpTo] were not committed
+    uint64_t failedUpTo;
+    uint8_t stop;
+}KV_FS_Commit;
+
+typedef struct {
+    char * metadata_root;       // Holds all keys but parts, may be on a different device than the root
     char* root;
     int metadata_root_path_len;
     int root_path_len;
+    char** roots;               // Data roots the parts are striped over, starting with the root
+    uint32_t nRoots;
+
+    uint32_t maxDescriptors;
+    uint8_t direct;
+    uint8_t links;
+    uint8_t uring;
+    KV_FS_Durability durability;
+    uint32_t interval;          // In milliseconds
+    uint32_t batch;
+    KV_FS_Commit commit;
+
+    GMutex lock;                // Protects the following
+    GHashTable* descriptors;    // Open part files by path
+    GQueue lru;                 // Most recently used descriptors first
+    GHashTable* directories;    // Directories known to exist
+    GSList* buffers;            // Idle aligned buffers
+    uint32_t nBuffers;
+    GSList* rings;              // Idle io_uring instances
+    uint32_t nRings;
 }KV_Filesystem_Handle;
 
 static void StripSlashes(char* path){
@@ -77,9 +162,33 @@ static int DoMkdir(const char *path, mode_t mode) {
     return error;
 }
 
-static int MakePath(const char* fullKey, mode_t mode) {
+// Make a directory entry durable, syncing a directory that did not change is cheap
+static int SyncParent(const char* path){
+    char* parent = strdup(path);
+    char* separator = strrchr(parent, '/');
+    int fd, error = 0;
+
+    if(separator){
+        *separator = '\0';
+
+        // A directory gone meanwhile was pruned, it holds no entries to sync
+        if( (fd = open(separator == parent?"/":parent, O_RDONLY)) == -1 )
+            error = errno != ENOENT;
+        else if(fsync(fd) != 0)
+            error = 1;
+
+        if(fd != -1)
+            close(fd);
+    }
+    free(parent);
+
+    return !error;
+}
+
+// Directories are remembered once created or found, so that their parents are not checked again
+static int MakePath(KV_Filesystem_Handle* handle, const char* fullKey, mode_t mode) {
     char *pp, *sp, *copypath = strdup(fullKey);
-    int error = 0;
+    int error = 0, known;
 
     // The key is expected to end with a filename or '/'
     // otherwise the last sub-dir will not be created
@@ -88,7 +197,20 @@ static int MakePath(const char* fullKey, mode_t mode) {
     while(!error && (sp = strchr(pp, '/'))){
         if (sp != pp) {
             *sp = '\0';
-            error = DoMkdir(copypath, mode);
+            g_mutex_lock(&handle->lock);
+            known = g_hash_table_contains(handle->directories, copypath);
+            g_mutex_unlock(&handle->lock);
+
+            if(!known && !(error = DoMkdir(copypath, mode))){
+                if(handle->durability == KV_FS_DURABILITY_STRICT)
+                    SyncParent(copypath);
+
+                g_mutex_lock(&handle->lock);
+                if(g_hash_table_size(handle->directories) >= KV_FS_DIRECTORIES)
+                    g_hash_table_remove_all(handle->directories);
+                g_hash_table_add(handle->directories, strdup(copypath));
+                g_mutex_unlock(&handle->lock);
+            }
             *sp = '/';
         }
         pp = sp + 1;
@@ -98,10 +220,53 @@ static int MakePath(const char* fullKey, mode_t mode) {
     return !error;
 }
 
+/*
+ * With several data roots, consecutive parts of an object go to consecutive roots, starting
+ * from one picked by the UUID, so that a large object is spread evenly over all of them. The
+ * placement follows from the key alone, thus the list of roots must not change over the
+ * lifetime of the store.
+ */
+static const char* GetPartRoot(KV_Filesystem_Handle* handle, KV_Key key){
+    uint32_t hash = 2166136261U;
+    unsigned long number = 0;
+    char* end;
+    int i;
+
+    if(handle->nRoots == 1)
+        return handle->root;
+
+    // FNV-1a, it has to give the same placement on every platform and version
+    for(i=1; i<=KV_FS_UUID_LEN; i++){
+        hash ^= (unsigned char)key[i];
+        hash *= 16777619U;
+    }
+
+    // Sub-parts, i.e. "#<number>.<sub-part>", are striped like parts
+    if(key[KV_FS_UUID_LEN + 1] == '#'){
+        number = strtoul(&key[KV_FS_UUID_LEN + 2], &end, 10);
+        if(*end == '.')
+            number += strtoul(&end[1], NULL, 10);
+    }
+
+    return handle->roots[(hash + number) % handle->nRoots];
+}
+
+/*
+ * Part keys, i.e. "_<uuid>#<number>", are spread over a fixed fan-out derived from the UUID
+ * rather than placed next to each other at the root. All parts of an object share a directory,
+ * e.g. "_0a1b2c3d-...#3" is stored at "_/0a/1b/0a1b2c3d-.../3", so directories stay small no
+ * matter how many parts the store holds. The layout has to match tools/h3lib-fs-migrate.c.
+ */
+// Parts are placed under the data roots, all other keys under the metadata root (the root unless set otherwise)
 static char* GetFullKey(KV_Filesystem_Handle* handle, KV_Key key){
 	int size = 0;
 	char* fullKey = NULL;
-	if(handle && key && (size = asprintf(&fullKey, "%s/%s", handle->root, key)) > 0){
+	if(handle && key && IsPartKey(key)){
+		const char* uuid = &key[1];
+		const char* number = key[KV_FS_UUID_LEN + 1]?&key[KV_FS_UUID_LEN + 2]:KV_FS_WHOLE_PART;
+		asprintf(&fullKey, "%s/" KV_FS_PARTS_DIR "/%.2s/%.2s/%.*s/%s", GetPartRoot(handle, key), uuid, &uuid[2], KV_FS_UUID_LEN, uuid, number);
+	}
+	else if(handle && key && (size = asprintf(&fullKey, "%s/%s", handle->metadata_root, key)) > 0){
 		if(fullKey[size-1] == '/'){
 			fullKey[size-1] = KV_FS_DIRECTORY_CHAR;
 		}
@@ -109,48 +274,657 @@ static char* GetFullKey(KV_Filesystem_Handle* handle, KV_Key key){
 	return fullKey;
 }
 
-static char* GetFullPrefix(KV_Filesystem_Handle* handle, KV_Key key){
-	char* fullKey = NULL;
-	if(handle && key){
-		asprintf(&fullKey, "%s/%s", handle->root, key);
-	}
-	return fullKey;
+// Drop the directory of an object's parts once its last part is gone
+static void PrunePartDir(KV_Filesystem_Handle* handle, KV_Key key, char* fullKey){
+    if(IsPartKey(key)){
+        char* separator = strrchr(fullKey, '/');
+        *separator = '\0';
+        if(rmdir(fullKey) == 0){
+            g_mutex_lock(&handle->lock);
+            g_hash_table_remove(handle->directories, fullKey);
+            g_mutex_unlock(&handle->lock);
+        }
+        *separator = '/';
+    }
 }
 
-static KV_Status Write(int fd, KV_Value value, off_t offset, size_t size){
-    KV_Status status = KV_FAILURE;
+// Open a file, creating the missing directories on its path only when needed
+static int OpenFullKey(KV_Filesystem_Handle* handle, char* fullKey, int flags){
+    int fd = open(fullKey, flags, 0666);
 
-    if(size){
-        if(value){
-            if(lseek(fd, offset, SEEK_SET) != offset){
-                LogActivity(H3_ERROR_MSG, "Error create/write seeking in offset %" PRIu64 "\n",offset);
-            }
-            else{
-                // Use an attempt counter to allow for legitimate partial writes
-                int attempts = 2;
-                size_t writen, remaining = size;
-                while(--attempts && remaining){
-                    KV_Value buffer = &value[size - remaining];
-                    if((writen = write(fd, buffer, remaining)) == -1){
-                        break;
-                    }
-                    remaining -= writen;
-                }
-
-                if(!remaining)
-                    status = KV_SUCCESS;
+    if(fd == -1 && errno == ENOENT && (flags & O_CREAT) && MakePath(handle, fullKey, S_IRWXU | S_IRWXG | S_IRWXO)){
+
+        // Directories known to exist may have been removed behind our back
+        if( (fd = open(fullKey, flags, 0666)) == -1 && errno == ENOENT){
+            g_mutex_lock(&handle->lock);
+            g_hash_table_remove_all(handle->directories);
+            g_mutex_unlock(&handle->lock);
+
+            if(MakePath(handle, fullKey, S_IRWXU | S_IRWXG | S_IRWXO))
+                fd = open(fullKey, flags, 0666);
+        }
+    }
+
+    return fd;
+}
+
+
+/*
+ * Part files are kept open in an LRU cache, so that accessing a part does not resolve its path
+ * every time. Other files, i.e. metadata, are opened per access. Descriptors are reference
+ * counted, as a descriptor evicted by one thread may still be in use by another; the last user
+ * closes it.
+ */
+static void CloseDescriptor(KV_FS_Descriptor* descriptor){
+    g_mutex_clear(&descriptor->lock);
+    close(descriptor->fd);
+    free(descriptor->path);
+    free(descriptor);
+}
+
+// Called with the lock held
+static void EvictDescriptor(KV_Filesystem_Handle* handle, KV_FS_Descriptor* descriptor){
+    g_hash_table_remove(handle->descriptors, descriptor->path);
+    g_queue_delete_link(&handle->lru, descriptor->link);
+    descriptor->evicted = 1;
+
+    if(!descriptor->refs)
+        CloseDescriptor(descriptor);
+}
+
+static void ReleaseDescriptor(KV_Filesystem_Handle* handle, KV_FS_Descriptor* descriptor){
+    int error = errno;
+
+    g_mutex_lock(&handle->lock);
+    if(!--descriptor->refs && descriptor->evicted)
+        CloseDescriptor(descriptor);
+    g_mutex_unlock(&handle->lock);
+
+    errno = error;
+}
+
+// Drop the cached descriptor of a file about to be removed or replaced
+static void ForgetDescriptor(KV_Filesystem_Handle* handle, char* fullKey){
+    KV_FS_Descriptor* descriptor;
+
+    g_mutex_lock(&handle->lock);
+    if( (descriptor = g_hash_table_lookup(handle->descriptors, fullKey)) )
+        EvictDescriptor(handle, descriptor);
+    g_mutex_unlock(&handle->lock);
+}
+
+/*
+ * Files deleted or replaced through this handle have their descriptors forgotten beforehand.
+ * Those deleted or replaced by other handles or processes leave cached descriptors to refer to
+ * unlinked files, which are told apart by their link count, or by the file now found at their
+ * path. Cached descriptors are used unchecked, only an access that fails has its descriptor
+ * checked, and dropped if stale so that the access is retried on the file now at the path.
+ */
+static int IsStale(KV_FS_Descriptor* descriptor){
+    struct stat opened, current;
+
+    return fstat(descriptor->fd, &opened) == -1 || opened.st_nlink == 0 ||
+           stat(descriptor->path, &current) == -1 ||
+           opened.st_dev != current.st_dev || opened.st_ino != current.st_ino;
+}
+
+static int ForgetStale(KV_Filesystem_Handle* handle, KV_FS_Descriptor* descriptor){
+    int error = errno;
+    int stale = !descriptor->evicted && IsStale(descriptor);
+
+    if(stale)
+        ForgetDescriptor(handle, descriptor->path);
+
+    errno = error;
+    return stale;
+}
+
+static KV_FS_Descriptor* AcquireDescriptor(KV_Filesystem_Handle* handle, KV_Key key, char* fullKey, int flags){
+    KV_FS_Descriptor *descriptor = NULL, *cached;
+    int isPart = IsPartKey(key);
+    int cache = isPart && handle->maxDescriptors;
+    int direct = isPart && handle->direct;
+    int writable = 1;
+    int fd;
+
+    // Creating a file exclusively has to reach the filesystem
+    if(cache && !(flags & O_EXCL)){
+        g_mutex_lock(&handle->lock);
+        if( (descriptor = g_hash_table_lookup(handle->descriptors, fullKey)) ){
+            descriptor->refs++;
+            g_queue_unlink(&handle->lru, descriptor->link);
+            g_queue_push_head_link(&handle->lru, descriptor->link);
+        }
+        g_mutex_unlock(&handle->lock);
+
+        if(descriptor)
+            return descriptor;
+    }
+
+    // Files are opened for reading and writing so that descriptors serve both
+    flags |= O_RDWR;
+    if( (fd = OpenFullKey(handle, fullKey, flags | (direct?O_DIRECT:0))) == -1 && direct && errno == EINVAL){
+        LogActivity(H3_INFO_MSG, "WARNING: O_DIRECT not supported for %s - disabled\n", fullKey);
+        handle->direct = direct = 0;
+        fd = OpenFullKey(handle, fullKey, flags);
+    }
+
+    if(fd == -1 && !(flags & O_CREAT) && (errno == EACCES || errno == EROFS)){
+        direct = writable = 0;
+        fd = open(fullKey, O_RDONLY);
+    }
+
+    if(fd == -1 || !(descriptor = malloc(sizeof(KV_FS_Descriptor)))){
+        if(fd != -1)
+            close(fd);
+        return NULL;
+    }
+
+    descriptor->path = strdup(fullKey);
+    descriptor->fd = fd;
+    descriptor->writable = writable;
+    descriptor->direct = direct;
+    descriptor->evicted = !cache;
+    descriptor->refs = 1;
+    descriptor->link = NULL;
+    g_mutex_init(&descriptor->lock);
+
+    if(cache){
+        g_mutex_lock(&handle->lock);
+
+        // Another thread may have opened the same file meanwhile
+        if( (cached = g_hash_table_lookup(handle->descriptors, fullKey)) )
+            EvictDescriptor(handle, cached);
+
+        g_hash_table_insert(handle->descriptors, descriptor->path, descriptor);
+        g_queue_push_head(&handle->lru, descriptor);
+        descriptor->link = handle->lru.head;
+
+        while(handle->lru.length > handle->maxDescriptors)
+            EvictDescriptor(handle, g_queue_peek_tail(&handle->lru));
+
+        g_mutex_unlock(&handle->lock);
+    }
+
+    return descriptor;
+}
+
+
+
+// Buffers for O_DIRECT are recycled, apart from those larger than a part
+static KV_Value GetAlignedBuffer(KV_Filesystem_Handle* handle, size_t size){
+    KV_Value buffer = NULL;
+
+    if(size <= KV_FS_DIRECT_BUFFER_SIZE){
+        g_mutex_lock(&handle->lock);
+        if(handle->buffers){
+            buffer = handle->buffers->data;
+            handle->buffers = g_slist_delete_link(handle->buffers, handle->buffers);
+            handle->nBuffers--;
+        }
+        g_mutex_unlock(&handle->lock);
+
+        size = KV_FS_DIRECT_BUFFER_SIZE;
+    }
+
+    if(!buffer && posix_memalign((void**)&buffer, KV_FS_DIRECT_ALIGNMENT, size))
+        buffer = NULL;
+
+    return buffer;
+}
+
+static void PutAlignedBuffer(KV_Filesystem_Handle* handle, KV_Value buffer, size_t size){
+    if(size <= KV_FS_DIRECT_BUFFER_SIZE){
+        g_mutex_lock(&handle->lock);
+        if(handle->nBuffers < KV_FS_DIRECT_BUFFERS){
+            handle->buffers = g_slist_prepend(handle->buffers, buffer);
+            handle->nBuffers++;
+            buffer = NULL;
+        }
+        g_mutex_unlock(&handle->lock);
+    }
+
+    free(buffer);
+}
+
+// Rings serve a thread at a time, those idle are shared across threads
+static KV_FS_Ring* GetRing(KV_Filesystem_Handle* handle){
+    KV_FS_Ring* ring = NULL;
+
+    g_mutex_lock(&handle->lock);
+    if(handle->rings){
+        ring = handle->rings->data;
+        handle->rings = g_slist_delete_link(handle->rings, handle->rings);
+        handle->nRings--;
+    }
+    g_mutex_unlock(&handle->lock);
+
+    if(!ring && handle->uring && !(ring = CreateRing(KV_FS_RING_DEPTH))){
+        LogActivity(H3_INFO_MSG, "WARNING: io_uring not available - %s\n", strerror(errno));
+        handle->uring = 0;
+    }
+
+    return ring;
+}
+
+static void PutRing(KV_Filesystem_Handle* handle, KV_FS_Ring* ring){
+    g_mutex_lock(&handle->lock);
+    if(handle->nRings < KV_FS_RINGS){
+        handle->rings = g_slist_prepend(handle->rings, ring);
+        handle->nRings++;
+        ring = NULL;
+    }
+    g_mutex_unlock(&handle->lock);
+
+    if(ring)
+        DestroyRing(ring);
+}
+
+
+// Read up to the requested size, less only at the end of the file
+static ssize_t ReadFully(int fd, KV_Value buffer, size_t size, off_t offset, uint8_t direct){
+    size_t done = 0;
+    ssize_t nBytes;
+
+    while(done < size){
+        if( (nBytes = pread(fd, &buffer[done], size - done, offset + done)) > 0){
+            done += nBytes;
+
+            // A short read with O_DIRECT leaves an unaligned offset, which is the end of file anyway
+            if(direct && done < size)
+                break;
+        }
+        else if(nBytes == 0)
+            break;
+        else if(errno != EINTR)
+            return -1;
+    }
+
+    return done;
+}
+
+static int WriteFully(int fd, KV_Value buffer, size_t size, off_t offset){
+    size_t done = 0;
+    ssize_t nBytes;
+
+    while(done < size){
+        if( (nBytes = pwrite(fd, &buffer[done], size - done, offset + done)) >= 0)
+            done += nBytes;
+        else if(errno != EINTR)
+            return -1;
+    }
+
+    return 0;
+}
+
+static ssize_t ReadDescriptor(KV_Filesystem_Handle* handle, KV_FS_Descriptor* descriptor, KV_Value value, size_t size, off_t offset){
+    if(!descriptor->direct)
+        return ReadFully(descriptor->fd, value, size, offset, 0);
+
+    // Read the enclosing aligned blocks and keep the requested range
+    off_t start = AlignDown(offset);
+    size_t span = AlignUp(offset + (off_t)size) - start;
+    KV_Value buffer = GetAlignedBuffer(handle, span);
+    ssize_t nBytes = -1;
+
+    if(buffer){
+        if( (nBytes = ReadFully(descriptor->fd, buffer, span, start, 1)) != -1){
+            nBytes = nBytes > offset - start?min((ssize_t)size, nBytes - (ssize_t)(offset - start)):0;
+            memcpy(value, &buffer[offset - start], nBytes);
+        }
+        PutAlignedBuffer(handle, buffer, span);
+    }
+
+    return nBytes;
+}
+
+static int WriteDescriptor(KV_Filesystem_Handle* handle, KV_FS_Descriptor* descriptor, KV_Value value, size_t size, off_t offset){
+    if(!size)
+        return 0;
+
+    if(!descriptor->direct)
+        return WriteFully(descriptor->fd, value, size, offset);
+
+    // Write the enclosing aligned blocks, the first and last of which may hold data around the range
+    off_t start = AlignDown(offset);
+    off_t end = AlignUp(offset + (off_t)size);
+    size_t span = end - start;
+    KV_Value buffer;
+    struct stat st;
+    int status = -1;
+
+    if( !(buffer = GetAlignedBuffer(handle, span)) )
+        return -1;
+
+    // Concurrent writes to the same blocks would otherwise undo each other
+    g_mutex_lock(&descriptor->lock);
+    if(fstat(descriptor->fd, &st) == -1){
+        g_mutex_unlock(&descriptor->lock);
+        PutAlignedBuffer(handle, buffer, span);
+        return -1;
+    }
+
+    memset(buffer, 0, KV_FS_DIRECT_ALIGNMENT);
+    memset(&buffer[span - KV_FS_DIRECT_ALIGNMENT], 0, KV_FS_DIRECT_ALIGNMENT);
+
+    off_t tail = end - KV_FS_DIRECT_ALIGNMENT;
+    if( (offset == start || start >= st.st_size || ReadFully(descriptor->fd, buffer, KV_FS_DIRECT_ALIGNMENT, start, 1) != -1) &&
+        (offset + (off_t)size == end || tail >= st.st_size || (tail == start && offset > start) ||
+         ReadFully(descriptor->fd, &buffer[span - KV_FS_DIRECT_ALIGNMENT], KV_FS_DIRECT_ALIGNMENT, tail, 1) != -1) ){
+
+        memcpy(&buffer[offset - start], value, size);
+        if( (status = WriteFully(descriptor->fd, buffer, span, start)) == 0 && end > st.st_size){
+
+            // Drop the padding written past the end of the data
+            status = ftruncate(descriptor->fd, max(st.st_size, offset + (off_t)size));
+        }
+    }
+    g_mutex_unlock(&descriptor->lock);
+
+    PutAlignedBuffer(handle, buffer, span);
+    return status;
+}
+
+
+
+/*
+ * Copy a file by the cheapest means available, i.e. share its extents (reflink), have the kernel
+ * copy the data, or copy it through a buffer. Each method picks up where the previous one stopped.
+ */
+static int CopyFile(int srcFd, int dstFd){
+    off_t copied = 0;
+    ssize_t nBytes;
+    KV_Value buffer;
+
+#ifdef FICLONE
+    if(ioctl(dstFd, FICLONE, srcFd) == 0)
+        return 0;
+#endif
+
+#ifdef H3LIB_HAVE_COPY_FILE_RANGE
+    while( (nBytes = copy_file_range(srcFd, &copied, dstFd, NULL, SSIZE_MAX, 0)) > 0);
+
+    if(nBytes == 0)
+        return 0;
+
+    if(errno != EXDEV && errno != EINVAL && errno != ENOSYS && errno != EOPNOTSUPP)
+        return -1;
+#endif
+
+    if( !(buffer = malloc(KV_FS_COPY_BUFFER_SIZE)) )
+        return -1;
+
+    while( (nBytes = ReadFully(srcFd, buffer, KV_FS_COPY_BUFFER_SIZE, copied, 0)) > 0 && WriteFully(dstFd, buffer, nBytes, copied) == 0)
+        copied += nBytes;
+
+    free(buffer);
+    return nBytes == 0?0:-1;
+}
+
+/*
+ * With "links" enabled, copied parts are hard links to the original files. A linked part is given
+ * its own file before being written to, so that the copies do not see the change. Returns 1 if the
+ * file was replaced or deleted meanwhile, i.e. the descriptor no longer refers to the file at its
+ * path, 0 if it is not shared and -1 on failure.
+ */
+static int UnsharePart(char* fullKey, int fd){
+    char* tmpPath = NULL;
+    int srcFd, dstFd, status = -1;
+    struct stat st;
+
+    if(fstat(fd, &st) == -1)
+        return -1;
+
+    if(st.st_nlink == 0)
+        return 1;
+
+    if(st.st_nlink == 1)
+        return 0;
+
+    if(asprintf(&tmpPath, "%s.XXXXXX", fullKey) == -1)
+        return -1;
+
+    if( (dstFd = mkstemp(tmpPath)) != -1){
+        if( (srcFd = open(fullKey, O_RDONLY)) != -1){
+            if(fchmod(dstFd, st.st_mode & 07777) == 0 && CopyFile(srcFd, dstFd) == 0 && rename(tmpPath, fullKey) == 0)
+                status = 1;
+            close(srcFd);
+        }
+
+        if(status == -1)
+            unlink(tmpPath);
+        close(dstFd);
+    }
+    free(tmpPath);
+
+    return status;
+}
+
+
+// Sync the filesystem of every root (once per device) for all operations completed so far
+static int SyncRoots(KV_Filesystem_Handle* handle){
+    int error = 0;
+
+#ifdef H3LIB_HAVE_SYNCFS
+    dev_t devices[handle->nRoots + 1];
+    uint32_t i, j, nDevices = 0;
+    struct stat st;
+    int fd;
+
+    for(i=0; i<=handle->nRoots && !error; i++){
+        const char* root = i?handle->roots[i - 1]:handle->metadata_root;
+
+        // Roots are created along with their first key
+        if( (fd = open(root, O_RDONLY)) == -1 ){
+            error = errno != ENOENT;
+            continue;
+        }
+
+        if(fstat(fd, &st) != 0){
+            error = 1;
+        }
+        else {
+            for(j=0; j<nDevices && devices[j] != st.st_dev; j++);
+            if(j == nDevices){
+                devices[nDevices++] = st.st_dev;
+                error = syncfs(fd) != 0;
             }
         }
+        close(fd);
     }
-    else
-        status = KV_SUCCESS;
 
-    close(fd);
+    if(error)
+        LogActivity(H3_ERROR_MSG, "Syncing the store failed - %s\n", strerror(errno));
+#else
+    // Without syncfs() all filesystems are synced
+    sync();
+#endif
+
+    return !error;
+}
+
+static gpointer CommitThread(gpointer data){
+    KV_Filesystem_Handle* handle = data;
+    KV_FS_Commit* commit = &handle->commit;
+    uint64_t target;
+    gint64 deadline;
+    int synced;
+
+    g_mutex_lock(&commit->lock);
+    while(!commit->stop || commit->requested > commit->committed){
+        if(commit->requested == commit->committed){
+            g_cond_wait(&commit->pending, &commit->lock);
+            continue;
+        }
+
+        // Let the batch build up for a while, unless it is big enough already
+        deadline = g_get_monotonic_time() + handle->interval * G_TIME_SPAN_MILLISECOND;
+        while(!commit->stop && commit->requested - commit->committed < handle->batch &&
+              g_cond_wait_until(&commit->pending, &commit->lock, deadline));
 
-    return  status;
+        target = commit->requested;
+        g_mutex_unlock(&commit->lock);
+        synced = SyncRoots(handle);
+        g_mutex_lock(&commit->lock);
+
+        if(!synced){
+            if(commit->failedUpTo != commit->committed)
+                commit->failedFrom = commit->committed;
+            commit->failedUpTo = target;
+        }
+        commit->committed = target;
+        g_cond_broadcast(&commit->done);
+    }
+    g_mutex_unlock(&commit->lock);
+
+    return NULL;
 }
 
+// Take part in the next commit, waiting for it if asked to
+static int Commit(KV_Filesystem_Handle* handle, int wait){
+    KV_FS_Commit* commit = &handle->commit;
+    uint64_t ticket;
+    int committed = 1;
 
+    g_mutex_lock(&commit->lock);
+    ticket = ++commit->requested;
+    if(ticket - commit->committed == 1 || ticket - commit->committed >= handle->batch)
+        g_cond_signal(&commit->pending);
+
+    if(wait){
+        while(commit->committed < ticket)
+            g_cond_wait(&commit->done, &commit->lock);
+
+        committed = !(commit->failedFrom < ticket && ticket <= commit->failedUpTo);
+    }
+    g_mutex_unlock(&commit->lock);
+
+    return committed;
+}
+
+/*
+ * Make an operation durable as configured. The file written (if any) is synced in strict mode,
+ * as are the directories holding the entries that changed, i.e. that of the key and, for moves,
+ * that of the source key.
+ */
+static KV_Status Persist(KV_Filesystem_Handle* handle, KV_Key key, int fd, const char* fullKey, const char* srcFullKey){
+    int persisted = 1;
+
+    switch(handle->durability){
+        case KV_FS_DURABILITY_NONE:
+            break;
+
+        case KV_FS_DURABILITY_GROUP:
+            persisted = Commit(handle, !IsPartKey(key));
+            break;
+
+        case KV_FS_DURABILITY_STRICT:
+            persisted = (fd == -1 || fdatasync(fd) == 0) && SyncParent(fullKey) && (!srcFullKey || SyncParent(srcFullKey));
+            if(!persisted)
+                LogActivity(H3_ERROR_MSG, "Syncing key %s failed - %s\n", key, strerror(errno));
+            break;
+    }
+
+    return persisted?KV_SUCCESS:KV_FAILURE;
+}
+
+
+// Options are passed in the query of the URI, e.g. file:///tmp/h3?direct=1&descriptors=256&links=1&metadata=/nvme/h3&data=/disk1/h3,/disk2/h3
+static void ParseOptions(KV_Filesystem_Handle* handle, const char* query){
+    gchar** options = g_strsplit(query, "&", 0);
+    int i;
+
+    for(i=0; options[i]; i++){
+        char* value = strchr(options[i], '=');
+        if(!value)
+            continue;
+
+        *value++ = '\0';
+        if(strcmp(options[i], "descriptors") == 0)
+            handle->maxDescriptors = strtoul(value, NULL, 10);
+        else if(strcmp(options[i], "direct") == 0)
+            handle->direct = atoi(value) != 0;
+        else if(strcmp(options[i], "links") == 0)
+            handle->links = atoi(value) != 0;
+        else if(strcmp(options[i], "uring") == 0)
+            handle->uring = atoi(value) != 0;
+        else if(strcmp(options[i], "durability") == 0){
+            if(strcmp(value, "group") == 0)
+                handle->durability = KV_FS_DURABILITY_GROUP;
+            else if(strcmp(value, "strict") == 0)
+                handle->durability = KV_FS_DURABILITY_STRICT;
+            else if(strcmp(value, "none") == 0)
+                handle->durability = KV_FS_DURABILITY_NONE;
+            else
+                LogActivity(H3_INFO_MSG, "WARNING: Unknown durability in URI: %s\n", value);
+        }
+        else if(strcmp(options[i], "interval") == 0)
+            handle->interval = strtoul(value, NULL, 10);
+        else if(strcmp(options[i], "batch") == 0)
+            handle->batch = max(strtoul(value, NULL, 10), 1);
+        else if(strcmp(options[i], "metadata") == 0){
+            free(handle->metadata_root);
+            handle->metadata_root = strdup(value);
+        }
+        else if(strcmp(options[i], "data") == 0){
+            g_strfreev(handle->roots);
+            handle->roots = g_strsplit(value, ",", 0);
+        }
+        else
+            LogActivity(H3_INFO_MSG, "WARNING: Unknown option in URI: %s\n", options[i]);
+    }
+
+    g_strfreev(options);
+}
+
+// Paths given as options must be absolute, as keys placed elsewhere than configured would go missing
+static int SetRoots(KV_Filesystem_Handle* handle){
+    gchar** extraRoots = handle->roots;
+    uint32_t i, nExtraRoots = extraRoots?g_strv_length(extraRoots):0;
+    int valid = 1;
+
+    if(!handle->metadata_root){
+        handle->metadata_root = strdup(handle->root);
+    }
+    else if(handle->metadata_root[0] == '/'){
+        StripSlashes(handle->metadata_root);
+        LogActivity(H3_INFO_MSG, "INFO: Metadata path: %s\n", handle->metadata_root);
+    }
+    else {
+        LogActivity(H3_ERROR_MSG, "ERROR: Metadata path is not absolute: %s\n", handle->metadata_root);
+        valid = 0;
+    }
+    handle->metadata_root_path_len = strlen(handle->metadata_root);
+
+    // The root is always the first data root, followed by the additional ones (if any)
+    handle->roots = calloc(nExtraRoots + 1, sizeof(char*));
+    handle->roots[handle->nRoots++] = strdup(handle->root);
+    for(i=0; i<nExtraRoots; i++){
+        if(extraRoots[i][0] == '/'){
+            char* root = strdup(extraRoots[i]);
+            StripSlashes(root);
+            LogActivity(H3_INFO_MSG, "INFO: Data path: %s\n", root);
+            handle->roots[handle->nRoots++] = root;
+        }
+        else if(extraRoots[i][0]){
+            LogActivity(H3_ERROR_MSG, "ERROR: Data path is not absolute: %s\n", extraRoots[i]);
+            valid = 0;
+        }
+    }
+    g_strfreev(extraRoots);
+
+    return valid;
+}
+
+static void FreeRoots(KV_Filesystem_Handle* handle){
+    uint32_t i;
+
+    for(i=0; i<handle->nRoots; i++)
+        free(handle->roots[i]);
+    free(handle->roots);
+    free(handle->metadata_root);
+    free(handle->root);
+}
 
 KV_Handle KV_FS_Init(const char* storageUri) {
     struct parsed_url *url = parse_url(storageUri);
@@ -169,35 +943,95 @@ KV_Handle KV_FS_Init(const char* storageUri) {
         path = strdup("/tmp/h3");
         LogActivity(H3_INFO_MSG, "WARNING: No path in URI. Using default: /tmp/h3\n");
     }
-    parsed_url_free(url);
 
-    KV_Filesystem_Handle* handle = malloc(sizeof(KV_Filesystem_Handle));
+    KV_Filesystem_Handle* handle = calloc(1, sizeof(KV_Filesystem_Handle));
     handle->root = path;
     StripSlashes(handle->root);
     handle->root_path_len = strlen(handle->root);
 
+    handle->maxDescriptors = KV_FS_DESCRIPTORS;
+    handle->uring = 1;
+    handle->interval = KV_FS_COMMIT_INTERVAL;
+    handle->batch = KV_FS_COMMIT_BATCH;
+    if(url->query)
+        ParseOptions(handle, url->query);
+    parsed_url_free(url);
+
+    if(!SetRoots(handle)){
+        FreeRoots(handle);
+        free(handle);
+        return NULL;
+    }
+
+    g_mutex_init(&handle->lock);
+    handle->descriptors = g_hash_table_new(g_str_hash, g_str_equal);
+    g_queue_init(&handle->lru);
+    handle->directories = g_hash_table_new_full(g_str_hash, g_str_equal, free, NULL);
+
+    if(handle->durability == KV_FS_DURABILITY_GROUP){
+        g_mutex_init(&handle->commit.lock);
+        g_cond_init(&handle->commit.pending);
+        g_cond_init(&handle->commit.done);
+        handle->commit.thread = g_thread_new("kv_fs_commit", CommitThread, handle);
+    }
+
     return (KV_Handle)handle;
 }
 
 void KV_FS_Free(KV_Handle handle) {
     KV_Filesystem_Handle* iHandle = (KV_Filesystem_Handle*) handle;
-    free(iHandle->root);
+    KV_FS_Descriptor* descriptor;
+
+    // Operations still pending are committed before the thread exits
+    if(iHandle->commit.thread){
+        g_mutex_lock(&iHandle->commit.lock);
+        iHandle->commit.stop = 1;
+        g_cond_signal(&iHandle->commit.pending);
+        g_mutex_unlock(&iHandle->commit.lock);
+
+        g_thread_join(iHandle->commit.thread);
+        g_cond_clear(&iHandle->commit.pending);
+        g_cond_clear(&iHandle->commit.done);
+        g_mutex_clear(&iHandle->commit.lock);
+    }
+
+    while( (descriptor = g_queue_pop_head(&iHandle->lru)) )
+        CloseDescriptor(descriptor);
+
+    g_hash_table_destroy(iHandle->descriptors);
+    g_hash_table_destroy(iHandle->directories);
+    g_slist_free_full(iHandle->buffers, free);
+    g_slist_free_full(iHandle->rings, (GDestroyNotify)DestroyRing);
+    g_mutex_clear(&iHandle->lock);
+    FreeRoots(iHandle);
     free(iHandle);
     return;
 }
 
 KV_Status KV_FS_StorageInfo(KV_Handle handle, KV_StorageInfo* storageInfo) {
     KV_Filesystem_Handle* _handle = (KV_Filesystem_Handle*) handle;
+    dev_t devices[_handle->nRoots];
     struct statvfs stats;
+    struct stat st;
+    uint32_t i, j, nDevices = 0;
 
-    // Take the storage info 
-    if (statvfs(_handle->root, &stats) != 0) {
-        return KV_FAILURE;
-    }
+    storageInfo->totalSpace = storageInfo->freeSpace = 0;
+
+    // Take the storage info of each device holding data roots, once
+    for(i=0; i<_handle->nRoots; i++){
+        if (stat(_handle->roots[i], &st) != 0 || statvfs(_handle->roots[i], &stats) != 0) {
+            return KV_FAILURE;
+        }
+
+        for(j=0; j<nDevices && devices[j] != st.st_dev; j++);
+        if(j < nDevices)
+            continue;
+        devices[nDevices++] = st.st_dev;
 
-    // pass the storage space to the user
-    storageInfo->totalSpace = stats.f_bsize * stats.f_blocks; 
-    storageInfo->freeSpace  = stats.f_bsize * stats.f_bavail; 
+        // pass the storage space to the user
+        storageInfo->totalSpace += stats.f_bsize * stats.f_blocks;
+        storageInfo->freeSpace  += stats.f_bsize * stats.f_bavail;
+    }
     storageInfo->usedSpace  = storageInfo->totalSpace - storageInfo->freeSpace;
 
     return KV_SUCCESS;
@@ -225,95 +1059,244 @@ KV_Status KV_FS_ValidateKey(KV_Key key){
 }
 
 
-KV_Status KV_FS_List(KV_Handle handle, KV_Key prefix, uint8_t nTrim, KV_Key buffer, uint32_t offset, uint32_t* nKeys){
-    KV_Filesystem_Handle* storeHandle = (KV_Filesystem_Handle*) handle;
-    char* fullPrefix = GetFullPrefix(storeHandle, prefix);
-    int status = KV_FAILURE;
-
-    uint32_t nRequiredKeys = *nKeys>0?*nKeys:UINT32_MAX;
-    uint32_t nMatchingKeys = 0;
-    size_t prefixLen = strlen(fullPrefix);
-    size_t rootLen = strlen(storeHandle->root) + nTrim + 1;
-    size_t remaining = KV_LIST_BUFFER_SIZE;
-
-    int CopyDirEntry(const char* fpath, const struct stat* sb, int typeflag, struct FTW* ftwbuf) {
-
-    	if(S_ISREG(sb->st_mode)){
-    		size_t rawSize = strlen(fpath);
-    		int isFakeDir = iscntrl(fpath[rawSize-1]);
-
-    		if(strncmp(fpath, fullPrefix, prefixLen) == 0 || (isFakeDir && fullPrefix[prefixLen-1] == '/' && strncmp(fpath, fullPrefix, prefixLen -1) == 0 )){
-    			LogActivity(H3_DEBUG_MSG, "'%s'\n", fpath);
-                if(offset)
-                    offset--;
-
-                else if( nMatchingKeys < nRequiredKeys ){
-                	size_t entrySize = rawSize - rootLen;
-
-                    if(remaining >= (entrySize + 1)) {
-                        memcpy(&buffer[KV_LIST_BUFFER_SIZE - remaining], &fpath[rootLen], entrySize);
-
-                        // Replace the directory marker with '/'
-                        if(isFakeDir){
-                        	buffer[KV_LIST_BUFFER_SIZE - remaining + entrySize - 1] = '/';
-                        }
-
-                        remaining -= (entrySize+1);
-                        nMatchingKeys++;
-                    }
-                    else
-                        return KV_CONTINUE;
-                }
-                else
-                    return KV_CONTINUE;
-    		}
-    	}
+/*
+ * Listings walk only the subtree implied by the prefix, i.e. the directory up to the
+ * last slash of the prefix, where entries are matched against the rest of the prefix.
+ * Entries of each directory are visited in the order of the keys they hold so that
+ * the keys come out sorted and offsets remain stable across calls. Part keys are never
+ * listed, thus listings stay within the metadata root.
+ */
+typedef struct {
+    KV_Key buffer;
+    size_t remaining;
+    size_t rootLen;
+    size_t trimmed;                 // Length of the root, the separator and the trimmed key characters
+    uint32_t offset;
+    uint32_t nRequired;
+    uint32_t nMatching;
+    KV_ListCallback function;
+    void* userData;
+    char path[PATH_MAX];
+}KV_FS_Listing;
 
-        return 0;
+typedef struct {
+    char* name;
+    char* key;                      // The name as it appears within the keys, i.e. with a trailing '/' for directories
+    uint8_t isDir;
+}KV_FS_Entry;
+
+static int CompareEntries(const void* a, const void* b){
+    const KV_FS_Entry* entryA = a;
+    const KV_FS_Entry* entryB = b;
+    int result = strcmp(entryA->key, entryB->key);
+
+    // A directory object "x/" sorts before the keys under directory "x"
+    return result?result:(entryA->isDir - entryB->isDir);
+}
+
+// Read a whole file met while walking the tree
+static KV_Value ReadEntry(const char* path, size_t* size){
+    KV_Value value = NULL;
+    struct stat st;
+    int fd;
+
+    if((fd = open(path, O_RDONLY)) != -1){
+        if(fstat(fd, &st) == 0 && (value = malloc(max(st.st_size, 1)))){
+            if(read(fd, value, st.st_size) == st.st_size)
+                *size = st.st_size;
+            else{
+                free(value);
+                value = NULL;
+            }
+        }
+        close(fd);
     }
 
+    return value;
+}
 
-    int CountDirEntry(const char* fpath, const struct stat* sb, int typeflag, struct FTW* ftwbuf) {
-    	if(S_ISREG(sb->st_mode)){
-    		size_t rawSize = strlen(fpath);
-    		int isFakeDir = iscntrl(fpath[rawSize-1]);
+// Account for the key stored in the file at the current path
+static KV_Status ListEntry(KV_FS_Listing* listing, size_t pathLen){
+    LogActivity(H3_DEBUG_MSG, "'%s'\n", listing->path);
 
-    		if(strncmp(fpath, fullPrefix, prefixLen) == 0 || (isFakeDir && fullPrefix[prefixLen-1] == '/')){
-                if(offset)
-                    offset--;
-                else if (nMatchingKeys < nRequiredKeys)
-                    nMatchingKeys++;
-                else
-                    return KV_CONTINUE;
+    if(listing->offset){
+        listing->offset--;
+        return KV_SUCCESS;
+    }
 
-    		}
-    	}
+    if(listing->nMatching == listing->nRequired)
+        return KV_CONTINUE;
 
-        return 0;
+    if(listing->buffer){
+        size_t entrySize = pathLen - listing->trimmed;
+        if(listing->remaining < entrySize + 1)
+            return KV_CONTINUE;
+
+        KV_Key entry = &listing->buffer[KV_LIST_BUFFER_SIZE - listing->remaining];
+        memcpy(entry, &listing->path[listing->trimmed], entrySize);
+
+        // Replace the directory marker with '/'
+        if(listing->path[pathLen - 1] == KV_FS_DIRECTORY_CHAR){
+            entry[entrySize - 1] = '/';
+        }
+
+        if(listing->function){
+            size_t size = 0;
+            KV_Value value = ReadEntry(listing->path, &size);
+            listing->function(entry, value, size, listing->userData);
+            free(value);
+        }
+
+        listing->remaining -= (entrySize + 1);
     }
 
-    if(buffer){
-    	memset(buffer, 0, KV_LIST_BUFFER_SIZE);
-        status = nftw(storeHandle->root, CopyDirEntry, 10, FTW_DEPTH|FTW_MOUNT|FTW_PHYS);
+    listing->nMatching++;
+    return KV_SUCCESS;
+}
+
+// Walk the directory at the current path, taking only the entries that start with the pattern (if any)
+static KV_Status ListDirectory(KV_FS_Listing* listing, size_t pathLen, const char* pattern){
+    KV_Status status = KV_SUCCESS;
+    size_t patternLen = pattern?strlen(pattern):0;
+    GArray* entries;
+    struct dirent* dirEntry;
+    struct stat st;
+    DIR* dir;
+    guint i;
+
+    if( !(dir = opendir(listing->path)) ){
+        if(errno == ENOENT || errno == ENOTDIR)
+            return KV_SUCCESS;
+
+        LogActivity(H3_ERROR_MSG, "Listing directory %s failed - %s\n", listing->path, strerror(errno));
+        return KV_FAILURE;
     }
-    else
-        status = nftw(storeHandle->root, CountDirEntry, 10, FTW_DEPTH|FTW_MOUNT|FTW_PHYS);
 
-    *nKeys = nMatchingKeys;
+    entries = g_array_new(FALSE, FALSE, sizeof(KV_FS_Entry));
+    while( (dirEntry = readdir(dir)) ){
+        KV_FS_Entry entry;
+        size_t nameLen = strlen(dirEntry->d_name);
+        unsigned char type = dirEntry->d_type;
+
+        if(strcmp(dirEntry->d_name, ".") == 0 || strcmp(dirEntry->d_name, "..") == 0)
+            continue;
+
+        // Part files are not named after their keys, thus they are not listed
+        if(pathLen == listing->rootLen && strcmp(dirEntry->d_name, KV_FS_PARTS_DIR) == 0)
+            continue;
+
+        if(type == DT_UNKNOWN && pathLen + nameLen + 1 < PATH_MAX){
+            listing->path[pathLen] = '/';
+            strcpy(&listing->path[pathLen + 1], dirEntry->d_name);
+            if(lstat(listing->path, &st) == 0)
+                type = S_ISDIR(st.st_mode)?DT_DIR:(S_ISREG(st.st_mode)?DT_REG:DT_UNKNOWN);
+            listing->path[pathLen] = '\0';
+        }
 
-    if(status == 0)
-        status = KV_SUCCESS;
+        if(type != DT_DIR && type != DT_REG)
+            continue;
+
+        entry.isDir = (type == DT_DIR);
+        entry.name = strdup(dirEntry->d_name);
+        entry.key = malloc(nameLen + 2);
+        strcpy(entry.key, dirEntry->d_name);
+        if(entry.isDir)
+            strcat(entry.key, "/");
+        else if(entry.key[nameLen - 1] == KV_FS_DIRECTORY_CHAR)
+            entry.key[nameLen - 1] = '/';
+
+        if(patternLen && strncmp(entry.key, pattern, patternLen)){
+            free(entry.name);
+            free(entry.key);
+            continue;
+        }
 
-    else if (status < -0){
-    	if (errno == ENAMETOOLONG)
-    		status = KV_KEY_TOO_LONG;
-    	else{
-    		status = KV_FAILURE;
-    		LogActivity(H3_ERROR_MSG, "Listing from key %s failed - %s\n",fullPrefix, strerror(errno));
-    	}
+        g_array_append_val(entries, entry);
+    }
+    closedir(dir);
+
+    g_array_sort(entries, CompareEntries);
+
+    for(i=0; i<entries->len; i++){
+        KV_FS_Entry* entry = &g_array_index(entries, KV_FS_Entry, i);
+        size_t entryPathLen = pathLen + 1 + strlen(entry->name);
+
+        if(status == KV_SUCCESS){
+            if(entryPathLen >= PATH_MAX){
+                status = KV_KEY_TOO_LONG;
+            }
+            else{
+                listing->path[pathLen] = '/';
+                strcpy(&listing->path[pathLen + 1], entry->name);
+                status = entry->isDir?ListDirectory(listing, entryPathLen, NULL):ListEntry(listing, entryPathLen);
+            }
+        }
+
+        free(entry->name);
+        free(entry->key);
     }
+    listing->path[pathLen] = '\0';
+    g_array_free(entries, TRUE);
+
+    return status;
+}
+
+static KV_Status List(KV_Handle handle, KV_Key prefix, uint8_t nTrim, KV_Key buffer, uint32_t offset, uint32_t* nKeys, KV_ListCallback function, void* userData){
+    KV_Filesystem_Handle* storeHandle = (KV_Filesystem_Handle*) handle;
+    KV_FS_Listing* listing = calloc(1, sizeof(KV_FS_Listing));
+    KV_Status status = KV_SUCCESS;
+
+    if(!listing)
+        return KV_FAILURE;
+
+    // The directory implied by the prefix, the rest of the prefix is matched against its entries
+    char* pattern = strrchr(prefix, '/');
+    int dirLen = pattern?pattern - prefix:0;
+    pattern = pattern?pattern + 1:prefix;
+
+    size_t pathLen = snprintf(listing->path, PATH_MAX, "%s%s%.*s", storeHandle->metadata_root, dirLen?"/":"", dirLen, prefix);
+    if(pathLen + 1 >= PATH_MAX){
+        free(listing);
+        return KV_KEY_TOO_LONG;
+    }
+
+    listing->buffer = buffer;
+    listing->remaining = KV_LIST_BUFFER_SIZE;
+    listing->rootLen = storeHandle->metadata_root_path_len;
+    listing->trimmed = storeHandle->metadata_root_path_len + nTrim + 1;
+    listing->offset = offset;
+    listing->nRequired = *nKeys>0?*nKeys:UINT32_MAX;
+    listing->function = function;
+    listing->userData = userData;
+
+    if(buffer)
+        memset(buffer, 0, KV_LIST_BUFFER_SIZE);
+
+    // A prefix ending with '/' also matches the directory object stored next to the directory
+    if(dirLen && !*pattern){
+        struct stat st;
+        listing->path[pathLen] = KV_FS_DIRECTORY_CHAR;
+        if(lstat(listing->path, &st) == 0 && S_ISREG(st.st_mode))
+            status = ListEntry(listing, pathLen + 1);
+        listing->path[pathLen] = '\0';
+    }
+
+    if(status == KV_SUCCESS)
+        status = ListDirectory(listing, pathLen, pattern);
+
+    *nKeys = listing->nMatching;
+    free(listing);
+
+    return status;
+}
+
+
+KV_Status KV_FS_List(KV_Handle handle, KV_Key prefix, uint8_t nTrim, KV_Key buffer, uint32_t offset, uint32_t* nKeys){
+    return List(handle, prefix, nTrim, buffer, offset, nKeys, NULL, NULL);
+}
 
-    return (KV_Status)status;
+KV_Status KV_FS_ListMetadata(KV_Handle handle, KV_Key prefix, uint8_t nTrim, KV_Key buffer, uint32_t offset, uint32_t* nKeys, KV_ListCallback function, void* userData){
+    return List(handle, prefix, nTrim, buffer, offset, nKeys, function, userData);
 }
 
 
@@ -343,36 +1326,41 @@ KV_Status KV_FS_Read(KV_Handle handle, KV_Key key, off_t offset, KV_Value* value
     KV_Filesystem_Handle* storeHandle = (KV_Filesystem_Handle*) handle;
     char* fullKey = GetFullKey(storeHandle, key);
     KV_Status status = KV_FAILURE;
+    KV_FS_Descriptor* descriptor;
     struct stat st;
+    ssize_t nBytes;
     char freeOnError = 0;
+    int attempts = 2, stale;
 
     if(!fullKey){
         return KV_FAILURE;
     }
 
-    if(stat(fullKey, &st)!= -1 && S_ISREG(st.st_mode)){
-    	int fd;
+    while( attempts-- && (descriptor = AcquireDescriptor(storeHandle, key, fullKey, 0)) ){
 
-		if( (fd = open(fullKey, O_RDONLY)) != -1){
+		// Check if we need to allocate the buffer
+		if(*value == NULL && fstat(descriptor->fd, &st) != -1){
+			*size = st.st_size > offset?st.st_size - offset:0;
+			*value = malloc(max(*size, 1));
+			freeOnError = 1;
+		}
 
-			// Check if we need to allocate the buffer
-			if(*value == NULL){
-				*size = st.st_size - offset;
-				*value = malloc(*size - offset);
-				freeOnError = 1;
-			}
+		// At this point we MUST have a buffer
+		if( *value && (nBytes = ReadDescriptor(storeHandle, descriptor, *value, *size, offset)) != -1){
+			*size = nBytes;
+			status = KV_SUCCESS;
+		}
 
-			// At this point we MUST have a buffer
-			if( *value ){
-				// Read the data
-				if(lseek(fd, offset, SEEK_SET) != offset){
-					LogActivity(H3_ERROR_MSG, "Error read seeking in offset %" PRIu64 "\n",offset);
-				}
-				else if((*size = read(fd, *value, *size)) != -1){
-					status = KV_SUCCESS;
-				}
-			}
-			close(fd);
+		stale = status != KV_SUCCESS && ForgetStale(storeHandle, descriptor);
+		ReleaseDescriptor(storeHandle, descriptor);
+		if(!stale)
+			break;
+
+		// Read the file now at the path from scratch
+		if(freeOnError){
+			free(*value);
+			*value = NULL;
+			freeOnError = 0;
 		}
     }
 
@@ -404,20 +1392,146 @@ KV_Status KV_FS_Read(KV_Handle handle, KV_Key key, off_t offset, KV_Value* value
     return status;
 }
 
+// Read a part once more, with a descriptor of its own
+static ssize_t ReadFresh(KV_Filesystem_Handle* handle, KV_ReadRequest* request){
+    char* fullKey = GetFullKey(handle, request->key);
+    KV_FS_Descriptor* descriptor;
+    ssize_t nBytes = -1;
+
+    if(fullKey && (descriptor = AcquireDescriptor(handle, request->key, fullKey, 0))){
+        nBytes = ReadDescriptor(handle, descriptor, request->value, request->size, request->offset);
+        ReleaseDescriptor(handle, descriptor);
+    }
+
+    free(fullKey);
+    return nBytes;
+}
+
+/*
+ * Parts are read through io_uring, so that a batch is submitted and reaped with a few system
+ * calls. Files are opened beforehand through the descriptor cache, i.e. usually not at all.
+ * Files opened with O_DIRECT, reads the ring failed to serve and short reads are completed
+ * synchronously, as are all reads if io_uring is not available.
+ */
+KV_Status KV_FS_ReadBatch(KV_Handle handle, KV_ReadRequest* requests, uint32_t nRequests){
+    KV_Filesystem_Handle* storeHandle = (KV_Filesystem_Handle*) handle;
+    KV_FS_Descriptor** descriptors = calloc(nRequests, sizeof(KV_FS_Descriptor*));
+    KV_FS_RingRead* reads = malloc(nRequests * sizeof(KV_FS_RingRead));
+    uint32_t* owners = malloc(nRequests * sizeof(uint32_t));
+    KV_Status status = KV_SUCCESS;
+    KV_FS_Ring* ring = NULL;
+    uint32_t i, nReads = 0;
+    ssize_t nBytes;
+
+    if(!descriptors || !reads || !owners){
+        free(descriptors);
+        free(reads);
+        free(owners);
+        return KV_FAILURE;
+    }
+
+    for(i=0; i<nRequests; i++){
+        KV_ReadRequest* request = &requests[i];
+        char* fullKey = GetFullKey(storeHandle, request->key);
+
+        request->status = KV_FAILURE;
+        if(!fullKey || !request->value){
+            free(fullKey);
+            continue;
+        }
+
+        if( !(descriptors[i] = AcquireDescriptor(storeHandle, request->key, fullKey, 0)) ){
+            if(errno == ENAMETOOLONG)
+                request->status = KV_KEY_TOO_LONG;
+            else if(errno == ENOENT || errno == EISDIR)
+                request->status = KV_KEY_NOT_EXIST;
+            else
+                LogActivity(H3_ERROR_MSG, "Reading from key %s failed - %s\n",fullKey, strerror(errno));
+        }
+        else if(!descriptors[i]->direct){
+            reads[nReads].fd = descriptors[i]->fd;
+            reads[nReads].buffer = request->value;
+            reads[nReads].size = request->size;
+            reads[nReads].offset = request->offset;
+            reads[nReads].result = -ECANCELED;
+            owners[nReads++] = i;
+        }
+        else if( (nBytes = ReadDescriptor(storeHandle, descriptors[i], request->value, request->size, request->offset)) != -1 ||
+                 (ForgetStale(storeHandle, descriptors[i]) && (nBytes = ReadFresh(storeHandle, request)) != -1) ){
+            request->size = nBytes;
+            request->status = KV_SUCCESS;
+        }
+        else
+            LogActivity(H3_ERROR_MSG, "Reading from key %s failed - %s\n",fullKey, strerror(errno));
+
+        free(fullKey);
+    }
+
+    if(nReads && (ring = GetRing(storeHandle))){
+        if(RingRead(ring, reads, nReads) == 0)
+            PutRing(storeHandle, ring);
+        else {
+            LogActivity(H3_ERROR_MSG, "Submitting reads failed - %s\n", strerror(errno));
+            DestroyRing(ring);
+        }
+    }
+
+    for(i=0; i<nReads; i++){
+        KV_FS_RingRead* read = &reads[i];
+        KV_ReadRequest* request = &requests[owners[i]];
+
+        nBytes = read->result;
+        if(nBytes < 0)
+            nBytes = ReadDescriptor(storeHandle, descriptors[owners[i]], read->buffer, read->size, read->offset);
+        else if(nBytes > 0 && (size_t)nBytes < read->size){
+            ssize_t rest = ReadDescriptor(storeHandle, descriptors[owners[i]], &read->buffer[nBytes], read->size - nBytes, read->offset + nBytes);
+            nBytes = rest == -1?-1:nBytes + rest;
+        }
+
+        // Read again from the file now at the path
+        if(nBytes == -1 && ForgetStale(storeHandle, descriptors[owners[i]]))
+            nBytes = ReadFresh(storeHandle, request);
+
+        if(nBytes != -1){
+            request->size = nBytes;
+            request->status = KV_SUCCESS;
+        }
+        else
+            LogActivity(H3_ERROR_MSG, "Reading from key %s failed - %s\n",request->key, strerror(errno));
+    }
+
+    for(i=0; i<nRequests; i++){
+        if(descriptors[i])
+            ReleaseDescriptor(storeHandle, descriptors[i]);
+
+        if(requests[i].status != KV_SUCCESS)
+            status = KV_FAILURE;
+    }
+
+    free(descriptors);
+    free(reads);
+    free(owners);
+
+    return status;
+}
+
 KV_Status KV_FS_Create(KV_Handle handle, KV_Key key, KV_Value value, size_t size){
     KV_Filesystem_Handle* storeHandle = (KV_Filesystem_Handle*) handle;
     char* fullKey = GetFullKey(storeHandle, key);
     KV_Status status = KV_FAILURE;
-    int fd;
+    KV_FS_Descriptor* descriptor;
 
     if(!fullKey){
         return KV_FAILURE;
     }
 
-    MakePath(fullKey, S_IRWXU | S_IRWXG | S_IRWXO);
+    if( (descriptor = AcquireDescriptor(storeHandle, key, fullKey, O_CREAT|O_EXCL)) ){
+        if(WriteDescriptor(storeHandle, descriptor, value, size, 0) == 0)
+            status = Persist(storeHandle, key, descriptor->fd, fullKey, NULL);
+        else
+            LogActivity(H3_ERROR_MSG, "Writing key %s failed - %s\n",key, strerror(errno));
 
-    if( (fd = open(fullKey,O_CREAT|O_EXCL|O_WRONLY,0666)) != -1){
-        return Write(fd, value, 0, size);
+        ReleaseDescriptor(storeHandle, descriptor);
     }
     else if( errno == EEXIST ){
         status =  KV_KEY_EXIST;
@@ -437,19 +1551,28 @@ KV_Status KV_FS_Update(KV_Handle handle, KV_Key key, KV_Value value, off_t offse
     KV_Filesystem_Handle* storeHandle = (KV_Filesystem_Handle*) handle;
     char* fullKey = GetFullKey(storeHandle, key);
     KV_Status status = KV_FAILURE;
-    int fd;
+    KV_FS_Descriptor* descriptor;
+    int shared;
 
     if(!fullKey){
         return KV_FAILURE;
     }
 
-    MakePath(fullKey, S_IRWXU | S_IRWXG | S_IRWXO);
-
-    if( (fd = open(fullKey,O_CREAT|O_WRONLY,0666)) != -1){
-        return Write(fd, value, offset, size);
+    // A part linked to its copies is given its own file, the cached descriptor refers to the shared one, as it does to a file deleted elsewhere
+    descriptor = AcquireDescriptor(storeHandle, key, fullKey, O_CREAT);
+    if(descriptor && IsPartKey(key) && (shared = UnsharePart(fullKey, descriptor->fd))){
+        ReleaseDescriptor(storeHandle, descriptor);
+        ForgetDescriptor(storeHandle, fullKey);
+        descriptor = shared == 1?AcquireDescriptor(storeHandle, key, fullKey, O_CREAT):NULL;
     }
-    else if( errno == EEXIST ){
-        status =  KV_KEY_EXIST;
+
+    if(descriptor){
+        if(WriteDescriptor(storeHandle, descriptor, value, size, offset) == 0)
+            status = Persist(storeHandle, key, descriptor->fd, fullKey, NULL);
+        else
+            LogActivity(H3_ERROR_MSG, "Writing key %s failed - %s\n",key, strerror(errno));
+
+        ReleaseDescriptor(storeHandle, descriptor);
     }
     else if(errno == ENAMETOOLONG){
     	status = KV_KEY_TOO_LONG;
@@ -481,17 +1604,21 @@ KV_Status KV_FS_Copy(KV_Handle handle, KV_Key src_key, KV_Key dest_key) {
         return KV_FAILURE;
     }
 
-    MakePath(dstFullKey, S_IRWXU | S_IRWXG | S_IRWXO);
+    // The copy is always a new file, as the current one may be shared with other parts
+    ForgetDescriptor(storeHandle, dstFullKey);
+    unlink(dstFullKey);
 
-    if( (srcFd = open(srcFullKey, O_RDONLY)) != -1 ){
-        if( (dstFd = open(dstFullKey, O_CREAT|O_WRONLY|O_TRUNC, 0666)) != -1){
-            ssize_t readSize, writeSize;
-            char buffer[4096]; // 4K
-
-            while((readSize = read(srcFd, buffer, 4096)) > 0 && (writeSize = write(dstFd, buffer, readSize)) > 0 && readSize == writeSize);
-            if(readSize == 0){
-                status = KV_SUCCESS;
-            }
+    // Parts may share their file until either is written to
+    if(storeHandle->links && IsPartKey(src_key) && IsPartKey(dest_key) &&
+       MakePath(storeHandle, dstFullKey, S_IRWXU | S_IRWXG | S_IRWXO) && link(srcFullKey, dstFullKey) == 0){
+        status = Persist(storeHandle, dest_key, -1, dstFullKey, NULL);
+    }
+    else if( (srcFd = open(srcFullKey, O_RDONLY)) != -1 ){
+        if( (dstFd = OpenFullKey(storeHandle, dstFullKey, O_CREAT|O_WRONLY|O_TRUNC)) != -1){
+            if(CopyFile(srcFd, dstFd) == 0)
+                status = Persist(storeHandle, dest_key, dstFd, dstFullKey, NULL);
+            else
+                LogActivity(H3_ERROR_MSG, "Copying key %s to %s failed - %s\n",src_key, dest_key, strerror(errno));
             close(dstFd);
         }
         else if(errno == ENAMETOOLONG){
@@ -521,8 +1648,10 @@ KV_Status KV_FS_Delete(KV_Handle handle, KV_Key key) {
     KV_Status status = KV_FAILURE;
 
     if(fullKey){
+    	ForgetDescriptor(storeHandle, fullKey);
     	if(remove(fullKey) == 0){
-    		status = KV_SUCCESS;
+    		PrunePartDir(storeHandle, key, fullKey);
+    		status = Persist(storeHandle, key, -1, fullKey, NULL);
     	}
     	else if(errno == ENOENT){
     		status = KV_KEY_NOT_EXIST;
@@ -555,10 +1684,18 @@ KV_Status KV_FS_Move(KV_Handle handle, KV_Key src_key, KV_Key dest_key) {
         return KV_FAILURE;
     }
 
-    MakePath(dstFullKey, S_IRWXU | S_IRWXG | S_IRWXO);
+    ForgetDescriptor(storeHandle, srcFullKey);
+    ForgetDescriptor(storeHandle, dstFullKey);
+    MakePath(storeHandle, dstFullKey, S_IRWXU | S_IRWXG | S_IRWXO);
 
     if( rename(srcFullKey, dstFullKey) != -1){
-        status = KV_SUCCESS;
+        PrunePartDir(storeHandle, src_key, srcFullKey);
+        status = Persist(storeHandle, dest_key, -1, dstFullKey, srcFullKey);
+    }
+    else if(errno == EXDEV){
+        // The keys are placed on different data roots
+        if( (status = KV_FS_Copy(handle, src_key, dest_key)) == KV_SUCCESS)
+            status = KV_FS_Delete(handle, src_key);
     }
     else if(errno == ENOENT){
         status = KV_KEY_NOT_EXIST;
@@ -577,8 +1714,30 @@ KV_Status KV_FS_Move(KV_Handle handle, KV_Key src_key, KV_Key dest_key) {
 }
 
 
+KV_Status KV_FS_Open(KV_Handle handle, KV_Key key, int* fd) {
+    KV_Filesystem_Handle* storeHandle = (KV_Filesystem_Handle*) handle;
+    char* fullKey = GetFullKey(storeHandle, key);
+    KV_Status status = KV_FAILURE;
+
+    if(!fullKey){
+        return KV_FAILURE;
+    }
+
+    if( (*fd = open(fullKey, O_RDONLY)) != -1)
+        status = KV_SUCCESS;
+    else if(errno == ENOENT)
+        status = KV_KEY_NOT_EXIST;
+    else if(errno == ENAMETOOLONG)
+        status = KV_KEY_TOO_LONG;
+    else
+        LogActivity(H3_ERROR_MSG, "Opening key %s failed - %s\n",fullKey, strerror(errno));
+
+    free(fullKey);
+    return status;
+}
+
 KV_Status KV_FS_Sync(KV_Handle handle) {
-    return KV_FAILURE;
+    return SyncRoots((KV_Filesystem_Handle*) handle)?KV_SUCCESS:KV_FAILURE;
 }
 
 
@@ -594,15 +1753,18 @@ KV_Operations operationsFilesystem = {
     .metadata_delete = KV_FS_Delete,
     .metadata_move = KV_FS_Move,
     .metadata_exists = KV_FS_Exists,
+    .metadata_list = KV_FS_ListMetadata,
 
     .list = KV_FS_List,
     .exists = KV_FS_Exists,
     .read = KV_FS_Read,
+    .read_batch = KV_FS_ReadBatch,
     .create = KV_FS_Create,
     .update = KV_FS_Update,
     .write = KV_FS_Write,
     .copy = KV_FS_Copy,
     .move = KV_FS_Move,
     .delete = KV_FS_Delete,
+    .open = KV_FS_Open,
     .sync = KV_FS_Sync
 };
@@ -0,0 +1,210 @@
+// Copyright [2019] [FORTH-ICS]
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "h3lib_config.h"
+#include "kv_fs_uring.h"
+
+#ifdef H3LIB_HAVE_IO_URING
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+/*
+ * A minimal io_uring engine for the filesystem store, talking to the kernel directly so that no
+ * library is needed. A ring serves one thread at a time; the reads handed to it are queued as
+ * long as there is room in the submission queue and reaped in batches as they complete, so that
+ * a whole batch costs a few system calls rather than one per part. Without io_uring support, no
+ * ring can be created and the caller reads synchronously.
+ */
+
+#ifdef H3LIB_HAVE_IO_URING
+
+struct KV_FS_Ring{
+    int fd;
+    uint32_t depth;
+
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+    unsigned *cqHead, *cqTail, *cqMask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+
+    char *sqRing, *cqRing;
+    size_t sqRingSize, cqRingSize, sqesSize;
+};
+
+static void* MapRing(int fd, size_t size, off_t offset){
+    void* area = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+    return area == MAP_FAILED?NULL:area;
+}
+
+KV_FS_Ring* CreateRing(uint32_t depth){
+    struct io_uring_params params;
+    KV_FS_Ring* ring;
+
+    if( !(ring = calloc(1, sizeof(KV_FS_Ring))) )
+        return NULL;
+
+    memset(&params, 0, sizeof(struct io_uring_params));
+    if( (ring->fd = syscall(__NR_io_uring_setup, depth, &params)) == -1 ){
+        free(ring);
+        return NULL;
+    }
+
+    ring->depth = params.sq_entries;
+    ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    // Newer kernels map both queues at once
+    if(params.features & IORING_FEAT_SINGLE_MMAP){
+        ring->sqRingSize = ring->cqRingSize = ring->sqRingSize > ring->cqRingSize?ring->sqRingSize:ring->cqRingSize;
+        ring->cqRing = ring->sqRing = MapRing(ring->fd, ring->sqRingSize, IORING_OFF_SQ_RING);
+    }
+    else {
+        ring->sqRing = MapRing(ring->fd, ring->sqRingSize, IORING_OFF_SQ_RING);
+        ring->cqRing = MapRing(ring->fd, ring->cqRingSize, IORING_OFF_CQ_RING);
+    }
+    ring->sqes = MapRing(ring->fd, ring->sqesSize, IORING_OFF_SQES);
+
+    if(!ring->sqRing || !ring->cqRing || !ring->sqes){
+        DestroyRing(ring);
+        return NULL;
+    }
+
+    ring->sqHead = (void*)(ring->sqRing + params.sq_off.head);
+    ring->sqTail = (void*)(ring->sqRing + params.sq_off.tail);
+    ring->sqMask = (void*)(ring->sqRing + params.sq_off.ring_mask);
+    ring->sqArray = (void*)(ring->sqRing + params.sq_off.array);
+    ring->cqHead = (void*)(ring->cqRing + params.cq_off.head);
+    ring->cqTail = (void*)(ring->cqRing + params.cq_off.tail);
+    ring->cqMask = (void*)(ring->cqRing + params.cq_off.ring_mask);
+    ring->cqes = (void*)(ring->cqRing + params.cq_off.cqes);
+
+    return ring;
+}
+
+void DestroyRing(KV_FS_Ring* ring){
+    if(ring->sqes)
+        munmap(ring->sqes, ring->sqesSize);
+
+    if(ring->cqRing && ring->cqRing != ring->sqRing)
+        munmap(ring->cqRing, ring->cqRingSize);
+
+    if(ring->sqRing)
+        munmap(ring->sqRing, ring->sqRingSize);
+
+    close(ring->fd);
+    free(ring);
+}
+
+// Record the results of the reads completed so far, returns their number
+static uint32_t Reap(KV_FS_Ring* ring, KV_FS_RingRead* reads){
+    unsigned head = *ring->cqHead;
+    uint32_t nReaped = 0;
+
+    while(head != __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)){
+        struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cqMask];
+        reads[cqe->user_data].result = cqe->res;
+        head++;
+        nReaped++;
+    }
+    __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+
+    return nReaped;
+}
+
+/*
+ * Returns 0 once all reads have completed, each with its own result. On -1 the ring is no
+ * longer usable and is to be destroyed, the reads not completed are left with -ECANCELED.
+ * Reads are never left in flight, thus their buffers may be reused in either case.
+ */
+int RingRead(KV_FS_Ring* ring, KV_FS_RingRead* reads, uint32_t nReads){
+    uint32_t nQueued = 0, nCompleted = 0, i;
+    unsigned tail;
+
+    for(i=0; i<nReads; i++)
+        reads[i].result = -ECANCELED;
+
+    while(nCompleted < nReads){
+
+        // Queue as many reads as the ring holds, completions are bounded by the same depth
+        tail = *ring->sqTail;
+        while(nQueued < nReads && nQueued - nCompleted < ring->depth &&
+              tail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE) < ring->depth){
+            unsigned index = tail & *ring->sqMask;
+            struct io_uring_sqe* sqe = &ring->sqes[index];
+
+            memset(sqe, 0, sizeof(struct io_uring_sqe));
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = reads[nQueued].fd;
+            sqe->addr = (uintptr_t)reads[nQueued].buffer;
+            sqe->len = reads[nQueued].size;
+            sqe->off = reads[nQueued].offset;
+            sqe->user_data = nQueued;
+
+            ring->sqArray[index] = index;
+            tail++;
+            nQueued++;
+        }
+        __atomic_store_n(ring->sqTail, tail, __ATOMIC_RELEASE);
+
+        // Submit what is pending and wait for at least one completion
+        unsigned nPending = tail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+        if(syscall(__NR_io_uring_enter, ring->fd, nPending, 1, IORING_ENTER_GETEVENTS, NULL, 0) == -1 &&
+           errno != EINTR && errno != EAGAIN && errno != EBUSY){
+            int error = errno;
+
+            // Withdraw the reads the kernel has not taken, those taken write to their buffers until they complete
+            unsigned head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+            uint32_t nSubmitted = nQueued - (tail - head);
+            __atomic_store_n(ring->sqTail, head, __ATOMIC_RELEASE);
+
+            while( (nCompleted += Reap(ring, reads)) < nSubmitted ){
+                if(syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) == -1 && errno != EINTR)
+                    sched_yield();
+            }
+
+            errno = error;
+            return -1;
+        }
+
+        nCompleted += Reap(ring, reads);
+    }
+
+    return 0;
+}
+
+#else
+
+KV_FS_Ring* CreateRing(uint32_t depth){
+    errno = ENOSYS;
+    return NULL;
+}
+
+void DestroyRing(KV_FS_Ring* ring){
+}
+
+int RingRead(KV_FS_Ring* ring, KV_FS_RingRead* reads, uint32_t nReads){
+    errno = ENOSYS;
+    return -1;
+}
+
+#endif
@@ -0,0 +1,37 @@
+// Copyright [2019] [FORTH-ICS]
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KV_FS_URING_H_
+#define KV_FS_URING_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "kv_interface.h"
+
+typedef struct KV_FS_Ring KV_FS_Ring;
+
+typedef struct {
+    int fd;
+    KV_Value buffer;
+    size_t size;
+    off_t offset;
+    ssize_t result;         // Bytes read, or -errno
+}KV_FS_RingRead;
+
+KV_FS_Ring* CreateRing(uint32_t depth);
+void DestroyRing(KV_FS_Ring* ring);
+int RingRead(KV_FS_Ring* ring, KV_FS_RingRead* reads, uint32_t nReads);
+
+#endif /* KV_FS_URING_H_ */
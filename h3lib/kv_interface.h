@@ -29,6 +29,27 @@ typedef enum {
     KV_FAILURE, KV_KEY_EXIST, KV_KEY_NOT_EXIST, KV_SUCCESS, KV_CONTINUE, KV_KEY_TOO_LONG, KV_INVALID_KEY
 }KV_Status;
 
+// Invoked by metadata_list() with the value of each listed key
+typedef void (*KV_ListCallback)(KV_Key key, KV_Value value, size_t size, void* userData);
+
+// A single read of read_batch()
+typedef struct {
+	KV_Key key;
+	off_t offset;
+	KV_Value value;
+	size_t size;
+	KV_Status status;
+} KV_ReadRequest;
+
+// A single write of write_batch()
+typedef struct {
+	KV_Key key;
+	off_t offset;
+	KV_Value value;
+	size_t size;
+	KV_Status status;
+} KV_WriteRequest;
+
 typedef struct {
 	unsigned long totalSpace;
 	unsigned long freeSpace;
@@ -73,12 +94,32 @@ typedef struct KV_Operations {
 	 * actually retrieved. Setting the number to 0x00 means to retrieve all the objects.
 	 * If the buffer pointer is NULL then we only count the number of matching keys.
 	 * The caller may also indicate the number of entries to be skipped.
+	 * Function metadata_list() behaves as list() but also hands the value of every key placed
+	 * in the buffer to a callback, in the same order. The value belongs to the storage-backend
+	 * and is NULL if the key vanished meanwhile. It is meant for backends that keep values next
+	 * to keys and may be left NULL otherwise, in which case each key is read individually.
+	 *
+	 *
+	 * --- Batch Read/Write Operations ---
+	 * Function read_batch() serves a number of reads, e.g. the parts of a segment, at once so
+	 * that backends may issue them concurrently. Every request carries a caller supplied buffer
+	 * and its "size" is in/out as with read(). The outcome of each request is set in its status
+	 * and the function returns KV_SUCCESS only if all requests succeeded. Backends without such
+	 * support may leave it NULL, in which case each key is read individually.
+	 * Function write_batch() likewise applies a number of writes at once, each behaving as update()
+	 * at its offset, and may be left NULL, in which case each key is written individually.
 	 *
 	 *
 	 * --- Move/Copy Operations ---
 	 * The destination will be overwritten if exists
 	 *
 	 *
+	 * --- Open Operation ---
+	 * Back-ends keeping values in regular files may provide a read-only descriptor to the
+	 * value of a key, so that callers can hand it over to the kernel (e.g. splice). The
+	 * value starts at position 0x00 of the file and the caller is expected to close it.
+	 *
+	 *
      * --- Sync Operation ---
      * This may be useful for an external storage device.
 	 */
@@ -89,16 +130,20 @@ typedef struct KV_Operations {
 	KV_Status (*metadata_delete)(KV_Handle handle, KV_Key key);
 	KV_Status (*metadata_move)(KV_Handle handle, KV_Key srcKey, KV_Key dstKey);
 	KV_Status (*metadata_exists)(KV_Handle handle, KV_Key key);
+	KV_Status (*metadata_list)(KV_Handle handle, KV_Key prefix, uint8_t nTrim, KV_Key key, uint32_t offset, uint32_t* nKeys, KV_ListCallback function, void* userData);
 
 	KV_Status (*list)(KV_Handle handle, KV_Key prefix, uint8_t nTrim, KV_Key key, uint32_t offset, uint32_t* nKeys);
 	KV_Status (*exists)(KV_Handle handle, KV_Key key);
 	KV_Status (*read)(KV_Handle handle, KV_Key key, off_t offset, KV_Value* value, size_t* size);
+	KV_Status (*read_batch)(KV_Handle handle, KV_ReadRequest* requests, uint32_t nRequests);
 	KV_Status (*create)(KV_Handle handle, KV_Key key, KV_Value value, size_t size);
 	KV_Status (*update)(KV_Handle handle, KV_Key key, KV_Value value, off_t offset, size_t size);
 	KV_Status (*write)(KV_Handle handle, KV_Key key, KV_Value value, size_t size);
+	KV_Status (*write_batch)(KV_Handle handle, KV_WriteRequest* requests, uint32_t nRequests);
 	KV_Status (*copy)(KV_Handle handle, KV_Key srcKey, KV_Key dstKey);
 	KV_Status (*move)(KV_Handle handle, KV_Key srcKey, KV_Key dstKey);
 	KV_Status (*delete)(KV_Handle handle, KV_Key key);
+	KV_Status (*open)(KV_Handle handle, KV_Key key, int* fd);
 	KV_Status (*sync)(KV_Handle handle);
 } KV_Operations;
 
@@ -25,100 +25,102 @@
 #include <kreon/kreon_rdma_client.h>
 
 #ifdef H3LIB_USE_COMPRESSION
+#include "compression.h"
+#endif
+
+typedef struct {
+    char* ip;
+    int port;
+}KV_Kreon_RDMA_Handle;
 
-#include <zstd.h>
+void KV_Kreon_RDMA_Free(KV_Handle _handle) {
+	KV_Kreon_RDMA_Handle* handle = (KV_Kreon_RDMA_Handle*) _handle;
+	krc_close();
+	free(handle->ip);
+	free(handle);
+    return;
+}
 
-krc_ret_code krc_put_compressed(uint32_t key_size, void *key, uint32_t val_size, void *value) {
-    uint32_t compress_bound = ZSTD_compressBound(val_size);
-    void *compressed_value = malloc(compress_bound);
+#ifdef H3LIB_USE_COMPRESSION
 
-    // The last argument to the function is the compression level, which can range from 1 (lowest) to 22 (highest).
-    uint32_t compressed_value_len = ZSTD_compress(compressed_value, compress_bound, value, val_size, -1);
+/*
+ * Earlier versions built with compression support kept every value as a Zstandard frame, whereas data is now
+ * compressed by h3lib itself. Such stores are told apart by their user and bucket records, whose raw form
+ * never starts with the Zstandard magic number.
+ */
+static int IsLegacyCompressed(){
+    const char* prefixes[] = {"#", "@"};
+    int i, compressed = 0, found = 0;
+
+    for(i=0; i<2 && !found; i++){
+        krc_scannerp scanner;
+        char *key, *value;
+        size_t keySize, valueSize;
+
+        if(!(scanner = krc_scan_init(1, KV_LIST_BUFFER_SIZE)))
+            break;
 
-    if (ZSTD_isError(compressed_value_len)) {
-        LogActivity(H3_ERROR_MSG, "Failed to compress the value!");
-        free(compressed_value);
-        return KRC_FAILURE;
+        krc_scan_set_prefix_filter(scanner, 1, (char*)prefixes[i]);
+        if(krc_scan_get_next(scanner, &key, &keySize, &value, &valueSize)){
+            KV_Value decoded = DecodeLegacyFrame((KV_Value)value, valueSize, &valueSize);
+            compressed = decoded?1:0;
+            found = 1;
+            free(decoded);
+        }
+        krc_scan_close(scanner);
     }
 
-    krc_ret_code result = krc_put(key_size, key, compressed_value_len, compressed_value);
-    free(compressed_value);
-
-    return result;
+    return compressed;
 }
 
-krc_ret_code krc_get_compressed(uint32_t key_size, char *key, char **buffer, uint32_t *size, uint32_t offset) {
-    void *compressed_value = NULL;
-    uint32_t compressed_value_len;
+// Replace every value by its decoded form, the store should not be used meanwhile
+static KV_Status ExpandValues(){
+    GPtrArray* keys = g_ptr_array_new_with_free_func(g_free);
+    KV_Status status = KV_SUCCESS;
+    krc_scannerp scanner;
+    uint32_t i;
 
-    // Retrieve whole compressed value
-    krc_ret_code result = krc_get(key_size, key, (char **)&compressed_value, &compressed_value_len, 0);
-    if (result != KRC_SUCCESS) {
-        return result;
-    }
+    LogActivity(H3_INFO_MSG, "INFO: Expanding the values of a store compressed by an earlier version\n");
 
-    uint32_t frameContentSize = ZSTD_getFrameContentSize(compressed_value, compressed_value_len);
-    // Check if returned ZSTD_CONTENTSIZE_ERROR (error occured) / ZSTD_CONTENTSIZE_UNKNOWN (size can't be determined)
-    if(frameContentSize == ZSTD_CONTENTSIZE_ERROR
-      || frameContentSize == ZSTD_CONTENTSIZE_UNKNOWN){
-	LogActivity(H3_ERROR_MSG, "%s: could not retrieve original size!", key);
-	free(compressed_value);
-	return KRC_FAILURE;
+    // Collect the keys first, values are rewritten once the scan is over
+    if(!(scanner = krc_scan_init(16, KV_LIST_BUFFER_SIZE))){
+        g_ptr_array_free(keys, TRUE);
+        return KV_FAILURE;
     }
 
-    void *decompressed_value = malloc(frameContentSize);
-    uint32_t decompressed_value_len = ZSTD_decompress(decompressed_value, frameContentSize, compressed_value, compressed_value_len);
-
-    if (ZSTD_isError(decompressed_value_len)) {
-        LogActivity(H3_ERROR_MSG, "Failed to decompress the value!");
-        result = KRC_FAILURE;
-    } else {
-        // Retrieve whole decompressed value
-        if(*buffer == NULL){
-          *buffer = decompressed_value;
-          *size = decompressed_value_len;
-        } else {
-          // Retrieve a part of the value
-          if ((decompressed_value_len - offset) < *size) {
-            result = KRC_FAILURE;
-          } else {
-            memcpy(*buffer, (char *)decompressed_value + offset, *size);
-            result = KRC_SUCCESS;
-          }
-          free(decompressed_value);
+    char *key, *value;
+    size_t keySize, valueSize;
+    krc_scan_fetch_keys_only(scanner);
+    krc_scan_set_prefix_filter(scanner, 0, "");
+    while(krc_scan_get_next(scanner, &key, &keySize, &value, &valueSize))
+        g_ptr_array_add(keys, g_strndup(key, keySize));
+    krc_scan_close(scanner);
+
+    for(i=0; i<keys->len && status == KV_SUCCESS; i++){
+        char* current = g_ptr_array_index(keys, i);
+        char* frame = NULL;
+        uint32_t frameSize;
+        size_t size;
+
+        if(krc_get(strlen(current)+1, current, &frame, &frameSize, 0) != KRC_SUCCESS){
+            status = KV_FAILURE;
+            break;
         }
-    }
-
-    free(compressed_value);
 
-    return result;
-}
-
-#else
+        KV_Value decoded = DecodeLegacyFrame((KV_Value)frame, frameSize, &size);
+        if(decoded && krc_put(strlen(current)+1, current, size, decoded) != KRC_SUCCESS)
+            status = KV_FAILURE;
 
-krc_ret_code krc_put_compressed(uint32_t key_size, void *key, uint32_t val_size, void *value) {
-    return krc_put(key_size, key, val_size, value);
-}
+        free(decoded);
+        free(frame);
+    }
 
-krc_ret_code krc_get_compressed(uint32_t key_size, char *key, char **buffer, uint32_t *size, uint32_t offset) {
-    return krc_get(key_size, key, buffer, size, offset);
+    g_ptr_array_free(keys, TRUE);
+    return status;
 }
 
 #endif
 
-typedef struct {
-    char* ip;
-    int port;
-}KV_Kreon_RDMA_Handle;
-
-void KV_Kreon_RDMA_Free(KV_Handle _handle) {
-	KV_Kreon_RDMA_Handle* handle = (KV_Kreon_RDMA_Handle*) _handle;
-	krc_close();
-	free(handle->ip);
-	free(handle);
-    return;
-}
-
 KV_Handle KV_Kreon_RDMA_Init(const char* storageUri) {
     struct parsed_url *url = parse_url(storageUri);
     if (url == NULL) {
@@ -161,6 +163,14 @@ KV_Handle KV_Kreon_RDMA_Init(const char* storageUri) {
         return NULL;
     }
 
+#ifdef H3LIB_USE_COMPRESSION
+    if(IsLegacyCompressed() && ExpandValues() != KV_SUCCESS){
+        LogActivity(H3_ERROR_MSG, "Kreon - Failed to expand the values of the store\n");
+        KV_Kreon_RDMA_Free(handle);
+        return NULL;
+    }
+#endif
+
     return (KV_Handle)handle;
 }
 
@@ -225,7 +235,7 @@ KV_Status KV_Kreon_RDMA_Exists(KV_Handle _handle, KV_Key key) {
 KV_Status KV_Kreon_RDMA_Read(KV_Handle handle, KV_Key key, off_t offset, KV_Value* value, size_t* size) {
 	KV_Status status;
 
-	switch(krc_get_compressed(strlen(key)+1, key, (char**)value, (uint32_t*)size, (uint32_t)offset)){
+	switch(krc_get(strlen(key)+1, key, (char**)value, (uint32_t*)size, (uint32_t)offset)){
 		case KRC_SUCCESS: status = KV_SUCCESS; break;
 		case KRC_KEY_NOT_FOUND: status = KV_KEY_NOT_EXIST; break;
 		default: status = KV_FAILURE; break;
@@ -237,13 +247,13 @@ KV_Status KV_Kreon_RDMA_Read(KV_Handle handle, KV_Key key, off_t offset, KV_Valu
 KV_Status KV_Kreon_RDMA_Update(KV_Handle handle, KV_Key key, KV_Value value, off_t offset, size_t size) {
     KV_Status status;
 
-    KV_Value currentValue;
+    KV_Value currentValue = NULL;
     size_t currentSize;
     KV_Value newValue;
     size_t newSize;
     int freeNewValue = 0;
 
-    switch(krc_get_compressed(strlen(key)+1, key, (char**)&currentValue, (uint32_t*)&currentSize, 0)){
+    switch(krc_get(strlen(key)+1, key, (char**)&currentValue, (uint32_t*)&currentSize, 0)){
         case KRC_SUCCESS:
             if (offset + size <= currentSize) {
                 newValue = currentValue;
@@ -273,7 +283,7 @@ KV_Status KV_Kreon_RDMA_Update(KV_Handle handle, KV_Key key, KV_Value value, off
     }
 
     // Convert key blob to string
-    if(krc_put_compressed(strlen(key)+1, key, newSize, newValue) == KRC_SUCCESS) {
+    if(krc_put(strlen(key)+1, key, newSize, newValue) == KRC_SUCCESS) {
         status = KV_SUCCESS;
     } else {
         status = KV_FAILURE;
@@ -287,7 +297,7 @@ KV_Status KV_Kreon_RDMA_Update(KV_Handle handle, KV_Key key, KV_Value value, off
 KV_Status KV_Kreon_RDMA_Write(KV_Handle handle, KV_Key key, KV_Value value, size_t size) {
 
 	// Convert key blob to string
-	if(krc_put_compressed(strlen(key)+1, key, size, value) == KRC_SUCCESS)
+	if(krc_put(strlen(key)+1, key, size, value) == KRC_SUCCESS)
 		return KV_SUCCESS;
 
 	return KV_FAILURE;
@@ -0,0 +1,679 @@
+// Copyright [2019] [FORTH-ICS]
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/statvfs.h>
+
+#include <glib.h>
+#include <lmdb.h>
+
+#include "kv_interface.h"
+#include "util.h"
+#include "url_parser.h"
+
+#define LMDB_MAP_SIZE       64      // Default upper bound of the database in GB
+#define LMDB_MAX_READERS    512     // Default number of concurrent read transactions
+#define LMDB_KEY_SIZE       511     // Maximum key size of LMDB, unless built otherwise
+#define LMDB_HASH_SIZE      64      // Hexadecimal digits of the SHA-256 hash of long keys
+
+/*
+ * The store is a single memory-mapped B+tree kept in a directory. Keys are stored with their
+ * terminating '\0', so they sort in the same order as the keys of the other backends and a prefix
+ * scan ends as soon as a key no longer matches. Reads run in their own read-only transactions and
+ * copy values straight out of the map, whereas writes are serialized by LMDB itself, so any number
+ * of readers proceed next to a single writer. Operations touching more than one key (i.e. copy and
+ * move) are carried out in a single transaction.
+ *
+ * Keys longer than LMDB allows are stored under their beginning followed by a '\0' and their hash,
+ * thus they are still found by prefix scans, and the full key is kept in front of their value.
+ *
+ * LMDB does not allow a database to be opened more than once by the same process, thus handles to
+ * the same path are shared and the environment is closed once the last of them is released.
+ */
+
+typedef struct {
+    char* path;
+    MDB_env* env;
+    MDB_dbi dbi;
+    size_t mapSize;
+    unsigned int maxReaders;
+    unsigned int flags;
+    size_t maxKeySize;
+    uint32_t refs;
+    GRWLock resizeLock;         // Held for reading by each transaction, for writing to adopt a new map size
+} KV_LMDB_Handle;
+
+static GMutex handlesLock;
+static GHashTable* handles = NULL;      // Open handles, keyed by the real path of their database
+
+static KV_Status Status(int rc){
+    switch(rc){
+        case MDB_SUCCESS:       return KV_SUCCESS;
+        case MDB_NOTFOUND:      return KV_KEY_NOT_EXIST;
+        case MDB_KEYEXIST:      return KV_KEY_EXIST;
+        case MDB_BAD_VALSIZE:   return KV_KEY_TOO_LONG;
+        case MDB_MAP_FULL:
+            LogActivity(H3_ERROR_MSG, "LMDB - %s, consider a larger map size\n", mdb_strerror(rc));
+            return KV_FAILURE;
+        default:
+            LogActivity(H3_ERROR_MSG, "LMDB - %s\n", mdb_strerror(rc));
+            return KV_FAILURE;
+    }
+}
+
+/*
+ * Another process may have grown the map, in which case we adopt its size and retry. The size may
+ * only be set while no transaction is open in this process, thus transactions hold the resize lock
+ * for reading until they end, and the resize waits for all of them to end.
+ */
+static int BeginTxn(KV_LMDB_Handle* storeHandle, unsigned int flags, MDB_txn** txn){
+    int rc;
+
+    g_rw_lock_reader_lock(&storeHandle->resizeLock);
+    if( (rc = mdb_txn_begin(storeHandle->env, NULL, flags, txn)) == MDB_MAP_RESIZED ){
+        g_rw_lock_reader_unlock(&storeHandle->resizeLock);
+
+        g_rw_lock_writer_lock(&storeHandle->resizeLock);
+        rc = mdb_env_set_mapsize(storeHandle->env, 0);
+        g_rw_lock_writer_unlock(&storeHandle->resizeLock);
+
+        g_rw_lock_reader_lock(&storeHandle->resizeLock);
+        if(rc == MDB_SUCCESS)
+            rc = mdb_txn_begin(storeHandle->env, NULL, flags, txn);
+    }
+
+    if(rc != MDB_SUCCESS)
+        g_rw_lock_reader_unlock(&storeHandle->resizeLock);
+
+    return rc;
+}
+
+static int CommitTxn(KV_LMDB_Handle* storeHandle, MDB_txn* txn){
+    int rc = mdb_txn_commit(txn);
+
+    g_rw_lock_reader_unlock(&storeHandle->resizeLock);
+    return rc;
+}
+
+static void AbortTxn(KV_LMDB_Handle* storeHandle, MDB_txn* txn){
+    mdb_txn_abort(txn);
+    g_rw_lock_reader_unlock(&storeHandle->resizeLock);
+}
+
+// Returns the size of the full key to keep in front of the value, if the key has to be shortened
+static size_t SetKey(KV_LMDB_Handle* storeHandle, MDB_val* entry, KV_Key key, char* shortKey){
+    size_t keySize = strlen(key) + 1;
+    size_t length = storeHandle->maxKeySize - LMDB_HASH_SIZE - 2;
+    gchar* hash;
+
+    if(keySize <= storeHandle->maxKeySize){
+        entry->mv_data = key;
+        entry->mv_size = keySize;
+        return 0;
+    }
+
+    hash = g_compute_checksum_for_string(G_CHECKSUM_SHA256, key, -1);
+    memcpy(shortKey, key, length);
+    shortKey[length] = '\0';
+    memcpy(&shortKey[length + 1], hash, LMDB_HASH_SIZE + 1);
+    g_free(hash);
+
+    entry->mv_data = shortKey;
+    entry->mv_size = storeHandle->maxKeySize;
+    return keySize;
+}
+
+static void SkipKey(MDB_val* data, size_t keySize){
+    keySize = min(keySize, data->mv_size);
+    data->mv_data = (char*)data->mv_data + keySize;
+    data->mv_size -= keySize;
+}
+
+// Options are passed in the query of the URI, e.g. lmdb:///tmp/h3/lmdb?size=128&readers=1024&sync=0
+static void ParseOptions(KV_LMDB_Handle* handle, const char* query){
+    gchar** options = g_strsplit(query, "&", 0);
+    int i;
+
+    for(i=0; options[i]; i++){
+        char* value = strchr(options[i], '=');
+        if(!value)
+            continue;
+
+        *value++ = '\0';
+        if(strcmp(options[i], "size") == 0)
+            handle->mapSize = max(strtoul(value, NULL, 10), 1) * __1GByte;
+        else if(strcmp(options[i], "readers") == 0)
+            handle->maxReaders = max(strtoul(value, NULL, 10), 1);
+        else if(strcmp(options[i], "sync") == 0)
+            handle->flags = atoi(value)?(handle->flags & ~MDB_NOSYNC):(handle->flags | MDB_NOSYNC);
+        else
+            LogActivity(H3_INFO_MSG, "WARNING: Unknown option in URI: %s\n", options[i]);
+    }
+
+    g_strfreev(options);
+}
+
+KV_Handle KV_LMDB_Init(const char* storageUri) {
+    struct parsed_url *url = parse_url(storageUri);
+    if (url == NULL) {
+        LogActivity(H3_ERROR_MSG, "ERROR: Unrecognized storage URI\n");
+        return NULL;
+    }
+
+    char *path;
+    if (url->path != NULL) {
+        path = malloc(strlen(url->path) + 2);
+        path[0] = '/';
+        strcpy(&(path[1]), url->path);
+        LogActivity(H3_INFO_MSG, "INFO: Path in URI: %s\n", path);
+    } else {
+        path = strdup("/tmp/h3/lmdb");
+        LogActivity(H3_INFO_MSG, "WARNING: No path in URI. Using default: /tmp/h3/lmdb\n");
+    }
+
+    KV_LMDB_Handle* handle = calloc(1, sizeof(KV_LMDB_Handle));
+    handle->mapSize = LMDB_MAP_SIZE * (size_t)__1GByte;
+    handle->maxReaders = LMDB_MAX_READERS;
+    g_rw_lock_init(&handle->resizeLock);
+
+    // Read transactions are not bound to threads, and random lookups gain nothing from read-ahead
+    handle->flags = MDB_NOTLS | MDB_NORDAHEAD;
+    if(url->query)
+        ParseOptions(handle, url->query);
+    parsed_url_free(url);
+
+    MDB_txn* txn;
+    int rc, dead;
+    char* realPath;
+    KV_LMDB_Handle* shared;
+    if( g_mkdir_with_parents(path, 0755) != 0 || !(realPath = realpath(path, NULL)) ){
+        LogActivity(H3_ERROR_MSG, "ERROR: Failed to create directory %s\n", path);
+        free(path);
+        g_rw_lock_clear(&handle->resizeLock);
+        free(handle);
+        return NULL;
+    }
+    free(path);
+    handle->path = realPath;
+
+    g_mutex_lock(&handlesLock);
+    if(!handles)
+        handles = g_hash_table_new(g_str_hash, g_str_equal);
+
+    if( (shared = g_hash_table_lookup(handles, realPath)) ){
+        LogActivity(H3_INFO_MSG, "INFO: Sharing open database %s\n", realPath);
+        shared->refs++;
+        g_mutex_unlock(&handlesLock);
+        free(realPath);
+        g_rw_lock_clear(&handle->resizeLock);
+        free(handle);
+        return (KV_Handle)shared;
+    }
+
+    if( (rc = mdb_env_create(&handle->env)) != MDB_SUCCESS ){
+        LogActivity(H3_ERROR_MSG, "LMDB - %s\n", mdb_strerror(rc));
+        g_mutex_unlock(&handlesLock);
+        free(realPath);
+        g_rw_lock_clear(&handle->resizeLock);
+        free(handle);
+        return NULL;
+    }
+
+    if( (rc = mdb_env_set_mapsize(handle->env, handle->mapSize)) == MDB_SUCCESS                &&
+        (rc = mdb_env_set_maxreaders(handle->env, handle->maxReaders)) == MDB_SUCCESS          &&
+        (rc = mdb_env_open(handle->env, realPath, handle->flags, 0644)) == MDB_SUCCESS         &&
+        (rc = BeginTxn(handle, 0, &txn)) == MDB_SUCCESS                                        ){
+
+        if( (rc = mdb_dbi_open(txn, NULL, 0, &handle->dbi)) == MDB_SUCCESS )
+            rc = CommitTxn(handle, txn);
+        else
+            AbortTxn(handle, txn);
+    }
+
+    if(rc != MDB_SUCCESS){
+        LogActivity(H3_ERROR_MSG, "LMDB - %s\n", mdb_strerror(rc));
+        g_mutex_unlock(&handlesLock);
+        mdb_env_close(handle->env);
+        free(realPath);
+        g_rw_lock_clear(&handle->resizeLock);
+        free(handle);
+        return NULL;
+    }
+
+    // Release reader slots left behind by processes that crashed
+    mdb_reader_check(handle->env, &dead);
+    handle->maxKeySize = min(mdb_env_get_maxkeysize(handle->env), LMDB_KEY_SIZE);
+
+    handle->refs = 1;
+    g_hash_table_insert(handles, handle->path, handle);
+    g_mutex_unlock(&handlesLock);
+
+    return (KV_Handle)handle;
+}
+
+void KV_LMDB_Free(KV_Handle handle) {
+    KV_LMDB_Handle* storeHandle = (KV_LMDB_Handle*)handle;
+
+    g_mutex_lock(&handlesLock);
+    if(--storeHandle->refs){
+        g_mutex_unlock(&handlesLock);
+        return;
+    }
+    g_hash_table_remove(handles, storeHandle->path);
+    g_mutex_unlock(&handlesLock);
+
+    mdb_env_close(storeHandle->env);
+    g_rw_lock_clear(&storeHandle->resizeLock);
+    free(storeHandle->path);
+    free(storeHandle);
+}
+
+KV_Status KV_LMDB_StorageInfo(KV_Handle handle, KV_StorageInfo* storageInfo) {
+    KV_LMDB_Handle* storeHandle = (KV_LMDB_Handle*)handle;
+    struct statvfs stats;
+    MDB_envinfo info;
+    MDB_stat stat;
+
+    if( statvfs(storeHandle->path, &stats) != 0                ||
+        mdb_env_info(storeHandle->env, &info) != MDB_SUCCESS   ||
+        mdb_env_stat(storeHandle->env, &stat) != MDB_SUCCESS   ){
+        return KV_FAILURE;
+    }
+
+    // The map bounds the store, unless the device runs out of space first
+    storageInfo->usedSpace = (info.me_last_pgno + 1) * stat.ms_psize;
+    storageInfo->freeSpace = min(info.me_mapsize - min(storageInfo->usedSpace, info.me_mapsize), stats.f_bsize * stats.f_bavail);
+    storageInfo->totalSpace = storageInfo->usedSpace + storageInfo->freeSpace;
+
+    return KV_SUCCESS;
+}
+
+static KV_Status List(KV_Handle handle, KV_Key prefix, uint8_t nTrim, KV_Key buffer, uint32_t offset, uint32_t* nKeys, KV_ListCallback function, void* userData) {
+    KV_Status status = KV_SUCCESS;
+    KV_LMDB_Handle* storeHandle = (KV_LMDB_Handle *)handle;
+    MDB_cursor* cursor;
+    MDB_txn* txn;
+    MDB_val key, value;
+    int rc;
+
+    size_t remaining = KV_LIST_BUFFER_SIZE;
+    uint32_t nRequiredKeys = *nKeys>0?*nKeys:UINT32_MAX;
+    uint32_t nMatchingKeys = 0;
+    size_t prefixLen = strlen(prefix);
+    size_t scanLen = min(prefixLen, storeHandle->maxKeySize - LMDB_HASH_SIZE - 2);
+    KV_Key name;
+    size_t nameSize;
+
+    if( (rc = BeginTxn(storeHandle, MDB_RDONLY, &txn)) != MDB_SUCCESS )
+        return Status(rc);
+
+    if( (rc = mdb_cursor_open(txn, storeHandle->dbi, &cursor)) != MDB_SUCCESS ){
+        AbortTxn(storeHandle, txn);
+        return Status(rc);
+    }
+
+    // Keys are ordered, thus the matching ones are contiguous starting from the prefix
+    // Shortened keys only keep the beginning of the prefix, their full key is matched instead
+    key.mv_data = prefix;
+    key.mv_size = scanLen;
+    rc = mdb_cursor_get(cursor, &key, &value, scanLen?MDB_SET_RANGE:MDB_FIRST);
+
+    while(rc == MDB_SUCCESS && status != KV_CONTINUE &&
+          key.mv_size > scanLen && memcmp(key.mv_data, prefix, scanLen) == 0){
+
+        name = key.mv_data;
+        nameSize = key.mv_size;
+        if(memchr(key.mv_data, '\0', key.mv_size - 1)){
+            name = value.mv_data;
+            nameSize = strnlen(name, value.mv_size) + 1;
+            SkipKey(&value, nameSize);
+        }
+
+        if(nameSize <= prefixLen || memcmp(name, prefix, prefixLen)){
+            rc = mdb_cursor_get(cursor, &key, &value, MDB_NEXT);
+            continue;
+        }
+
+        if(offset)
+            offset--;
+        else if( nMatchingKeys < nRequiredKeys ){
+
+            // Copy the keys if a buffer is provided...
+            if(buffer){
+                size_t entrySize = nameSize - nTrim;
+                if(remaining >= entrySize ){
+                    KV_Key entry = &buffer[KV_LIST_BUFFER_SIZE - remaining];
+                    memcpy(entry, &name[nTrim], entrySize);
+                    remaining -= entrySize;
+                    nMatchingKeys++;
+
+                    // The value is handed over straight from the map
+                    if(function)
+                        function(entry, (KV_Value)value.mv_data, value.mv_size, userData);
+                }
+                else
+                    status = KV_CONTINUE;
+            }
+
+            // ... otherwise just count them.
+            else
+                nMatchingKeys++;
+        }
+        else
+            status = KV_CONTINUE;
+
+        rc = mdb_cursor_get(cursor, &key, &value, MDB_NEXT);
+    }
+
+    if(rc != MDB_SUCCESS && rc != MDB_NOTFOUND)
+        status = Status(rc);
+
+    mdb_cursor_close(cursor);
+    AbortTxn(storeHandle, txn);
+
+    *nKeys = nMatchingKeys;
+
+    return status;
+}
+
+KV_Status KV_LMDB_List(KV_Handle handle, KV_Key prefix, uint8_t nTrim, KV_Key buffer, uint32_t offset, uint32_t* nKeys) {
+    return List(handle, prefix, nTrim, buffer, offset, nKeys, NULL, NULL);
+}
+
+KV_Status KV_LMDB_ListMetadata(KV_Handle handle, KV_Key prefix, uint8_t nTrim, KV_Key buffer, uint32_t offset, uint32_t* nKeys, KV_ListCallback function, void* userData) {
+    return List(handle, prefix, nTrim, buffer, offset, nKeys, function, userData);
+}
+
+// Copies a segment of a value out of the map, the value is valid only while the transaction lasts
+static KV_Status CopySegment(MDB_val* data, off_t offset, KV_Value* value, size_t* size){
+    size_t segmentSize;
+
+    if(offset > data->mv_size){
+        *size = 0;
+        return KV_SUCCESS;
+    }
+
+    segmentSize = data->mv_size - offset;
+    if(*value == NULL){
+        if( !(*value = malloc(max(segmentSize, 1))) )
+            return KV_FAILURE;
+    }
+    else
+        segmentSize = min(segmentSize, *size);
+
+    memcpy(*value, (char*)data->mv_data + offset, segmentSize);
+    *size = segmentSize;
+
+    return KV_SUCCESS;
+}
+
+KV_Status KV_LMDB_Read(KV_Handle handle, KV_Key key, off_t offset, KV_Value* value, size_t* size) {
+    KV_LMDB_Handle* storeHandle = (KV_LMDB_Handle*) handle;
+    KV_Status status;
+    MDB_val entry, data;
+    MDB_txn* txn;
+    char shortKey[LMDB_KEY_SIZE];
+    size_t keySize;
+    int rc;
+
+    if( (rc = BeginTxn(storeHandle, MDB_RDONLY, &txn)) != MDB_SUCCESS )
+        return Status(rc);
+
+    keySize = SetKey(storeHandle, &entry, key, shortKey);
+    if( (rc = mdb_get(txn, storeHandle->dbi, &entry, &data)) == MDB_SUCCESS ){
+        SkipKey(&data, keySize);
+        status = CopySegment(&data, offset, value, size);
+    }
+    else
+        status = Status(rc);
+
+    AbortTxn(storeHandle, txn);
+
+    return status;
+}
+
+// All reads are served from the same snapshot of the store
+KV_Status KV_LMDB_ReadBatch(KV_Handle handle, KV_ReadRequest* requests, uint32_t nRequests){
+    KV_LMDB_Handle* storeHandle = (KV_LMDB_Handle*) handle;
+    KV_Status status = KV_SUCCESS;
+    MDB_val entry, data;
+    MDB_txn* txn;
+    char shortKey[LMDB_KEY_SIZE];
+    size_t keySize;
+    uint32_t i;
+    int rc;
+
+    if( (rc = BeginTxn(storeHandle, MDB_RDONLY, &txn)) != MDB_SUCCESS ){
+        for(i=0; i<nRequests; i++)
+            requests[i].status = KV_FAILURE;
+        return Status(rc);
+    }
+
+    for(i=0; i<nRequests; i++){
+        keySize = SetKey(storeHandle, &entry, requests[i].key, shortKey);
+        if( (rc = mdb_get(txn, storeHandle->dbi, &entry, &data)) == MDB_SUCCESS ){
+            SkipKey(&data, keySize);
+            requests[i].status = CopySegment(&data, requests[i].offset, &requests[i].value, &requests[i].size);
+        }
+        else
+            requests[i].status = Status(rc);
+
+        if(requests[i].status != KV_SUCCESS)
+            status = KV_FAILURE;
+    }
+
+    AbortTxn(storeHandle, txn);
+
+    return status;
+}
+
+static KV_Status Put(KV_LMDB_Handle* storeHandle, KV_Key key, KV_Value value, size_t size, unsigned int flags) {
+    MDB_val entry, data;
+    MDB_txn* txn;
+    char shortKey[LMDB_KEY_SIZE];
+    size_t keySize;
+    int rc;
+
+    if( (rc = BeginTxn(storeHandle, 0, &txn)) != MDB_SUCCESS )
+        return Status(rc);
+
+    // Reserve the space in the map and fill it in place
+    keySize = SetKey(storeHandle, &entry, key, shortKey);
+    data.mv_size = keySize + size;
+    if( (rc = mdb_put(txn, storeHandle->dbi, &entry, &data, flags | MDB_RESERVE)) == MDB_SUCCESS ){
+        memcpy(data.mv_data, key, keySize);
+        memcpy((char*)data.mv_data + keySize, value, size);
+        rc = CommitTxn(storeHandle, txn);
+    }
+    else
+        AbortTxn(storeHandle, txn);
+
+    return Status(rc);
+}
+
+KV_Status KV_LMDB_Write(KV_Handle handle, KV_Key key, KV_Value value, size_t size) {
+    return Put((KV_LMDB_Handle*)handle, key, value, size, 0);
+}
+
+KV_Status KV_LMDB_Create(KV_Handle handle, KV_Key key, KV_Value value, size_t size) {
+    return Put((KV_LMDB_Handle*)handle, key, value, size, MDB_NOOVERWRITE);
+}
+
+KV_Status KV_LMDB_Update(KV_Handle handle, KV_Key key, KV_Value value, off_t offset, size_t size) {
+    KV_LMDB_Handle* storeHandle = (KV_LMDB_Handle*) handle;
+    KV_Value buffer;
+    MDB_val entry, data;
+    size_t bufferSize;
+    MDB_txn* txn;
+    char shortKey[LMDB_KEY_SIZE];
+    size_t keySize;
+    int rc;
+
+    if( (rc = BeginTxn(storeHandle, 0, &txn)) != MDB_SUCCESS )
+        return Status(rc);
+
+    keySize = SetKey(storeHandle, &entry, key, shortKey);
+    if( (rc = mdb_get(txn, storeHandle->dbi, &entry, &data)) == MDB_NOTFOUND ){
+        data.mv_size = 0;
+        rc = MDB_SUCCESS;
+    }
+    else if(rc == MDB_SUCCESS)
+        SkipKey(&data, keySize);
+
+    // Patch the previous value (if any) with user-data, padding any gap with zeros
+    if(rc == MDB_SUCCESS){
+        bufferSize = max(data.mv_size, offset + size);
+        if( (buffer = malloc(max(keySize + bufferSize, 1))) ){
+            memcpy(buffer, key, keySize);
+            if(data.mv_size)
+                memcpy(&buffer[keySize], data.mv_data, data.mv_size);
+            if(offset > data.mv_size)
+                memset(&buffer[keySize + data.mv_size], 0, offset - data.mv_size);
+            memcpy(&buffer[keySize + offset], value, size);
+
+            data.mv_data = buffer;
+            data.mv_size = keySize + bufferSize;
+            rc = mdb_put(txn, storeHandle->dbi, &entry, &data, 0);
+            free(buffer);
+        }
+        else
+            rc = ENOMEM;
+    }
+
+    if(rc == MDB_SUCCESS)
+        rc = CommitTxn(storeHandle, txn);
+    else
+        AbortTxn(storeHandle, txn);
+
+    return Status(rc);
+}
+
+KV_Status KV_LMDB_Delete(KV_Handle handle, KV_Key key) {
+    KV_LMDB_Handle* storeHandle = (KV_LMDB_Handle*) handle;
+    MDB_val entry;
+    MDB_txn* txn;
+    char shortKey[LMDB_KEY_SIZE];
+    int rc;
+
+    if( (rc = BeginTxn(storeHandle, 0, &txn)) != MDB_SUCCESS )
+        return Status(rc);
+
+    SetKey(storeHandle, &entry, key, shortKey);
+    if( (rc = mdb_del(txn, storeHandle->dbi, &entry, NULL)) == MDB_SUCCESS )
+        rc = CommitTxn(storeHandle, txn);
+    else
+        AbortTxn(storeHandle, txn);
+
+    return Status(rc);
+}
+
+KV_Status KV_LMDB_Exists(KV_Handle handle, KV_Key key) {
+    KV_LMDB_Handle* storeHandle = (KV_LMDB_Handle*) handle;
+    MDB_val entry, data;
+    MDB_txn* txn;
+    char shortKey[LMDB_KEY_SIZE];
+    int rc;
+
+    if( (rc = BeginTxn(storeHandle, MDB_RDONLY, &txn)) != MDB_SUCCESS )
+        return Status(rc);
+
+    SetKey(storeHandle, &entry, key, shortKey);
+    rc = mdb_get(txn, storeHandle->dbi, &entry, &data);
+    AbortTxn(storeHandle, txn);
+
+    return rc == MDB_SUCCESS?KV_KEY_EXIST:Status(rc);
+}
+
+// Both the copy and the removal of the source (if requested) take effect at once
+static KV_Status Transfer(KV_LMDB_Handle* storeHandle, KV_Key srcKey, KV_Key dstKey, int move) {
+    MDB_val srcEntry, dstEntry, data;
+    MDB_txn* txn;
+    char srcShortKey[LMDB_KEY_SIZE], dstShortKey[LMDB_KEY_SIZE];
+    size_t srcKeySize, dstKeySize;
+    int rc;
+
+    if( (rc = BeginTxn(storeHandle, 0, &txn)) != MDB_SUCCESS )
+        return Status(rc);
+
+    srcKeySize = SetKey(storeHandle, &srcEntry, srcKey, srcShortKey);
+    dstKeySize = SetKey(storeHandle, &dstEntry, dstKey, dstShortKey);
+    if( (rc = mdb_get(txn, storeHandle->dbi, &srcEntry, &data)) == MDB_SUCCESS && strcmp(srcKey, dstKey) ){
+        SkipKey(&data, srcKeySize);
+
+        // The source is no longer valid once the destination is written, so keep a copy of it
+        KV_Value value = malloc(max(dstKeySize + data.mv_size, 1));
+        if(value){
+            memcpy(value, dstKey, dstKeySize);
+            memcpy(&value[dstKeySize], data.mv_data, data.mv_size);
+            data.mv_data = value;
+            data.mv_size += dstKeySize;
+            if( (rc = mdb_put(txn, storeHandle->dbi, &dstEntry, &data, 0)) == MDB_SUCCESS && move)
+                rc = mdb_del(txn, storeHandle->dbi, &srcEntry, NULL);
+            free(value);
+        }
+        else
+            rc = ENOMEM;
+    }
+
+    if(rc == MDB_SUCCESS)
+        rc = CommitTxn(storeHandle, txn);
+    else
+        AbortTxn(storeHandle, txn);
+
+    return Status(rc);
+}
+
+KV_Status KV_LMDB_Copy(KV_Handle handle, KV_Key src_key, KV_Key dest_key) {
+    return Transfer((KV_LMDB_Handle*)handle, src_key, dest_key, 0);
+}
+
+KV_Status KV_LMDB_Move(KV_Handle handle, KV_Key src_key, KV_Key dest_key) {
+    return Transfer((KV_LMDB_Handle*)handle, src_key, dest_key, 1);
+}
+
+// Only meaningful if syncing on commit has been disabled
+KV_Status KV_LMDB_Sync(KV_Handle handle) {
+    KV_LMDB_Handle* storeHandle = (KV_LMDB_Handle*) handle;
+    return Status(mdb_env_sync(storeHandle->env, 1));
+}
+
+KV_Operations operationsLMDB = {
+    .init = KV_LMDB_Init,
+    .free = KV_LMDB_Free,
+    .storage_info = KV_LMDB_StorageInfo,
+    .validate_key = NULL,
+
+    .metadata_read = KV_LMDB_Read,
+    .metadata_write = KV_LMDB_Write,
+    .metadata_create = KV_LMDB_Create,
+    .metadata_delete = KV_LMDB_Delete,
+    .metadata_move = KV_LMDB_Move,
+    .metadata_exists = KV_LMDB_Exists,
+    .metadata_list = KV_LMDB_ListMetadata,
+
+    .list = KV_LMDB_List,
+    .exists = KV_LMDB_Exists,
+    .read = KV_LMDB_Read,
+    .read_batch = KV_LMDB_ReadBatch,
+    .create = KV_LMDB_Create,
+    .update = KV_LMDB_Update,
+    .write = KV_LMDB_Write,
+    .copy = KV_LMDB_Copy,
+    .move = KV_LMDB_Move,
+    .delete = KV_LMDB_Delete,
+    .sync = KV_LMDB_Sync
+};
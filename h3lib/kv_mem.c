@@ -0,0 +1,603 @@
+// Copyright [2019] [FORTH-ICS]
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "kv_interface.h"
+#include "util.h"
+#include "url_parser.h"
+
+#define KV_MEM_MAX_LEVEL    32      // Enough for 4^32 keys with a branching factor of 4
+
+/*
+ * A store kept in memory, indexed by a skiplist ordered as strcmp() orders the keys. Lookups and
+ * listings only share a read lock on the index, while every value has a lock of its own, so that
+ * reads and in-place updates of different keys proceed in parallel. Only adding or removing keys
+ * takes the index lock exclusively, which also makes copies and moves atomic.
+ *
+ * A store is private to its handle unless named in the URI, e.g. mem:///hot, in which case all
+ * handles of the process naming it share it until the last one is released.
+ */
+
+typedef struct KV_MEM_Node {
+    char* key;
+    KV_Value value;
+    size_t size;                    // Bytes in use
+    size_t allocated;               // Bytes allocated, parts grow geometrically as they are appended to
+    GMutex lock;                    // Guards the value
+    uint8_t nLevels;
+    struct KV_MEM_Node* next[];
+} KV_MEM_Node;
+
+typedef struct {
+    char* name;                     // NULL for private stores
+    uint32_t refs;
+    GRWLock lock;                   // Guards the structure of the index
+    KV_MEM_Node* head;
+    uint8_t nLevels;
+    uint32_t seed;
+    size_t capacity;                // Max bytes of keys and values, 0 for no limit
+    size_t used;
+} KV_MEM_Store;
+
+typedef enum {
+    KV_MEM_WRITE,                   // Replace the value
+    KV_MEM_CREATE,                  // As above, provided the key does not exist
+    KV_MEM_UPDATE                   // Patch the value at an offset
+} KV_MEM_PutMode;
+
+static GMutex storesLock;
+static GHashTable* stores = NULL;   // Named stores
+
+static KV_MEM_Node* NewNode(const char* key, uint8_t nLevels){
+    KV_MEM_Node* node = calloc(1, sizeof(KV_MEM_Node) + nLevels * sizeof(KV_MEM_Node*));
+
+    if(node){
+        if(key && !(node->key = strdup(key))){
+            free(node);
+            return NULL;
+        }
+        g_mutex_init(&node->lock);
+        node->nLevels = nLevels;
+    }
+
+    return node;
+}
+
+static void FreeNode(KV_MEM_Node* node){
+    g_mutex_clear(&node->lock);
+    free(node->value);
+    free(node->key);
+    free(node);
+}
+
+// Accounts for a change in memory use, failing if the capacity would be exceeded
+static int Reserve(KV_MEM_Store* store, ssize_t delta){
+    size_t used = __atomic_add_fetch(&store->used, delta, __ATOMIC_RELAXED);
+
+    if(delta > 0 && store->capacity && used > store->capacity){
+        __atomic_sub_fetch(&store->used, delta, __ATOMIC_RELAXED);
+        LogActivity(H3_ERROR_MSG, "ERROR: Store is full, capacity is %zu bytes\n", store->capacity);
+        return 0;
+    }
+
+    return 1;
+}
+
+// Returns the first node not less than the key, along with its predecessor at every level if requested
+static KV_MEM_Node* Seek(KV_MEM_Store* store, const char* key, KV_MEM_Node** update){
+    KV_MEM_Node* node = store->head;
+    int level;
+
+    for(level = store->nLevels - 1; level >= 0; level--){
+        while(node->next[level] && strcmp(node->next[level]->key, key) < 0)
+            node = node->next[level];
+
+        if(update)
+            update[level] = node;
+    }
+
+    return node->next[0];
+}
+
+static KV_MEM_Node* Lookup(KV_MEM_Store* store, const char* key, KV_MEM_Node** update){
+    KV_MEM_Node* node = Seek(store, key, update);
+    return node && strcmp(node->key, key) == 0?node:NULL;
+}
+
+// Levels are drawn with a probability of 1/4 each, under the exclusive lock of the index
+static uint8_t RandomLevel(KV_MEM_Store* store){
+    uint8_t nLevels = 1;
+
+    store->seed ^= store->seed << 13;
+    store->seed ^= store->seed >> 17;
+    store->seed ^= store->seed << 5;
+
+    uint32_t bits = store->seed;
+    while(nLevels < KV_MEM_MAX_LEVEL && (bits & 3) == 0){
+        nLevels++;
+        bits >>= 2;
+    }
+
+    return nLevels;
+}
+
+static void Link(KV_MEM_Store* store, KV_MEM_Node* node, KV_MEM_Node** update){
+    int level;
+
+    for(level = store->nLevels; level < node->nLevels; level++)
+        update[level] = store->head;
+    store->nLevels = max(store->nLevels, node->nLevels);
+
+    for(level = 0; level < node->nLevels; level++){
+        node->next[level] = update[level]->next[level];
+        update[level]->next[level] = node;
+    }
+}
+
+static void Unlink(KV_MEM_Store* store, KV_MEM_Node* node, KV_MEM_Node** update){
+    int level;
+
+    for(level = 0; level < node->nLevels; level++)
+        update[level]->next[level] = node->next[level];
+
+    while(store->nLevels > 1 && !store->head->next[store->nLevels - 1])
+        store->nLevels--;
+}
+
+static void Discard(KV_MEM_Store* store, KV_MEM_Node* node){
+    Reserve(store, -(ssize_t)(node->allocated + strlen(node->key) + 1));
+    FreeNode(node);
+}
+
+// Stores the value in the node, the caller holds the node exclusively
+static KV_Status Store(KV_MEM_Store* store, KV_MEM_Node* node, KV_Value value, off_t offset, size_t size, int truncate){
+    size_t newSize = truncate?offset + size:max(node->size, offset + size);
+
+    // Grow appended values geometrically, shrink replaced ones if they waste much of their buffer
+    if(newSize > node->allocated || (truncate && newSize < node->allocated / 2)){
+        size_t allocated = truncate?newSize:max(newSize, node->allocated * 2);
+        KV_Value buffer;
+
+        if(!Reserve(store, (ssize_t)allocated - (ssize_t)node->allocated))
+            return KV_FAILURE;
+
+        if( !(buffer = realloc(node->value, max(allocated, 1))) ){
+            Reserve(store, (ssize_t)node->allocated - (ssize_t)allocated);
+            return KV_FAILURE;
+        }
+
+        node->value = buffer;
+        node->allocated = allocated;
+    }
+
+    if(offset > node->size)
+        memset(&node->value[node->size], 0, offset - node->size);
+    if(size)
+        memcpy(&node->value[offset], value, size);
+    node->size = newSize;
+
+    return KV_SUCCESS;
+}
+
+static KV_Status Put(KV_MEM_Store* store, KV_Key key, KV_Value value, off_t offset, size_t size, KV_MEM_PutMode mode){
+    KV_MEM_Node* update[KV_MEM_MAX_LEVEL];
+    KV_MEM_Node* node;
+    KV_Status status;
+
+    // Existing keys are written in place...
+    g_rw_lock_reader_lock(&store->lock);
+    if( (node = Lookup(store, key, NULL)) ){
+        if(mode == KV_MEM_CREATE)
+            status = KV_KEY_EXIST;
+        else {
+            g_mutex_lock(&node->lock);
+            status = Store(store, node, value, offset, size, mode == KV_MEM_WRITE);
+            g_mutex_unlock(&node->lock);
+        }
+        g_rw_lock_reader_unlock(&store->lock);
+        return status;
+    }
+    g_rw_lock_reader_unlock(&store->lock);
+
+    // ... whereas new ones are added exclusively, unless someone else added them meanwhile
+    g_rw_lock_writer_lock(&store->lock);
+    if( (node = Lookup(store, key, update)) ){
+        status = mode == KV_MEM_CREATE?KV_KEY_EXIST:Store(store, node, value, offset, size, mode == KV_MEM_WRITE);
+    }
+    else if( (node = NewNode(key, RandomLevel(store))) && Reserve(store, strlen(key) + 1) ){
+        if( (status = Store(store, node, value, offset, size, 1)) == KV_SUCCESS )
+            Link(store, node, update);
+        else
+            Discard(store, node);
+    }
+    else {
+        if(node)
+            FreeNode(node);
+        status = KV_FAILURE;
+    }
+    g_rw_lock_writer_unlock(&store->lock);
+
+    return status;
+}
+
+// Options are passed in the query of the URI, e.g. mem:///hot?capacity=4096
+static void ParseOptions(KV_MEM_Store* store, const char* query){
+    gchar** options = g_strsplit(query, "&", 0);
+    int i;
+
+    for(i=0; options[i]; i++){
+        char* value = strchr(options[i], '=');
+        if(!value)
+            continue;
+
+        *value++ = '\0';
+        if(strcmp(options[i], "capacity") == 0)
+            store->capacity = strtoul(value, NULL, 10) * __1MByte;
+        else
+            LogActivity(H3_INFO_MSG, "WARNING: Unknown option in URI: %s\n", options[i]);
+    }
+
+    g_strfreev(options);
+}
+
+static void FreeStore(KV_MEM_Store* store){
+    KV_MEM_Node *node, *next;
+
+    for(node = store->head->next[0]; node; node = next){
+        next = node->next[0];
+        FreeNode(node);
+    }
+
+    FreeNode(store->head);
+    g_rw_lock_clear(&store->lock);
+    free(store->name);
+    free(store);
+}
+
+KV_Handle KV_MEM_Init(const char* storageUri) {
+    struct parsed_url *url = parse_url(storageUri);
+    KV_MEM_Store *store, *shared;
+    if (url == NULL) {
+        LogActivity(H3_ERROR_MSG, "ERROR: Unrecognized storage URI\n");
+        return NULL;
+    }
+
+    if( !(store = calloc(1, sizeof(KV_MEM_Store))) || !(store->head = NewNode(NULL, KV_MEM_MAX_LEVEL)) ){
+        parsed_url_free(url);
+        free(store);
+        return NULL;
+    }
+    g_rw_lock_init(&store->lock);
+    store->nLevels = 1;
+    store->seed = g_random_int() | 1;
+    store->refs = 1;
+
+    if(url->path && url->path[0]){
+        store->name = strdup(url->path);
+        LogActivity(H3_INFO_MSG, "INFO: Store name in URI: %s\n", store->name);
+    }
+    if(url->query)
+        ParseOptions(store, url->query);
+    parsed_url_free(url);
+
+    if(!store->name)
+        return (KV_Handle)store;
+
+    g_mutex_lock(&storesLock);
+    if(!stores)
+        stores = g_hash_table_new(g_str_hash, g_str_equal);
+
+    if( (shared = g_hash_table_lookup(stores, store->name)) ){
+        LogActivity(H3_INFO_MSG, "INFO: Sharing store %s\n", store->name);
+        shared->refs++;
+        FreeStore(store);
+        store = shared;
+    }
+    else
+        g_hash_table_insert(stores, store->name, store);
+    g_mutex_unlock(&storesLock);
+
+    return (KV_Handle)store;
+}
+
+void KV_MEM_Free(KV_Handle handle) {
+    KV_MEM_Store* store = (KV_MEM_Store*)handle;
+
+    if(store->name){
+        g_mutex_lock(&storesLock);
+        if(--store->refs){
+            g_mutex_unlock(&storesLock);
+            return;
+        }
+        g_hash_table_remove(stores, store->name);
+        g_mutex_unlock(&storesLock);
+    }
+
+    FreeStore(store);
+}
+
+KV_Status KV_MEM_StorageInfo(KV_Handle handle, KV_StorageInfo* storageInfo) {
+    KV_MEM_Store* store = (KV_MEM_Store*)handle;
+    size_t used = __atomic_load_n(&store->used, __ATOMIC_RELAXED);
+
+    storageInfo->totalSpace = store->capacity?store->capacity:(size_t)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
+    storageInfo->usedSpace = min(used, storageInfo->totalSpace);
+    storageInfo->freeSpace = storageInfo->totalSpace - storageInfo->usedSpace;
+
+    return KV_SUCCESS;
+}
+
+static KV_Status List(KV_Handle handle, KV_Key prefix, uint8_t nTrim, KV_Key buffer, uint32_t offset, uint32_t* nKeys, KV_ListCallback function, void* userData) {
+    KV_MEM_Store* store = (KV_MEM_Store*)handle;
+    KV_Status status = KV_SUCCESS;
+    KV_MEM_Node* node;
+
+    size_t remaining = KV_LIST_BUFFER_SIZE;
+    uint32_t nRequiredKeys = *nKeys>0?*nKeys:UINT32_MAX;
+    uint32_t nMatchingKeys = 0;
+    size_t prefixLen = strlen(prefix);
+
+    // Keys are ordered, thus the matching ones are contiguous starting from the prefix
+    g_rw_lock_reader_lock(&store->lock);
+    for(node = Seek(store, prefix, NULL); node && status != KV_CONTINUE && strncmp(node->key, prefix, prefixLen) == 0; node = node->next[0]){
+
+        if(offset)
+            offset--;
+        else if( nMatchingKeys < nRequiredKeys ){
+
+            // Copy the keys if a buffer is provided...
+            if(buffer){
+                size_t entrySize = strlen(node->key) + 1 - nTrim;
+                if(remaining >= entrySize ){
+                    KV_Key entry = &buffer[KV_LIST_BUFFER_SIZE - remaining];
+                    memcpy(entry, &node->key[nTrim], entrySize);
+                    remaining -= entrySize;
+                    nMatchingKeys++;
+
+                    if(function){
+                        g_mutex_lock(&node->lock);
+                        function(entry, node->value, node->size, userData);
+                        g_mutex_unlock(&node->lock);
+                    }
+                }
+                else
+                    status = KV_CONTINUE;
+            }
+
+            // ... otherwise just count them.
+            else
+                nMatchingKeys++;
+        }
+        else
+            status = KV_CONTINUE;
+    }
+    g_rw_lock_reader_unlock(&store->lock);
+
+    *nKeys = nMatchingKeys;
+
+    return status;
+}
+
+KV_Status KV_MEM_List(KV_Handle handle, KV_Key prefix, uint8_t nTrim, KV_Key buffer, uint32_t offset, uint32_t* nKeys) {
+    return List(handle, prefix, nTrim, buffer, offset, nKeys, NULL, NULL);
+}
+
+KV_Status KV_MEM_ListMetadata(KV_Handle handle, KV_Key prefix, uint8_t nTrim, KV_Key buffer, uint32_t offset, uint32_t* nKeys, KV_ListCallback function, void* userData) {
+    return List(handle, prefix, nTrim, buffer, offset, nKeys, function, userData);
+}
+
+// Copies a segment of the value of a node, the caller holds the node
+static KV_Status CopySegment(KV_MEM_Node* node, off_t offset, KV_Value* value, size_t* size){
+    size_t segmentSize;
+
+    if(offset > node->size){
+        *size = 0;
+        return KV_SUCCESS;
+    }
+
+    segmentSize = node->size - offset;
+    if(*value == NULL){
+        if( !(*value = malloc(max(segmentSize, 1))) )
+            return KV_FAILURE;
+    }
+    else
+        segmentSize = min(segmentSize, *size);
+
+    memcpy(*value, &node->value[offset], segmentSize);
+    *size = segmentSize;
+
+    return KV_SUCCESS;
+}
+
+static KV_Status Read(KV_MEM_Store* store, KV_Key key, off_t offset, KV_Value* value, size_t* size){
+    KV_MEM_Node* node;
+    KV_Status status;
+
+    if( (node = Lookup(store, key, NULL)) ){
+        g_mutex_lock(&node->lock);
+        status = CopySegment(node, offset, value, size);
+        g_mutex_unlock(&node->lock);
+    }
+    else
+        status = KV_KEY_NOT_EXIST;
+
+    return status;
+}
+
+KV_Status KV_MEM_Read(KV_Handle handle, KV_Key key, off_t offset, KV_Value* value, size_t* size) {
+    KV_MEM_Store* store = (KV_MEM_Store*)handle;
+    KV_Status status;
+
+    g_rw_lock_reader_lock(&store->lock);
+    status = Read(store, key, offset, value, size);
+    g_rw_lock_reader_unlock(&store->lock);
+
+    return status;
+}
+
+KV_Status KV_MEM_ReadBatch(KV_Handle handle, KV_ReadRequest* requests, uint32_t nRequests){
+    KV_MEM_Store* store = (KV_MEM_Store*)handle;
+    KV_Status status = KV_SUCCESS;
+    uint32_t i;
+
+    g_rw_lock_reader_lock(&store->lock);
+    for(i=0; i<nRequests; i++){
+        if( (requests[i].status = Read(store, requests[i].key, requests[i].offset, &requests[i].value, &requests[i].size)) != KV_SUCCESS )
+            status = KV_FAILURE;
+    }
+    g_rw_lock_reader_unlock(&store->lock);
+
+    return status;
+}
+
+KV_Status KV_MEM_Exists(KV_Handle handle, KV_Key key) {
+    KV_MEM_Store* store = (KV_MEM_Store*)handle;
+    KV_Status status;
+
+    g_rw_lock_reader_lock(&store->lock);
+    status = Lookup(store, key, NULL)?KV_KEY_EXIST:KV_KEY_NOT_EXIST;
+    g_rw_lock_reader_unlock(&store->lock);
+
+    return status;
+}
+
+KV_Status KV_MEM_Write(KV_Handle handle, KV_Key key, KV_Value value, size_t size) {
+    return Put((KV_MEM_Store*)handle, key, value, 0, size, KV_MEM_WRITE);
+}
+
+KV_Status KV_MEM_Create(KV_Handle handle, KV_Key key, KV_Value value, size_t size) {
+    return Put((KV_MEM_Store*)handle, key, value, 0, size, KV_MEM_CREATE);
+}
+
+KV_Status KV_MEM_Update(KV_Handle handle, KV_Key key, KV_Value value, off_t offset, size_t size) {
+    return Put((KV_MEM_Store*)handle, key, value, offset, size, KV_MEM_UPDATE);
+}
+
+KV_Status KV_MEM_Delete(KV_Handle handle, KV_Key key) {
+    KV_MEM_Store* store = (KV_MEM_Store*)handle;
+    KV_MEM_Node* update[KV_MEM_MAX_LEVEL];
+    KV_MEM_Node* node;
+    KV_Status status = KV_KEY_NOT_EXIST;
+
+    g_rw_lock_writer_lock(&store->lock);
+    if( (node = Lookup(store, key, update)) ){
+        Unlink(store, node, update);
+        Discard(store, node);
+        status = KV_SUCCESS;
+    }
+    g_rw_lock_writer_unlock(&store->lock);
+
+    return status;
+}
+
+KV_Status KV_MEM_Copy(KV_Handle handle, KV_Key src_key, KV_Key dest_key) {
+    KV_MEM_Store* store = (KV_MEM_Store*)handle;
+    KV_MEM_Node* update[KV_MEM_MAX_LEVEL];
+    KV_MEM_Node *src, *dst;
+    KV_Status status = KV_KEY_NOT_EXIST;
+
+    g_rw_lock_writer_lock(&store->lock);
+    if( (src = Lookup(store, src_key, NULL)) && strcmp(src_key, dest_key) ){
+        if( (dst = Lookup(store, dest_key, update)) ){
+            status = Store(store, dst, src->value, 0, src->size, 1);
+        }
+        else if( (dst = NewNode(dest_key, RandomLevel(store))) && Reserve(store, strlen(dest_key) + 1) ){
+            if( (status = Store(store, dst, src->value, 0, src->size, 1)) == KV_SUCCESS )
+                Link(store, dst, update);
+            else
+                Discard(store, dst);
+        }
+        else {
+            if(dst)
+                FreeNode(dst);
+            status = KV_FAILURE;
+        }
+    }
+    else if(src)
+        status = KV_SUCCESS;
+    g_rw_lock_writer_unlock(&store->lock);
+
+    return status;
+}
+
+// The node of the source is relinked under the destination key, replacing its node if any
+KV_Status KV_MEM_Move(KV_Handle handle, KV_Key src_key, KV_Key dest_key) {
+    KV_MEM_Store* store = (KV_MEM_Store*)handle;
+    KV_MEM_Node* update[KV_MEM_MAX_LEVEL];
+    KV_MEM_Node *src, *dst;
+    KV_Status status = KV_KEY_NOT_EXIST;
+    char* key;
+
+    g_rw_lock_writer_lock(&store->lock);
+    if( (src = Lookup(store, src_key, update)) && strcmp(src_key, dest_key) ){
+        if( (key = strdup(dest_key)) ){
+            Unlink(store, src, update);
+            if( (dst = Lookup(store, dest_key, update)) ){
+                Unlink(store, dst, update);
+                Discard(store, dst);
+                Lookup(store, dest_key, update);
+            }
+
+            Reserve(store, (ssize_t)strlen(dest_key) - (ssize_t)strlen(src->key));
+            free(src->key);
+            src->key = key;
+            Link(store, src, update);
+            status = KV_SUCCESS;
+        }
+        else
+            status = KV_FAILURE;
+    }
+    else if(src)
+        status = KV_SUCCESS;
+    g_rw_lock_writer_unlock(&store->lock);
+
+    return status;
+}
+
+KV_Status KV_MEM_Sync(KV_Handle handle) {
+    return KV_SUCCESS;
+}
+
+KV_Operations operationsMemory = {
+    .init = KV_MEM_Init,
+    .free = KV_MEM_Free,
+    .storage_info = KV_MEM_StorageInfo,
+    .validate_key = NULL,
+
+    .metadata_read = KV_MEM_Read,
+    .metadata_write = KV_MEM_Write,
+    .metadata_create = KV_MEM_Create,
+    .metadata_delete = KV_MEM_Delete,
+    .metadata_move = KV_MEM_Move,
+    .metadata_exists = KV_MEM_Exists,
+    .metadata_list = KV_MEM_ListMetadata,
+
+    .list = KV_MEM_List,
+    .exists = KV_MEM_Exists,
+    .read = KV_MEM_Read,
+    .read_batch = KV_MEM_ReadBatch,
+    .create = KV_MEM_Create,
+    .update = KV_MEM_Update,
+    .write = KV_MEM_Write,
+    .copy = KV_MEM_Copy,
+    .move = KV_MEM_Move,
+    .delete = KV_MEM_Delete,
+    .sync = KV_MEM_Sync
+};
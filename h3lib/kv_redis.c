@@ -16,6 +16,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
+#include <glib.h>
 #include <hiredis/hiredis.h>
 
 #include "kv_interface.h"
@@ -24,58 +26,493 @@
 #include "url_parser.h"
 
 #ifdef H3LIB_USE_COMPRESSION
+#include "common.h"
+#include "compression.h"
+#endif
+
+#define REDIS_CONNECTIONS   8
+#define REDIS_LIST_PAGE     1000
+#define REDIS_INDEX_MARKER  "/"
+#define REDIS_INDEX_VERSION 2       // Users and buckets are indexed as of version 2
+#define REDIS_RING_POINTS   64
+
+/*
+ * A connection may only serve one command (or pipeline) at a time, thus every call takes one from the pool of
+ * the node it addresses for its duration. Connections are opened on demand up to a max, whereas broken ones
+ * are dropped and replaced by the next call.
+ */
+typedef struct {
+    char* host;
+    int port;
+    uint32_t nConnections;
+    GQueue idle;
+    GMutex lock;
+    GCond released;
+}KV_Redis_Node;
+
+typedef struct {
+    uint32_t hash;
+    uint32_t node;
+}KV_Redis_Point;
+
+/*
+ * Keys are spread over independent instances (nodes) by consistent hashing, i.e. each node is placed at a number
+ * of points on a ring of hashes and keys are kept by the node at the first point following their own hash.
+ */
+typedef struct {
+    KV_Redis_Node* node;
+    uint32_t nNodes;
+    KV_Redis_Point* ring;
+    uint32_t nPoints;
+    uint32_t maxConnections;    // Per node
+    char noUnlink;              // Servers older than 4.0 lack UNLINK
+}KV_Redis_Handle;
+
+
+static redisContext* Connect(KV_Redis_Node* node){
+    redisContext* ctx = redisConnect(node->host, node->port);
+
+    if(!ctx || ctx->err){
+        LogActivity(H3_ERROR_MSG, "Hiredis - %s:%d %s\n", node->host, node->port, ctx?ctx->errstr:"Out of memory");
+        if(ctx)
+            redisFree(ctx);
+        return NULL;
+    }
+
+    return ctx;
+}
+
+static redisContext* GetConnection(KV_Redis_Handle* handle, uint32_t index){
+    KV_Redis_Node* node = &handle->node[index];
+    redisContext* ctx;
+
+    g_mutex_lock(&node->lock);
+    while( !(ctx = g_queue_pop_head(&node->idle)) && node->nConnections >= handle->maxConnections)
+        g_cond_wait(&node->released, &node->lock);
+
+    if(!ctx)
+        node->nConnections++;
+    g_mutex_unlock(&node->lock);
 
-#include <zstd.h>
+    if(!ctx && !(ctx = Connect(node))){
+        g_mutex_lock(&node->lock);
+        node->nConnections--;
+        g_cond_signal(&node->released);
+        g_mutex_unlock(&node->lock);
+    }
+
+    return ctx;
+}
 
-// Return a compressed value. Free when done on success.
-KV_Status compress_value(void *value, uint32_t value_size, void **compressed_value, uint32_t *compressed_value_size) {
-    uint32_t compress_bound = ZSTD_compressBound(value_size);
-    *compressed_value = malloc(compress_bound);
+static void PutConnection(KV_Redis_Handle* handle, uint32_t index, redisContext* ctx){
+    KV_Redis_Node* node = &handle->node[index];
 
-    // The last argument to the function is the compression level, which can range from 1 (lowest) to 22 (highest).
-    *compressed_value_size = ZSTD_compress(*compressed_value, compress_bound, value, value_size, -1);
+    g_mutex_lock(&node->lock);
+    if(ctx->err){
+        LogActivity(H3_ERROR_MSG, "Hiredis - %s\n", ctx->errstr);
+        redisFree(ctx);
+        node->nConnections--;
+    }
+    else
+        g_queue_push_head(&node->idle, ctx);
+    g_cond_signal(&node->released);
+    g_mutex_unlock(&node->lock);
+}
 
-    if (ZSTD_isError(*compressed_value_size)) {
-        LogActivity(H3_ERROR_MSG, "Failed to compress the value!");
-        free(*compressed_value);
-        *compressed_value = NULL;
-        *compressed_value_size = 0;
+/*
+ * Listings are served by a sorted set per namespace, i.e. the users, the buckets (along with the dictionaries), and the
+ * objects, the object metadata and the multipart uploads of each bucket. A namespace extends up to the first separator
+ * of a key, or is the leading '@' or '#' of users and buckets, and its set holds the rest of every key in it with equal
+ * scores, so that members are kept in lexicographical order. Sets are named after their namespace prefixed by '/', which
+ * no other key starts with. Data parts are never listed, thus not indexed.
+ */
+static size_t GetNamespace(const char* key){
+    size_t length;
+
+    if(key[0] == '@' || key[0] == '#')
+        return 1;
+
+    if(key[0] == '_' || key[0] == '/')
+        return 0;
+
+    length = strcspn(key, "/#$");
+    return key[length]?length + 1:0;
+}
+
+// Keys are indexed if named within their namespace, i.e. not the ids of multipart uploads ("<uuid>$")
+static size_t GetIndexedNamespace(const char* key){
+    size_t length = GetNamespace(key);
+    return length && key[length]?length:0;
+}
+
+// FNV-1a, followed by the finalizer of MurmurHash3 so that similar keys land far apart on the ring
+static uint32_t Hash(const char* data, size_t length){
+    uint32_t hash = 2166136261u;
+
+    while(length--){
+        hash ^= (uint8_t)*data++;
+        hash *= 16777619u;
+    }
+
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6b;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+static int ComparePoints(const void* a, const void* b){
+    uint32_t hashA = ((const KV_Redis_Point*)a)->hash, hashB = ((const KV_Redis_Point*)b)->hash;
+    return hashA < hashB?-1:hashA > hashB;
+}
+
+/*
+ * Points are derived from the address of each node as written in the URI, thus handles listing the same nodes in any order
+ * agree, whereas adding a node, removing one or writing its address differently (e.g. by another name) remaps keys. Keys
+ * are never moved between nodes, hence the list of nodes has to stay the same for the lifetime of the store.
+ */
+static KV_Status BuildRing(KV_Redis_Handle* handle){
+    uint32_t i, j;
+
+    handle->nPoints = handle->nNodes * REDIS_RING_POINTS;
+    if(!(handle->ring = malloc(handle->nPoints * sizeof(KV_Redis_Point))))
         return KV_FAILURE;
+
+    for(i=0; i<handle->nNodes; i++){
+        for(j=0; j<REDIS_RING_POINTS; j++){
+            gchar* point = g_strdup_printf("%s:%d-%u", handle->node[i].host, handle->node[i].port, j);
+            handle->ring[i * REDIS_RING_POINTS + j].hash = Hash(point, strlen(point));
+            handle->ring[i * REDIS_RING_POINTS + j].node = i;
+            g_free(point);
+        }
     }
 
+    qsort(handle->ring, handle->nPoints, sizeof(KV_Redis_Point), ComparePoints);
     return KV_SUCCESS;
 }
 
-// Return a decompressed value. Free when done on success.
-KV_Status decompress_value(void *compressed_value, uint32_t compressed_value_size, void **value, uint32_t *value_size) {
-    uint32_t frameContentSize = ZSTD_getFrameContentSize(compressed_value, compressed_value_size);
-    // Check if returned ZSTD_CONTENTSIZE_ERROR (error occured) / ZSTD_CONTENTSIZE_UNKNOWN (size can't be determined)
-    if(frameContentSize == ZSTD_CONTENTSIZE_ERROR
-      || frameContentSize == ZSTD_CONTENTSIZE_UNKNOWN){
-        LogActivity(H3_ERROR_MSG, "Could not retrieve original size!");
-        return KV_FAILURE;
+/*
+ * Keys within a namespace are placed by their namespace alone, acting as a hash tag, so that they are kept along
+ * with their index by a single node and listed from it, e.g. all users by one node and all buckets by one node. Other
+ * keys, e.g. data parts, are placed by their whole name thus the parts of an object are spread over all nodes.
+ */
+static uint32_t GetNode(KV_Redis_Handle* handle, KV_Key key){
+    uint32_t low = 0, high, middle, hash;
+    size_t length;
+
+    if(handle->nNodes == 1)
+        return 0;
+
+    length = GetNamespace(key);
+    hash = Hash(key, length?length:strlen(key));
+
+    for(high = handle->nPoints; low < high; ){
+        middle = (low + high) / 2;
+        if(handle->ring[middle].hash < hash)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    return handle->ring[low % handle->nPoints].node;
+}
+
+/*
+ * Appends a command on a key along with the update of its index, i.e. ZADD or ZREM, within a transaction. Returns the
+ * number of replies to expect, or 0 if the command could not be appended.
+ */
+static int vAppendIndexed(redisContext* ctx, KV_Key key, char add, const char* format, va_list ap){
+    size_t nsLength = GetIndexedNamespace(key);
+
+    if(!nsLength)
+        return redisvAppendCommand(ctx, format, ap) == REDIS_OK?1:0;
+
+    if( redisAppendCommand(ctx, "MULTI") == REDIS_OK                 &&
+        redisvAppendCommand(ctx, format, ap) == REDIS_OK             &&
+        redisAppendCommand(ctx, add?"ZADD /%b 0 %s":"ZREM /%b %s", key, nsLength, &key[nsLength]) == REDIS_OK &&
+        redisAppendCommand(ctx, "EXEC") == REDIS_OK                  )
+        return 4;
+
+    // Part of the transaction may have been appended, the connection is not to be reused
+    ctx->err = REDIS_ERR_OOM;
+    return 0;
+}
+
+static int AppendIndexed(redisContext* ctx, KV_Key key, char add, const char* format, ...){
+    va_list ap;
+    int nReplies;
+
+    va_start(ap, format);
+    nReplies = vAppendIndexed(ctx, key, add, format, ap);
+    va_end(ap);
+
+    return nReplies;
+}
+
+// Returns the reply of the command, the replies to MULTI and to the queued commands only acknowledge them
+static redisReply* GetIndexedReply(redisContext* ctx, int nReplies){
+    redisReply *reply = NULL, *result;
+
+    for(; nReplies; nReplies--){
+        freeReplyObject(reply);
+        if(redisGetReply(ctx, (void**)&reply) != REDIS_OK)
+            return NULL;
     }
 
-    *value = malloc(frameContentSize);
-    *value_size = ZSTD_decompress(*value, frameContentSize, compressed_value, compressed_value_size);
+    // A failed transaction is reported as such
+    if(!reply || reply->type != REDIS_REPLY_ARRAY)
+        return reply;
+
+    result = reply->elements?reply->element[0]:NULL;
+    if(result)
+        reply->element[0] = NULL;
+    freeReplyObject(reply);
+
+    return result;
+}
+
+static redisReply* IndexedCommand(redisContext* ctx, KV_Key key, char add, const char* format, ...){
+    va_list ap;
+    int nReplies;
+
+    va_start(ap, format);
+    nReplies = vAppendIndexed(ctx, key, add, format, ap);
+    va_end(ap);
+
+    return nReplies?GetIndexedReply(ctx, nReplies):NULL;
+}
+
+#ifdef H3LIB_USE_COMPRESSION
+
+/*
+ * Earlier versions built with compression support kept every value as a Zstandard frame, whereas data is now
+ * compressed by h3lib itself. Such stores are told apart by their user and bucket records, whose raw form
+ * never starts with the Zstandard magic number. Returns 1 if so, 0 if not and -1 on failure.
+ */
+static int IsLegacyCompressed(redisContext* ctx){
+    redisReply *reply, *value;
+    char cursor[32] = "0";
+    int compressed = 0;
+    size_t size;
+
+    do{
+        if( !(reply = redisCommand(ctx, "SCAN %s MATCH [#@]* COUNT %d", cursor, REDIS_LIST_PAGE)) || reply->type != REDIS_REPLY_ARRAY || reply->elements != 2){
+            freeReplyObject(reply);
+            return -1;
+        }
+
+        if(reply->element[1]->elements){
+            if( !(value = redisCommand(ctx, "GET %s", reply->element[1]->element[0]->str)) ){
+                freeReplyObject(reply);
+                return -1;
+            }
+
+            KV_Value decoded = value->type == REDIS_REPLY_STRING?DecodeLegacyFrame((KV_Value)value->str, value->len, &size):NULL;
+            compressed = decoded?1:0;
+            free(decoded);
+            freeReplyObject(value);
+            freeReplyObject(reply);
+            return compressed;
+        }
+
+        snprintf(cursor, sizeof(cursor), "%s", reply->element[0]->str);
+        freeReplyObject(reply);
+    }while(strcmp(cursor, "0") != 0);
 
-    if (ZSTD_isError(*value_size)) {
-        LogActivity(H3_ERROR_MSG, "Failed to decompress the value!");
-        free(*value);
-        *value = NULL;
-        *value_size = 0;
+    return compressed;
+}
+
+/*
+ * Replace every value by its decoded form, the store should not be used meanwhile. SCAN may return a key
+ * more than once, thus keys already expanded are remembered so that none is decoded twice.
+ */
+static KV_Status ExpandValues(redisContext* ctx){
+    GHashTable* expanded = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    KV_Status status = KV_SUCCESS;
+    redisReply *reply, *value;
+    char cursor[32] = "0";
+    size_t i, size;
+
+    LogActivity(H3_INFO_MSG, "INFO: Expanding the values of a store compressed by an earlier version\n");
+    do{
+        if( !(reply = redisCommand(ctx, "SCAN %s COUNT %d", cursor, REDIS_LIST_PAGE)) || reply->type != REDIS_REPLY_ARRAY || reply->elements != 2){
+            status = KV_FAILURE;
+            break;
+        }
+
+        for(i=0; i<reply->element[1]->elements && status == KV_SUCCESS; i++){
+            char* key = reply->element[1]->element[i]->str;
+            if(g_hash_table_contains(expanded, key))
+                continue;
+
+            if( !(value = redisCommand(ctx, "GET %s", key)) ){
+                status = KV_FAILURE;
+                break;
+            }
+
+            KV_Value decoded = value->type == REDIS_REPLY_STRING?DecodeLegacyFrame((KV_Value)value->str, value->len, &size):NULL;
+            freeReplyObject(value);
+            if(decoded){
+                if( (value = redisCommand(ctx, "SET %s %b", key, decoded, size)) && value->type != REDIS_REPLY_ERROR)
+                    g_hash_table_add(expanded, g_strdup(key));
+                else
+                    status = KV_FAILURE;
+
+                freeReplyObject(value);
+                free(decoded);
+            }
+        }
+
+        snprintf(cursor, sizeof(cursor), "%s", reply->element[0]->str);
+        freeReplyObject(reply);
+    }while(status == KV_SUCCESS && strcmp(cursor, "0") != 0);
+
+    g_hash_table_destroy(expanded);
+    return status;
+}
+
+#endif
+
+/*
+ * Stores written before keys were indexed, or before some of them were, are indexed once by scanning the whole keyspace.
+ * The marker holds the version of the index, adding the keys indexed already again leaves their sets as they are.
+ */
+static KV_Status BuildIndex(redisContext* ctx){
+    KV_Status status = KV_SUCCESS;
+    redisReply *reply, *added;
+    char cursor[32] = "0";
+    uint32_t nAppended;
+    size_t i, nsLength;
+    int version;
+
+    if(!(reply = redisCommand(ctx, "GET %s", REDIS_INDEX_MARKER)))
         return KV_FAILURE;
+
+    version = reply->type == REDIS_REPLY_STRING?atoi(reply->str):0;
+    freeReplyObject(reply);
+    if(version >= REDIS_INDEX_VERSION)
+        return KV_SUCCESS;
+
+#ifdef H3LIB_USE_COMPRESSION
+    // Values compressed by the driver predate the index, thus they are expanded beforehand
+    int compressed = version?0:IsLegacyCompressed(ctx);
+    if(compressed < 0 || (compressed && ExpandValues(ctx) != KV_SUCCESS))
+        return KV_FAILURE;
+#endif
+
+    LogActivity(H3_INFO_MSG, "INFO: Indexing the keys of the store\n");
+    do{
+        if( !(reply = redisCommand(ctx, "SCAN %s COUNT %d", cursor, REDIS_LIST_PAGE)) || reply->type != REDIS_REPLY_ARRAY || reply->elements != 2){
+            status = KV_FAILURE;
+            break;
+        }
+
+        for(i=0, nAppended=0; i<reply->element[1]->elements; i++){
+            char* key = reply->element[1]->element[i]->str;
+            if((nsLength = GetIndexedNamespace(key)) && redisAppendCommand(ctx, "ZADD /%b 0 %s", key, nsLength, &key[nsLength]) == REDIS_OK)
+                nAppended++;
+        }
+
+        for(; nAppended && status == KV_SUCCESS; nAppended--){
+            if(redisGetReply(ctx, (void**)&added) == REDIS_OK)
+                freeReplyObject(added);
+            else
+                status = KV_FAILURE;
+        }
+
+        snprintf(cursor, sizeof(cursor), "%s", reply->element[0]->str);
+        freeReplyObject(reply);
+        reply = NULL;
+    }while(status == KV_SUCCESS && strcmp(cursor, "0") != 0);
+
+    freeReplyObject(reply);
+    if(status == KV_SUCCESS && (reply = redisCommand(ctx, "SET %s %d", REDIS_INDEX_MARKER, REDIS_INDEX_VERSION)))
+        freeReplyObject(reply);
+    else
+        status = KV_FAILURE;
+
+    return status;
+}
+
+// Nodes are told apart by their address as given, the same node listed twice is only kept once
+static KV_Status AddNode(KV_Redis_Handle* handle, const char* host, int port){
+    KV_Redis_Node* node;
+    uint32_t i;
+
+    for(i=0; i<handle->nNodes; i++){
+        if(handle->node[i].port == port && strcmp(handle->node[i].host, host) == 0)
+            return KV_SUCCESS;
     }
 
+    if(!(node = realloc(handle->node, (handle->nNodes + 1) * sizeof(KV_Redis_Node))))
+        return KV_FAILURE;
+
+    handle->node = node;
+    node = &handle->node[handle->nNodes];
+    memset(node, 0, sizeof(KV_Redis_Node));
+    if(!(node->host = strdup(host)))
+        return KV_FAILURE;
+
+    node->port = port;
+    handle->nNodes++;
     return KV_SUCCESS;
 }
 
-#endif
+/*
+ * Options are passed in the query of the URI, e.g. redis://127.0.0.1:6379/?connections=16&nodes=10.0.0.2:6379,10.0.0.3
+ * where nodes lists further instances to spread keys over, next to the one of the URI.
+ */
+static KV_Status ParseOptions(KV_Redis_Handle* handle, const char* query){
+    KV_Status status = KV_SUCCESS;
+    gchar** options = g_strsplit(query, "&", 0);
+    int i, j;
+
+    for(i=0; options[i] && status == KV_SUCCESS; i++){
+        char* value = strchr(options[i], '=');
+        if(!value)
+            continue;
+
+        *value++ = '\0';
+        if(strcmp(options[i], "connections") == 0)
+            handle->maxConnections = max(strtoul(value, NULL, 10), 1);
+        else if(strcmp(options[i], "nodes") == 0){
+            gchar** nodes = g_strsplit(value, ",", 0);
+            for(j=0; nodes[j] && status == KV_SUCCESS; j++){
+                char* port = strrchr(nodes[j], ':');
+                if(port)
+                    *port++ = '\0';
+
+                if(*nodes[j])
+                    status = AddNode(handle, nodes[j], port && atoi(port)?atoi(port):6379);
+            }
+            g_strfreev(nodes);
+        }
+        else
+            LogActivity(H3_INFO_MSG, "WARNING: Unknown option in URI: %s\n", options[i]);
+    }
 
-typedef struct {
-	redisContext* ctx;
-}KV_Redis_Handle;
+    g_strfreev(options);
+    return status;
+}
 
+void KV_Redis_Free(KV_Handle handle) {
+	KV_Redis_Handle* _handle = (KV_Redis_Handle*) handle;
+	redisContext* ctx;
+	uint32_t i;
+	for(i=0; i<_handle->nNodes; i++){
+		KV_Redis_Node* node = &_handle->node[i];
+		while( (ctx = g_queue_pop_head(&node->idle)) )
+			redisFree(ctx);
+		g_mutex_clear(&node->lock);
+		g_cond_clear(&node->released);
+		free(node->host);
+	}
+	free(_handle->node);
+	free(_handle->ring);
+    free(_handle);
+    return;
+}
 
 KV_Handle KV_Redis_Init(const char* storageUri) {
     struct parsed_url *url = parse_url(storageUri);
@@ -84,15 +521,21 @@ KV_Handle KV_Redis_Init(const char* storageUri) {
         return NULL;
     }
 
-    char *host;
+    KV_Redis_Handle* handle = calloc(1, sizeof(KV_Redis_Handle));
+    if (!handle){
+        parsed_url_free(url);
+        return NULL;
+    }
+
+    const char* host;
+    int port;
     if (url->host != NULL) {
-        host = strdup(url->host);
+        host = url->host;
         LogActivity(H3_INFO_MSG, "INFO: Host in URI: %s\n", host);
     } else {
-        host = strdup("127.0.0.1");
+        host = "127.0.0.1";
         LogActivity(H3_INFO_MSG, "WARNING: No host in URI. Using default: 127.0.0.1\n");
     }
-    int port;
     if (url->port != NULL) {
         port = atoi(url->port);
         if (port == 0) {
@@ -103,97 +546,303 @@ KV_Handle KV_Redis_Init(const char* storageUri) {
         port = 6379;
         LogActivity(H3_INFO_MSG, "WARNING: No port in URI. Using default: 6379\n");
     }
+    handle->maxConnections = REDIS_CONNECTIONS;
+    KV_Status status = AddNode(handle, host, port);
+    if(status == KV_SUCCESS && url->query)
+        status = ParseOptions(handle, url->query);
     parsed_url_free(url);
 
-    KV_Redis_Handle* handle = malloc(sizeof(KV_Redis_Handle));
-    if (!handle)
-        return NULL;
+    uint32_t i;
+    for(i=0; i<handle->nNodes; i++){
+        g_queue_init(&handle->node[i].idle);
+        g_mutex_init(&handle->node[i].lock);
+        g_cond_init(&handle->node[i].released);
+    }
+
+    if(status == KV_SUCCESS)
+        status = BuildRing(handle);
+
+    // Connect once upfront to find out whether the servers are reachable
+    for(i=0; i<handle->nNodes && status == KV_SUCCESS; i++){
+        redisContext* ctx;
+        if (!(ctx = Connect(&handle->node[i])) || BuildIndex(ctx) != KV_SUCCESS) {
+            if(ctx)
+                redisFree(ctx);
+            status = KV_FAILURE;
+        }
+        else {
+            g_queue_push_head(&handle->node[i].idle, ctx);
+            handle->node[i].nConnections = 1;
+        }
+    }
 
-    if (!(handle->ctx = redisConnect(host, port))) {
-        LogActivity(H3_ERROR_MSG, "Hiredis - %s\n", handle->ctx->errstr);
-        free(host);
-        free(handle);
+    if(status != KV_SUCCESS){
+        KV_Redis_Free(handle);
         return NULL;
     }
 
-    free(host);
+    LogActivity(H3_INFO_MSG, "INFO: Keys spread over %u node(s)\n", handle->nNodes);
     return (KV_Handle)handle;
 }
 
-void KV_Redis_Free(KV_Handle handle) {
-	KV_Redis_Handle* _handle = (KV_Redis_Handle*) handle;
-	redisFree(_handle->ctx);
-    free(_handle);
-    return;
+// Places a key in the listing buffer after trimming it, the key may come in two pieces (namespace and member)
+static int AddEntry(KV_Key buffer, size_t* remaining, const char* head, size_t headLength, const char* tail, size_t tailLength, uint8_t nTrim){
+    size_t trimmed = min(headLength, nTrim);
+
+    headLength -= trimmed;
+    tail += nTrim - trimmed;
+    tailLength -= nTrim - trimmed;
+    if(*remaining < headLength + tailLength + 1)
+        return 0;
+
+    memcpy(&buffer[KV_LIST_BUFFER_SIZE - *remaining], &head[trimmed], headLength);
+    memcpy(&buffer[KV_LIST_BUFFER_SIZE - *remaining + headLength], tail, tailLength);
+    *remaining -= headLength + tailLength + 1;
+    return 1;
 }
 
-KV_Status KV_Redis_List(KV_Handle handle, KV_Key prefix, uint8_t nTrim, KV_Key buffer, uint32_t offset, uint32_t* nKeys){
-	KV_Redis_Handle* storeHandle = (KV_Redis_Handle*) handle;
+/*
+ * Prefixes outside of any namespace are matched against the whole keyspace of a node, in no particular order. The
+ * listing carries on from node to node, thus the position in it and in the buffer are kept by the caller.
+ */
+static KV_Status ScanKeys(redisContext* ctx, KV_Key prefix, uint8_t nTrim, KV_Key buffer, size_t* remaining, uint32_t* offset, uint32_t nRequiredKeys, uint32_t* nMatchingKeys){
 	KV_Status status = KV_SUCCESS;
-    uint32_t nRequiredKeys = *nKeys>0?*nKeys:UINT32_MAX;
-    uint32_t nMatchingKeys = 0;
-    size_t remaining = KV_LIST_BUFFER_SIZE;
-
     redisReply* reply = NULL;
-    char* cursor = strdup("0");
-
-    if(buffer)
-   	    memset(buffer, 0, KV_LIST_BUFFER_SIZE);
+    char cursor[32] = "0";
+    size_t i;
 
     do{
        	freeReplyObject(reply);
-       	if((reply = redisCommand(storeHandle->ctx, "SCAN %s MATCH %s*", cursor, prefix))){
-            if (!reply->elements) break;
-
-       		int i;
+       	if((reply = redisCommand(ctx, "SCAN %s MATCH %s* COUNT %d", cursor, prefix, REDIS_LIST_PAGE))){
+            if (reply->type != REDIS_REPLY_ARRAY || reply->elements != 2) break;
 
        		for(i=0; i<reply->element[1]->elements && status != KV_CONTINUE; i++){
+       			redisReply* key = reply->element[1]->element[i];
 
-       			if(offset)
-       				offset--;
+       			// Skip the indices
+       			if(key->str[0] == '/')
+       				continue;
 
-       			else if( nMatchingKeys < nRequiredKeys ){
+       			if(*offset)
+       				(*offset)--;
 
-       				// Copy the keys if a buffer is provided...
-       				if(buffer){
-       					size_t entrySize = reply->element[1]->element[i]->len - nTrim;
-       					if(remaining >= (entrySize + 1) ){
-       						memcpy(&buffer[KV_LIST_BUFFER_SIZE - remaining], &reply->element[1]->element[i]->str[nTrim], entrySize);
-       						remaining -= (entrySize+1);
-       						nMatchingKeys++;
-       					}
-       					else
-       						status = KV_CONTINUE;
-       				}
+       			else if( *nMatchingKeys < nRequiredKeys ){
 
-       				// ... otherwise just count them.
+       				// Copy the keys if a buffer is provided, otherwise just count them
+       				if(!buffer || AddEntry(buffer, remaining, "", 0, key->str, key->len, nTrim))
+       					(*nMatchingKeys)++;
        				else
-       					nMatchingKeys++;
+       					status = KV_CONTINUE;
        			}
        			else
        				status = KV_CONTINUE;
        		}
 
-       		cursor = strdup(reply->element[0]->str);
+       		snprintf(cursor, sizeof(cursor), "%s", reply->element[0]->str);
        	}
 
     }while(reply && strcmp(cursor, "0") != 0 && status != KV_CONTINUE);
 
-    if(reply){
+    if(reply)
    	    freeReplyObject(reply);
-   	    *nKeys = nMatchingKeys;
-    } else
+    else
         status = KV_FAILURE;
 
    return status;
 }
 
+// Keys are listed in order from the index of their namespace, a page at a time
+KV_Status KV_Redis_List(KV_Handle handle, KV_Key prefix, uint8_t nTrim, KV_Key buffer, uint32_t offset, uint32_t* nKeys){
+	KV_Redis_Handle* storeHandle = (KV_Redis_Handle*) handle;
+	KV_Status status = KV_SUCCESS;
+    uint32_t nRequiredKeys = *nKeys>0?*nKeys:UINT32_MAX;
+    uint32_t nMatchingKeys = 0;
+    size_t remaining = KV_LIST_BUFFER_SIZE;
+    size_t nsLength = GetNamespace(prefix);
+
+    redisContext* ctx;
+    redisReply* reply = NULL;
+    char *from, *to;
+    uint32_t node;
+    size_t i;
+
+    if(buffer)
+   	    memset(buffer, 0, KV_LIST_BUFFER_SIZE);
+
+    // Keys outside of any namespace are spread over all nodes, they are listed from one node after the other
+    if(!nsLength){
+        for(node=0; node<storeHandle->nNodes && status == KV_SUCCESS; node++){
+            if((ctx = GetConnection(storeHandle, node))){
+                status = ScanKeys(ctx, prefix, nTrim, buffer, &remaining, &offset, nRequiredKeys, &nMatchingKeys);
+                PutConnection(storeHandle, node, ctx);
+            }
+            else
+                status = KV_FAILURE;
+        }
+
+        if(status != KV_FAILURE)
+            *nKeys = nMatchingKeys;
+
+        return status;
+    }
+
+    node = GetNode(storeHandle, prefix);
+    if(!(ctx = GetConnection(storeHandle, node)))
+        return KV_FAILURE;
+
+    // Members starting with the rest of the prefix, names are UTF-8 thus never contain 0xFF
+    if(prefix[nsLength]){
+        from = g_strdup_printf("[%s", &prefix[nsLength]);
+        to = g_strdup_printf("[%s\xff", &prefix[nsLength]);
+    }
+    else {
+        from = g_strdup("-");
+        to = g_strdup("+");
+    }
+
+    // Counting needs no transfer of keys
+    if(!buffer){
+        if((reply = redisCommand(ctx, "ZLEXCOUNT /%b %s %s", prefix, nsLength, from, to)) && reply->type == REDIS_REPLY_INTEGER){
+            uint64_t nAvailable = (uint64_t)reply->integer > offset?reply->integer - offset:0;
+            nMatchingKeys = min(nAvailable, (uint64_t)nRequiredKeys);
+            status = nAvailable > nRequiredKeys?KV_CONTINUE:KV_SUCCESS;
+        }
+        else
+            status = KV_FAILURE;
+
+        freeReplyObject(reply);
+    }
+
+    else {
+        char last = 0;
+        do{
+            uint32_t nWanted = min(nRequiredKeys - nMatchingKeys, REDIS_LIST_PAGE);
+
+            // Ask for one more to find out whether the listing continues
+            if((reply = redisCommand(ctx, "ZRANGEBYLEX /%b %s %s LIMIT %u %u", prefix, nsLength, from, to, offset, nWanted + 1)) && reply->type == REDIS_REPLY_ARRAY){
+                for(i=0; i<reply->elements && status == KV_SUCCESS; i++){
+                    redisReply* member = reply->element[i];
+                    if(nMatchingKeys < nRequiredKeys && AddEntry(buffer, &remaining, prefix, nsLength, member->str, member->len, nTrim))
+                        nMatchingKeys++;
+                    else
+                        status = KV_CONTINUE;
+                }
+
+                offset += reply->elements;
+                last = reply->elements <= nWanted;
+            }
+            else
+                status = KV_FAILURE;
+
+            freeReplyObject(reply);
+        }while(status == KV_SUCCESS && !last);
+    }
+
+    PutConnection(storeHandle, node, ctx);
+    g_free(from);
+    g_free(to);
+
+    if(status != KV_FAILURE)
+        *nKeys = nMatchingKeys;
+
+   return status;
+}
+
+// Fetch the values of all listed keys with a single round trip per node keeping any of them
+KV_Status KV_Redis_ListMetadata(KV_Handle handle, KV_Key prefix, uint8_t nTrim, KV_Key buffer, uint32_t offset, uint32_t* nKeys, KV_ListCallback function, void* userData){
+	KV_Redis_Handle* storeHandle = (KV_Redis_Handle*) handle;
+	KV_Status status;
+
+	if( (status = KV_Redis_List(handle, prefix, nTrim, buffer, offset, nKeys)) != KV_SUCCESS && status != KV_CONTINUE)
+		return status;
+
+	if(!*nKeys)
+		return status;
+
+	char** keys = calloc(*nKeys, sizeof(char*));
+	uint32_t* nodes = malloc(*nKeys * sizeof(uint32_t));
+	const char** argv = malloc((*nKeys + 1) * sizeof(char*));
+	size_t* argvLen = malloc((*nKeys + 1) * sizeof(size_t));
+	redisReply** replies = calloc(storeHandle->nNodes, sizeof(redisReply*));
+	uint32_t* next = calloc(storeHandle->nNodes, sizeof(uint32_t));
+	KV_Key entry = buffer;
+	redisContext* ctx;
+	uint32_t i, node, argc;
+
+	if(!keys || !nodes || !argv || !argvLen || !replies || !next)
+		status = KV_FAILURE;
+
+	// Listed keys are trimmed, restore them
+	for(i=0; i<*nKeys && status != KV_FAILURE; i++, entry += strlen(entry) + 1){
+		if(asprintf(&keys[i], "%.*s%s", nTrim, prefix, entry) < 0){
+			keys[i] = NULL;
+			status = KV_FAILURE;
+		}
+		else
+			nodes[i] = GetNode(storeHandle, keys[i]);
+	}
+
+	for(node=0; node<storeHandle->nNodes && status != KV_FAILURE; node++){
+		argv[0] = "MGET";
+		argvLen[0] = 4;
+		for(i=0, argc=1; i<*nKeys; i++){
+			if(nodes[i] == node){
+				argv[argc] = keys[i];
+				argvLen[argc++] = strlen(keys[i]);
+			}
+		}
+
+		if(argc == 1)
+			continue;
+
+		if(!(ctx = GetConnection(storeHandle, node))){
+			status = KV_FAILURE;
+			break;
+		}
+
+		replies[node] = redisCommandArgv(ctx, argc, argv, argvLen);
+		if(!replies[node] || replies[node]->type != REDIS_REPLY_ARRAY || replies[node]->elements != argc - 1){
+			LogActivity(H3_ERROR_MSG, "Hiredis - %s\n", replies[node]?replies[node]->str:ctx->errstr);
+			status = KV_FAILURE;
+		}
+
+		PutConnection(storeHandle, node, ctx);
+	}
+
+	if(status != KV_FAILURE){
+		for(i=0, entry=buffer; i<*nKeys; i++, entry += strlen(entry) + 1){
+			redisReply* value = replies[nodes[i]]->element[next[nodes[i]]++];
+			if(value->type == REDIS_REPLY_STRING)
+				function(entry, (KV_Value)value->str, value->len, userData);
+			else
+				function(entry, NULL, 0, userData);
+		}
+	}
+
+	for(i=0; keys && i<*nKeys; i++)
+		free(keys[i]);
+	for(node=0; replies && node<storeHandle->nNodes; node++)
+		freeReplyObject(replies[node]);
+	free(next);
+	free(replies);
+	free(argvLen);
+	free(argv);
+	free(nodes);
+	free(keys);
+	return status;
+}
+
 KV_Status KV_Redis_Exists(KV_Handle handle, KV_Key key) {
 	KV_Redis_Handle* storeHandle = (KV_Redis_Handle*) handle;
     KV_Status status = KV_FAILURE;
+    redisContext* ctx;
     redisReply* reply = NULL;
 
-    if((reply = redisCommand(storeHandle->ctx, "EXISTS %s", key))){
+    uint32_t node = GetNode(storeHandle, key);
+    if(!(ctx = GetConnection(storeHandle, node)))
+        return KV_FAILURE;
+
+    if((reply = redisCommand(ctx, "EXISTS %s", key))){
 
     	if(reply->integer == 0)
     		status = KV_KEY_NOT_EXIST;
@@ -203,95 +852,157 @@ KV_Status KV_Redis_Exists(KV_Handle handle, KV_Key key) {
     	freeReplyObject(reply);
     }
 
+    PutConnection(storeHandle, node, ctx);
     return status;
 }
 
+/*
+ * Reads into a caller supplied buffer fetch just the requested range, otherwise the value is fetched from the
+ * offset to its end. Redis returns an empty range rather than nil for missing keys, so ranges are preceded by
+ * an EXISTS in the same pipeline.
+ */
+static int AppendRead(redisContext* ctx, KV_Key key, off_t offset, KV_Value value, size_t size){
+	if(!value && !offset)
+		return redisAppendCommand(ctx, "GET %s", key);
+
+	if(redisAppendCommand(ctx, "EXISTS %s", key) != REDIS_OK)
+		return REDIS_ERR;
+
+	if(value)
+		return redisAppendCommand(ctx, "GETRANGE %s %lld %lld", key, (long long)offset, (long long)(offset + size) - 1);
+	else
+		return redisAppendCommand(ctx, "GETRANGE %s %lld -1", key, (long long)offset);
+}
+
+static KV_Status ParseRead(redisReply* reply, KV_Value* value, size_t* size){
+	KV_Status status = KV_FAILURE;
+
+	switch(reply->type){
+		case REDIS_REPLY_NIL:
+			status = KV_KEY_NOT_EXIST;
+			break;
+
+		case REDIS_REPLY_STRING:
+			if(*value == NULL){
+				*value = malloc(reply->len);
+				*size = reply->len;
+			}
+
+			if(*value){
+				*size = min(reply->len, *size);
+				memcpy(*value, reply->str, *size);
+				status = KV_SUCCESS;
+			}
+			break;
+	}
+
+	return status;
+}
+
+// Collects the replies of the commands appended by AppendRead, with the same offset and value
+static KV_Status GetRead(redisContext* ctx, off_t offset, KV_Value* value, size_t* size){
+	KV_Status status = KV_SUCCESS;
+	redisReply* reply;
+
+	if(*value || offset){
+		if(redisGetReply(ctx, (void**)&reply) != REDIS_OK)
+			return KV_FAILURE;
+
+		if(reply->type != REDIS_REPLY_INTEGER)
+			status = KV_FAILURE;
+		else if(reply->integer == 0)
+			status = KV_KEY_NOT_EXIST;
+		freeReplyObject(reply);
+	}
+
+	if(redisGetReply(ctx, (void**)&reply) != REDIS_OK)
+		return KV_FAILURE;
+
+	if(status == KV_SUCCESS)
+		status = ParseRead(reply, value, size);
+	freeReplyObject(reply);
+
+	return status;
+}
+
 KV_Status KV_Redis_Read(KV_Handle handle, KV_Key key, off_t offset, KV_Value* value, size_t* size) {
 	KV_Redis_Handle* storeHandle = (KV_Redis_Handle*) handle;
-    KV_Status status = KV_FAILURE;
-	redisReply* reply = NULL;
+	KV_Status status = KV_FAILURE;
+	redisContext* ctx;
 
-#ifdef H3LIB_USE_COMPRESSION
-    void *decompressed_value;
-    uint32_t decompressed_value_size;
+	uint32_t node = GetNode(storeHandle, key);
+	if(!(ctx = GetConnection(storeHandle, node)))
+		return KV_FAILURE;
 
-    reply = redisCommand(storeHandle->ctx, "GET %s", key);
-#else
-	if(offset)
-		reply = redisCommand(storeHandle->ctx, "GETRANGE %s %d %d", key, offset, offset + *size);
-	else
-		reply = redisCommand(storeHandle->ctx, "GET %s", key);
-#endif
+	if(AppendRead(ctx, key, offset, *value, *size) == REDIS_OK)
+		status = GetRead(ctx, offset, value, size);
 
-	if(reply){
-		switch(reply->type){
-			case REDIS_REPLY_NIL:
-				status = KV_KEY_NOT_EXIST;
-				break;
+	PutConnection(storeHandle, node, ctx);
+	return status;
+}
 
-			case REDIS_REPLY_STRING:
-#ifdef H3LIB_USE_COMPRESSION
-                // Get decompressed value.
-                if (decompress_value(reply->str, reply->len, &decompressed_value, &decompressed_value_size) == KV_SUCCESS &&
-                    decompressed_value_size >= offset) {
-                    if (*value == NULL) {
-                        *size = decompressed_value_size - offset;
-                    } else {
-                        *size = min(decompressed_value_size - offset, *size);
-                    }
-
-                    if (*value == NULL && offset == 0) {
-                        // No value malloced and no offset. Return decompressed value.
-                        *value = decompressed_value;
-                        status = KV_SUCCESS;
-                    } else {
-                        if (*value == NULL && offset != 0) {
-                            // We need to malloc a smaller value since there is an offset.
-                            *value = malloc(*size);
-                        }
-                        if (*value != NULL) {
-                            // Copy decompressed value in return value.
-                            memcpy(*value, ((char *)decompressed_value) + offset, *size);
-                            free(decompressed_value);
-                            status = KV_SUCCESS;
-                        }
-                    }
-                }
-#else
-				if(*value == NULL){
-					*value = malloc(reply->len);
-					*size = reply->len;
-				}
-
-				if(*value){
-					*size = min(reply->len, *size);
-					memcpy(*value, reply->str, *size);
-					status = KV_SUCCESS;
-				}
+// The reads of a node are sent at once over a single connection, so that the batch costs a round trip per node
+KV_Status KV_Redis_ReadBatch(KV_Handle handle, KV_ReadRequest* requests, uint32_t nRequests){
+	KV_Redis_Handle* storeHandle = (KV_Redis_Handle*) handle;
+	KV_Status status = KV_SUCCESS;
+	redisContext* ctx;
+	uint32_t i, node, nSent;
+	uint32_t* nodes;
+
+	for(i=0; i<nRequests; i++)
+		requests[i].status = KV_FAILURE;
+
+	if(!(nodes = malloc(nRequests * sizeof(uint32_t))))
+		return KV_FAILURE;
+
+	for(i=0; i<nRequests; i++)
+		nodes[i] = GetNode(storeHandle, requests[i].key);
+
+	for(node=0; node<storeHandle->nNodes; node++){
+		for(i=0, nSent=0, ctx=NULL; i<nRequests; i++){
+			KV_ReadRequest* request = &requests[i];
+			if(nodes[i] != node)
+				continue;
+
+			if( (!ctx && !(ctx = GetConnection(storeHandle, node))) ||
+				AppendRead(ctx, request->key, request->offset, request->value, request->size) != REDIS_OK)
 				break;
-#endif
+
+			nSent++;
 		}
-		freeReplyObject(reply);
+
+		for(i=0; nSent; i++){
+			if(nodes[i] != node)
+				continue;
+
+			nSent--;
+			requests[i].status = GetRead(ctx, requests[i].offset, &requests[i].value, &requests[i].size);
+		}
+
+		if(ctx)
+			PutConnection(storeHandle, node, ctx);
 	}
+	free(nodes);
 
-    return status;
+	for(i=0; i<nRequests; i++){
+		if(requests[i].status != KV_SUCCESS)
+			status = KV_FAILURE;
+	}
+
+	return status;
 }
 
 KV_Status KV_Redis_Create(KV_Handle handle, KV_Key key, KV_Value value, size_t size){
 	KV_Redis_Handle* storeHandle = (KV_Redis_Handle*) handle;
 	KV_Status status = KV_FAILURE;
+	redisContext* ctx;
 	redisReply* reply = NULL;
 
-#ifdef H3LIB_USE_COMPRESSION
-    void *compressed_value;
-    uint32_t compressed_value_size;
-    if (compress_value(value, size, &compressed_value, &compressed_value_size) == KV_FAILURE)
-        return KV_FAILURE;
-    reply = redisCommand(storeHandle->ctx, "SET %s %b NX", key, compressed_value, compressed_value_size);
-    free(compressed_value);
-#else
-	reply = redisCommand(storeHandle->ctx, "SET %s %b NX", key, value, size);
-#endif
+	uint32_t node = GetNode(storeHandle, key);
+	if(!(ctx = GetConnection(storeHandle, node)))
+		return KV_FAILURE;
+
+	reply = IndexedCommand(ctx, key, 1, "SET %s %b NX", key, value, size);
 
 	if(reply){
 		switch(reply->type){
@@ -306,82 +1017,126 @@ KV_Status KV_Redis_Create(KV_Handle handle, KV_Key key, KV_Value value, size_t s
 		freeReplyObject(reply);
 	}
 
+	PutConnection(storeHandle, node, ctx);
 	return status;
 }
 
+/*
+ * Updates keep the rest of the value, thus they are applied with SETRANGE which also pads the value with 0x00 up to
+ * the offset. An empty update only makes sure the key exists, as SETRANGE would not create it.
+ */
+static int AppendUpdate(redisContext* ctx, KV_Key key, KV_Value value, off_t offset, size_t size){
+	if(size)
+		return AppendIndexed(ctx, key, 1, "SETRANGE %s %lld %b", key, (long long)offset, value, size);
+	else
+		return AppendIndexed(ctx, key, 1, "SET %s %b NX", key, "", (size_t)0);
+}
+
+static KV_Status ParseUpdate(redisReply* reply){
+	switch(reply->type){
+		case REDIS_REPLY_NIL:           // SET, key exists
+		case REDIS_REPLY_STATUS:        // SET
+		case REDIS_REPLY_INTEGER:       // SETRANGE
+			return KV_SUCCESS;
+	}
+
+	return KV_FAILURE;
+}
+
 KV_Status KV_Redis_Update(KV_Handle handle, KV_Key key, KV_Value value, off_t offset, size_t size) {
     KV_Redis_Handle* storeHandle = (KV_Redis_Handle*) handle;
     KV_Status status = KV_FAILURE;
+    redisContext* ctx;
     redisReply* reply;
+    int nReplies;
 
-#ifdef H3LIB_USE_COMPRESSION
-    if (offset) {
-        // Read.
-        KV_Value current_value = NULL;
-        size_t current_value_size = 0;
-        if (KV_Redis_Read(handle, key, 0, &current_value, &current_value_size) == KV_FAILURE)
-            return KV_FAILURE;
-
-        // Modify.
-        if (offset + size > current_value_size) {
-            current_value = ReAllocFreeOnFail(current_value, offset + size);
-            if (current_value == NULL)
-                return KV_FAILURE;
-            current_value_size = offset + size;
-        }
-        memcpy(current_value + offset, value, size);
-
-        // Write.
-        void *compressed_value;
-        uint32_t compressed_value_size;
-        if (compress_value(current_value, current_value_size, &compressed_value, &compressed_value_size) == KV_FAILURE)
-            return KV_FAILURE;
-        reply = redisCommand(storeHandle->ctx, "SET %s %b", key, compressed_value, compressed_value_size);
-        free(compressed_value);
-        free(current_value);
-    } else {
-        void *compressed_value;
-        uint32_t compressed_value_size;
-        if (compress_value(value, size, &compressed_value, &compressed_value_size) == KV_FAILURE)
-            return KV_FAILURE;
-        reply = redisCommand(storeHandle->ctx, "SET %s %b", key, compressed_value, compressed_value_size);
-        free(compressed_value);
-    }
-#else
-    if(offset)
-        reply = redisCommand(storeHandle->ctx, "SETRANGE %s %d %b", key, offset, value, size);
-    else
-        reply = redisCommand(storeHandle->ctx, "SET %s %b", key, value, size);
-#endif
+    uint32_t node = GetNode(storeHandle, key);
+    if(!(ctx = GetConnection(storeHandle, node)))
+        return KV_FAILURE;
 
-    if(reply){
-        switch(reply->type){
-            case REDIS_REPLY_STATUS:    // SET
-            case REDIS_REPLY_INTEGER:     // SETRANGE
-                status = KV_SUCCESS;
-                break;
-        }
+    if((nReplies = AppendUpdate(ctx, key, value, offset, size)) && (reply = GetIndexedReply(ctx, nReplies))){
+        status = ParseUpdate(reply);
         freeReplyObject(reply);
     }
 
+    PutConnection(storeHandle, node, ctx);
     return status;
 }
 
+// The updates of a node are sent at once over a single connection, as with reads
+KV_Status KV_Redis_WriteBatch(KV_Handle handle, KV_WriteRequest* requests, uint32_t nRequests){
+	KV_Redis_Handle* storeHandle = (KV_Redis_Handle*) handle;
+	KV_Status status = KV_SUCCESS;
+	redisContext* ctx;
+	redisReply* reply;
+	uint32_t i, node, nSent;
+	uint32_t* nodes;
+	uint8_t* nReplies;
+
+	for(i=0; i<nRequests; i++)
+		requests[i].status = KV_FAILURE;
+
+	nodes = malloc(nRequests * sizeof(uint32_t));
+	nReplies = malloc(nRequests);
+	if(!nodes || !nReplies){
+		free(nodes);
+		free(nReplies);
+		return KV_FAILURE;
+	}
+
+	for(i=0; i<nRequests; i++)
+		nodes[i] = GetNode(storeHandle, requests[i].key);
+
+	for(node=0; node<storeHandle->nNodes; node++){
+		for(i=0, nSent=0, ctx=NULL; i<nRequests; i++){
+			KV_WriteRequest* request = &requests[i];
+			if(nodes[i] != node)
+				continue;
+
+			if( (!ctx && !(ctx = GetConnection(storeHandle, node))) ||
+				!(nReplies[i] = AppendUpdate(ctx, request->key, request->value, request->offset, request->size)))
+				break;
+
+			nSent++;
+		}
+
+		for(i=0; nSent; i++){
+			if(nodes[i] != node)
+				continue;
+
+			nSent--;
+			if(!(reply = GetIndexedReply(ctx, nReplies[i])))
+				break;
+
+			requests[i].status = ParseUpdate(reply);
+			freeReplyObject(reply);
+		}
+
+		if(ctx)
+			PutConnection(storeHandle, node, ctx);
+	}
+	free(nReplies);
+	free(nodes);
+
+	for(i=0; i<nRequests; i++){
+		if(requests[i].status != KV_SUCCESS)
+			status = KV_FAILURE;
+	}
+
+	return status;
+}
+
 KV_Status KV_Redis_Write(KV_Handle handle, KV_Key key, KV_Value value, size_t size) {
 	KV_Redis_Handle* storeHandle = (KV_Redis_Handle*) handle;
 	KV_Status status = KV_FAILURE;
+	redisContext* ctx;
 	redisReply* reply = NULL;
 
-#ifdef H3LIB_USE_COMPRESSION
-    void *compressed_value;
-    uint32_t compressed_value_size;
-    if (compress_value(value, size, &compressed_value, &compressed_value_size) == KV_FAILURE)
-        return KV_FAILURE;
-    reply = redisCommand(storeHandle->ctx, "SET %s %b", key, compressed_value, compressed_value_size);
-    free(compressed_value);
-#else
-	reply = redisCommand(storeHandle->ctx, "SET %s %b", key, value, size);
-#endif
+	uint32_t node = GetNode(storeHandle, key);
+	if(!(ctx = GetConnection(storeHandle, node)))
+		return KV_FAILURE;
+
+	reply = IndexedCommand(ctx, key, 1, "SET %s %b", key, value, size);
 
     if(reply){
         switch(reply->type){
@@ -392,41 +1147,104 @@ KV_Status KV_Redis_Write(KV_Handle handle, KV_Key key, KV_Value value, size_t si
 		freeReplyObject(reply);
 	}
 
+	PutConnection(storeHandle, node, ctx);
+	return status;
+}
+
+/*
+ * Copies and moves within a node run as scripts on it, so that values never cross the network and the indices are
+ * updated in the same step. Servers older than 6.2 lack COPY, thus the value is copied by the script instead. The keys of the
+ * scripts are the source, the destination and their indices, or empty strings for keys not indexed, whereas the
+ * arguments are their members.
+ */
+static const char* copyScript =
+	"if redis.call('EXISTS', KEYS[1]) == 0 then return 0 end\n"
+	"if type(redis.pcall('COPY', KEYS[1], KEYS[2], 'REPLACE')) ~= 'number' then\n"
+	"    redis.call('SET', KEYS[2], redis.call('GET', KEYS[1]))\n"
+	"end\n"
+	"if KEYS[4] ~= '' then redis.call('ZADD', KEYS[4], 0, ARGV[2]) end\n"
+	"return 1\n";
+
+static const char* moveScript =
+	"if redis.call('EXISTS', KEYS[1]) == 0 then return 0 end\n"
+	"redis.call('RENAME', KEYS[1], KEYS[2])\n"
+	"if KEYS[3] ~= '' then redis.call('ZREM', KEYS[3], ARGV[1]) end\n"
+	"if KEYS[4] ~= '' then redis.call('ZADD', KEYS[4], 0, ARGV[2]) end\n"
+	"return 1\n";
+
+static KV_Status RunScript(KV_Handle handle, const char* script, KV_Key src_key, KV_Key dest_key){
+	KV_Redis_Handle* storeHandle = (KV_Redis_Handle*) handle;
+	KV_Status status = KV_FAILURE;
+	size_t srcLength = GetIndexedNamespace(src_key);
+	size_t dstLength = GetIndexedNamespace(dest_key);
+	uint32_t node = GetNode(storeHandle, src_key);
+	redisContext* ctx;
+	redisReply* reply;
+
+	if(!(ctx = GetConnection(storeHandle, node)))
+		return KV_FAILURE;
+
+	if((reply = redisCommand(ctx, "EVAL %s 4 %s %s %s%b %s%b %s %s", script, src_key, dest_key,
+	                         srcLength?"/":"", src_key, srcLength, dstLength?"/":"", dest_key, dstLength,
+	                         &src_key[srcLength], &dest_key[dstLength]))){
+
+		if(reply->type == REDIS_REPLY_INTEGER)
+			status = reply->integer?KV_SUCCESS:KV_KEY_NOT_EXIST;
+		else if(reply->type == REDIS_REPLY_ERROR)
+			LogActivity(H3_ERROR_MSG, "Hiredis - %s\n", reply->str);
+
+		freeReplyObject(reply);
+	}
+
+	PutConnection(storeHandle, node, ctx);
+	return status;
+}
+
+// Keys kept by different nodes can only be copied through the client
+static KV_Status CopyAcross(KV_Handle handle, KV_Key src_key, KV_Key dest_key){
+	KV_Status status;
+	KV_Value value = NULL;
+	size_t size = 0;
+
+	if((status = KV_Redis_Read(handle, src_key, 0, &value, &size)) == KV_SUCCESS){
+		status = KV_Redis_Write(handle, dest_key, value, size);
+		free(value);
+	}
+
 	return status;
 }
 
 KV_Status KV_Redis_Copy(KV_Handle handle, KV_Key src_key, KV_Key dest_key) {
 	KV_Redis_Handle* storeHandle = (KV_Redis_Handle*) handle;
-    KV_Status status = KV_FAILURE;
-    redisReply *setReply = NULL, *getReply = NULL;
-
-    // NOTE: Command RESTORE does not work
-    if((getReply = redisCommand(storeHandle->ctx, "GET %s", src_key))){
-    	if(getReply->type == REDIS_REPLY_STRING){
-    		if((setReply = redisCommand(storeHandle->ctx, "SET %s %b", dest_key, getReply->str, getReply->len))){
-    			if(setReply->type == REDIS_REPLY_STATUS)
-    				status = KV_SUCCESS;
-
-    			freeReplyObject(setReply);
-    		}
-    	}
-    	else
-    		status = KV_KEY_NOT_EXIST;
 
-    	freeReplyObject(getReply);
-    }
+	if(GetNode(storeHandle, src_key) != GetNode(storeHandle, dest_key))
+		return CopyAcross(handle, src_key, dest_key);
 
-    return status;
+	return RunScript(handle, copyScript, src_key, dest_key);
 }
 
+// Values are released in the background with UNLINK, unless the server does not know of it
 KV_Status KV_Redis_Delete(KV_Handle handle, KV_Key key) {
 	KV_Redis_Handle* storeHandle = (KV_Redis_Handle*) handle;
     KV_Status status = KV_FAILURE;
+    redisContext* ctx;
     redisReply* reply = NULL;
 
-    if((reply = redisCommand(storeHandle->ctx, "DEL %s", key))){
+    uint32_t node = GetNode(storeHandle, key);
+    if(!(ctx = GetConnection(storeHandle, node)))
+        return KV_FAILURE;
 
-    	if(reply->integer == 0)
+    if(!storeHandle->noUnlink && (reply = IndexedCommand(ctx, key, 0, "UNLINK %s", key)) && reply->type == REDIS_REPLY_ERROR){
+        storeHandle->noUnlink = 1;
+        freeReplyObject(reply);
+        reply = NULL;
+    }
+
+    if((reply || (!ctx->err && (reply = IndexedCommand(ctx, key, 0, "DEL %s", key))))){
+
+    	if(reply->type != REDIS_REPLY_INTEGER)
+    		status = KV_FAILURE;
+    	else if(reply->integer == 0)
     		status = KV_KEY_NOT_EXIST;
     	else
     		status = KV_SUCCESS;
@@ -434,36 +1252,23 @@ KV_Status KV_Redis_Delete(KV_Handle handle, KV_Key key) {
     	freeReplyObject(reply);
     }
 
+    PutConnection(storeHandle, node, ctx);
     return status;
 }
 
 
 KV_Status KV_Redis_Move(KV_Handle handle, KV_Key src_key, KV_Key dest_key) {
-//  KV_Redis_Cluster_Handle* storeHandle = (KV_Redis_Cluster_Handle*) handle;
-//  KV_Status status = KV_FAILURE;
-//  redisReply* reply = NULL;
-//
-//  if((reply = redisClusterCommand(storeHandle->ctx, "RENAME %s %s", src_key, dest_key))){
-//      switch(reply->type){
-//          case REDIS_REPLY_STRING:
-//              status = KV_SUCCESS;
-//              break;
-//
-//          case REDIS_REPLY_ERROR:
-//              status = KV_KEY_NOT_EXIST;
-//              break;
-//      }
-//
-//      freeReplyObject(reply);
-//  }
-//
-//  return status;
+	KV_Redis_Handle* storeHandle = (KV_Redis_Handle*) handle;
+	KV_Status status;
 
-    // XXX Quick implementation
-    if(KV_Redis_Copy(handle, src_key, dest_key) == KV_SUCCESS)
-        return KV_Redis_Delete(handle, src_key);
+	if(GetNode(storeHandle, src_key) != GetNode(storeHandle, dest_key)){
+		if((status = CopyAcross(handle, src_key, dest_key)) == KV_SUCCESS)
+			status = KV_Redis_Delete(handle, src_key);
 
-    return KV_FAILURE;
+		return status;
+	}
+
+	return RunScript(handle, moveScript, src_key, dest_key);
 }
 
 
@@ -484,13 +1289,16 @@ KV_Operations operationsRedis = {
     .metadata_delete = KV_Redis_Delete,
     .metadata_move = KV_Redis_Move,
     .metadata_exists = KV_Redis_Exists,
+    .metadata_list = KV_Redis_ListMetadata,
 
     .list = KV_Redis_List,
     .exists = KV_Redis_Exists,
     .read = KV_Redis_Read,
+    .read_batch = KV_Redis_ReadBatch,
     .create = KV_Redis_Create,
     .update = KV_Redis_Update,
     .write = KV_Redis_Write,
+    .write_batch = KV_Redis_WriteBatch,
     .copy = KV_Redis_Copy,
     .move = KV_Redis_Move,
     .delete = KV_Redis_Delete,
@@ -130,7 +130,7 @@ void KV_RocksDb_Free(KV_Handle handle) {
     free(storeHandle);
 }
 
-KV_Status KV_RocksDb_List(KV_Handle handle, KV_Key prefix, uint8_t nTrim, KV_Key buffer, uint32_t offset, uint32_t* nKeys) {
+static KV_Status List(KV_Handle handle, KV_Key prefix, uint8_t nTrim, KV_Key buffer, uint32_t offset, uint32_t* nKeys, KV_ListCallback function, void* userData) {
 	KV_Status status = KV_SUCCESS;
     KV_RocksDB_Handle* storeHandle = (KV_RocksDB_Handle *)handle;
 
@@ -162,9 +162,17 @@ KV_Status KV_RocksDb_List(KV_Handle handle, KV_Key prefix, uint8_t nTrim, KV_Key
 				if(buffer){
 					size_t entrySize = keySize - nTrim;
 					if(remaining >= entrySize ){
-						memcpy(&buffer[KV_LIST_BUFFER_SIZE - remaining], &key[nTrim], entrySize);
+						KV_Key entry = &buffer[KV_LIST_BUFFER_SIZE - remaining];
+						memcpy(entry, &key[nTrim], entrySize);
 						remaining -= entrySize; // Convert blob to string
 						nMatchingKeys++;
+
+						// The value is at hand while iterating
+						if(function){
+							size_t valueSize;
+							const char* value = rocksdb_iter_value(iter, &valueSize);
+							function(entry, (KV_Value)value, valueSize, userData);
+						}
 					}
 					else
 						status = KV_CONTINUE;
@@ -196,6 +204,14 @@ KV_Status KV_RocksDb_List(KV_Handle handle, KV_Key prefix, uint8_t nTrim, KV_Key
     return status;
 }
 
+KV_Status KV_RocksDb_List(KV_Handle handle, KV_Key prefix, uint8_t nTrim, KV_Key buffer, uint32_t offset, uint32_t* nKeys) {
+	return List(handle, prefix, nTrim, buffer, offset, nKeys, NULL, NULL);
+}
+
+KV_Status KV_RocksDb_ListMetadata(KV_Handle handle, KV_Key prefix, uint8_t nTrim, KV_Key buffer, uint32_t offset, uint32_t* nKeys, KV_ListCallback function, void* userData) {
+	return List(handle, prefix, nTrim, buffer, offset, nKeys, function, userData);
+}
+
 KV_Status KV_RocksDb_Read(KV_Handle handle, KV_Key key, off_t offset, KV_Value* value, size_t* size) {
 	KV_Status status = KV_FAILURE;
 	char *segment, *error = NULL;
@@ -404,6 +420,7 @@ KV_Operations operationsRocksDB = {
 	.metadata_delete = KV_RocksDb_Delete,
 	.metadata_move = KV_RocksDb_Move,
 	.metadata_exists = KV_RocksDb_Exists,
+	.metadata_list = KV_RocksDb_ListMetadata,
 
 	.list = KV_RocksDb_List,
 	.exists = KV_RocksDb_Exists,
@@ -0,0 +1,306 @@
+// Copyright [2019] [FORTH-ICS]
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "kv_interface.h"
+#include "util.h"
+#include "url_parser.h"
+
+/*
+ * A store made of two others, one holding the data parts and another holding everything else,
+ * i.e. users, buckets, object headers, user metadata and dictionaries. Part keys are told apart
+ * by their form, "_<uuid>#<number>", thus calls are routed by key rather than by operation, as
+ * h3lib also reaches metadata keys through the data operations. Listings go to the metadata
+ * store, apart from those of part keys.
+ *
+ * The URI names both stores, e.g. split://meta=rocksdb:///nvme/h3?data=file:///hdd/h3, each with
+ * its own options, e.g. split://meta=redis://127.0.0.1:6379?data=file:///hdd/h3?direct=1
+ */
+
+typedef struct {
+    KV_Operations* metaOp;
+    KV_Handle metaHandle;
+    KV_Operations* dataOp;
+    KV_Handle dataHandle;
+} KV_Split_Handle;
+
+H3_StoreType GetSplitDataType(const char* storageUri){
+    H3_StoreType type = H3_STORE_SPLIT;
+    const char *spec;
+    char *metaUri, *dataUri;
+    struct parsed_url *url;
+
+    if(SplitUri(storageUri, "meta", "data", &spec, &metaUri, &dataUri)){
+        if( (url = parse_url(dataUri)) ){
+            type = H3_String2Type(url->scheme);
+            parsed_url_free(url);
+        }
+        free(metaUri);
+        free(dataUri);
+    }
+
+    return type;
+}
+
+static KV_Operations* Route(KV_Split_Handle* storeHandle, KV_Key key, KV_Handle* handle){
+    if(IsPartKey(key)){
+        *handle = storeHandle->dataHandle;
+        return storeHandle->dataOp;
+    }
+
+    *handle = storeHandle->metaHandle;
+    return storeHandle->metaOp;
+}
+
+KV_Handle KV_Split_Init(const char* storageUri) {
+    KV_Split_Handle* handle;
+    const char *spec;
+    char *metaUri, *dataUri;
+
+    if(!SplitUri(storageUri, "meta", "data", &spec, &metaUri, &dataUri)){
+        LogActivity(H3_ERROR_MSG, "ERROR: Expected split://meta=<uri>?data=<uri>, got %s\n", storageUri);
+        return NULL;
+    }
+    LogActivity(H3_INFO_MSG, "INFO: Metadata store: %s\n", metaUri);
+    LogActivity(H3_INFO_MSG, "INFO: Data store: %s\n", dataUri);
+
+    if( (handle = calloc(1, sizeof(KV_Split_Handle))) ){
+        if( !(handle->metaOp = GetUriOperations(metaUri)) || !(handle->metaHandle = handle->metaOp->init(metaUri)) ){
+            LogActivity(H3_ERROR_MSG, "ERROR: Failed to initialize metadata store %s\n", metaUri);
+            free(handle);
+            handle = NULL;
+        }
+        else if( !(handle->dataOp = GetUriOperations(dataUri)) || !(handle->dataHandle = handle->dataOp->init(dataUri)) ){
+            LogActivity(H3_ERROR_MSG, "ERROR: Failed to initialize data store %s\n", dataUri);
+            handle->metaOp->free(handle->metaHandle);
+            free(handle);
+            handle = NULL;
+        }
+    }
+
+    free(metaUri);
+    free(dataUri);
+
+    return (KV_Handle)handle;
+}
+
+void KV_Split_Free(KV_Handle handle) {
+    KV_Split_Handle* storeHandle = (KV_Split_Handle*)handle;
+
+    storeHandle->dataOp->free(storeHandle->dataHandle);
+    storeHandle->metaOp->free(storeHandle->metaHandle);
+    free(storeHandle);
+}
+
+// The space of both stores is summed, as they are meant to be on different devices
+KV_Status KV_Split_StorageInfo(KV_Handle handle, KV_StorageInfo* storageInfo) {
+    KV_Split_Handle* storeHandle = (KV_Split_Handle*)handle;
+    KV_StorageInfo metaInfo, dataInfo;
+    KV_Status status = KV_FAILURE;
+
+    memset(storageInfo, 0, sizeof(KV_StorageInfo));
+
+    if(storeHandle->metaOp->storage_info && storeHandle->metaOp->storage_info(storeHandle->metaHandle, &metaInfo) == KV_SUCCESS){
+        storageInfo->totalSpace += metaInfo.totalSpace;
+        storageInfo->freeSpace += metaInfo.freeSpace;
+        storageInfo->usedSpace += metaInfo.usedSpace;
+        status = KV_SUCCESS;
+    }
+
+    if(storeHandle->dataOp->storage_info && storeHandle->dataOp->storage_info(storeHandle->dataHandle, &dataInfo) == KV_SUCCESS){
+        storageInfo->totalSpace += dataInfo.totalSpace;
+        storageInfo->freeSpace += dataInfo.freeSpace;
+        storageInfo->usedSpace += dataInfo.usedSpace;
+        status = KV_SUCCESS;
+    }
+
+    return status;
+}
+
+KV_Status KV_Split_MetadataRead(KV_Handle handle, KV_Key key, off_t offset, KV_Value* value, size_t* size) {
+    KV_Split_Handle* storeHandle = (KV_Split_Handle*)handle;
+    return storeHandle->metaOp->metadata_read(storeHandle->metaHandle, key, offset, value, size);
+}
+
+KV_Status KV_Split_MetadataWrite(KV_Handle handle, KV_Key key, KV_Value value, size_t size) {
+    KV_Split_Handle* storeHandle = (KV_Split_Handle*)handle;
+    return storeHandle->metaOp->metadata_write(storeHandle->metaHandle, key, value, size);
+}
+
+KV_Status KV_Split_MetadataCreate(KV_Handle handle, KV_Key key, KV_Value value, size_t size) {
+    KV_Split_Handle* storeHandle = (KV_Split_Handle*)handle;
+    return storeHandle->metaOp->metadata_create(storeHandle->metaHandle, key, value, size);
+}
+
+KV_Status KV_Split_MetadataDelete(KV_Handle handle, KV_Key key) {
+    KV_Split_Handle* storeHandle = (KV_Split_Handle*)handle;
+    return storeHandle->metaOp->metadata_delete(storeHandle->metaHandle, key);
+}
+
+KV_Status KV_Split_MetadataMove(KV_Handle handle, KV_Key srcKey, KV_Key dstKey) {
+    KV_Split_Handle* storeHandle = (KV_Split_Handle*)handle;
+    return storeHandle->metaOp->metadata_move(storeHandle->metaHandle, srcKey, dstKey);
+}
+
+KV_Status KV_Split_MetadataExists(KV_Handle handle, KV_Key key) {
+    KV_Split_Handle* storeHandle = (KV_Split_Handle*)handle;
+    return storeHandle->metaOp->metadata_exists(storeHandle->metaHandle, key);
+}
+
+KV_Status KV_Split_ListMetadata(KV_Handle handle, KV_Key prefix, uint8_t nTrim, KV_Key buffer, uint32_t offset, uint32_t* nKeys, KV_ListCallback function, void* userData) {
+    KV_Split_Handle* storeHandle = (KV_Split_Handle*)handle;
+    return ListStoreMetadata(storeHandle->metaOp, storeHandle->metaHandle, prefix, nTrim, buffer, offset, nKeys, function, userData);
+}
+
+KV_Status KV_Split_List(KV_Handle handle, KV_Key prefix, uint8_t nTrim, KV_Key buffer, uint32_t offset, uint32_t* nKeys) {
+    KV_Handle _handle;
+    KV_Operations* op = Route((KV_Split_Handle*)handle, prefix, &_handle);
+    return op->list(_handle, prefix, nTrim, buffer, offset, nKeys);
+}
+
+KV_Status KV_Split_Exists(KV_Handle handle, KV_Key key) {
+    KV_Handle _handle;
+    KV_Operations* op = Route((KV_Split_Handle*)handle, key, &_handle);
+    return op->exists(_handle, key);
+}
+
+KV_Status KV_Split_Read(KV_Handle handle, KV_Key key, off_t offset, KV_Value* value, size_t* size) {
+    KV_Handle _handle;
+    KV_Operations* op = Route((KV_Split_Handle*)handle, key, &_handle);
+    return op->read(_handle, key, offset, value, size);
+}
+
+// Batches consist of parts, and are handed over as such if the data store can serve them at once
+KV_Status KV_Split_ReadBatch(KV_Handle handle, KV_ReadRequest* requests, uint32_t nRequests){
+    KV_Split_Handle* storeHandle = (KV_Split_Handle*)handle;
+    KV_Status status = KV_SUCCESS;
+    uint32_t i;
+
+    for(i=0; i<nRequests && IsPartKey(requests[i].key); i++);
+    if(i == nRequests && storeHandle->dataOp->read_batch)
+        return storeHandle->dataOp->read_batch(storeHandle->dataHandle, requests, nRequests);
+
+    for(i=0; i<nRequests; i++){
+        if( (requests[i].status = KV_Split_Read(handle, requests[i].key, requests[i].offset, &requests[i].value, &requests[i].size)) != KV_SUCCESS )
+            status = KV_FAILURE;
+    }
+
+    return status;
+}
+
+KV_Status KV_Split_Create(KV_Handle handle, KV_Key key, KV_Value value, size_t size) {
+    KV_Handle _handle;
+    KV_Operations* op = Route((KV_Split_Handle*)handle, key, &_handle);
+    return op->create(_handle, key, value, size);
+}
+
+KV_Status KV_Split_Update(KV_Handle handle, KV_Key key, KV_Value value, off_t offset, size_t size) {
+    KV_Handle _handle;
+    KV_Operations* op = Route((KV_Split_Handle*)handle, key, &_handle);
+    return op->update(_handle, key, value, offset, size);
+}
+
+KV_Status KV_Split_Write(KV_Handle handle, KV_Key key, KV_Value value, size_t size) {
+    KV_Handle _handle;
+    KV_Operations* op = Route((KV_Split_Handle*)handle, key, &_handle);
+    return op->write(_handle, key, value, size);
+}
+
+KV_Status KV_Split_WriteBatch(KV_Handle handle, KV_WriteRequest* requests, uint32_t nRequests){
+    KV_Split_Handle* storeHandle = (KV_Split_Handle*)handle;
+    KV_Status status = KV_SUCCESS;
+    uint32_t i;
+
+    for(i=0; i<nRequests && IsPartKey(requests[i].key); i++);
+    if(i == nRequests && storeHandle->dataOp->write_batch)
+        return storeHandle->dataOp->write_batch(storeHandle->dataHandle, requests, nRequests);
+
+    for(i=0; i<nRequests; i++){
+        if( (requests[i].status = KV_Split_Update(handle, requests[i].key, requests[i].value, requests[i].offset, requests[i].size)) != KV_SUCCESS )
+            status = KV_FAILURE;
+    }
+
+    return status;
+}
+
+// Copies and moves never cross stores, as keys keep their kind
+KV_Status KV_Split_Copy(KV_Handle handle, KV_Key srcKey, KV_Key dstKey) {
+    KV_Handle _handle;
+    KV_Operations* op = Route((KV_Split_Handle*)handle, srcKey, &_handle);
+    return op->copy(_handle, srcKey, dstKey);
+}
+
+KV_Status KV_Split_Move(KV_Handle handle, KV_Key srcKey, KV_Key dstKey) {
+    KV_Handle _handle;
+    KV_Operations* op = Route((KV_Split_Handle*)handle, srcKey, &_handle);
+    return op->move(_handle, srcKey, dstKey);
+}
+
+KV_Status KV_Split_Delete(KV_Handle handle, KV_Key key) {
+    KV_Handle _handle;
+    KV_Operations* op = Route((KV_Split_Handle*)handle, key, &_handle);
+    return op->delete(_handle, key);
+}
+
+KV_Status KV_Split_Open(KV_Handle handle, KV_Key key, int* fd) {
+    KV_Handle _handle;
+    KV_Operations* op = Route((KV_Split_Handle*)handle, key, &_handle);
+    return op->open?op->open(_handle, key, fd):KV_FAILURE;
+}
+
+KV_Status KV_Split_Sync(KV_Handle handle) {
+    KV_Split_Handle* storeHandle = (KV_Split_Handle*)handle;
+    KV_Status status = KV_SUCCESS;
+
+    if(storeHandle->dataOp->sync && storeHandle->dataOp->sync(storeHandle->dataHandle) != KV_SUCCESS)
+        status = KV_FAILURE;
+
+    if(storeHandle->metaOp->sync && storeHandle->metaOp->sync(storeHandle->metaHandle) != KV_SUCCESS)
+        status = KV_FAILURE;
+
+    return status;
+}
+
+KV_Operations operationsSplit = {
+    .init = KV_Split_Init,
+    .free = KV_Split_Free,
+    .storage_info = KV_Split_StorageInfo,
+    .validate_key = ValidateNestedKey,
+
+    .metadata_read = KV_Split_MetadataRead,
+    .metadata_write = KV_Split_MetadataWrite,
+    .metadata_create = KV_Split_MetadataCreate,
+    .metadata_delete = KV_Split_MetadataDelete,
+    .metadata_move = KV_Split_MetadataMove,
+    .metadata_exists = KV_Split_MetadataExists,
+    .metadata_list = KV_Split_ListMetadata,
+
+    .list = KV_Split_List,
+    .exists = KV_Split_Exists,
+    .read = KV_Split_Read,
+    .read_batch = KV_Split_ReadBatch,
+    .create = KV_Split_Create,
+    .update = KV_Split_Update,
+    .write = KV_Split_Write,
+    .write_batch = KV_Split_WriteBatch,
+    .copy = KV_Split_Copy,
+    .move = KV_Split_Move,
+    .delete = KV_Split_Delete,
+    .open = KV_Split_Open,
+    .sync = KV_Split_Sync
+};
@@ -87,7 +87,7 @@ H3_Status H3_CreateMultipart(H3_Handle handle, H3_Token token, H3_Name bucketNam
     }
 
     // Make sure user has access to the bucket
-    if((storeStatus = op->metadata_read(_handle, bucketId, 0, &value, &mSize)) == KV_KEY_TOO_LONG){
+    if((storeStatus = ReadMetadata(ctx, bucketId, &value, &mSize)) == KV_KEY_TOO_LONG){
         return H3_NAME_TOO_LONG;
     }
     else if(storeStatus != KV_SUCCESS)
@@ -99,9 +99,11 @@ H3_Status H3_CreateMultipart(H3_Handle handle, H3_Token token, H3_Name bucketNam
 
         // Populate temporary object metadata
         H3_ObjectMetadata objMeta;
+        objMeta.version = H3_METADATA_VERSION;
         memcpy(objMeta.userId, userId, sizeof(H3_UserId));
         uuid_generate(objMeta.uuid);
         objMeta.isBad = 0;
+        objMeta.compression = bucketMetadata->compression;
 
         // Populate multipart metadata
         H3_MultipartMetadata multiMeta;
@@ -172,7 +174,7 @@ H3_Status H3_CompleteMultipart(H3_Handle handle, H3_Token token, H3_MultipartId
     }
 
     // ...and retrieve multipart metadata
-    if((kvStatus = op->metadata_read(_handle, multipartId, 0, &value, &mSize)) == KV_KEY_NOT_EXIST){
+    if((kvStatus = ReadMetadata(ctx, multipartId, &value, &mSize)) == KV_KEY_NOT_EXIST){
         return H3_NOT_EXISTS;
     }
     else if(kvStatus == KV_FAILURE )
@@ -182,7 +184,7 @@ H3_Status H3_CompleteMultipart(H3_Handle handle, H3_Token token, H3_MultipartId
     H3_MultipartMetadata* multiMeta = (H3_MultipartMetadata*)value;
     if(GrantMultipartAccess(userId, multiMeta)){
         value = NULL; mSize = 0;
-        if(op->metadata_read(_handle, multiMeta->objectId, 0, &value, &mSize) == KV_SUCCESS){
+        if(ReadMetadata(ctx, multiMeta->objectId, &value, &mSize) == KV_SUCCESS){
             H3_ObjectMetadata* objMeta = (H3_ObjectMetadata*)value;
             if(objMeta->nParts){
 
@@ -260,7 +262,7 @@ H3_Status H3_AbortMultipart(H3_Handle handle, H3_Token token, H3_MultipartId mul
     }
 
     // ...and retrieve multipart metadata
-    if((kvStatus = op->metadata_read(_handle, multipartId, 0, &value, &mSize)) == KV_KEY_NOT_EXIST){
+    if((kvStatus = ReadMetadata(ctx, multipartId, &value, &mSize)) == KV_KEY_NOT_EXIST){
         return H3_NOT_EXISTS;
     }
     else if(kvStatus == KV_FAILURE )
@@ -329,7 +331,7 @@ H3_Status H3_ListMultiparts(H3_Handle handle, H3_Token token, H3_Name bucketName
     }
 
     status = H3_FAILURE;
-    if( (kvStatus = op->metadata_read(_handle, bucketId, 0, &value, &mSize)) == KV_SUCCESS){
+    if( (kvStatus = ReadMetadata(ctx, bucketId, &value, &mSize)) == KV_SUCCESS){
 
         // Make sure the token grants access to the bucket
         H3_BucketMetadata* bucketMetadata = (H3_BucketMetadata*)value;
@@ -387,8 +389,6 @@ H3_Status H3_ListParts(H3_Handle handle, H3_Token token, H3_MultipartId multipar
 
     H3_Status status = H3_FAILURE;
     H3_Context* ctx = (H3_Context*)handle;
-    KV_Handle _handle = ctx->handle;
-    KV_Operations* op = ctx->operation;
     H3_UserId userId;
     KV_Status kvStatus;
     KV_Value value = NULL;
@@ -400,7 +400,7 @@ H3_Status H3_ListParts(H3_Handle handle, H3_Token token, H3_MultipartId multipar
     }
 
     // ...and retrieve multipart metadata
-    if((kvStatus = op->metadata_read(_handle, multipartId, 0, &value, &mSize)) == KV_KEY_NOT_EXIST){
+    if((kvStatus = ReadMetadata(ctx, multipartId, &value, &mSize)) == KV_KEY_NOT_EXIST){
         return H3_NOT_EXISTS;
     }
     else if(kvStatus == KV_FAILURE )
@@ -410,7 +410,7 @@ H3_Status H3_ListParts(H3_Handle handle, H3_Token token, H3_MultipartId multipar
     H3_MultipartMetadata* multiMeta = (H3_MultipartMetadata*)value;
     if(GrantMultipartAccess(userId, multiMeta)){
         value = NULL; mSize = 0;
-        if(op->metadata_read(_handle, multiMeta->objectId, 0, &value, &mSize) == KV_SUCCESS){
+        if(ReadMetadata(ctx, multiMeta->objectId, &value, &mSize) == KV_SUCCESS){
 
             // Create hash table on partNumber with size as value
             H3_ObjectMetadata* objMeta = (H3_ObjectMetadata*)value;
@@ -488,13 +488,15 @@ KV_Status CreatePart(H3_Context* ctx, H3_ObjectMetadata* objMeta, KV_Value value
     	int partIndex = objMeta->nParts;
 
     	CreatePartId(partId, objMeta->uuid, partNumber, partSubNumber);
-        if( (status = ctx->operation->write(ctx->handle, partId, value, partSize)) == KV_SUCCESS){
+    	objMeta->part[partIndex].size = 0;
+    	objMeta->part[partIndex].codec = H3_CODEC_NONE;
+    	objMeta->part[partIndex].storedSize = 0;
+        if( (status = WritePart(ctx, objMeta, &objMeta->part[partIndex], partId, value, inPartOffset, partSize)) == KV_SUCCESS){
 
-            // Create/Update metadata entry
+            // Create/Update metadata entry, the size is set by WritePart()
         	objMeta->part[partIndex].number = partNumber;
         	objMeta->part[partIndex].subNumber = partSubNumber++;
         	objMeta->part[partIndex].offset = 0;					// Will be adjusted when object is completed
-        	objMeta->part[partIndex].size = inPartOffset + partSize;
 
             // Advance counters
         	size -= partSize;
@@ -553,7 +555,7 @@ H3_Status H3_CreatePart(H3_Handle handle, H3_Token token, H3_MultipartId multipa
     }
 
     // ...and retrieve multipart metadata
-    if((kvStatus = op->metadata_read(_handle, multipartId, 0, &value, &mSize)) == KV_KEY_NOT_EXIST){
+    if((kvStatus = ReadMetadata(ctx, multipartId, &value, &mSize)) == KV_KEY_NOT_EXIST){
         return H3_NOT_EXISTS;
     }
     else if(kvStatus == KV_FAILURE )
@@ -563,7 +565,7 @@ H3_Status H3_CreatePart(H3_Handle handle, H3_Token token, H3_MultipartId multipa
     H3_MultipartMetadata* multiMeta = (H3_MultipartMetadata*)value;
     if(GrantMultipartAccess(userId, multiMeta)){
         value = NULL; mSize = 0;
-        if(op->metadata_read(_handle, multiMeta->objectId, 0, &value, &mSize) == KV_SUCCESS){
+        if(ReadMetadata(ctx, multiMeta->objectId, &value, &mSize) == KV_SUCCESS){
 
             // Delete previous version of said part if any
             H3_ObjectMetadata* objMeta = (H3_ObjectMetadata*)value;
@@ -647,7 +649,7 @@ H3_Status H3_CreatePartCopy(H3_Handle handle, H3_Token token, H3_Name objectName
     }
 
     // ...and retrieve multipart metadata
-    if((kvStatus = op->metadata_read(_handle, multipartId, 0, &value, &mSize)) == KV_KEY_NOT_EXIST){
+    if((kvStatus = ReadMetadata(ctx, multipartId, &value, &mSize)) == KV_KEY_NOT_EXIST){
         return H3_NOT_EXISTS;
     }
     else if(kvStatus == KV_FAILURE )
@@ -664,11 +666,11 @@ H3_Status H3_CreatePartCopy(H3_Handle handle, H3_Token token, H3_Name objectName
         GetBucketFromId(multiMeta->objectId, bucketName);
         GetObjectId(bucketName, objectName, srcObjId);
         value = NULL; mSize = 0;
-        if((kvStatus = op->metadata_read(_handle, srcObjId, 0, &value, &mSize)) == KV_SUCCESS){
+        if((kvStatus = ReadMetadata(ctx, srcObjId, &value, &mSize)) == KV_SUCCESS){
             H3_ObjectMetadata* srcObjMeta = (H3_ObjectMetadata*)value;
 
             value = NULL; mSize = 0;
-            if(op->metadata_read(_handle, multiMeta->objectId, 0, &value, &mSize) == KV_SUCCESS){
+            if(ReadMetadata(ctx, multiMeta->objectId, &value, &mSize) == KV_SUCCESS){
                 H3_ObjectMetadata* dstObjMeta = (H3_ObjectMetadata*)value;
                 if( DeletePart(ctx, dstObjMeta, partNumber) == KV_SUCCESS) {
 
@@ -689,7 +691,7 @@ H3_Status H3_CreatePartCopy(H3_Handle handle, H3_Token token, H3_Name objectName
 						while(remaining && kvStatus == KV_SUCCESS){
 
 							size_t buffSize = min(H3_PART_SIZE, remaining);
-							if( (kvStatus = ReadData(ctx, srcObjMeta, buffer, &buffSize, srcOffset)) == KV_SUCCESS              &&
+							if( (kvStatus = ReadData(ctx, srcObjMeta, buffer, &buffSize, srcOffset, 0)) == KV_SUCCESS              &&
 								(kvStatus = CreatePart(ctx, dstObjMeta, buffer, buffSize, dstOffset, partNumber)) == KV_SUCCESS     ){
 
 								remaining -= buffSize;
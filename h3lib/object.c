@@ -16,6 +16,8 @@
 
 #include "common.h"
 #include "util.h"
+#include "compression.h"
+#include "readahead.h"
 
 H3_Status ValidObjectName(KV_Operations* op, char* name){
     H3_Status status = H3_SUCCESS;
@@ -98,6 +100,130 @@ int ComparePartMetadataByOffset(const void* partA, const void* partB) {
     return ((H3_PartMetadata*)partA)->offset - ((H3_PartMetadata*)partB)->offset;
 }
 
+KV_Status ReadPart(H3_Context* ctx, H3_PartMetadata* part, H3_PartId partId, KV_Value value, off_t inPartOffset, size_t size){
+    KV_Operations* op = ctx->operation;
+    KV_Status status;
+
+    if(part->codec == H3_CODEC_NONE){
+        size_t retrieved = size;
+        if((status = op->read(ctx->handle, partId, inPartOffset, &value, &retrieved)) == KV_SUCCESS && retrieved != size)
+            status = KV_FAILURE;
+
+        return status;
+    }
+
+    // Compressed parts are retrieved and decoded as a whole
+    size_t frameSize = part->storedSize;
+    KV_Value frame = malloc(frameSize);
+    if(!frame)
+        return KV_FAILURE;
+
+    if((status = op->read(ctx->handle, partId, 0, &frame, &frameSize)) == KV_SUCCESS){
+        H3_FrameHeader* header = (H3_FrameHeader*)frame;
+        size_t rawSize = frameSize < sizeof(H3_FrameHeader)?0:header->rawSize;
+        H3_Dictionary* dictionary = (rawSize && header->dictId)?GetDictionary(ctx, header->dictId):NULL;
+
+        // Decode straight into the caller's buffer if it is asking for the whole part
+        if(inPartOffset == 0 && rawSize == size){
+            status = DecompressPart(frame, frameSize, dictionary, value, &rawSize);
+        }
+        else {
+            KV_Value buffer = malloc(rawSize + 1);
+            if(buffer && (status = DecompressPart(frame, frameSize, dictionary, buffer, &rawSize)) == KV_SUCCESS){
+                if(inPartOffset + size <= rawSize)
+                    memcpy(value, &buffer[inPartOffset], size);
+                else
+                    status = KV_FAILURE;
+            }
+            else
+                status = KV_FAILURE;
+
+            free(buffer);
+        }
+    }
+    free(frame);
+
+    return status;
+}
+
+KV_Status WritePart(H3_Context* ctx, H3_ObjectMetadata* meta, H3_PartMetadata* part, H3_PartId partId, KV_Value value, off_t inPartOffset, size_t size){
+    /*
+     * Raw parts are updated in place, whereas compressed parts are rewritten as a whole, i.e. decompressed, patched and
+     * compressed again. Objects inheriting compression from their bucket keep partial writes to raw parts in place and
+     * compress a part once it is filled up, so that small sequential writes do not recompress the same data over and over.
+     */
+    KV_Operations* op = ctx->operation;
+    KV_Status status;
+    size_t partSize = max(part->size, inPartOffset + size);
+    char whole = (inPartOffset == 0 && size == partSize);
+
+    if(part->codec == H3_CODEC_NONE && (meta->compression.codec == H3_CODEC_NONE || (!whole && partSize < H3_PART_SIZE))){
+        if(inPartOffset == 0 && size == H3_PART_SIZE)
+            status = op->write(ctx->handle, partId, value, size);
+        else
+            status = op->update(ctx->handle, partId, value, inPartOffset, size);
+    }
+    else {
+        KV_Value buffer = value, frame = NULL;
+        size_t frameSize = 0;
+        uint8_t codec;
+
+        // Stage the whole part
+        if(!whole){
+            if(!(buffer = calloc(1, partSize)))
+                return KV_FAILURE;
+
+            if(part->size && (status = ReadPart(ctx, part, partId, buffer, 0, part->size)) != KV_SUCCESS){
+                free(buffer);
+                return status;
+            }
+            memcpy(&buffer[inPartOffset], value, size);
+        }
+
+        H3_Dictionary* dictionary = meta->compression.dictId?GetDictionary(ctx, meta->compression.dictId):NULL;
+        if((codec = CompressPart(&meta->compression, dictionary, buffer, partSize, &frame, &frameSize)) != H3_CODEC_NONE){
+            status = op->write(ctx->handle, partId, frame, frameSize);
+            free(frame);
+        }
+
+        // Not worth compressing, if the part is already raw only the segment needs to be stored
+        else if(part->codec == H3_CODEC_NONE && !whole)
+            status = op->update(ctx->handle, partId, value, inPartOffset, size);
+
+        else
+            status = op->write(ctx->handle, partId, buffer, partSize);
+
+        if(status == KV_SUCCESS){
+            part->codec = codec;
+            part->storedSize = frameSize;
+        }
+
+        if(buffer != value)
+            free(buffer);
+    }
+
+    if(status == KV_SUCCESS)
+        part->size = partSize;
+
+    // Dropped once written, as the part may have been fetched meanwhile
+    InvalidatePrefetched(ctx, partId);
+
+    return status;
+}
+
+// Parts queued by WriteData() are handed to the store at once, a single part is written as by WritePart()
+static KV_Status WriteParts(H3_Context* ctx, KV_WriteRequest* requests, uint32_t nRequests){
+    KV_Operations* op = ctx->operation;
+
+    if(nRequests > 1)
+        return op->write_batch(ctx->handle, requests, nRequests);
+
+    if(requests[0].offset == 0 && requests[0].size == H3_PART_SIZE)
+        return op->write(ctx->handle, requests[0].key, requests[0].value, requests[0].size);
+
+    return op->update(ctx->handle, requests[0].key, requests[0].value, requests[0].offset, requests[0].size);
+}
+
 KV_Status WriteData(H3_Context* ctx, H3_ObjectMetadata* meta, KV_Value value, size_t size, off_t offset){
     /*
      * Used by H3_WriteObject, H3_WriteObjectCopy. If the object exists it is overwritten rather than truncated. Parts are of max-size
@@ -119,6 +245,17 @@ KV_Status WriteData(H3_Context* ctx, H3_ObjectMetadata* meta, KV_Value value, si
     uint segmentEnd = offset + size -1;
     size_t partSize;
 
+    // Raw parts are written in a single batch if the store supports it, a segment touches at most
+    // the existing parts plus the ones it fills
+    KV_WriteRequest* requests = NULL;
+    H3_PartId* partIds = NULL;
+    uint32_t nRequests = 0, maxRequests = meta->nParts + size / H3_PART_SIZE + 2;
+
+    if(ctx->operation->write_batch && meta->compression.codec == H3_CODEC_NONE){
+        requests = malloc(maxRequests * sizeof(KV_WriteRequest));
+        partIds = malloc(maxRequests * sizeof(H3_PartId));
+    }
+
     while(size && status == KV_SUCCESS) {
 
         off_t partOffset, inPartOffset;
@@ -175,19 +312,30 @@ KV_Status WriteData(H3_Context* ctx, H3_ObjectMetadata* meta, KV_Value value, si
 
         H3_PartId partId;
         CreatePartId(partId, meta->uuid, partNumber, partSubNumber);
-        if (inPartOffset == 0 && partSize == H3_PART_SIZE) {
-            status = ctx->operation->write(ctx->handle, partId, value, partSize);
+        if(!overWrite){
+            meta->part[partIndex].size = 0;
+            meta->part[partIndex].codec = H3_CODEC_NONE;
+            meta->part[partIndex].storedSize = 0;
         }
-        else {
-            status = ctx->operation->update(ctx->handle, partId, value, inPartOffset, partSize);
+        if(requests && partIds && nRequests < maxRequests && meta->part[partIndex].codec == H3_CODEC_NONE){
+            strcpy(partIds[nRequests], partId);
+            requests[nRequests].key = partIds[nRequests];
+            requests[nRequests].offset = inPartOffset;
+            requests[nRequests].value = value;
+            requests[nRequests].size = partSize;
+            requests[nRequests].status = KV_FAILURE;
+            nRequests++;
+            meta->part[partIndex].size = max(meta->part[partIndex].size, inPartOffset + partSize);
         }
+        else
+            status = WritePart(ctx, meta, &meta->part[partIndex], partId, value, inPartOffset, partSize);
+
         if(status == KV_SUCCESS){
 
-            // Create/Update metadata entry
+            // Create/Update metadata entry, the size is set when writing or queuing the part
             meta->part[partIndex].number = partNumber;
             meta->part[partIndex].subNumber = partSubNumber;
             meta->part[partIndex].offset = partOffset;
-            meta->part[partIndex].size = inPartOffset + partSize;
 
             // Advance offset
             offset += partSize;
@@ -196,6 +344,15 @@ KV_Status WriteData(H3_Context* ctx, H3_ObjectMetadata* meta, KV_Value value, si
         }
     }
 
+    if(status == KV_SUCCESS && nRequests)
+        status = WriteParts(ctx, requests, nRequests);
+
+    for(i=0; i<nRequests; i++)
+        InvalidatePrefetched(ctx, partIds[i]);
+
+    free(requests);
+    free(partIds);
+
     // Update object metadata
     meta->isBad = status==KV_SUCCESS?0:1;
     meta->nParts += nNewParts;
@@ -205,7 +362,32 @@ KV_Status WriteData(H3_Context* ctx, H3_ObjectMetadata* meta, KV_Value value, si
     return status;
 }
 
-KV_Status ReadData(H3_Context* ctx, H3_ObjectMetadata* meta, KV_Value value, size_t* size, off_t offset){
+// Parts not found in the read-ahead buffer are read in a single batch, if the store supports it
+static KV_Status ReadParts(H3_Context* ctx, KV_ReadRequest* requests, uint32_t nRequests){
+    KV_Operations* op = ctx->operation;
+    size_t requested = 0, retrieved = 0;
+    uint32_t i;
+
+    for(i=0; i<nRequests; i++)
+        requested += requests[i].size;
+
+    if(nRequests == 1)
+        requests[0].status = op->read(ctx->handle, requests[0].key, requests[0].offset, &requests[0].value, &requests[0].size);
+    else
+        op->read_batch(ctx->handle, requests, nRequests);
+
+    for(i=0; i<nRequests; i++){
+        if(requests[i].status != KV_SUCCESS)
+            return KV_FAILURE;
+        retrieved += requests[i].size;
+    }
+
+    // Sizes only shrink, so any short read shows in the total
+    return retrieved == requested?KV_SUCCESS:KV_FAILURE;
+}
+
+// Only reads on behalf of users are tracked for read-ahead, internal ones (e.g. copies) would only disturb it
+KV_Status ReadData(H3_Context* ctx, H3_ObjectMetadata* meta, KV_Value value, size_t* size, off_t offset, char readAhead){
 	uint i, bufferOffset;
 
     // Make sure we do not try to read more than available
@@ -214,8 +396,19 @@ KV_Status ReadData(H3_Context* ctx, H3_ObjectMetadata* meta, KV_Value value, siz
     size_t required = min(*size, (objectSize - offset));
     size_t remaining = required;
     off_t segmentEnd = offset + remaining - 1;
+    uint32_t window = readAhead?TrackStream(ctx, meta, offset, required):0;
+    KV_Status status = KV_SUCCESS;
+
+    KV_ReadRequest* requests = NULL;
+    H3_PartId* partIds = NULL;
+    uint32_t nRequests = 0;
 
-    for(i=0; i<meta->nParts && remaining; i++){
+    if(ctx->operation->read_batch){
+        requests = malloc(meta->nParts * sizeof(KV_ReadRequest));
+        partIds = malloc(meta->nParts * sizeof(H3_PartId));
+    }
+
+    for(i=0; i<meta->nParts && remaining && status == KV_SUCCESS; i++){
     	size_t readSize;
     	off_t inPartOffset, partEnd = meta->part[i].offset + meta->part[i].size -1;
     	char contributes = 1;
@@ -238,20 +431,43 @@ KV_Status ReadData(H3_Context* ctx, H3_ObjectMetadata* meta, KV_Value value, siz
 
 
     	if(contributes){
-    		size_t retrieved = readSize;
     		H3_PartId partId;
-    		KV_Value buffer = &value[bufferOffset];
 
     		CreatePartId(partId, meta->uuid, meta->part[i].number, meta->part[i].subNumber);
-    		if(ctx->operation->read(ctx->handle, partId, inPartOffset, &buffer, &retrieved) != KV_SUCCESS || retrieved != readSize){
-    			*size = 0;
-    			return KV_FAILURE;
+    		if(ReadPrefetched(ctx, &meta->part[i], partId, &value[bufferOffset], inPartOffset, readSize) != KV_SUCCESS){
+
+    			// Compressed parts are decoded as a whole, they are not batched
+    			if(requests && partIds && meta->part[i].codec == H3_CODEC_NONE){
+    				strcpy(partIds[nRequests], partId);
+    				requests[nRequests].key = partIds[nRequests];
+    				requests[nRequests].offset = inPartOffset;
+    				requests[nRequests].value = &value[bufferOffset];
+    				requests[nRequests].size = readSize;
+    				requests[nRequests].status = KV_FAILURE;
+    				nRequests++;
+    			}
+    			else if(ReadPart(ctx, &meta->part[i], partId, &value[bufferOffset], inPartOffset, readSize) != KV_SUCCESS){
+    				status = KV_FAILURE;
+    			}
     		}
 
     		remaining -= readSize;
     	}
     }
 
+    if(status == KV_SUCCESS && nRequests)
+        status = ReadParts(ctx, requests, nRequests);
+
+    free(requests);
+    free(partIds);
+
+    if(status != KV_SUCCESS){
+        *size = 0;
+        return KV_FAILURE;
+    }
+
+    Prefetch(ctx, meta, offset + required, window);
+
     *size = required;
     return KV_SUCCESS;
 }
@@ -263,7 +479,7 @@ KV_Status CopyData(H3_Context* ctx, H3_UserId userId, H3_ObjectId srcObjId, H3_O
     KV_Value value = NULL;
     size_t mSize = 0;
 
-    if( (status = op->metadata_read(_handle, srcObjId, 0, &value, &mSize)) == KV_SUCCESS){
+    if( (status = ReadMetadata(ctx, srcObjId, &value, &mSize)) == KV_SUCCESS){
 
         // Make sure the user has access to the object
         H3_ObjectMetadata* srcObjMeta = (H3_ObjectMetadata*)value;
@@ -286,7 +502,7 @@ KV_Status CopyData(H3_Context* ctx, H3_UserId userId, H3_ObjectId srcObjId, H3_O
                     while(remaining && status == KV_SUCCESS){
 
                         size_t buffSize = min(H3_PART_SIZE, remaining);
-                        if( (status = ReadData(ctx, srcObjMeta, buffer, &buffSize, srcOffset) == KV_SUCCESS)                    &&
+                        if( (status = ReadData(ctx, srcObjMeta, buffer, &buffSize, srcOffset, 0) == KV_SUCCESS)                    &&
                             (status = WriteData(ctx, dstObjMeta, buffer, buffSize, dstOffset) == KV_SUCCESS)     ){
 
                             remaining -= buffSize;
@@ -323,7 +539,7 @@ H3_Status PurgeObjectMetadata(H3_Context* ctx, H3_UserId userId, H3_Name bucketN
     GetObjectId(bucketName, objectName, objId);
 
     H3_Status status = H3_FAILURE;
-    if ((storeStatus = op->metadata_read(_handle, objId, 0, &objMetaValue, &mSize)) == KV_SUCCESS) {
+    if ((storeStatus = ReadMetadata(ctx, objId, &objMetaValue, &mSize)) == KV_SUCCESS) {
         H3_ObjectMetadata* objMeta = (H3_ObjectMetadata*)objMetaValue;
         
         // Access the object
@@ -408,13 +624,13 @@ H3_Status CopyOrMoveObjectMetadata(H3_Context* ctx, H3_UserId userId, H3_Name bu
     GetObjectId(bucketName, dstObjectName, dstObjId);
 
     H3_Status status = H3_FAILURE;
-    if ((storeStatus = op->metadata_read(_handle, srcObjId, 0, &srcObjMetaValue, &srcMetaSize)) == KV_SUCCESS) {
+    if ((storeStatus = ReadMetadata(ctx, srcObjId, &srcObjMetaValue, &srcMetaSize)) == KV_SUCCESS) {
         H3_ObjectMetadata* srcObjMeta = (H3_ObjectMetadata*)srcObjMetaValue;
         
         // Access the source object
         if (GrantObjectAccess(userId, srcObjMeta)) { 
             
-            if ((storeStatus = op->metadata_read(_handle, dstObjId, 0, &dstObjMetaValue, &dstMetaSize)) == KV_SUCCESS) {
+            if ((storeStatus = ReadMetadata(ctx, dstObjId, &dstObjMetaValue, &dstMetaSize)) == KV_SUCCESS) {
                 H3_ObjectMetadata* dstObjMeta = (H3_ObjectMetadata*)dstObjMetaValue;
 
                 // Access the destination object
@@ -553,7 +769,7 @@ H3_Status H3_CreateObject(H3_Handle handle, H3_Token token, H3_Name bucketName,
     }
 
     // Make sure user has access to the bucket
-    if(op->metadata_read(_handle, bucketId, 0, &value, &mSize) != KV_SUCCESS){
+    if(ReadMetadata(ctx, bucketId, &value, &mSize) != KV_SUCCESS){
         return H3_FAILURE;
     }
 
@@ -570,9 +786,11 @@ H3_Status H3_CreateObject(H3_Handle handle, H3_Token token, H3_Name bucketName,
         uint nBatch = (nParts + H3_PART_BATCH_SIZE - 1)/H3_PART_BATCH_SIZE;
         size_t objMetaSize = sizeof(H3_ObjectMetadata) + nBatch * H3_PART_BATCH_SIZE * sizeof(H3_PartMetadata);
         H3_ObjectMetadata* objMeta = calloc(1, objMetaSize);
+        objMeta->version = H3_METADATA_VERSION;
         memcpy(objMeta->userId, userId, sizeof(H3_UserId));
         uuid_generate(objMeta->uuid);
         InitMode(objMeta);
+        objMeta->compression = bucketMetadata->compression;
         objMeta->readOnly = 0;
 
         // Reserve object
@@ -645,7 +863,7 @@ H3_Status H3_CreatePseudoObject(H3_Handle handle, H3_Token token, H3_Name bucket
     }
 
     // Make sure user has access to the bucket
-    if(op->metadata_read(_handle, bucketId, 0, &value, &mSize) != KV_SUCCESS){
+    if(ReadMetadata(ctx, bucketId, &value, &mSize) != KV_SUCCESS){
         return H3_FAILURE;
     }
 
@@ -659,9 +877,11 @@ H3_Status H3_CreatePseudoObject(H3_Handle handle, H3_Token token, H3_Name bucket
 
         size_t objMetaSize = sizeof(H3_ObjectMetadata) + sizeof(H3_PartMetadata);
         H3_ObjectMetadata* objMeta = calloc(1, objMetaSize);
+        objMeta->version = H3_METADATA_VERSION;
         memcpy(objMeta->userId, userId, sizeof(H3_UserId));
         uuid_generate(objMeta->uuid);
         InitMode(objMeta);
+        objMeta->compression = bucketMetadata->compression;
 
         objMeta->isBad = info->isBad;                                
         objMeta->readOnly = info->readOnly;                       
@@ -750,7 +970,7 @@ H3_Status H3_CreateObjectFromFile(H3_Handle handle, H3_Token token, H3_Name buck
     }
 
     // Make sure user has access to the bucket
-    if(op->metadata_read(_handle, bucketId, 0, &value, &mSize) != KV_SUCCESS){
+    if(ReadMetadata(ctx, bucketId, &value, &mSize) != KV_SUCCESS){
         return H3_FAILURE;
     }
 
@@ -767,9 +987,11 @@ H3_Status H3_CreateObjectFromFile(H3_Handle handle, H3_Token token, H3_Name buck
         uint nBatch = (nParts + H3_PART_BATCH_SIZE - 1)/H3_PART_BATCH_SIZE;
         size_t objMetaSize = sizeof(H3_ObjectMetadata) + nBatch * H3_PART_BATCH_SIZE * sizeof(H3_PartMetadata);
         H3_ObjectMetadata* objMeta = calloc(1, objMetaSize);
+        objMeta->version = H3_METADATA_VERSION;
         memcpy(objMeta->userId, userId, sizeof(H3_UserId));
         uuid_generate(objMeta->uuid);
         InitMode(objMeta);
+        objMeta->compression = bucketMetadata->compression;
         objMeta->readOnly = 0;
 
         // Reserve object
@@ -858,7 +1080,7 @@ H3_Status H3_CreateDummyObject(H3_Handle handle, H3_Token token, H3_Name bucketN
     }
 
     // Make sure user has access to the bucket
-    if(op->metadata_read(_handle, bucketId, 0, &value, &mSize) != KV_SUCCESS){
+    if(ReadMetadata(ctx, bucketId, &value, &mSize) != KV_SUCCESS){
         return H3_FAILURE;
     }
 
@@ -875,9 +1097,11 @@ H3_Status H3_CreateDummyObject(H3_Handle handle, H3_Token token, H3_Name bucketN
         uint nBatch = (nParts + H3_PART_BATCH_SIZE - 1)/H3_PART_BATCH_SIZE;
         size_t objMetaSize = sizeof(H3_ObjectMetadata) + nBatch * H3_PART_BATCH_SIZE * sizeof(H3_PartMetadata);
         H3_ObjectMetadata* objMeta = calloc(1, objMetaSize);
+        objMeta->version = H3_METADATA_VERSION;
         memcpy(objMeta->userId, userId, sizeof(H3_UserId));
         uuid_generate(objMeta->uuid);
         InitMode(objMeta);
+        objMeta->compression = bucketMetadata->compression;
         objMeta->readOnly = 0;
 
         // Reserve object
@@ -967,7 +1191,7 @@ H3_Status H3_ReadObject(H3_Handle handle, H3_Token token, H3_Name bucketName, H3
 
     status = H3_FAILURE;
     GetObjectId(bucketName, objectName, objId);
-    if( (storeStatus = op->metadata_read(_handle, objId, 0, &value, &mSize)) == KV_SUCCESS){
+    if( (storeStatus = ReadMetadata(ctx, objId, &value, &mSize)) == KV_SUCCESS){
         H3_ObjectMetadata* objMeta = (H3_ObjectMetadata*)value;
         size_t objectSize = 0;
 
@@ -991,7 +1215,7 @@ H3_Status H3_ReadObject(H3_Handle handle, H3_Token token, H3_Name bucketName, H3
 
             clock_gettime(CLOCK_REALTIME, &objMeta->lastAccess);
             if(*data){
-                if( ReadData(ctx, objMeta, *data, size, offset) == KV_SUCCESS                      &&
+                if( ReadData(ctx, objMeta, *data, size, offset, 1) == KV_SUCCESS                      &&
                     op->metadata_write(_handle, objId, (KV_Value)objMeta, mSize) == KV_SUCCESS     ){
 
                     if((objectSize - offset) > *size)
@@ -999,8 +1223,11 @@ H3_Status H3_ReadObject(H3_Handle handle, H3_Token token, H3_Name bucketName, H3
                     else
                         status = H3_SUCCESS;
                 }
-                else if(freeOnFail)
+                else if(freeOnFail){
                     free(*data);
+                    *data = NULL;
+                    *size = 0;
+                }
             }
         }
 
@@ -1044,7 +1271,6 @@ H3_Status H3_ReadDummyObject(H3_Handle handle, H3_Token token, H3_Name bucketNam
 
     H3_Status status;
     H3_Context* ctx = (H3_Context*)handle;
-    KV_Handle _handle = ctx->handle;
     KV_Operations* op = ctx->operation;
 
     H3_UserId userId;
@@ -1064,7 +1290,7 @@ H3_Status H3_ReadDummyObject(H3_Handle handle, H3_Token token, H3_Name bucketNam
 
     status = H3_FAILURE;
     GetObjectId(bucketName, objectName, objId);
-    if( (storeStatus = op->metadata_read(_handle, objId, 0, &value, &mSize)) == KV_SUCCESS){
+    if( (storeStatus = ReadMetadata(ctx, objId, &value, &mSize)) == KV_SUCCESS){
         H3_ObjectMetadata* objMeta = (H3_ObjectMetadata*)value;
         size_t objectSize = 0;
 
@@ -1082,7 +1308,7 @@ H3_Status H3_ReadDummyObject(H3_Handle handle, H3_Token token, H3_Name bucketNam
 
 
             	off_t offset = 0;
-            	while(objectSize && ReadData(ctx, objMeta, buffer, &readSize, offset) == KV_SUCCESS){
+            	while(objectSize && ReadData(ctx, objMeta, buffer, &readSize, offset, 1) == KV_SUCCESS){
             		offset += readSize;
             		objectSize -= readSize;
             		readSize = H3_PART_SIZE;
@@ -1160,7 +1386,7 @@ H3_Status H3_ReadObjectToFile(H3_Handle handle, H3_Token token, H3_Name bucketNa
 
     status = H3_FAILURE;
     GetObjectId(bucketName, objectName, objId);
-    if( (storeStatus = op->metadata_read(_handle, objId, 0, &value, &mSize)) == KV_SUCCESS){
+    if( (storeStatus = ReadMetadata(ctx, objId, &value, &mSize)) == KV_SUCCESS){
         H3_ObjectMetadata* objMeta = (H3_ObjectMetadata*)value;
         size_t availableSize = 0, objectSize = 0;
 
@@ -1181,7 +1407,7 @@ H3_Status H3_ReadObjectToFile(H3_Handle handle, H3_Token token, H3_Name bucketNa
         			requiredSize = availableSize;
 
         		ssize_t chunkSize = min(bufferSize, requiredSize);
-        		while(requiredSize && (storeStatus = ReadData(ctx, objMeta, buffer, (size_t*)&chunkSize, offset)) == KV_SUCCESS && chunkSize && (chunkSize = write(fd, buffer, (size_t)chunkSize)) != -1){
+        		while(requiredSize && (storeStatus = ReadData(ctx, objMeta, buffer, (size_t*)&chunkSize, offset, 1)) == KV_SUCCESS && chunkSize && (chunkSize = write(fd, buffer, (size_t)chunkSize)) != -1){
         			offset += chunkSize;
         			requiredSize -= chunkSize;
         			chunkSize = min(bufferSize, requiredSize);
@@ -1217,6 +1443,151 @@ H3_Status H3_ReadObjectToFile(H3_Handle handle, H3_Token token, H3_Name bucketNa
 
 
 
+// As with relatime, the access time is only updated if it precedes the last modification or a period has passed since
+static int RefreshAccess(H3_ObjectMetadata* objMeta){
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    if(Compare(&objMeta->lastAccess, &objMeta->lastModification) > 0 && now.tv_sec - objMeta->lastAccess.tv_sec < H3_ACCESS_PERIOD)
+        return 0;
+
+    objMeta->lastAccess = now;
+    return 1;
+}
+
+/*! \brief  Retrieve a file descriptor to the data of an object
+ *
+ * Locate the data at the given offset of an object and provide a read-only file descriptor to it, along with the position
+ * of the data within the file and the number of bytes available from there on, up to the end of the part hosting them.
+ * This allows the kernel to move the data, e.g. with splice() or sendfile(), rather than copying them through user space.
+ * It is only possible with storage back-ends keeping values in files and for data stored as is, i.e. not compressed; in
+ * any other case the data are to be retrieved with H3_ReadObject(). It is the responsibility of the user to close the
+ * descriptor. No descriptor is provided if the offset is past the end of the object, indicated by a size of 0x00.
+ * The access time is updated lazily, i.e. if it precedes the last modification or H3_ACCESS_PERIOD seconds have passed.
+ *
+ * @param[in]    handle             An h3lib handle
+ * @param[in]    token              Authentication information
+ * @param[in]    bucketName         The name of the bucket to host the object
+ * @param[in]    objectName         The name of the object
+ * @param[in]    offset             Offset within the object's data
+ * @param[out]   fd                 File descriptor to the data
+ * @param[out]   position           Position of the data within the file
+ * @param[out]   size               Size of the data available through the descriptor
+ *
+ * @result \b H3_SUCCESS            Operation completed successfully
+ * @result \b H3_FAILURE            Data are not available as a file, or bucket does not exist or user has no access
+ * @result \b H3_NOT_EXISTS         Object does not exist
+ * @result \b H3_INVALID_ARGS       Missing or malformed arguments
+ * @result \b H3_NAME_TOO_LONG      Bucket or Object name is longer than H3_BUCKET_NAME_SIZE or H3_OBJECT_NAME_SIZE respectively
+ *
+ */
+H3_Status H3_OpenObjectData(H3_Handle handle, H3_Token token, H3_Name bucketName, H3_Name objectName, off_t offset, int* fd, off_t* position, size_t* size){
+
+    // Argument check
+    if(!handle || !token  || !bucketName || !objectName || !fd || !position || !size ){
+        return H3_INVALID_ARGS;
+    }
+
+    H3_Status status;
+    H3_Context* ctx = (H3_Context*)handle;
+    KV_Handle _handle = ctx->handle;
+    KV_Operations* op = ctx->operation;
+
+    H3_UserId userId;
+    H3_ObjectId objId;
+    KV_Status storeStatus;
+    KV_Value value = NULL;
+    size_t mSize = 0;
+
+    // Validate bucketName & extract userId from token
+    if( (status = ValidBucketName(op, bucketName)) != H3_SUCCESS || (status = ValidObjectName(op, objectName)) != H3_SUCCESS){
+        return status;
+    }
+
+    if( !GetUserId(token, userId) ){
+        return H3_INVALID_ARGS;
+    }
+
+    // The store has to keep values in files
+    if(!op->open){
+        return H3_FAILURE;
+    }
+
+    status = H3_FAILURE;
+    GetObjectId(bucketName, objectName, objId);
+    if( (storeStatus = ReadMetadata(ctx, objId, &value, &mSize)) == KV_SUCCESS){
+        H3_ObjectMetadata* objMeta = (H3_ObjectMetadata*)value;
+        size_t objectSize = 0;
+
+        if(objMeta->nParts)
+            objectSize = objMeta->part[objMeta->nParts-1].offset + objMeta->part[objMeta->nParts-1].size;
+
+        if(GrantObjectAccess(userId, objMeta) && !objMeta->isBad){
+            H3_PartMetadata* part = NULL;
+            uint32_t i;
+
+            for(i=0; i<objMeta->nParts && !part; i++){
+                if(objMeta->part[i].offset <= offset && offset < objMeta->part[i].offset + objMeta->part[i].size)
+                    part = &objMeta->part[i];
+            }
+
+            if(offset >= objectSize){
+                *size = 0;
+                status = H3_SUCCESS;
+            }
+
+            // Holes and compressed parts have to be read
+            else if(part && part->codec == H3_CODEC_NONE){
+                H3_PartId partId;
+                struct stat st;
+                int partFd;
+
+                CreatePartId(partId, objMeta->uuid, part->number, part->subNumber);
+                if(op->open(_handle, partId, &partFd) == KV_SUCCESS){
+
+                    // Parts not (fully) backed by the file are left to H3_ReadObject()
+                    if(fstat(partFd, &st) == 0 && st.st_size >= part->size &&
+                       (!RefreshAccess(objMeta) || op->metadata_write(_handle, objId, (KV_Value)objMeta, mSize) == KV_SUCCESS)){
+                        *fd = partFd;
+                        *position = offset - part->offset;
+                        *size = part->size - *position;
+                        status = H3_SUCCESS;
+                    }
+                    else
+                        close(partFd);
+                }
+            }
+        }
+        free(objMeta);
+    }
+    else if(storeStatus == KV_KEY_NOT_EXIST)
+        return H3_NOT_EXISTS;
+
+    else if(storeStatus == KV_KEY_TOO_LONG)
+        return H3_NAME_TOO_LONG;
+
+    return status;
+}
+
+
+
+
+void FillObjectInfo(H3_ObjectMetadata* objMeta, H3_ObjectInfo* objectInfo){
+    objectInfo->isBad = objMeta->isBad;
+    objectInfo->creation = objMeta->creation;
+    objectInfo->lastAccess = objMeta->lastAccess;
+    objectInfo->lastModification = objMeta->lastModification;
+    objectInfo->lastChange = objMeta->lastChange;
+    objectInfo->readOnly = objMeta->readOnly;
+    objectInfo->mode = objMeta->mode;
+    objectInfo->uid = objMeta->uid;
+    objectInfo->gid = objMeta->gid;
+
+    if(objMeta->nParts)
+        objectInfo->size = objMeta->part[objMeta->nParts-1].offset + objMeta->part[objMeta->nParts-1].size;
+    else
+        objectInfo->size = 0;
+}
 
 /*! \brief  Retrieve information about an object
  *
@@ -1245,7 +1616,6 @@ H3_Status H3_InfoObject(H3_Handle handle, H3_Token token, H3_Name bucketName, H3
 
     H3_Status status;
     H3_Context* ctx = (H3_Context*)handle;
-    KV_Handle _handle = ctx->handle;
     KV_Operations* op = ctx->operation;
 
     H3_UserId userId;
@@ -1265,26 +1635,12 @@ H3_Status H3_InfoObject(H3_Handle handle, H3_Token token, H3_Name bucketName, H3
 
     status = H3_FAILURE;
     GetObjectId(bucketName, objectName, objId);
-    if((storeStatus = op->metadata_read(_handle, objId, 0, &value, &mSize)) == KV_SUCCESS){
+    if((storeStatus = ReadMetadata(ctx, objId, &value, &mSize)) == KV_SUCCESS){
 
         // Make sure user has access to the object
         H3_ObjectMetadata* objMeta = (H3_ObjectMetadata*)value;
         if(GrantObjectAccess(userId, objMeta)){
-
-            objectInfo->isBad = objMeta->isBad;
-            objectInfo->lastAccess = objMeta->lastAccess;
-            objectInfo->lastModification = objMeta->lastModification;
-            objectInfo->lastChange = objMeta->lastChange;
-            objectInfo->readOnly = objMeta->readOnly;
-            objectInfo->mode = objMeta->mode;
-            objectInfo->uid = objMeta->uid;
-            objectInfo->gid = objMeta->gid;
-
-            if(objMeta->nParts)
-                objectInfo->size = objMeta->part[objMeta->nParts-1].offset + objMeta->part[objMeta->nParts-1].size;
-            else
-                objectInfo->size = 0;
-
+            FillObjectInfo(objMeta, objectInfo);
             status = H3_SUCCESS;
         }
         free(objMeta);
@@ -1398,7 +1754,7 @@ H3_Status H3_TouchObject(H3_Handle handle, H3_Token token, H3_Name bucketName, H
 
     status = H3_FAILURE;
     GetObjectId(bucketName, objectName, objId);
-    if((storeStatus = op->metadata_read(_handle, objId, 0, &value, &mSize)) == KV_SUCCESS){
+    if((storeStatus = ReadMetadata(ctx, objId, &value, &mSize)) == KV_SUCCESS){
 
         // Make sure user has access to the object
         H3_ObjectMetadata* objMeta = (H3_ObjectMetadata*)value;
@@ -1474,9 +1830,14 @@ H3_Status H3_SetObjectAttributes(H3_Handle handle, H3_Token token, H3_Name bucke
         return H3_INVALID_ARGS;
     }
 
+    // Compression is set per bucket
+    if(attrib.type == H3_ATTRIBUTE_COMPRESSION) {
+        return H3_INVALID_ARGS;
+    }
+
     status = H3_FAILURE;
     GetObjectId(bucketName, objectName, objId);
-    if((storeStatus = op->metadata_read(_handle, objId, 0, &value, &mSize)) == KV_SUCCESS){
+    if((storeStatus = ReadMetadata(ctx, objId, &value, &mSize)) == KV_SUCCESS){
 
         // Make sure user has access to the object
         H3_ObjectMetadata* objMeta = (H3_ObjectMetadata*)value;
@@ -1516,7 +1877,7 @@ H3_Status DeleteObject(H3_Context* ctx, H3_UserId userId, H3_ObjectId objId, cha
     KV_Value value = NULL;
     size_t mSize = 0;
 
-    if( (storeStatus = op->metadata_read(_handle, objId, 0, &value, &mSize)) == KV_SUCCESS ){
+    if( (storeStatus = ReadMetadata(ctx, objId, &value, &mSize)) == KV_SUCCESS ){
 
         // Make sure user has access to the object
         H3_ObjectMetadata* objMeta = (H3_ObjectMetadata*)value;
@@ -1525,6 +1886,7 @@ H3_Status DeleteObject(H3_Context* ctx, H3_UserId userId, H3_ObjectId objId, cha
 
             H3_PartId partId;
             while(objMeta->nParts && op->delete(_handle, PartToId(partId, objMeta->uuid, &objMeta->part[objMeta->nParts - 1])) == KV_SUCCESS){
+            	InvalidatePrefetched(ctx, partId);
             	objMeta->nParts--;
             }
 
@@ -1658,7 +2020,7 @@ H3_Status H3_TruncateObject(H3_Handle handle, H3_Token token, H3_Name bucketName
     	return DeleteObject(ctx, userId, objId, 1);
 
     status = H3_FAILURE;
-    if((storeStatus = op->metadata_read(_handle, objId, 0, &value, &mSize)) == KV_SUCCESS){
+    if((storeStatus = ReadMetadata(ctx, objId, &value, &mSize)) == KV_SUCCESS){
 
         // Make sure user has access to the object
         H3_ObjectMetadata* objMeta = (H3_ObjectMetadata*)value;
@@ -1715,6 +2077,7 @@ H3_Status H3_TruncateObject(H3_Handle handle, H3_Token token, H3_Name bucketName
         			if(objMeta->part[i].size <= extra){
         				H3_PartId partId;
         				if( (storeStatus = op->delete(_handle, PartToId(partId, objMeta->uuid, &objMeta->part[i]))) == KV_SUCCESS){
+        					InvalidatePrefetched(ctx, partId);
         					objMeta->nParts--;
         					extra -= objMeta->part[i].size;
         				}
@@ -1722,6 +2085,8 @@ H3_Status H3_TruncateObject(H3_Handle handle, H3_Token token, H3_Name bucketName
         					break;
         			}
         			else {
+        				H3_PartId partId;
+        				InvalidatePrefetched(ctx, PartToId(partId, objMeta->uuid, &objMeta->part[i]));
         				objMeta->part[i].size -= extra;
         				extra = 0;
         			}
@@ -1788,7 +2153,7 @@ H3_Status MoveObject(H3_Handle handle, H3_Token token, H3_Name bucketName, H3_Na
     GetObjectId(bucketName, dstObjectName, dstObjId);
 
     status = H3_FAILURE;
-    if( (storeStatus = op->metadata_read(_handle, srcObjId, 0, &value, &srcMetaSize)) == KV_SUCCESS){
+    if( (storeStatus = ReadMetadata(ctx, srcObjId, &value, &srcMetaSize)) == KV_SUCCESS){
 
         // Make sure the user has access to the source object
         H3_ObjectMetadata* srcObjMeta = (H3_ObjectMetadata*)value;
@@ -1799,7 +2164,7 @@ H3_Status MoveObject(H3_Handle handle, H3_Token token, H3_Name bucketName, H3_Na
             H3_Name tempObject = GenerateDummyObjectName();
             GetObjectId(bucketName, tempObject, tempObjectId);
             
-            switch(op->metadata_read(_handle, dstObjId, 0, &value, &dstMetaSize)){
+            switch(ReadMetadata(ctx, dstObjId, &value, &dstMetaSize)){
 
                 case KV_SUCCESS:{
                     // Make sure the user has access to the destination object
@@ -1968,60 +2333,57 @@ H3_Status H3_CopyObject(H3_Handle handle, H3_Token token, H3_Name bucketName, H3
     GetObjectId(bucketName, dstObjectName, dstObjId);
 
     status = H3_FAILURE;
-    if( (storeStatus = op->metadata_read(_handle, srcObjId, 0, &value, &mSize)) == KV_SUCCESS){
+    if( (storeStatus = ReadMetadata(ctx, srcObjId, &value, &mSize)) == KV_SUCCESS){
 
         // Make sure the user has access to the object
         H3_ObjectMetadata* srcObjMeta = (H3_ObjectMetadata*)value;
         if( GrantObjectAccess(userId, srcObjMeta) ){
 
-            // TODO - Instead of exist do a create
+            int i;
+            H3_ObjectMetadata* dstObjMeta = malloc(mSize);
+            memcpy(dstObjMeta, srcObjMeta, mSize);
 
-            if(( (storeStatus = op->metadata_exists(_handle, dstObjId)) == KV_FAILURE) ||
-                 (storeStatus == KV_KEY_EXIST &&  (noOverwrite || DeleteObject(ctx, userId, dstObjId, 0) == H3_FAILURE))  ){
-                status = H3_FAILURE;
+            // Reserve the destination object, replacing the existing one if allowed
+            uuid_generate(dstObjMeta->uuid);
+            dstObjMeta->nParts = 0;
+            if( (storeStatus = op->metadata_create(_handle, dstObjId, (KV_Value)dstObjMeta, mSize)) == KV_KEY_EXIST &&
+                !noOverwrite && DeleteObject(ctx, userId, dstObjId, 0) == H3_SUCCESS                                    ){
+                storeStatus = op->metadata_create(_handle, dstObjId, (KV_Value)dstObjMeta, mSize);
             }
-            else {
-                int i;
-                H3_ObjectMetadata* dstObjMeta = malloc(mSize);
-                memcpy(dstObjMeta, srcObjMeta, mSize);
-
-                // Reserve the destination object
-                uuid_generate(dstObjMeta->uuid);
-                dstObjMeta->nParts = 0;
-                if(op->metadata_create(_handle, dstObjId, (KV_Value)dstObjMeta, mSize) == KV_SUCCESS){
-
-                    // Copy the parts
-                    H3_PartId srcPartId, dstPartId;
-                    for(i=0, storeStatus = KV_SUCCESS; i<srcObjMeta->nParts && storeStatus == KV_SUCCESS; i++){
-                        PartToId(srcPartId, srcObjMeta->uuid, &srcObjMeta->part[i]);
-                        CreatePartId(dstPartId, dstObjMeta->uuid, dstObjMeta->part[i].number, dstObjMeta->part[i].subNumber);
-                        storeStatus = op->copy(_handle, srcPartId, dstPartId);
-                    }
 
-                    // Also copy the object's user defined metadata
-                    status = CopyOrMoveObjectMetadata(ctx, userId, bucketName, srcObjectName, dstObjectName, 0);
+            if(storeStatus == KV_SUCCESS){
 
-                    // Update destination metadata
-                    clock_gettime(CLOCK_REALTIME, &dstObjMeta->creation);
-                    dstObjMeta->lastAccess = dstObjMeta->lastModification = dstObjMeta->creation;
-                    dstObjMeta->nParts = i;
-                    if(storeStatus != KV_SUCCESS){
-                        dstObjMeta->isBad = 1;
-                    }
+                // Copy the parts
+                H3_PartId srcPartId, dstPartId;
+                for(i=0, storeStatus = KV_SUCCESS; i<srcObjMeta->nParts && storeStatus == KV_SUCCESS; i++){
+                    PartToId(srcPartId, srcObjMeta->uuid, &srcObjMeta->part[i]);
+                    CreatePartId(dstPartId, dstObjMeta->uuid, dstObjMeta->part[i].number, dstObjMeta->part[i].subNumber);
+                    storeStatus = op->copy(_handle, srcPartId, dstPartId);
+                }
 
-                    // Update source metadata
-                    clock_gettime(CLOCK_REALTIME, &srcObjMeta->lastAccess);
+                // Also copy the object's user defined metadata
+                status = CopyOrMoveObjectMetadata(ctx, userId, bucketName, srcObjectName, dstObjectName, 0);
 
-                    if( op->metadata_write(_handle, dstObjId, (KV_Value)dstObjMeta, mSize)== KV_SUCCESS &&
-                        op->metadata_write(_handle, srcObjId, (KV_Value)srcObjMeta, mSize)== KV_SUCCESS && status == H3_SUCCESS){
-                        status = H3_SUCCESS;
-                    } else {
-                        status = H3_FAILURE;
-                    }
+                // Update destination metadata
+                clock_gettime(CLOCK_REALTIME, &dstObjMeta->creation);
+                dstObjMeta->lastAccess = dstObjMeta->lastModification = dstObjMeta->creation;
+                dstObjMeta->nParts = i;
+                if(storeStatus != KV_SUCCESS){
+                    dstObjMeta->isBad = 1;
                 }
 
-                free(dstObjMeta);
+                // Update source metadata
+                clock_gettime(CLOCK_REALTIME, &srcObjMeta->lastAccess);
+
+                if( op->metadata_write(_handle, dstObjId, (KV_Value)dstObjMeta, mSize)== KV_SUCCESS &&
+                    op->metadata_write(_handle, srcObjId, (KV_Value)srcObjMeta, mSize)== KV_SUCCESS && status == H3_SUCCESS){
+                    status = H3_SUCCESS;
+                } else {
+                    status = H3_FAILURE;
+                }
             }
+
+            free(dstObjMeta);
         }
         free(srcObjMeta);
     }
@@ -2037,33 +2399,92 @@ H3_Status H3_CopyObject(H3_Handle handle, H3_Token token, H3_Name bucketName, H3
 
 
 
-/*! \brief  Retrieve objects matching a pattern
- *
- * Produce a list of object names with object matching a given pattern. The pattern is a simple prefix
- * rather than a regular expression. The pattern must adhere to the object naming conventions.
- * Upon success the buffer will contain a number of variable sized C strings (stored back to back) thus
- * it is the responsibility of the user to dispose it. In case the internal buffer is not big enough to
- * fit all matching entries (indicated by the operation status) the user may invoke again the function
- * with an appropriately set offset in order to retrieve the next batch of names.
- * In case of an error, the buffer will not be created.
- *
- * @param[in]     handle             An h3lib handle
- * @param[in]     token              Authentication information
- * @param[in]     bucketName         The name of the bucket to host the object
- * @param[in]     prefix             The initial part of an object name
- * @param[in]     offset             The number of matching names to skip
- * @param[out]    objectNameArray    Pointer to a C string buffer
- * @param[inout]  nObjects           Number of names in buffer
- *
- * @result \b H3_SUCCESS            Operation completed successfully (no more matching names exist)
- * @result \b H3_CONTINUE           Operation completed successfully (there could be more matching names)
- * @result \b H3_FAILURE            Unable to access bucket or user has no access
- * @result \b H3_NOT_EXISTS         Bucket does not exist
- * @result \b H3_INVALID_ARGS       Missing or malformed arguments
- * @result \b H3_NAME_TOO_LONG      Bucket or Object name is longer than H3_BUCKET_NAME_SIZE or H3_OBJECT_NAME_SIZE respectively
- *
- */
-H3_Status H3_ListObjects(H3_Handle handle, H3_Token token, H3_Name bucketName, H3_Name prefix, uint32_t offset, H3_Name* objectNameArray, uint32_t* nObjects){
+// Object information gathered while listing
+typedef struct {
+    char* userId;
+    H3_ObjectInfo* info;
+    uint32_t nEntries;
+    uint32_t capacity;
+}H3_InfoList;
+
+static void CollectObjectInfo(KV_Key key, KV_Value value, size_t size, void* userData){
+    H3_InfoList* list = (H3_InfoList*)userData;
+    H3_ObjectMetadata* objMeta = (H3_ObjectMetadata*)value;
+
+    if(list->nEntries == list->capacity){
+        uint32_t capacity = max(list->capacity * 2, 64);
+        H3_ObjectInfo* info = realloc(list->info, capacity * sizeof(H3_ObjectInfo));
+        if(!info)
+            return;
+
+        list->info = info;
+        list->capacity = capacity;
+    }
+
+    H3_ObjectInfo* info = &list->info[list->nEntries++];
+    memset(info, 0, sizeof(H3_ObjectInfo));
+
+    // Keys removed meanwhile, or not accessible by the user, are reported as bad
+    if(objMeta && size >= sizeof(H3_ObjectMetadata) && GrantObjectAccess(list->userId, objMeta))
+        FillObjectInfo(objMeta, info);
+    else
+        info->isBad = 1;
+}
+
+// Make sure there is an entry for every listed key, the list is handed over to the caller
+static H3_ObjectInfo* CompleteObjectInfo(H3_InfoList* list, uint32_t nEntries){
+    H3_ObjectInfo* info = realloc(list->info, max(nEntries, 1) * sizeof(H3_ObjectInfo));
+    if(!info){
+        free(list->info);
+        return NULL;
+    }
+
+    for(; list->nEntries < nEntries; list->nEntries++){
+        memset(&info[list->nEntries], 0, sizeof(H3_ObjectInfo));
+        info[list->nEntries].isBad = 1;
+    }
+
+    return info;
+}
+
+typedef struct{
+    KV_Key prefix;
+    uint8_t nTrim;
+    KV_ListCallback function;
+    void* userData;
+}H3_ListUpgrade;
+
+// Values listed by the backend belong to it, records in an earlier layout are upgraded on a copy
+static void UpgradeListed(KV_Key key, KV_Value value, size_t size, void* userData){
+    H3_ListUpgrade* args = (H3_ListUpgrade*)userData;
+    KV_Value copy;
+
+    if(!value || ((H3_ObjectMetadata*)value)->version == H3_METADATA_VERSION || !(copy = malloc(size))){
+        args->function(key, value, size, args->userData);
+        return;
+    }
+
+    memcpy(copy, value, size);
+
+    KV_Key fullKey = g_strdup_printf("%.*s%s", args->nTrim, args->prefix, key);
+    if(UpgradeMetadata(fullKey, &copy, &size) != KV_SUCCESS){
+        free(copy);
+        copy = NULL;
+        size = 0;
+    }
+
+    args->function(key, copy, size, args->userData);
+    free(copy);
+    g_free(fullKey);
+}
+
+// List keys along with their metadata, as ListStoreMetadata() does, in the current layout
+KV_Status ListMetadata(H3_Context* ctx, KV_Key prefix, uint8_t nTrim, KV_Key buffer, uint32_t offset, uint32_t* nKeys, KV_ListCallback function, void* userData){
+    H3_ListUpgrade args = {prefix, nTrim, function, userData};
+    return ListStoreMetadata(ctx->operation, ctx->handle, prefix, nTrim, buffer, offset, nKeys, UpgradeListed, &args);
+}
+
+static H3_Status ListObjects(H3_Handle handle, H3_Token token, H3_Name bucketName, H3_Name prefix, uint32_t offset, H3_Name* objectNameArray, H3_ObjectInfo** objectInfoArray, uint32_t* nObjects){
 
     // Argument check. Note a 'prefix' is not required.
     if(!handle || !token  || !bucketName || !objectNameArray || !nObjects){
@@ -2091,7 +2512,7 @@ H3_Status H3_ListObjects(H3_Handle handle, H3_Token token, H3_Name bucketName, H
     }
 
     status = H3_FAILURE;
-    if( (storeStatus = op->metadata_read(_handle, bucketId, 0, &value, &mSize)) == KV_SUCCESS){
+    if( (storeStatus = ReadMetadata(ctx, bucketId, &value, &mSize)) == KV_SUCCESS){
 
         // Make sure the token grants access to the bucket
         H3_BucketMetadata* bucketMetadata = (H3_BucketMetadata*)value;
@@ -2103,7 +2524,19 @@ H3_Status H3_ListObjects(H3_Handle handle, H3_Token token, H3_Name bucketName, H
                 H3_ObjectId objId;
                 GetObjectId(bucketName, prefix, objId);
                 uint8_t trim = strlen(bucketName) + 1; // Remove the bucketName prefix from the matching entries
-                if( (storeStatus = op->list(_handle, objId, trim, keyBuffer, offset, nObjects)) != KV_FAILURE){
+                if(!objectInfoArray){
+                    storeStatus = op->list(_handle, objId, trim, keyBuffer, offset, nObjects);
+                }
+                else {
+                    H3_InfoList list = {.userId = userId};
+                    storeStatus = ListMetadata(ctx, objId, trim, keyBuffer, offset, nObjects, CollectObjectInfo, &list);
+                    if(storeStatus == KV_FAILURE)
+                        free(list.info);
+                    else if( !(*objectInfoArray = CompleteObjectInfo(&list, *nObjects)) )
+                        storeStatus = KV_FAILURE;
+                }
+
+                if(storeStatus != KV_FAILURE){
                     *objectNameArray = keyBuffer;
                     status = storeStatus==KV_SUCCESS?H3_SUCCESS:H3_CONTINUE;
                 }
@@ -2123,6 +2556,73 @@ H3_Status H3_ListObjects(H3_Handle handle, H3_Token token, H3_Name bucketName, H
 }
 
 
+/*! \brief  Retrieve objects matching a pattern
+ *
+ * Produce a list of object names with object matching a given pattern. The pattern is a simple prefix
+ * rather than a regular expression. The pattern must adhere to the object naming conventions.
+ * Upon success the buffer will contain a number of variable sized C strings (stored back to back) thus
+ * it is the responsibility of the user to dispose it. In case the internal buffer is not big enough to
+ * fit all matching entries (indicated by the operation status) the user may invoke again the function
+ * with an appropriately set offset in order to retrieve the next batch of names.
+ * In case of an error, the buffer will not be created.
+ *
+ * @param[in]     handle             An h3lib handle
+ * @param[in]     token              Authentication information
+ * @param[in]     bucketName         The name of the bucket to host the object
+ * @param[in]     prefix             The initial part of an object name
+ * @param[in]     offset             The number of matching names to skip
+ * @param[out]    objectNameArray    Pointer to a C string buffer
+ * @param[inout]  nObjects           Number of names in buffer
+ *
+ * @result \b H3_SUCCESS            Operation completed successfully (no more matching names exist)
+ * @result \b H3_CONTINUE           Operation completed successfully (there could be more matching names)
+ * @result \b H3_FAILURE            Unable to access bucket or user has no access
+ * @result \b H3_NOT_EXISTS         Bucket does not exist
+ * @result \b H3_INVALID_ARGS       Missing or malformed arguments
+ * @result \b H3_NAME_TOO_LONG      Bucket or Object name is longer than H3_BUCKET_NAME_SIZE or H3_OBJECT_NAME_SIZE respectively
+ *
+ */
+H3_Status H3_ListObjects(H3_Handle handle, H3_Token token, H3_Name bucketName, H3_Name prefix, uint32_t offset, H3_Name* objectNameArray, uint32_t* nObjects){
+    return ListObjects(handle, token, bucketName, prefix, offset, objectNameArray, NULL, nObjects);
+}
+
+
+
+/*! \brief  Retrieve objects matching a pattern along with their information
+ *
+ * Identical to H3_ListObjects() but also produces an array with the information of each object, in the
+ * same order as the names, so that listings presenting sizes or timestamps do not have to look up each
+ * object individually. Both buffers are created by the function and should be disposed by the user.
+ * Objects removed or inaccessible by the time their information is retrieved are included, marked as bad.
+ *
+ * @param[in]     handle             An h3lib handle
+ * @param[in]     token              Authentication information
+ * @param[in]     bucketName         The name of the bucket to host the object
+ * @param[in]     prefix             The initial part of an object name
+ * @param[in]     offset             The number of matching names to skip
+ * @param[out]    objectNameArray    Pointer to a C string buffer
+ * @param[out]    objectInfoArray    Pointer to an array of object information
+ * @param[inout]  nObjects           Number of names in buffer
+ *
+ * @result \b H3_SUCCESS            Operation completed successfully (no more matching names exist)
+ * @result \b H3_CONTINUE           Operation completed successfully (there could be more matching names)
+ * @result \b H3_FAILURE            Unable to access bucket or user has no access
+ * @result \b H3_NOT_EXISTS         Bucket does not exist
+ * @result \b H3_INVALID_ARGS       Missing or malformed arguments
+ * @result \b H3_NAME_TOO_LONG      Bucket name is longer than H3_BUCKET_NAME_SIZE
+ *
+ */
+H3_Status H3_ListObjectsWithInfo(H3_Handle handle, H3_Token token, H3_Name bucketName, H3_Name prefix, uint32_t offset, H3_Name* objectNameArray, H3_ObjectInfo** objectInfoArray, uint32_t* nObjects){
+
+    // Argument check. The rest are checked while listing.
+    if(!objectInfoArray){
+        return H3_INVALID_ARGS;
+    }
+
+    return ListObjects(handle, token, bucketName, prefix, offset, objectNameArray, objectInfoArray, nObjects);
+}
+
+
 /*! \brief  Execute a user provide function for each matching object
  *
  * Execute a user provide function for each object in a bucket matching a prefix. At each invocation the function
@@ -2172,7 +2672,7 @@ H3_Status H3_ForeachObject(H3_Handle handle, H3_Token token, H3_Name bucketName,
     }
 
     status = H3_FAILURE;
-    if( (storeStatus = op->metadata_read(_handle, bucketId, 0, &value, &mSize)) == KV_SUCCESS){
+    if( (storeStatus = ReadMetadata(ctx, bucketId, &value, &mSize)) == KV_SUCCESS){
 
         // Make sure the token grants access to the bucket
         H3_BucketMetadata* bucketMetadata = (H3_BucketMetadata*)value;
@@ -2274,7 +2774,7 @@ H3_Status H3_WriteObject(H3_Handle handle, H3_Token token, H3_Name bucketName, H
         return H3_NAME_TOO_LONG;
 
     // Get object metadata and make sure we have access
-    if((storeStatus = op->metadata_read(_handle, objId, 0, &value, &mSize)) == KV_KEY_TOO_LONG){
+    if((storeStatus = ReadMetadata(ctx, objId, &value, &mSize)) == KV_KEY_TOO_LONG){
         return H3_NAME_TOO_LONG;
     }
     else if(storeStatus != KV_SUCCESS)
@@ -2388,7 +2888,7 @@ H3_Status H3_WriteObjectFromFile(H3_Handle handle, H3_Token token, H3_Name bucke
         return H3_NAME_TOO_LONG;
 
     // Get object metadata and make sure we have access
-    if((storeStatus = op->metadata_read(_handle, objId, 0, &value, &mSize)) == KV_KEY_TOO_LONG){
+    if((storeStatus = ReadMetadata(ctx, objId, &value, &mSize)) == KV_KEY_TOO_LONG){
         return H3_NAME_TOO_LONG;
     }
     else if(storeStatus != KV_SUCCESS)
@@ -2619,7 +3119,7 @@ H3_Status H3_CreateObjectMetadata(H3_Handle handle, H3_Token token, H3_Name buck
     GetObjectId(bucketName, objectName, objId);
     
     status = H3_FAILURE;
-    if ((storeStatus = op->metadata_read(_handle, objId, 0, &objMetaValue, &mSize)) == KV_SUCCESS) {
+    if ((storeStatus = ReadMetadata(ctx, objId, &objMetaValue, &mSize)) == KV_SUCCESS) {
         H3_ObjectMetadata* objMeta = (H3_ObjectMetadata*)objMetaValue;
 
         // Access the object
@@ -2711,7 +3211,7 @@ H3_Status H3_ReadObjectMetadata(H3_Handle handle, H3_Token token, H3_Name bucket
     GetObjectId(bucketName, objectName, objId);
 
     status = H3_FAILURE;
-    if ((storeStatus = op->metadata_read(_handle, objId, 0, &objMetaValue, &mSize)) == KV_SUCCESS) {
+    if ((storeStatus = ReadMetadata(ctx, objId, &objMetaValue, &mSize)) == KV_SUCCESS) {
         H3_ObjectMetadata* objMeta = (H3_ObjectMetadata*)objMetaValue;
         
         // Access the object
@@ -2802,7 +3302,7 @@ H3_Status H3_DeleteObjectMetadata(H3_Handle handle, H3_Token token, H3_Name buck
     GetObjectId(bucketName, objectName, objId);
 
     status = H3_FAILURE;
-    if ((storeStatus = op->metadata_read(_handle, objId, 0, &objMetaValue, &mSize)) == KV_SUCCESS) {
+    if ((storeStatus = ReadMetadata(ctx, objId, &objMetaValue, &mSize)) == KV_SUCCESS) {
         H3_ObjectMetadata* objMeta = (H3_ObjectMetadata*)objMetaValue;
         
         // Access the object
@@ -2979,7 +3479,7 @@ H3_Status H3_ListObjectsWithMetadata(H3_Handle handle, H3_Token token, H3_Name b
     }
        
     status = H3_FAILURE;
-    if ((storeStatus = op->metadata_read(_handle, bucketId, 0, &value, &mSize)) == KV_SUCCESS) {
+    if ((storeStatus = ReadMetadata(ctx, bucketId, &value, &mSize)) == KV_SUCCESS) {
         H3_BucketMetadata* bucketMetadata = (H3_BucketMetadata*)value;
 
         if (GrantBucketAccess(userId, bucketMetadata)) {
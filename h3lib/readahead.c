@@ -0,0 +1,369 @@
+// Copyright [2019] [FORTH-ICS]
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "common.h"
+#include "util.h"
+#include "readahead.h"
+
+/*
+ * Reads are tracked per object (i.e. object UUID) on the handle. A read starting where the previous one
+ * ended makes the stream sequential and the parts following it are fetched in the background into a
+ * buffer shared by all streams. The window doubles with every sequential read up to a max and falls back
+ * to zero on a random read. Prefetched parts are kept until read to their end, invalidated or evicted
+ * in LRU order to make room for others.
+ *
+ * Only reads on behalf of users are tracked, not those of copies or dictionary training. Parts written,
+ * truncated or deleted through the handle are invalidated once the store has been changed, so that a fetch
+ * that raced with the change is dropped as well, whereas a buffered part is validated against the part
+ * metadata of the object being read, which catches most (but not all) modifications through other handles.
+ */
+
+typedef enum {
+    PartPending,
+    PartReady
+}H3_PrefetchState;
+
+typedef struct{
+    H3_PartId partId;
+    H3_PartMetadata part;   // As it was when the part was scheduled
+    H3_PrefetchState state;
+    char used;
+    KV_Value data;
+    GList* link;            // Position in the eviction queue, only for ready parts
+}H3_PrefetchedPart;
+
+typedef struct{
+    char id[37];            // Object UUID
+    off_t nextOffset;
+    uint32_t window;
+    gint64 lastAccess;
+}H3_Stream;
+
+struct H3_ReadAhead{
+    GMutex lock;
+    GCond cond;
+    GThreadPool* pool;
+    GHashTable* parts;      // H3_PartId --> H3_PrefetchedPart
+    GHashTable* streams;    // Object UUID --> H3_Stream
+    GQueue lru;             // Ready parts, least recently used first
+    uint32_t maxWindow;
+    H3_ReadAheadStats stats;
+};
+
+static void FreePrefetchedPart(H3_PrefetchedPart* entry){
+    free(entry->data);
+    free(entry);
+}
+
+// Must be called with the lock held
+static void DropPart(H3_ReadAhead* readAhead, H3_PrefetchedPart* entry){
+    if(!entry->used)
+        readAhead->stats.wasted++;
+
+    if(entry->link)
+        g_queue_delete_link(&readAhead->lru, entry->link);
+
+    g_hash_table_remove(readAhead->parts, entry->partId);
+}
+
+static void FetchPart(gpointer data, gpointer userData){
+    H3_PrefetchedPart* entry = (H3_PrefetchedPart*)data;
+    H3_Context* ctx = (H3_Context*)userData;
+    H3_ReadAhead* readAhead = ctx->readAhead;
+    KV_Status status = KV_FAILURE;
+
+    KV_Value buffer = malloc(entry->part.size);
+    if(buffer)
+        status = ReadPart(ctx, &entry->part, entry->partId, buffer, 0, entry->part.size);
+
+    g_mutex_lock(&readAhead->lock);
+    if(status == KV_SUCCESS){
+        entry->data = buffer;
+        entry->state = PartReady;
+        g_queue_push_tail(&readAhead->lru, entry);
+        entry->link = g_queue_peek_tail_link(&readAhead->lru);
+        readAhead->stats.prefetched++;
+    }
+    else {
+        // Readers waiting on the part will fetch it themselves
+        free(buffer);
+        entry->used = 1;
+        DropPart(readAhead, entry);
+    }
+    g_cond_broadcast(&readAhead->cond);
+    g_mutex_unlock(&readAhead->lock);
+}
+
+H3_ReadAhead* InitReadAhead(H3_Context* ctx){
+    H3_ReadAhead* readAhead = calloc(1, sizeof(H3_ReadAhead));
+
+    if(readAhead){
+        g_mutex_init(&readAhead->lock);
+        g_cond_init(&readAhead->cond);
+        g_queue_init(&readAhead->lru);
+        readAhead->parts = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)FreePrefetchedPart);
+        readAhead->streams = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, free);
+        readAhead->pool = g_thread_pool_new(FetchPart, ctx, H3_READAHEAD_THREADS, FALSE, NULL);
+
+        // Prefetching parts held in memory would only add a copy
+        readAhead->maxWindow = ctx->dataType == H3_STORE_MEMORY?0:H3_READAHEAD_WINDOW;
+    }
+
+    return readAhead;
+}
+
+void FreeReadAhead(H3_ReadAhead* readAhead){
+    if(!readAhead)
+        return;
+
+    // Drop any queued fetches and wait for the running ones
+    g_thread_pool_free(readAhead->pool, TRUE, TRUE);
+
+    g_queue_clear(&readAhead->lru);
+    g_hash_table_destroy(readAhead->parts);
+    g_hash_table_destroy(readAhead->streams);
+    g_cond_clear(&readAhead->cond);
+    g_mutex_clear(&readAhead->lock);
+    free(readAhead);
+}
+
+/*
+ * Record a read on the object's stream and return the number of parts to fetch
+ * ahead of it, 0 if the read does not appear to be part of a sequential scan.
+ */
+uint32_t TrackStream(H3_Context* ctx, H3_ObjectMetadata* meta, off_t offset, size_t size){
+    H3_ReadAhead* readAhead = ctx->readAhead;
+    uint32_t window = 0;
+    char id[37];
+
+    if(!readAhead || !readAhead->maxWindow || !size)
+        return 0;
+
+    uuid_unparse(meta->uuid, id);
+
+    g_mutex_lock(&readAhead->lock);
+    H3_Stream* stream = g_hash_table_lookup(readAhead->streams, id);
+    if(stream){
+        if(offset == stream->nextOffset)
+            stream->window = stream->window?min(stream->window * 2, readAhead->maxWindow):1;
+        else
+            stream->window = 0;
+    }
+    else {
+        // Make room by forgetting the least recently used stream
+        if(g_hash_table_size(readAhead->streams) >= H3_READAHEAD_STREAMS){
+            H3_Stream *candidate, *oldest = NULL;
+            GHashTableIter iter;
+
+            g_hash_table_iter_init(&iter, readAhead->streams);
+            while(g_hash_table_iter_next(&iter, NULL, (gpointer*)&candidate)){
+                if(!oldest || candidate->lastAccess < oldest->lastAccess)
+                    oldest = candidate;
+            }
+            g_hash_table_remove(readAhead->streams, oldest->id);
+        }
+
+        if( (stream = calloc(1, sizeof(H3_Stream))) ){
+            strcpy(stream->id, id);
+
+            // Reading from the start of an object is usually the beginning of a scan
+            stream->window = offset == 0?1:0;
+            g_hash_table_insert(readAhead->streams, stream->id, stream);
+        }
+    }
+
+    if(stream){
+        stream->nextOffset = offset + size;
+        stream->lastAccess = g_get_monotonic_time();
+        window = stream->window;
+    }
+    g_mutex_unlock(&readAhead->lock);
+
+    return window;
+}
+
+/*
+ * Serve a read from the read-ahead buffer, waiting for the part if it is being fetched. Returns
+ * KV_KEY_NOT_EXIST if the part is not buffered, in which case the caller should read it itself.
+ */
+KV_Status ReadPrefetched(H3_Context* ctx, H3_PartMetadata* part, H3_PartId partId, KV_Value value, off_t inPartOffset, size_t size){
+    H3_ReadAhead* readAhead = ctx->readAhead;
+    H3_PrefetchedPart* entry;
+    KV_Status status = KV_KEY_NOT_EXIST;
+
+    if(!readAhead)
+        return status;
+
+    g_mutex_lock(&readAhead->lock);
+    while((entry = g_hash_table_lookup(readAhead->parts, partId)) && entry->state == PartPending)
+        g_cond_wait(&readAhead->cond, &readAhead->lock);
+
+    // The part has been modified since it was fetched
+    if(entry && (entry->part.size != part->size || entry->part.codec != part->codec || entry->part.storedSize != part->storedSize)){
+        DropPart(readAhead, entry);
+        entry = NULL;
+    }
+
+    if(entry){
+        memcpy(value, &entry->data[inPartOffset], size);
+        entry->used = 1;
+        readAhead->stats.hits++;
+
+        // Readers are done with a part once they reach its end
+        if(inPartOffset + size == entry->part.size){
+            DropPart(readAhead, entry);
+        }
+        else {
+            g_queue_unlink(&readAhead->lru, entry->link);
+            g_queue_push_tail_link(&readAhead->lru, entry->link);
+        }
+        status = KV_SUCCESS;
+    }
+    else if(readAhead->maxWindow)
+        readAhead->stats.misses++;
+
+    g_mutex_unlock(&readAhead->lock);
+
+    return status;
+}
+
+// Schedule the parts from the given offset onwards, up to "window" parts
+void Prefetch(H3_Context* ctx, H3_ObjectMetadata* meta, off_t offset, uint32_t window){
+    H3_ReadAhead* readAhead = ctx->readAhead;
+    uint i, nParts = 0;
+
+    if(!readAhead || !window)
+        return;
+
+    g_mutex_lock(&readAhead->lock);
+    for(i=0; i<meta->nParts && nParts < window; i++){
+        H3_PartMetadata* part = &meta->part[i];
+        H3_PrefetchedPart* entry;
+        H3_PartId partId;
+
+        if(!part->size || part->offset + part->size <= offset)
+            continue;
+
+        nParts++;
+        CreatePartId(partId, meta->uuid, part->number, part->subNumber);
+        if(g_hash_table_contains(readAhead->parts, partId))
+            continue;
+
+        // Parts being fetched are never evicted, thus the buffer may be saturated
+        if(g_hash_table_size(readAhead->parts) >= H3_READAHEAD_PARTS){
+            if(!(entry = g_queue_peek_head(&readAhead->lru)))
+                break;
+
+            DropPart(readAhead, entry);
+        }
+
+        if( (entry = calloc(1, sizeof(H3_PrefetchedPart))) ){
+            memcpy(entry->partId, partId, sizeof(H3_PartId));
+            entry->part = *part;
+            entry->state = PartPending;
+            g_hash_table_insert(readAhead->parts, entry->partId, entry);
+            g_thread_pool_push(readAhead->pool, entry, NULL);
+        }
+    }
+    g_mutex_unlock(&readAhead->lock);
+}
+
+// Drop a part just modified, waiting for it if it is being fetched
+void InvalidatePrefetched(H3_Context* ctx, H3_PartId partId){
+    H3_ReadAhead* readAhead = ctx->readAhead;
+    H3_PrefetchedPart* entry;
+
+    if(!readAhead)
+        return;
+
+    g_mutex_lock(&readAhead->lock);
+    while((entry = g_hash_table_lookup(readAhead->parts, partId)) && entry->state == PartPending)
+        g_cond_wait(&readAhead->cond, &readAhead->lock);
+
+    if(entry)
+        DropPart(readAhead, entry);
+
+    g_mutex_unlock(&readAhead->lock);
+}
+
+
+/*! \brief Set the read-ahead window of a handle
+ *
+ * Sequential reads of an object through the handle are detected and the parts following them are fetched in the
+ * background. The window, i.e. the number of parts fetched ahead of a reader, starts at a single part and doubles
+ * with every sequential read up to the given max.
+ *
+ * @param[in]    handle             An h3lib handle
+ * @param[in]    window             Max number of parts fetched ahead of a reader, 0 disables read-ahead
+ *
+ * @result \b H3_SUCCESS            Operation completed successfully
+ * @result \b H3_INVALID_ARGS       Missing handle or window larger than H3_READAHEAD_PARTS
+ * @result \b H3_FAILURE            The read-ahead buffer of the handle is not available
+ *
+ */
+H3_Status H3_SetReadAhead(H3_Handle handle, uint32_t window){
+    if(!handle || window > H3_READAHEAD_PARTS){
+        return H3_INVALID_ARGS;
+    }
+
+    H3_Context* ctx = (H3_Context*)handle;
+    H3_ReadAhead* readAhead = ctx->readAhead;
+    H3_PrefetchedPart* entry;
+
+    if(!readAhead){
+        return H3_FAILURE;
+    }
+
+    g_mutex_lock(&readAhead->lock);
+    readAhead->maxWindow = window;
+    if(!window){
+        g_hash_table_remove_all(readAhead->streams);
+        while( (entry = g_queue_peek_head(&readAhead->lru)) )
+            DropPart(readAhead, entry);
+    }
+    g_mutex_unlock(&readAhead->lock);
+
+    return H3_SUCCESS;
+}
+
+
+/*! \brief Retrieve the read-ahead statistics of a handle
+ *
+ * @param[in]    handle             An h3lib handle
+ * @param[inout] stats              User allocated structure to be filled with the counters
+ *
+ * @result \b H3_SUCCESS            Operation completed successfully
+ * @result \b H3_INVALID_ARGS       Missing or malformed arguments
+ *
+ */
+H3_Status H3_InfoReadAhead(H3_Handle handle, H3_ReadAheadStats* stats){
+    if(!handle || !stats){
+        return H3_INVALID_ARGS;
+    }
+
+    H3_Context* ctx = (H3_Context*)handle;
+    H3_ReadAhead* readAhead = ctx->readAhead;
+
+    if(!readAhead){
+        memset(stats, 0, sizeof(H3_ReadAheadStats));
+        return H3_SUCCESS;
+    }
+
+    g_mutex_lock(&readAhead->lock);
+    *stats = readAhead->stats;
+    stats->window = readAhead->maxWindow;
+    g_mutex_unlock(&readAhead->lock);
+
+    return H3_SUCCESS;
+}
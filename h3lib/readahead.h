@@ -0,0 +1,35 @@
+// Copyright [2019] [FORTH-ICS]
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef READAHEAD_H_
+#define READAHEAD_H_
+
+#include <stdint.h>
+
+#define H3_READAHEAD_WINDOW     8       // Default max number of parts prefetched per stream
+#define H3_READAHEAD_PARTS      32      // Max number of parts held in the read-ahead buffer
+#define H3_READAHEAD_STREAMS    64      // Max number of objects tracked concurrently
+#define H3_READAHEAD_THREADS    2       // Number of background readers
+
+typedef struct H3_ReadAhead H3_ReadAhead;
+
+H3_ReadAhead* InitReadAhead(H3_Context* ctx);
+void FreeReadAhead(H3_ReadAhead* readAhead);
+
+uint32_t TrackStream(H3_Context* ctx, H3_ObjectMetadata* meta, off_t offset, size_t size);
+KV_Status ReadPrefetched(H3_Context* ctx, H3_PartMetadata* part, H3_PartId partId, KV_Value value, off_t inPartOffset, size_t size);
+void Prefetch(H3_Context* ctx, H3_ObjectMetadata* meta, off_t offset, uint32_t window);
+void InvalidatePrefetched(H3_Context* ctx, H3_PartId partId);
+
+#endif /* READAHEAD_H_ */
@@ -0,0 +1,139 @@
+// Copyright [2019] [FORTH-ICS]
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * Move the part files of a filesystem store from the flat layout, i.e. "<root>/_<uuid>#<number>",
+ * to the sharded layout used by kv_fs.c, i.e. "<root>/_/<uu>/<id>/<uuid>/<number>". The store
+ * must not be in use while migrating. Each part is moved with a single rename, so the tool can
+ * be interrupted and run again.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#define PARTS_DIR       "_"
+#define WHOLE_PART      "-"
+#define UUID_LEN        36
+
+static int IsPartKey(const char* key){
+    int i;
+
+    if(key[0] != '_')
+        return 0;
+
+    for(i=1; i<=UUID_LEN; i++){
+        if(!isxdigit((unsigned char)key[i]) && key[i] != '-')
+            return 0;
+    }
+
+    return key[i] == '\0' || key[i] == '#';
+}
+
+static int MakeDir(const char* path){
+    return mkdir(path, S_IRWXU | S_IRWXG | S_IRWXO) == 0 || errno == EEXIST;
+}
+
+static int MovePart(const char* root, const char* name, int dryRun){
+    char src[PATH_MAX], dst[PATH_MAX];
+    const char* uuid = &name[1];
+    const char* number = name[UUID_LEN + 1]?&name[UUID_LEN + 2]:WHOLE_PART;
+    int len;
+
+    snprintf(src, PATH_MAX, "%s/%s", root, name);
+    if(dryRun){
+        printf("%s -> %s/" PARTS_DIR "/%.2s/%.2s/%.*s/%s\n", src, root, uuid, &uuid[2], UUID_LEN, uuid, number);
+        return 1;
+    }
+
+    // Create the directories one level at a time, they are shared by many parts
+    len = snprintf(dst, PATH_MAX, "%s/" PARTS_DIR, root);
+    if(!MakeDir(dst))
+        return 0;
+
+    len += snprintf(&dst[len], PATH_MAX - len, "/%.2s", uuid);
+    if(!MakeDir(dst))
+        return 0;
+
+    len += snprintf(&dst[len], PATH_MAX - len, "/%.2s", &uuid[2]);
+    if(!MakeDir(dst))
+        return 0;
+
+    len += snprintf(&dst[len], PATH_MAX - len, "/%.*s", UUID_LEN, uuid);
+    if(!MakeDir(dst))
+        return 0;
+
+    snprintf(&dst[len], PATH_MAX - len, "/%s", number);
+    return rename(src, dst) == 0;
+}
+
+int main(int argc, char* argv[]){
+    const char* root = NULL;
+    unsigned long nMoved = 0, nFailed = 0;
+    int dryRun = 0, opt;
+    struct dirent* entry;
+    DIR* dir;
+
+    while((opt = getopt(argc, argv, "nh")) != -1){
+        switch(opt){
+            case 'n':
+                dryRun = 1;
+                break;
+
+            default:
+                fprintf(stderr, "Usage: %s [-n] <store root>\n", argv[0]);
+                fprintf(stderr, "  -n  Print the moves without applying them\n");
+                return opt == 'h'?EXIT_SUCCESS:EXIT_FAILURE;
+        }
+    }
+
+    if(optind != argc - 1){
+        fprintf(stderr, "Usage: %s [-n] <store root>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // Accept the storage URI as well, e.g. file:///tmp/h3
+    root = argv[optind];
+    if(strncmp(root, "file://", 7) == 0)
+        root += 7;
+
+    if( !(dir = opendir(root)) ){
+        fprintf(stderr, "Cannot open %s - %s\n", root, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    // Entries are only added under the parts directory, so the walk is not affected by the moves
+    while( (entry = readdir(dir)) ){
+        if(!IsPartKey(entry->d_name))
+            continue;
+
+        if(MovePart(root, entry->d_name, dryRun))
+            nMoved++;
+        else {
+            fprintf(stderr, "Cannot move %s - %s\n", entry->d_name, strerror(errno));
+            nFailed++;
+        }
+    }
+    closedir(dir);
+
+    printf("%lu parts %s, %lu failed\n", nMoved, dryRun?"to move":"moved", nFailed);
+    return nFailed?EXIT_FAILURE:EXIT_SUCCESS;
+}
@@ -16,7 +16,10 @@
 #include <string.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <ctype.h>
+#include "common.h"
 #include "util.h"
+#include "url_parser.h"
 
 //    http://web.theurbanpenguin.com/adding-color-to-your-output-from-c/
 static const char* color[] = {"\033[0;33m",     // H3_INFO  --> Yellow
@@ -67,3 +70,113 @@ void* ReAllocFreeOnFail(void* buffer, size_t size){
 
 	return tmp;
 }
+
+// Part keys are "_<uuid>#<number>", with the UUID as printed by uuid_unparse()
+int IsPartKey(const char* key){
+	int i;
+
+	if(key[0] != '_')
+		return 0;
+
+	for(i=1; i<=36; i++){
+		if(!isxdigit((unsigned char)key[i]) && key[i] != '-')
+			return 0;
+	}
+
+	return key[i] == '\0' || key[i] == '#';
+}
+
+// Finds an argument whose value is a URI itself, i.e. "<name>=<scheme>://", at the start of the
+// arguments or after a '?' or '&'. Arguments of nested URIs that are not URIs are skipped.
+const char* FindUriArgument(const char* arguments, const char* name){
+	const char *argument, *scheme;
+	size_t nameLen = strlen(name);
+
+	for(argument = arguments; (argument = strstr(argument, name)); argument++){
+		if(argument[nameLen] != '=' || (argument > arguments && argument[-1] != '?' && argument[-1] != '&'))
+			continue;
+
+		for(scheme = &argument[nameLen + 1]; isalnum((unsigned char)*scheme) || *scheme == '-'; scheme++);
+		if(scheme > &argument[nameLen + 1] && strncmp(scheme, "://", 3) == 0)
+			return argument;
+	}
+
+	return NULL;
+}
+
+// Splits "<scheme>://[<options>&]<first>=<uri>?<second>=<uri>" into the URIs of the two stores
+// composing it, each with its own options. Returns where the first one is named, after 'spec'.
+const char* SplitUri(const char* storageUri, const char* first, const char* second, const char** spec, char** firstUri, char** secondUri){
+	const char *firstArgument, *secondArgument, *uri;
+
+	if( !(*spec = strstr(storageUri, "://")) )
+		return NULL;
+
+	for(*spec += 3; **spec == '/'; (*spec)++);
+	if(**spec == '?')
+		(*spec)++;
+
+	if( !(firstArgument = FindUriArgument(*spec, first)) )
+		return NULL;
+
+	uri = &firstArgument[strlen(first) + 1];
+	if( !(secondArgument = FindUriArgument(uri, second)) )
+		return NULL;
+
+	*firstUri = strndup(uri, secondArgument - 1 - uri);
+	*secondUri = strdup(&secondArgument[strlen(second) + 1]);
+
+	return firstArgument;
+}
+
+KV_Operations* GetUriOperations(const char* storageUri){
+	KV_Operations* operation = NULL;
+	struct parsed_url *url;
+
+	if( (url = parse_url(storageUri)) ){
+		operation = GetOperations(H3_String2Type(url->scheme));
+		parsed_url_free(url);
+	}
+
+	return operation;
+}
+
+// Stores made of others cannot tell from a name alone which store its keys end up in,
+// thus names have to be valid for the most demanding one i.e. the filesystem.
+KV_Status ValidateNestedKey(KV_Key key){
+	return GetOperations(H3_STORE_FILESYSTEM)->validate_key(key);
+}
+
+// Lists keys along with their metadata. Stores keeping values next to the keys do it in a single pass,
+// otherwise each listed key is read individually. The callback is invoked once per listed key, in order.
+KV_Status ListStoreMetadata(KV_Operations* op, KV_Handle handle, KV_Key prefix, uint8_t nTrim, KV_Key buffer, uint32_t offset, uint32_t* nKeys, KV_ListCallback function, void* userData){
+	KV_Status status;
+
+	if(op->metadata_list)
+		return op->metadata_list(handle, prefix, nTrim, buffer, offset, nKeys, function, userData);
+
+	if( (status = op->list(handle, prefix, nTrim, buffer, offset, nKeys)) == KV_SUCCESS || status == KV_CONTINUE){
+		KV_Key entry = buffer;
+		uint32_t i;
+
+		for(i=0; i<*nKeys; i++, entry += strlen(entry) + 1){
+			KV_Value value = NULL;
+			size_t size = 0;
+
+			// Listed keys are trimmed, restore them
+			KV_Key key = g_strdup_printf("%.*s%s", nTrim, prefix, entry);
+
+			if(op->metadata_read(handle, key, 0, &value, &size) != KV_SUCCESS){
+				free(value);
+				value = NULL;
+				size = 0;
+			}
+
+			function(entry, value, size, userData);
+			free(value);
+			g_free(key);
+		}
+	}
+
+	return status;
+}
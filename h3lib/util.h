@@ -18,6 +18,8 @@
 #include <stdint.h>
 #include <time.h>
 
+#include "kv_interface.h"
+
 // Use typeof to make sure each argument is evaluated only once
 // https://gcc.gnu.org/onlinedocs/gcc-4.9.2/gcc/Typeof.html#Typeof
 #define max(a,b) ({ __typeof__ (a) _a = (a); __typeof__ (b) _b = (b); _a > _b ? _a : _b; })
@@ -49,5 +51,11 @@ int64_t Compare(struct timespec* a, struct timespec* b);
 struct timespec Posterior(struct timespec* a, struct timespec* b);
 struct timespec Anterior(struct timespec* a, struct timespec* b);
 void* ReAllocFreeOnFail(void* buffer, size_t size);
+int IsPartKey(const char* key);
+const char* FindUriArgument(const char* arguments, const char* name);
+const char* SplitUri(const char* storageUri, const char* first, const char* second, const char** spec, char** firstUri, char** secondUri);
+KV_Operations* GetUriOperations(const char* storageUri);
+KV_Status ValidateNestedKey(KV_Key key);
+KV_Status ListStoreMetadata(KV_Operations* op, KV_Handle handle, KV_Key prefix, uint8_t nTrim, KV_Key buffer, uint32_t offset, uint32_t* nKeys, KV_ListCallback function, void* userData);
 
 #endif
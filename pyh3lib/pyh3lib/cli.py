@@ -377,8 +377,18 @@ def cmd_list(config_path, args):
 
         h3 = pyh3lib.H3(config_path)
         if not list_buckets:
-            for object in h3.list_objects(bucket, prefix):
-                print(object)
+            if args.long:
+                offset = 0
+                while True:
+                    result = h3.list_objects_with_info(bucket, prefix, offset=offset)
+                    for object, info in result:
+                        print(f'{datetime.fromtimestamp(info.last_modification).strftime("%Y-%m-%d %H:%M:%S")} {sizeof(info.size):>10} {object}')
+                    offset += len(result)
+                    if result.done:
+                        break
+            else:
+                for object in h3.list_objects(bucket, prefix):
+                    print(object)
         else:
             for bucket in h3.list_buckets():
                 print(bucket)
@@ -574,6 +584,7 @@ def main(cmd=None):
 
     list = subprasers.add_parser('ls', help='List H3 objects and common prefixes under a prefix or all H3 buckets')
     list.add_argument('prefix', nargs='?', default=None)
+    list.add_argument('-l', '--long', action='store_true', help='Show the size and modification time of objects')
     list.set_defaults(func=cmd_list)
 
     remove_object = subprasers.add_parser('rm', help='Deletes an H3 object')
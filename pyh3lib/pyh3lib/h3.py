@@ -63,6 +63,10 @@ class H3(object, metaclass=H3Version):
     * ``kreon-rdma://127.0.0.1:2181`` for distributed Kreon with RDMA, where the network location refers to the ZooKeeper host and port
     * ``rocksdb:///tmp/h3/rocksdb`` for `RocksDB <https://rocksdb.org>`_
     * ``redis://127.0.0.1:6379`` for `Redis <https://redis.io>`_
+    * ``lmdb:///tmp/h3/lmdb`` for `LMDB <https://www.symas.com/lmdb>`_
+    * ``mem:///`` for memory, private to the handle unless named in the path (e.g. ``mem:///hot``)
+    * ``split://meta=rocksdb:///nvme/h3?data=file:///hdd/h3`` for metadata and data on different stores, each given by its own URI
+    * ``cache://hot=mem:///?cold=file:///hdd/h3`` for a hot store caching the data of a cold one, each given by its own URI
 
     .. note::
        All functions may raise standard exceptions on internal errors, or some ``pyh3lib.*Error``
@@ -78,6 +82,15 @@ class H3(object, metaclass=H3Version):
     METADATA_NAME_SIZE = h3lib.H3_METADATA_NAME_SIZE
     """Maximum metadata name size."""
 
+    CODEC_NONE = h3lib.H3_CODEC_NONE
+    """Store object data as is."""
+
+    CODEC_LZ4 = h3lib.H3_CODEC_LZ4
+    """Compress object data with LZ4."""
+
+    CODEC_ZSTD = h3lib.H3_CODEC_ZSTD
+    """Compress object data with Zstandard."""
+
     def __init__(self, storage_uri, user_id=0):
         self._handle = h3lib.init(storage_uri)
         if not self._handle:
@@ -154,6 +167,34 @@ class H3(object, metaclass=H3Version):
         """
         return h3lib.purge_bucket(self._handle, bucket_name, self._user_id)
 
+    def set_bucket_compression(self, bucket_name, codec, level=0):
+        """Set the codec applied to the data of objects created in a bucket.
+
+        :param bucket_name: the bucket name
+        :param codec: one of :attr:`CODEC_NONE`, :attr:`CODEC_LZ4` or :attr:`CODEC_ZSTD`
+        :param level: codec level, only used by Zstandard (default is the codec's default)
+        :type bucket_name: string
+        :type codec: int
+        :type level: int
+        :returns: ``True`` if the call was successful
+
+        .. note::
+           Existing objects retain the codec they were created with. Codecs other than
+           :attr:`CODEC_NONE` are only available if h3lib is built with compression.
+        """
+        return h3lib.set_bucket_compression(self._handle, bucket_name, codec, level, self._user_id)
+
+    def train_bucket_dictionary(self, bucket_name, size=0):
+        """Train a Zstandard dictionary from the objects in a bucket, used for objects created from now on.
+
+        :param bucket_name: the bucket name
+        :param size: max dictionary size (default is the library's default)
+        :type bucket_name: string
+        :type size: int
+        :returns: ``True`` if the call was successful
+        """
+        return h3lib.train_bucket_dictionary(self._handle, bucket_name, size, self._user_id)
+
     def list_objects(self, bucket_name, prefix='', offset=0, count=10000):
         """List objects in a bucket.
 
@@ -171,6 +212,26 @@ class H3(object, metaclass=H3Version):
         objects, done = h3lib.list_objects(self._handle, bucket_name, prefix, offset, count, self._user_id)
         return H3List(objects, done=done)
 
+    def list_objects_with_info(self, bucket_name, prefix='', offset=0, count=10000):
+        """List objects in a bucket along with their information.
+
+        :param bucket_name: the bucket name
+        :param prefix: list only objects starting with prefix (default is no prefix)
+        :param offset: continue list from offset (default is to start from the beginning)
+        :param count: number of objects to retrieve
+        :type bucket_name: string
+        :type prefix: string
+        :type offset: int
+        :type count: int
+        :returns: An H3List of (name, info) tuples if the call was successful
+
+        Information is in the format returned by :func:`info_object`, retrieved
+        in the same pass as the names.
+        """
+
+        objects, done = h3lib.list_objects_with_info(self._handle, bucket_name, prefix, offset, count, self._user_id)
+        return H3List(objects, done=done)
+
     def info_object(self, bucket_name, object_name):
         """Get object information.
 
@@ -66,10 +66,19 @@ class H3Cache(object, metaclass=H3Version):
     * ``kreon://127.0.0.1:2181`` for Kreon, where the network location refers to the ZooKeeper host and port
     * ``rocksdb:///tmp/h3/rocksdb`` for `RocksDB <https://rocksdb.org>`_
     * ``redis://127.0.0.1:6379`` for `Redis <https://redis.io>`_
+    * ``lmdb:///tmp/h3/lmdb`` for `LMDB <https://www.symas.com/lmdb>`_
+    * ``mem:///`` for memory, private to the handle unless named in the path (e.g. ``mem:///hot``)
+    * ``split://meta=rocksdb:///nvme/h3?data=file:///hdd/h3`` for metadata and data on different stores, each given by its own URI
+    * ``cache://hot=mem:///?cold=file:///hdd/h3`` for a hot store caching the data of a cold one, each given by its own URI
 
     .. note::
        All functions may raise standard exceptions on internal errors, or some ``h3lib.*Error``
        in respect to the underlying library's return values.
+
+    .. note::
+       ``h3lib`` also caches natively with ``cache://`` URIs, which any ``H3`` handle can use
+       (e.g. ``H3('cache://hot=mem:///?cold=file:///hdd/h3')``), keeping parts rather than
+       whole objects in the hot store.
     """
 
     BUCKET_NAME_SIZE = h3lib.H3_BUCKET_NAME_SIZE
@@ -391,6 +400,26 @@ class H3Cache(object, metaclass=H3Version):
         objects, done = h3lib.list_objects(self._cold_handle, bucket_name, prefix, offset, count, self._user_id)
         return H3List(objects, done=done)  
 
+    def list_objects_with_info(self, bucket_name, prefix='', offset=0, count=10000):
+        """List objects in a bucket along with their information.
+
+        :param bucket_name: the bucket name
+        :param prefix: list only objects starting with prefix (default is no prefix)
+        :param offset: continue list from offset (default is to start from the beginning)
+        :param count: number of objects to retrieve
+        :type bucket_name: string
+        :type prefix: string
+        :type offset: int
+        :type count: int
+        :returns: An H3List of (name, info) tuples if the call was successful
+
+        Information is in the format returned by :func:`info_object`, retrieved
+        in the same pass as the names.
+        """
+
+        objects, done = h3lib.list_objects_with_info(self._cold_handle, bucket_name, prefix, offset, count, self._user_id)
+        return H3List(objects, done=done)
+
     def info_object(self, bucket_name, object_name):
         """Get object information.
 
@@ -377,6 +377,57 @@ static PyObject *h3lib_purge_bucket(PyObject* self, PyObject *args, PyObject *kw
     Py_RETURN_TRUE;
 }
 
+static PyObject *h3lib_set_bucket_compression(PyObject* self, PyObject *args, PyObject *kw) {
+    PyObject *capsule = NULL;
+    H3_Name bucketName;
+    int codec;
+    int level = 0;
+    uint32_t userId = 0;
+
+    static char *kwlist[] = {"handle", "bucket_name", "codec", "level", "user_id", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kw, "Osi|iI", kwlist, &capsule, &bucketName, &codec, &level, &userId))
+        return NULL;
+
+    H3_Handle handle = (H3_Handle)PyCapsule_GetPointer(capsule, NULL);
+    if (handle == NULL)
+        return NULL;
+
+    H3_Auth auth;
+    H3_Attribute attribute;
+
+    auth.userId = userId;
+    attribute.type = H3_ATTRIBUTE_COMPRESSION;
+    attribute.codec = codec;
+    attribute.level = level;
+    if (did_raise_exception(H3_SetBucketAttributes(handle, &auth, bucketName, attribute)))
+        return NULL;
+
+    Py_RETURN_TRUE;
+}
+
+static PyObject *h3lib_train_bucket_dictionary(PyObject* self, PyObject *args, PyObject *kw) {
+    PyObject *capsule = NULL;
+    H3_Name bucketName;
+    size_t size = 0;
+    uint32_t userId = 0;
+
+    static char *kwlist[] = {"handle", "bucket_name", "size", "user_id", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kw, "Os|kI", kwlist, &capsule, &bucketName, &size, &userId))
+        return NULL;
+
+    H3_Handle handle = (H3_Handle)PyCapsule_GetPointer(capsule, NULL);
+    if (handle == NULL)
+        return NULL;
+
+    H3_Auth auth;
+
+    auth.userId = userId;
+    if (did_raise_exception(H3_TrainBucketDictionary(handle, &auth, bucketName, size)))
+        return NULL;
+
+    Py_RETURN_TRUE;
+}
+
 static PyObject *h3lib_list_objects(PyObject* self, PyObject *args, PyObject *kw) {
     PyObject *capsule = NULL;
     H3_Name bucketName;
@@ -386,7 +437,7 @@ static PyObject *h3lib_list_objects(PyObject* self, PyObject *args, PyObject *kw
     uint32_t userId = 0;
 
     static char *kwlist[] = {"handle", "bucket_name", "prefix", "offset", "count", "user_id", NULL};
-    if (!PyArg_ParseTupleAndKeywords(args, kw, "Os|skkI", kwlist, &capsule, &bucketName, &prefix, &offset, &count, &userId))
+    if (!PyArg_ParseTupleAndKeywords(args, kw, "Os|sIII", kwlist, &capsule, &bucketName, &prefix, &offset, &count, &userId))
         return NULL;
 
     H3_Handle handle = (H3_Handle)PyCapsule_GetPointer(capsule, NULL);
@@ -422,6 +473,79 @@ static PyObject *h3lib_list_objects(PyObject* self, PyObject *args, PyObject *kw
     return Py_BuildValue("(OO)", list, (return_value == H3_SUCCESS ? Py_True : Py_False));
 }
 
+static PyObject *build_object_info(H3_ObjectInfo *objectInfo) {
+    PyObject *object_info = PyStructSequence_New(&object_info_type);
+    if (object_info == NULL) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    PyStructSequence_SET_ITEM(object_info, 0, Py_BuildValue("O", (objectInfo->isBad ? Py_True : Py_False)));
+    PyStructSequence_SET_ITEM(object_info, 1, Py_BuildValue("O", (objectInfo->readOnly ? Py_True : Py_False)));
+    PyStructSequence_SET_ITEM(object_info, 2, Py_BuildValue("k", objectInfo->size));
+    PyStructSequence_SET_ITEM(object_info, 3, Py_BuildValue("d", TIMESPEC_TO_DOUBLE(objectInfo->creation)));
+    PyStructSequence_SET_ITEM(object_info, 4, Py_BuildValue("d", TIMESPEC_TO_DOUBLE(objectInfo->lastAccess)));
+    PyStructSequence_SET_ITEM(object_info, 5, Py_BuildValue("d", TIMESPEC_TO_DOUBLE(objectInfo->lastModification)));
+    PyStructSequence_SET_ITEM(object_info, 6, Py_BuildValue("d", TIMESPEC_TO_DOUBLE(objectInfo->lastChange)));
+    PyStructSequence_SET_ITEM(object_info, 7, Py_BuildValue("i", objectInfo->mode));
+    PyStructSequence_SET_ITEM(object_info, 8, Py_BuildValue("i", objectInfo->uid));
+    PyStructSequence_SET_ITEM(object_info, 9, Py_BuildValue("i", objectInfo->gid));
+    if (PyErr_Occurred()) {
+        Py_DECREF(object_info);
+        PyErr_NoMemory();
+        return NULL;
+    }
+
+    return object_info;
+}
+
+static PyObject *h3lib_list_objects_with_info(PyObject* self, PyObject *args, PyObject *kw) {
+    PyObject *capsule = NULL;
+    H3_Name bucketName;
+    char *prefix = "";
+    uint32_t offset = 0;
+    uint32_t count = 10000;
+    uint32_t userId = 0;
+
+    static char *kwlist[] = {"handle", "bucket_name", "prefix", "offset", "count", "user_id", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kw, "Os|sIII", kwlist, &capsule, &bucketName, &prefix, &offset, &count, &userId))
+        return NULL;
+
+    H3_Handle handle = (H3_Handle)PyCapsule_GetPointer(capsule, NULL);
+    if (handle == NULL)
+        return NULL;
+
+    H3_Auth auth;
+    H3_Name objectNameArray = NULL;
+    H3_ObjectInfo *objectInfoArray = NULL;
+    uint32_t nObjects = count;
+
+    auth.userId = userId;
+    H3_Status return_value = H3_ListObjectsWithInfo(handle, &auth, bucketName, prefix, offset, &objectNameArray, &objectInfoArray, &nObjects);
+    if (did_raise_exception(return_value))
+        return NULL;
+
+    PyObject *list = PyList_New(nObjects);
+    uint32_t i;
+    H3_Name current_name = objectNameArray;
+    for (i = 0; i < nObjects; i ++) {
+        PyObject *object_info = build_object_info(&(objectInfoArray[i]));
+        if (object_info == NULL) {
+            Py_DECREF(list);
+            list = NULL;
+            break;
+        }
+
+        PyList_SET_ITEM(list, i, Py_BuildValue("(sN)", current_name, object_info));
+        current_name += strlen(current_name) + 1;
+    }
+    free(objectNameArray);
+    free(objectInfoArray);
+    if (list == NULL)
+        return NULL;
+
+    return Py_BuildValue("(NO)", list, (return_value == H3_SUCCESS ? Py_True : Py_False));
+}
+
 static PyObject *h3lib_info_object(PyObject* self, PyObject *args, PyObject *kw) {
     PyObject *capsule = NULL;
     H3_Name bucketName;
@@ -443,28 +567,7 @@ static PyObject *h3lib_info_object(PyObject* self, PyObject *args, PyObject *kw)
     if (did_raise_exception(H3_InfoObject(handle, &auth, bucketName, objectName, &objectInfo)))
         return NULL;
 
-    PyObject *object_info = PyStructSequence_New(&object_info_type);
-    if (object_info == NULL) {
-        PyErr_NoMemory();
-        return NULL;
-    }
-    PyStructSequence_SET_ITEM(object_info, 0, Py_BuildValue("O", (objectInfo.isBad ? Py_True : Py_False)));
-    PyStructSequence_SET_ITEM(object_info, 1, Py_BuildValue("O", (objectInfo.readOnly ? Py_True : Py_False)));
-    PyStructSequence_SET_ITEM(object_info, 2, Py_BuildValue("k", objectInfo.size));
-    PyStructSequence_SET_ITEM(object_info, 3, Py_BuildValue("d", TIMESPEC_TO_DOUBLE(objectInfo.creation)));
-    PyStructSequence_SET_ITEM(object_info, 4, Py_BuildValue("d", TIMESPEC_TO_DOUBLE(objectInfo.lastAccess)));
-    PyStructSequence_SET_ITEM(object_info, 5, Py_BuildValue("d", TIMESPEC_TO_DOUBLE(objectInfo.lastModification)));
-    PyStructSequence_SET_ITEM(object_info, 6, Py_BuildValue("d", TIMESPEC_TO_DOUBLE(objectInfo.lastChange)));
-    PyStructSequence_SET_ITEM(object_info, 7, Py_BuildValue("i", objectInfo.mode));
-    PyStructSequence_SET_ITEM(object_info, 8, Py_BuildValue("i", objectInfo.uid));
-    PyStructSequence_SET_ITEM(object_info, 9, Py_BuildValue("i", objectInfo.gid));
-    if (PyErr_Occurred()) {
-        Py_DECREF(object_info);
-        PyErr_NoMemory();
-        return NULL;
-    }
-
-    return object_info;
+    return build_object_info(&objectInfo);
 }
 
 static PyObject *h3lib_object_exists(PyObject* self, PyObject *args, PyObject *kw) {
@@ -1181,7 +1284,7 @@ static PyObject *h3lib_list_objects_with_metadata(PyObject* self, PyObject *args
     uint32_t userId = 0;
 
     static char *kwlist[] = {"handle", "bucket_name", "metadata_name", "offset", "user_id", NULL};
-    if (!PyArg_ParseTupleAndKeywords(args, kw, "OsskI", kwlist, &capsule, &bucketName, &metadataName, &offset, &userId))
+    if (!PyArg_ParseTupleAndKeywords(args, kw, "OssII", kwlist, &capsule, &bucketName, &metadataName, &offset, &userId))
         return NULL;
 
     H3_Handle handle = (H3_Handle)PyCapsule_GetPointer(capsule, NULL);
@@ -1226,7 +1329,7 @@ static PyObject *h3lib_list_multiparts(PyObject* self, PyObject *args, PyObject
     uint32_t userId = 0;
 
     static char *kwlist[] = {"handle", "bucket_name", "offset", "count", "user_id", NULL};
-    if (!PyArg_ParseTupleAndKeywords(args, kw, "Os|kkI", kwlist, &capsule, &bucketName, &offset, &count, &userId))
+    if (!PyArg_ParseTupleAndKeywords(args, kw, "Os|III", kwlist, &capsule, &bucketName, &offset, &count, &userId))
         return NULL;
 
     H3_Handle handle = (H3_Handle)PyCapsule_GetPointer(capsule, NULL);
@@ -1442,8 +1545,11 @@ static PyMethodDef module_functions[] = {
     {"create_bucket",               (PyCFunction)h3lib_create_bucket,               METH_VARARGS|METH_KEYWORDS, NULL},
     {"delete_bucket",               (PyCFunction)h3lib_delete_bucket,               METH_VARARGS|METH_KEYWORDS, NULL},
     {"purge_bucket",                (PyCFunction)h3lib_purge_bucket,                METH_VARARGS|METH_KEYWORDS, NULL},
+    {"set_bucket_compression",      (PyCFunction)h3lib_set_bucket_compression,      METH_VARARGS|METH_KEYWORDS, NULL},
+    {"train_bucket_dictionary",     (PyCFunction)h3lib_train_bucket_dictionary,     METH_VARARGS|METH_KEYWORDS, NULL},
 
     {"list_objects",                (PyCFunction)h3lib_list_objects,                METH_VARARGS|METH_KEYWORDS, NULL},
+    {"list_objects_with_info",      (PyCFunction)h3lib_list_objects_with_info,      METH_VARARGS|METH_KEYWORDS, NULL},
     {"info_object",                 (PyCFunction)h3lib_info_object,                 METH_VARARGS|METH_KEYWORDS, NULL},
     {"object_exists",               (PyCFunction)h3lib_object_exists,               METH_VARARGS|METH_KEYWORDS, NULL},
     {"touch_object",                (PyCFunction)h3lib_touch_object,                METH_VARARGS|METH_KEYWORDS, NULL},
@@ -1496,6 +1602,9 @@ PyMODINIT_FUNC PyInit_h3lib(void) {
     PyModule_AddIntConstant(module, "H3_BUCKET_NAME_SIZE", H3_BUCKET_NAME_SIZE);
     PyModule_AddIntConstant(module, "H3_OBJECT_NAME_SIZE", H3_OBJECT_NAME_SIZE);
     PyModule_AddIntConstant(module, "H3_METADATA_NAME_SIZE", H3_METADATA_NAME_SIZE);
+    PyModule_AddIntConstant(module, "H3_CODEC_NONE", H3_CODEC_NONE);
+    PyModule_AddIntConstant(module, "H3_CODEC_LZ4", H3_CODEC_LZ4);
+    PyModule_AddIntConstant(module, "H3_CODEC_ZSTD", H3_CODEC_ZSTD);
 
     PyStructSequence_InitType(&storage_info_type, &storage_info_desc);
     PyStructSequence_InitType(&bucket_stats_type, &bucket_stats_desc);
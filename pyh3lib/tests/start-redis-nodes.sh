@@ -0,0 +1,17 @@
+#!/bin/sh
+
+# Start an empty Redis instance on each port given (6379 and 6380 by default), to run tests with
+# pytest -v -s --storage "redis://127.0.0.1:6379/?nodes=127.0.0.1:6380" tests
+
+PORTS=${*:-6379 6380}
+
+for PORT in ${PORTS}; do
+    redis-server --port ${PORT} --daemonize yes --save "" --appendonly no --dir /tmp --pidfile /tmp/redis-${PORT}.pid --logfile /tmp/redis-${PORT}.log
+done
+
+for PORT in ${PORTS}; do
+    until redis-cli -p ${PORT} ping > /dev/null 2>&1; do
+        sleep 1
+    done
+    redis-cli -p ${PORT} flushall > /dev/null
+done
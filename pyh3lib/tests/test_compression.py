@@ -0,0 +1,242 @@
+# Copyright [2019] [FORTH-ICS]
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+import pytest
+import pyh3lib
+import json
+
+from pyh3lib import H3
+
+MEGABYTE = 1048576
+
+@pytest.fixture(scope='module')
+def compression(h3):
+    """Skip unless h3lib is built with compression."""
+
+    h3.create_bucket('b0')
+    try:
+        h3.set_bucket_compression('b0', H3.CODEC_LZ4)
+    except pyh3lib.H3InvalidArgsError:
+        pytest.skip('h3lib is built without compression')
+    finally:
+        h3.delete_bucket('b0')
+
+def compressible(size, seed=0):
+    lines = (b'%08d,record-%d,%s\n' % (i, seed, b'abc' * (i % 7)) for i in range(size))
+    return b''.join(lines)[:size]
+
+def record(i, seed=0):
+    return json.dumps({'id': i,
+                       'name': 'user%d' % i,
+                       'email': 'user%d@example.com' % i,
+                       'active': i % 2 == 0,
+                       'roles': ['reader', 'writer'] if seed == 0 else ['admin'],
+                       'address': {'city': 'Heraklion', 'zip': '%05d' % (i * 7)},
+                       'score': i * 13 + seed}).encode()
+
+def check_object(h3, bucket_name, object_name, data):
+    assert h3.info_object(bucket_name, object_name).size == len(data)
+    assert h3.read_object(bucket_name, object_name) == data
+
+def test_arguments(h3, compression):
+    """Set compression with bad arguments."""
+
+    assert h3.list_buckets() == []
+
+    with pytest.raises(pyh3lib.H3NotExistsError):
+        h3.set_bucket_compression('b1', H3.CODEC_LZ4)
+
+    with pytest.raises(pyh3lib.H3NotExistsError):
+        h3.train_bucket_dictionary('b1')
+
+    assert h3.create_bucket('b1') == True
+
+    with pytest.raises(pyh3lib.H3InvalidArgsError):
+        h3.set_bucket_compression('b1', 100)
+
+    with pytest.raises(pyh3lib.H3InvalidArgsError):
+        h3.set_bucket_compression('b1', H3.CODEC_LZ4, 3)
+
+    with pytest.raises(pyh3lib.H3InvalidArgsError):
+        h3.set_bucket_compression('b1', H3.CODEC_ZSTD, 1000)
+
+    # Too few samples.
+    with pytest.raises(pyh3lib.H3FailureError):
+        h3.train_bucket_dictionary('b1')
+
+    assert h3.set_bucket_compression('b1', H3.CODEC_NONE) == True
+    assert h3.delete_bucket('b1') == True
+
+    assert h3.list_buckets() == []
+
+@pytest.mark.parametrize('codec,level', [(H3.CODEC_LZ4, 0), (H3.CODEC_ZSTD, 0), (H3.CODEC_ZSTD, 9)])
+def test_codec(h3, compression, codec, level):
+    """Write, read, copy and truncate compressed objects."""
+
+    assert h3.list_buckets() == []
+
+    assert h3.create_bucket('b1') == True
+
+    # Objects created before compression is set are not compressed.
+    plain = compressible(MEGABYTE + 100)
+    assert h3.create_object('b1', 'plain', plain) == True
+
+    assert h3.set_bucket_compression('b1', codec, level) == True
+
+    # Parts that do not compress are stored as is.
+    with open('/dev/urandom', 'rb') as f:
+        noise = f.read(MEGABYTE)
+
+    data = compressible(MEGABYTE) + noise + compressible(MEGABYTE + 12345, 1)
+    assert h3.create_object('b1', 'o1', data) == True
+    check_object(h3, 'b1', 'o1', data)
+    check_object(h3, 'b1', 'plain', plain)
+
+    # Read ranges across parts.
+    assert h3.read_object('b1', 'o1', offset=MEGABYTE - 100, size=200) == data[MEGABYTE - 100:MEGABYTE + 100]
+    assert h3.read_object('b1', 'o1', offset=2 * MEGABYTE + 5, size=MEGABYTE) == data[2 * MEGABYTE + 5:3 * MEGABYTE + 5]
+    assert h3.read_object('b1', 'o1', offset=len(data) - 10) == data[-10:]
+
+    # Partial writes, inside a part, across parts and past the end.
+    data = data[:10] + b'hello' + data[15:]
+    assert h3.write_object('b1', 'o1', b'hello', offset=10) == True
+    check_object(h3, 'b1', 'o1', data)
+
+    patch = compressible(5000, 2)
+    data = data[:MEGABYTE - 2000] + patch + data[MEGABYTE + 3000:]
+    assert h3.write_object('b1', 'o1', patch, offset=MEGABYTE - 2000) == True
+    check_object(h3, 'b1', 'o1', data)
+
+    tail = compressible(100000, 3)
+    assert h3.write_object('b1', 'o1', tail, offset=len(data)) == True
+    data += tail
+    check_object(h3, 'b1', 'o1', data)
+
+    # Truncate inside a compressed part, then extend.
+    assert h3.truncate_object('b1', 'o1', 2 * MEGABYTE + 777) == True
+    data = data[:2 * MEGABYTE + 777]
+    check_object(h3, 'b1', 'o1', data)
+
+    assert h3.truncate_object('b1', 'o1', 3 * MEGABYTE) == True
+    data += b'\0' * (3 * MEGABYTE - len(data))
+    check_object(h3, 'b1', 'o1', data)
+
+    assert h3.truncate_object('b1', 'o1', 1000) == True
+    data = data[:1000]
+    check_object(h3, 'b1', 'o1', data)
+
+    assert h3.write_object('b1', 'o1', compressible(2 * MEGABYTE), offset=0) == True
+    data = compressible(2 * MEGABYTE)
+    check_object(h3, 'b1', 'o1', data)
+
+    # Copies.
+    assert h3.copy_object('b1', 'o1', 'o2') == True
+    check_object(h3, 'b1', 'o2', data)
+
+    assert h3.move_object('b1', 'o2', 'o3') == True
+    check_object(h3, 'b1', 'o3', data)
+    assert h3.list_objects('b1') == ['o1', 'o3', 'plain']
+
+    # Existing objects retain their codec.
+    assert h3.set_bucket_compression('b1', H3.CODEC_NONE) == True
+    assert h3.write_object('b1', 'o1', b'world', offset=MEGABYTE) == True
+    data = data[:MEGABYTE] + b'world' + data[MEGABYTE + 5:]
+    check_object(h3, 'b1', 'o1', data)
+
+    assert h3.create_object('b1', 'o5', data) == True
+    check_object(h3, 'b1', 'o5', data)
+
+    bucket_info = h3.info_bucket('b1', get_stats=True)
+    assert bucket_info.stats.size == 3 * len(data) + MEGABYTE + 100
+    assert bucket_info.stats.count == 4
+
+    assert h3.purge_bucket('b1') == True
+    assert h3.delete_bucket('b1') == True
+
+    assert h3.list_buckets() == []
+
+def test_dictionary(h3, compression, request):
+    """Train dictionaries and use them for small objects."""
+
+    assert h3.list_buckets() == []
+
+    assert h3.create_bucket('b1') == True
+
+    count = 300
+    for i in range(count):
+        assert h3.create_object('b1', 'a%d' % i, record(i)) == True
+
+    assert h3.train_bucket_dictionary('b1', 8192) == True
+
+    for i in range(count):
+        assert h3.create_object('b1', 'b%d' % i, record(i)) == True
+    for i in range(count):
+        check_object(h3, 'b1', 'a%d' % i, record(i))
+        check_object(h3, 'b1', 'b%d' % i, record(i))
+
+    # Objects retain the dictionary they were created with.
+    for i in range(count):
+        assert h3.create_object('b1', 'c%d' % i, record(i, 1)) == True
+
+    assert h3.train_bucket_dictionary('b1') == True
+
+    for i in range(count):
+        assert h3.create_object('b1', 'd%d' % i, record(i, 1)) == True
+
+    data = record(0) + b' modified'
+    assert h3.write_object('b1', 'b0', b' modified', offset=len(record(0))) == True
+    check_object(h3, 'b1', 'b0', data)
+
+    assert h3.copy_object('b1', 'b1', 'e1') == True
+    assert h3.move_object('b1', 'd1', 'e2') == True
+    for i in range(2, count):
+        check_object(h3, 'b1', 'b%d' % i, record(i))
+        check_object(h3, 'b1', 'c%d' % i, record(i, 1))
+        check_object(h3, 'b1', 'd%d' % i, record(i, 1))
+    check_object(h3, 'b1', 'e1', record(1))
+    check_object(h3, 'b1', 'e2', record(1, 1))
+
+    # Other codecs drop the dictionary.
+    assert h3.set_bucket_compression('b1', H3.CODEC_LZ4) == True
+    assert h3.create_object('b1', 'f1', record(1)) == True
+    check_object(h3, 'b1', 'f1', record(1))
+    check_object(h3, 'b1', 'd2', record(2, 1))
+
+    # Purging and deleting the bucket removes its dictionary.
+    assert h3.purge_bucket('b1') == True
+    assert h3.list_objects('b1') == []
+
+    for i in range(count):
+        assert h3.create_object('b1', 'a%d' % i, record(i)) == True
+
+    assert h3.train_bucket_dictionary('b1') == True
+    assert h3.create_object('b1', 'b1', record(1)) == True
+    check_object(h3, 'b1', 'b1', record(1))
+
+    # Multipart uploads retain the dictionary they were created with, even if the bucket is purged meanwhile.
+    multipart = h3.create_multipart('b1', 'm1')
+    assert h3.create_part(multipart, 0, record(1)) == True
+    assert h3.purge_bucket('b1') == True
+    assert h3.complete_multipart(multipart) == True
+    check_object(h3, 'b1', 'm1', record(1))
+
+    # Another handle loads the dictionary anew, unless the store is private to a handle.
+    other = H3(request.config.getoption('--storage'))
+    if other.list_buckets() == ['b1']:
+        check_object(other, 'b1', 'm1', record(1))
+
+    assert h3.purge_bucket('b1') == True
+    assert h3.delete_bucket('b1') == True
+
+    assert h3.list_buckets() == []
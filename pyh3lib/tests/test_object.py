@@ -327,6 +327,41 @@ def test_purge(h3):
 
     assert h3.delete_bucket('b1') == True
 
+def test_list_with_info(h3):
+    """List objects along with their information."""
+
+    assert h3.list_buckets() == []
+
+    assert h3.create_bucket('b1') == True
+
+    assert h3.list_objects_with_info('b1') == []
+
+    h3.create_object('b1', 'o1', b'a' * 10)
+    h3.create_object('b1', 'o2', b'b' * MEGABYTE)
+    h3.create_object('b1', 'd/o3', b'')
+
+    objects = h3.list_objects_with_info('b1')
+    assert objects.done
+    assert set([name for name, info in objects]) == set(['o1', 'o2', 'd/o3'])
+    for name, info in objects:
+        object_info = h3.info_object('b1', name)
+        assert not info.is_bad
+        assert info.size == object_info.size
+        assert info.last_modification == object_info.last_modification
+
+    objects = []
+    while True:
+        result = h3.list_objects_with_info('b1', offset=len(objects), count=1)
+        objects += result
+        if result.done:
+            break
+
+    assert len(objects) == 3
+
+    assert h3.purge_bucket('b1') == True
+
+    assert h3.delete_bucket('b1') == True
+
 def test_file(h3):
     """Read and write using files."""
 
@@ -0,0 +1,128 @@
+# Copyright [2019] [FORTH-ICS]
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+import pytest
+import pyh3lib
+import os
+
+MEGABYTE = 1048576
+
+def read_sequentially(h3, bucket_name, object_name, chunk_size, offset=0):
+    """Read an object in chunks, so that the parts that follow are prefetched."""
+
+    chunks = []
+    while True:
+        chunk = h3.read_object(bucket_name, object_name, offset=offset, size=chunk_size)
+        chunks.append(chunk)
+        offset += len(chunk)
+        if len(chunk) < chunk_size or chunk.done:
+            return b''.join(chunks)
+
+def test_sequential(h3):
+    """Read sequentially after writing through the same handle."""
+
+    assert h3.list_buckets() == []
+
+    assert h3.create_bucket('b1') == True
+
+    data = os.urandom(12 * MEGABYTE + 333)
+    assert h3.create_object('b1', 'o1', data) == True
+
+    assert read_sequentially(h3, 'b1', 'o1', 256 * 1024) == data
+
+    # Start over, stop half way, overwrite parts ahead and behind, and continue.
+    assert read_sequentially(h3, 'b1', 'o1', MEGABYTE)[:MEGABYTE] == data[:MEGABYTE]
+    for offset in range(0, 4 * MEGABYTE, 128 * 1024):
+        assert h3.read_object('b1', 'o1', offset=offset, size=128 * 1024) == data[offset:offset + 128 * 1024]
+
+    patch = os.urandom(3 * MEGABYTE)
+    data = data[:MEGABYTE] + patch[:MEGABYTE] + data[2 * MEGABYTE:5 * MEGABYTE] + patch[MEGABYTE:] + data[7 * MEGABYTE:]
+    assert h3.write_object('b1', 'o1', patch[:MEGABYTE], offset=MEGABYTE) == True
+    assert h3.write_object('b1', 'o1', patch[MEGABYTE:], offset=5 * MEGABYTE) == True
+
+    assert read_sequentially(h3, 'b1', 'o1', 512 * 1024, offset=4 * MEGABYTE) == data[4 * MEGABYTE:]
+    assert read_sequentially(h3, 'b1', 'o1', 512 * 1024) == data
+
+    # Partial writes inside prefetched parts.
+    read_sequentially(h3, 'b1', 'o1', 64 * 1024)
+    assert h3.write_object('b1', 'o1', b'hello', offset=8 * MEGABYTE + 10) == True
+    data = data[:8 * MEGABYTE + 10] + b'hello' + data[8 * MEGABYTE + 15:]
+    assert read_sequentially(h3, 'b1', 'o1', 64 * 1024) == data
+
+    # Truncate, then extend.
+    read_sequentially(h3, 'b1', 'o1', 256 * 1024)
+    assert h3.truncate_object('b1', 'o1', 6 * MEGABYTE + 5) == True
+    data = data[:6 * MEGABYTE + 5]
+    assert read_sequentially(h3, 'b1', 'o1', 256 * 1024) == data
+
+    assert h3.truncate_object('b1', 'o1', 10 * MEGABYTE) == True
+    data += b'\0' * (10 * MEGABYTE - len(data))
+    assert read_sequentially(h3, 'b1', 'o1', 256 * 1024) == data
+
+    # Empty the object, which keeps its parts' names, and fill it again.
+    read_sequentially(h3, 'b1', 'o1', 256 * 1024)
+    assert h3.truncate_object('b1', 'o1', 0) == True
+    data = os.urandom(10 * MEGABYTE)
+    assert h3.write_object('b1', 'o1', data) == True
+    assert read_sequentially(h3, 'b1', 'o1', 256 * 1024) == data
+
+    # Replace the object under the same name.
+    read_sequentially(h3, 'b1', 'o1', 256 * 1024)
+    assert h3.delete_object('b1', 'o1') == True
+    data = os.urandom(9 * MEGABYTE)
+    assert h3.create_object('b1', 'o1', data) == True
+    assert read_sequentially(h3, 'b1', 'o1', 256 * 1024) == data
+
+    other = os.urandom(9 * MEGABYTE)
+    assert h3.create_object('b1', 'o2', other) == True
+    read_sequentially(h3, 'b1', 'o1', 256 * 1024)
+    assert h3.move_object('b1', 'o2', 'o1') == True
+    assert read_sequentially(h3, 'b1', 'o1', 256 * 1024) == other
+
+    assert h3.delete_object('b1', 'o1') == True
+    assert h3.delete_bucket('b1') == True
+
+    assert h3.list_buckets() == []
+
+def test_interleaved(h3):
+    """Read several objects sequentially while writing to them."""
+
+    assert h3.list_buckets() == []
+
+    assert h3.create_bucket('b1') == True
+
+    count = 4
+    data = [os.urandom(6 * MEGABYTE) for i in range(count)]
+    for i in range(count):
+        assert h3.create_object('b1', 'o%d' % i, data[i]) == True
+
+    chunk_size = 256 * 1024
+    for offset in range(0, 6 * MEGABYTE, chunk_size):
+        for i in range(count):
+            assert h3.read_object('b1', 'o%d' % i, offset=offset, size=chunk_size) == data[i][offset:offset + chunk_size]
+
+            # Write just ahead of the reader.
+            if (offset // chunk_size) % 5 == i and offset + 2 * chunk_size <= len(data[i]):
+                position = offset + chunk_size + 1000
+                patch = os.urandom(10)
+                assert h3.write_object('b1', 'o%d' % i, patch, offset=position) == True
+                data[i] = data[i][:position] + patch + data[i][position + 10:]
+
+    for i in range(count):
+        assert h3.read_object('b1', 'o%d' % i) == data[i]
+
+    assert h3.purge_bucket('b1') == True
+    assert h3.delete_bucket('b1') == True
+
+    assert h3.list_buckets() == []
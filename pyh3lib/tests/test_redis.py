@@ -0,0 +1,253 @@
+# Copyright [2019] [FORTH-ICS]
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# Checks where keys land when spread over several Redis instances, e.g. started with
+# ./start-redis-nodes.sh 6379 6380 and run with --storage "redis://127.0.0.1:6379/?nodes=127.0.0.1:6380"
+
+import pytest
+import pyh3lib
+import json
+import os
+
+from urllib.parse import urlparse, parse_qs
+from pyh3lib import H3
+
+MEGABYTE = 1048576
+
+redis = pytest.importorskip('redis')
+
+@pytest.fixture(scope='module')
+def storage_uri(request):
+    storage_uri = request.config.getoption('--storage')
+
+    url = urlparse(storage_uri)
+    if url.scheme != 'redis' or 'nodes' not in parse_qs(url.query):
+        pytest.skip('requires Redis on several nodes, e.g. "redis://127.0.0.1:6379/?nodes=127.0.0.1:6380"')
+    return storage_uri
+
+@pytest.fixture(scope='module')
+def nodes(storage_uri):
+    """Clients to each node, in the order given by the storage URI."""
+
+    url = urlparse(storage_uri)
+    addresses = [url.netloc or '127.0.0.1:6379'] + parse_qs(url.query)['nodes'][0].split(',')
+
+    clients = []
+    for address in addresses:
+        host, _, port = address.partition(':')
+        clients.append(redis.Redis(host=host or '127.0.0.1', port=int(port or 6379)))
+    return clients
+
+def keys(nodes, pattern='*'):
+    """Keys per node, apart from the marker of an indexed store."""
+
+    return [set(key.decode() for key in node.scan_iter(match=pattern)) - set(['/']) for node in nodes]
+
+def holders(nodes, pattern):
+    return [i for i, node_keys in enumerate(keys(nodes, pattern)) if node_keys]
+
+def members(nodes, index):
+    """Members of an index, in order, from whichever node keeps it."""
+
+    return [member.decode() for node in nodes for member in node.zrange(index, 0, -1)]
+
+def record(i, seed=0):
+    return json.dumps({'id': i,
+                       'name': 'user%d' % i,
+                       'email': 'user%d@example.com' % i,
+                       'roles': ['reader', 'writer'] if seed == 0 else ['admin'],
+                       'address': {'city': 'Heraklion', 'zip': '%05d' % (i * 7)}}).encode()
+
+def test_placement(h3, nodes):
+    """Keep the keys of a bucket along with their index on one node and spread the rest."""
+
+    assert h3.list_buckets() == []
+
+    buckets = ['b%d' % i for i in range(16)]
+    data = {}
+    multiparts = []
+    for bucket_name in buckets:
+        assert h3.create_bucket(bucket_name) == True
+        for i in range(3):
+            data[bucket_name, 'o%d' % i] = os.urandom(2 * MEGABYTE + i)
+            assert h3.create_object(bucket_name, 'o%d' % i, data[bucket_name, 'o%d' % i]) == True
+        assert h3.create_object_metadata(bucket_name, 'o0', 'Content-Type', b'binary') == True
+        multiparts.append(h3.create_multipart(bucket_name, 'm1'))
+        assert h3.create_part(multiparts[-1], 0, b'part') == True
+
+    # Each key is kept by a single node.
+    node_keys = keys(nodes)
+    assert sum(len(k) for k in node_keys) == len(set.union(*node_keys))
+
+    # Objects, object metadata and multipart uploads are kept along with their index.
+    for bucket_name in buckets:
+        for separator in '/#$':
+            namespace = bucket_name + separator
+            assert len(holders(nodes, namespace + '*')) == 1
+            assert holders(nodes, '/' + namespace) == holders(nodes, namespace + '*')
+
+    # Users and buckets are kept along with their index too, whereas parts are placed by their whole key.
+    for namespace in '@#':
+        assert len(holders(nodes, namespace + '*')) == 1
+        assert holders(nodes, '/' + namespace) == holders(nodes, namespace + '*')
+    assert holders(nodes, '_*') == list(range(len(nodes)))
+    assert len(set.union(*keys(nodes, '_*'))) == sum((len(d) + MEGABYTE - 1) // MEGABYTE for d in data.values()) + len(buckets)
+
+    assert sorted(h3.list_buckets()) == sorted(buckets)
+    assert members(nodes, '/#') == sorted(buckets)
+    for bucket_name in buckets:
+        assert h3.list_objects(bucket_name) == ['o0', 'o1', 'o2']
+        assert h3.list_multiparts(bucket_name) == ['m1']
+        assert h3.list_objects_with_metadata(bucket_name, 'Content-Type') == ['o0']
+        for i in range(3):
+            assert h3.read_object(bucket_name, 'o%d' % i) == data[bucket_name, 'o%d' % i]
+
+    for bucket_name, multipart in zip(buckets, multiparts):
+        assert h3.complete_multipart(multipart) == True
+        assert h3.list_objects(bucket_name) == ['m1', 'o0', 'o1', 'o2']
+        assert h3.read_object(bucket_name, 'm1') == b'part'
+        assert h3.purge_bucket(bucket_name) == True
+        assert h3.delete_bucket(bucket_name) == True
+
+    assert h3.list_buckets() == []
+    assert keys(nodes, '_*') == [set()] * len(nodes)
+
+def test_copy_across(h3, nodes):
+    """Copy and move parts between nodes."""
+
+    assert h3.list_buckets() == []
+
+    assert h3.create_bucket('b1') == True
+
+    data = os.urandom(5 * MEGABYTE + 10)
+    assert h3.create_object('b1', 'o1', data) == True
+
+    # Copies get parts of their own, kept by other nodes than those of the source.
+    assert h3.copy_object('b1', 'o1', 'o2') == True
+    assert len(set.union(*keys(nodes, '_*'))) == 12
+    assert h3.read_object('b1', 'o2') == data
+
+    assert h3.move_object('b1', 'o2', 'o3') == True
+    assert h3.list_objects('b1') == ['o1', 'o3']
+    assert h3.read_object('b1', 'o3') == data
+
+    other = os.urandom(MEGABYTE)
+    assert h3.create_object('b1', 'o4', other) == True
+    assert h3.exchange_object('b1', 'o3', 'o4') == True
+    assert h3.read_object('b1', 'o3') == other
+    assert h3.read_object('b1', 'o4') == data
+
+    # Completing a multipart upload moves its parts in place.
+    multipart = h3.create_multipart('b1', 'm1')
+    assert h3.create_part(multipart, 1, data) == True
+    assert h3.create_part(multipart, 0, other) == True
+    assert h3.complete_multipart(multipart) == True
+    assert h3.read_object('b1', 'm1') == other + data
+
+    assert h3.delete_object('b1', 'o1') == True
+    assert h3.delete_object('b1', 'o4') == True
+    assert len(set.union(*keys(nodes, '_*'))) == 1 + 7
+    assert h3.read_object('b1', 'o3') == other
+
+    assert h3.purge_bucket('b1') == True
+    assert h3.delete_bucket('b1') == True
+
+    assert h3.list_buckets() == []
+    assert keys(nodes, '_*') == [set()] * len(nodes)
+
+def test_shared_dictionary(h3, nodes, storage_uri):
+    """Look for other users of a dictionary among objects kept by all nodes."""
+
+    assert h3.list_buckets() == []
+
+    assert h3.create_bucket('b0') == True
+    try:
+        h3.set_bucket_compression('b0', H3.CODEC_ZSTD)
+    except pyh3lib.H3InvalidArgsError:
+        h3.delete_bucket('b0')
+        pytest.skip('h3lib is built without compression')
+    assert h3.delete_bucket('b0') == True
+
+    # Buckets trained on the same objects share a dictionary.
+    assert keys(nodes, '##*') == [set()] * len(nodes)
+    buckets = ['b%d' % i for i in range(8)]
+    for bucket_name in buckets:
+        assert h3.create_bucket(bucket_name) == True
+        for i in range(300):
+            assert h3.create_object(bucket_name, 'a%d' % i, record(i)) == True
+        assert h3.train_bucket_dictionary(bucket_name) == True
+        assert h3.create_object(bucket_name, 'b1', record(1)) == True
+
+    assert len(set.union(*keys(nodes, '##*'))) == 1
+    assert holders(nodes, '##*') == holders(nodes, '#b*')
+
+    # The dictionary replaced by retraining stays while objects use it.
+    for i in range(300):
+        assert h3.create_object('b0', 'c%d' % i, record(i, 1)) == True
+    assert h3.train_bucket_dictionary('b0') == True
+    assert h3.create_object('b0', 'b2', record(2, 1)) == True
+    assert len(set.union(*keys(nodes, '##*'))) == 2
+
+    # The dictionary stays until the last bucket using it is gone.
+    while buckets:
+        bucket_name = buckets.pop()
+        assert h3.purge_bucket(bucket_name) == True
+        assert h3.delete_bucket(bucket_name) == True
+
+        other = H3(storage_uri)
+        for bucket_name in buckets:
+            assert other.read_object(bucket_name, 'b1') == record(1)
+
+    assert h3.list_buckets() == []
+    assert keys(nodes, '##*') == [set()] * len(nodes)
+
+def test_build_index(h3, nodes, storage_uri):
+    """Index the keys of a store written without an index."""
+
+    assert h3.list_buckets() == []
+
+    buckets = ['b%d' % i for i in range(8)]
+    for bucket_name in buckets:
+        assert h3.create_bucket(bucket_name) == True
+        for i in range(20):
+            assert h3.create_object(bucket_name, 'o%02d' % i, b'%d' % i) == True
+        assert h3.create_object_metadata(bucket_name, 'o07', 'Content-Type', b'text') == True
+
+    for node in nodes:
+        node.delete('/', *node.scan_iter(match='/*'))
+    assert keys(nodes, '/*') == [set()] * len(nodes)
+
+    # Each node is indexed once opened again.
+    other = H3(storage_uri)
+    assert all(node.exists('/') for node in nodes)
+    assert members(nodes, '/#') == buckets
+    for bucket_name in buckets:
+        assert holders(nodes, '/' + bucket_name + '/') == holders(nodes, bucket_name + '/*')
+        assert other.list_objects(bucket_name) == ['o%02d' % i for i in range(20)]
+        assert other.list_objects(bucket_name, prefix='o1', offset=5, count=3) == ['o15', 'o16', 'o17']
+        assert other.list_objects_with_metadata(bucket_name, 'Content-Type') == ['o07']
+
+    # Stores indexed before users and buckets were are indexed again.
+    for node in nodes:
+        node.delete('/@', '/#')
+        node.set('/', 1)
+    other = H3(storage_uri)
+    assert members(nodes, '/#') == buckets
+    assert all(node.get('/') == b'2' for node in nodes)
+
+    for bucket_name in buckets:
+        assert other.purge_bucket(bucket_name) == True
+        assert other.delete_bucket(bucket_name) == True
+
+    assert h3.list_buckets() == []
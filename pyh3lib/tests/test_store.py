@@ -0,0 +1,188 @@
+# Copyright [2019] [FORTH-ICS]
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+import pytest
+import pyh3lib
+import os
+
+from pyh3lib import H3
+
+MEGABYTE = 1048576
+
+def fill(h3, bucket_name, count, size):
+    """Create objects of random data and return them by name."""
+
+    objects = {}
+    for i in range(count):
+        objects['o%d' % i] = os.urandom(size + i)
+        assert h3.create_object(bucket_name, 'o%d' % i, objects['o%d' % i]) == True
+    return objects
+
+def check(h3, bucket_name, objects):
+    assert sorted(h3.list_objects(bucket_name)) == sorted(objects.keys())
+    for name, data in objects.items():
+        assert h3.read_object(bucket_name, name) == data
+
+def test_long_names(h3):
+    """Use names that make keys longer than some stores allow."""
+
+    assert h3.list_buckets() == []
+
+    assert h3.create_bucket('b1') == True
+
+    # Names differ only at their end.
+    names = ['x' * (H3.OBJECT_NAME_SIZE - 1) + c for c in 'abc']
+    try:
+        h3.create_object('b1', names[0], b'a' * 100)
+    except pyh3lib.H3NameTooLongError:
+        h3.delete_bucket('b1')
+        pytest.skip('store does not take names this long')
+
+    assert h3.create_object('b1', names[1], b'b' * 100) == True
+    assert h3.create_object('b1', 'short', b'c' * 100) == True
+
+    assert sorted(h3.list_objects('b1')) == ['short', names[0], names[1]]
+    assert sorted(h3.list_objects('b1', prefix='x' * 300)) == names[:2]
+    assert sorted(h3.list_objects('b1', prefix=names[1])) == [names[1]]
+    assert sorted(name for name, info in h3.list_objects_with_info('b1')) == ['short', names[0], names[1]]
+    assert h3.info_object('b1', names[0]).size == 100
+    assert h3.read_object('b1', names[1]) == b'b' * 100
+
+    with pytest.raises(pyh3lib.H3ExistsError):
+        h3.create_object('b1', names[0], b'')
+
+    assert h3.move_object('b1', names[0], names[2]) == True
+    assert sorted(h3.list_objects('b1')) == ['short'] + names[1:]
+    assert h3.read_object('b1', names[2]) == b'a' * 100
+
+    assert h3.copy_object('b1', 'short', names[0]) == True
+    assert h3.read_object('b1', names[0]) == b'c' * 100
+
+    assert h3.exchange_object('b1', names[0], names[1]) == True
+    assert h3.read_object('b1', names[0]) == b'b' * 100
+    assert h3.read_object('b1', names[1]) == b'c' * 100
+
+    for name in names:
+        assert h3.delete_object('b1', name) == True
+    assert h3.list_objects('b1') == ['short']
+
+    assert h3.purge_bucket('b1') == True
+    assert h3.delete_bucket('b1') == True
+
+    assert h3.list_buckets() == []
+
+def test_mem():
+    """Share named memory stores among handles."""
+
+    h3 = H3('mem:///pytest')
+    other = H3('mem:///pytest')
+    private = H3('mem:///')
+
+    assert h3.create_bucket('b1') == True
+    assert other.list_buckets() == ['b1']
+    assert private.list_buckets() == []
+
+    objects = fill(other, 'b1', 3, MEGABYTE)
+    check(h3, 'b1', objects)
+
+    assert h3.purge_bucket('b1') == True
+    assert h3.delete_bucket('b1') == True
+    assert other.list_buckets() == []
+
+    # The store is gone along with the last handle naming it.
+    assert h3.create_bucket('b1') == True
+    del h3, other
+    assert H3('mem:///pytest').list_buckets() == []
+
+def test_split(tmp_path):
+    """Keep metadata and data in separate stores."""
+
+    os.mkdir(tmp_path / 'meta')
+    os.mkdir(tmp_path / 'data')
+    h3 = H3('split://meta=file://%s/meta?data=file://%s/data' % (tmp_path, tmp_path))
+
+    assert h3.create_bucket('b1') == True
+    objects = fill(h3, 'b1', 4, 2 * MEGABYTE)
+    check(h3, 'b1', objects)
+
+    assert h3.move_object('b1', 'o0', 'o4') == True
+    objects['o4'] = objects.pop('o0')
+    check(h3, 'b1', objects)
+
+    # Metadata stay out of the data store, while data parts are stored nowhere else.
+    meta = H3('file://%s/meta' % tmp_path)
+    assert H3('file://%s/data' % tmp_path).list_buckets() == []
+    assert meta.list_buckets() == ['b1']
+    assert meta.list_objects('b1') == sorted(objects.keys())
+    assert meta.info_object('b1', 'o1').size == len(objects['o1'])
+    with pytest.raises(pyh3lib.H3FailureError):
+        meta.read_object('b1', 'o1')
+
+    assert h3.purge_bucket('b1') == True
+    assert h3.delete_bucket('b1') == True
+    assert meta.list_buckets() == []
+
+@pytest.mark.parametrize('policy,mode', [('lru', 'through'), ('arc', 'through'), ('lru', 'back'), ('arc', 'back')])
+def test_cache(tmp_path, policy, mode):
+    """Cache data parts in a store smaller than the data."""
+
+    uri = 'cache://policy=%s&mode=%s&size=4&hot=mem:///?cold=file://%s' % (policy, mode, tmp_path)
+    h3 = H3(uri)
+
+    assert h3.create_bucket('b1') == True
+    objects = fill(h3, 'b1', 6, MEGABYTE + 1000)
+    check(h3, 'b1', objects)
+
+    # Reads of a few objects again and again keep them hot.
+    for i in range(3):
+        assert h3.read_object('b1', 'o0') == objects['o0']
+        assert h3.read_object('b1', 'o1') == objects['o1']
+    check(h3, 'b1', objects)
+
+    assert h3.write_object('b1', 'o2', b'hello', offset=MEGABYTE - 2) == True
+    objects['o2'] = objects['o2'][:MEGABYTE - 2] + b'hello' + objects['o2'][MEGABYTE + 3:]
+    assert h3.truncate_object('b1', 'o3', 100) == True
+    objects['o3'] = objects['o3'][:100]
+    assert h3.delete_object('b1', 'o4') == True
+    del objects['o4']
+    check(h3, 'b1', objects)
+
+    # Handles of the same URI share the cache, written back parts included.
+    check(H3(uri), 'b1', objects)
+
+    # The cold store holds everything once the cache is released.
+    del h3
+    cold = H3('file://%s' % tmp_path)
+    check(cold, 'b1', objects)
+
+    assert cold.purge_bucket('b1') == True
+    assert cold.delete_bucket('b1') == True
+
+def test_lmdb(tmp_path):
+    """Store keys of any length in LMDB."""
+
+    try:
+        h3 = H3('lmdb://%s?size=1' % tmp_path)
+    except pyh3lib.H3InvalidArgsError:
+        pytest.skip('h3lib is built without LMDB')
+
+    test_long_names(h3)
+
+    assert h3.create_bucket('b1') == True
+    objects = fill(h3, 'b1', 3, MEGABYTE)
+    check(h3, 'b1', objects)
+
+    assert h3.purge_bucket('b1') == True
+    assert h3.delete_bucket('b1') == True
+    assert h3.list_buckets() == []